@@ -8,17 +8,118 @@
 
 // --- 用户配置区 User Configuration Section ---
 
-// 定义MCU能支持同时监控的最大变量数量
-// Define the maximum number of variables the MCU can monitor simultaneously
+// 定义MCU能支持同时监控的最大变量数量 (最大 255, 不受 ARESPLOT_SHARED_BUFFER_SIZE 限制)
+// Define the maximum number of variables the MCU can monitor simultaneously (max 255, not limited by ARESPLOT_SHARED_BUFFER_SIZE)
 #define ARESPLOT_MAX_VARS_TO_MONITOR (10) // 可根据MCU资源调整 Can be adjusted based on MCU resources
 
-// 定义接收和发送缓冲区的最大大小 (应大于最大可能的帧大小)
-// Define max size for receive and transmit buffers (should be larger than max possible frame size)
-// 最大帧 (CMD_START_MONITOR): 1(SOP)+1(CMD)+2(LEN)+1(NumVars)+ARESPLOT_MAX_VARS_TO_MONITOR*5(Vars)+1(CS)+1(EOP)
-// = 7 + 10*5 = 57 bytes for 10 vars.
-// 选择一个安全的大小, e.g., 128. This buffer is used for RX payload and TX frame assembly.
+// 定义发送缓冲区的大小 (最小 16)
+// Define the size of the transmit buffer (min 16)
+// 大于该大小的帧分块组装, 分多次交给 aresplot_user_send_packet(), 校验和逐块累积; CMD_START_MONITOR 的变量列表边接收边解析。
+// 因此缓冲区大小不限制监控变量数量。能容纳完整帧时每帧仍只调用一次 aresplot_user_send_packet()。
+// Frames larger than this are assembled in pieces and handed to aresplot_user_send_packet() in several calls, with the
+// checksum accumulated across pieces; the CMD_START_MONITOR variable list is parsed as it arrives. The buffer size
+// therefore does not limit the number of monitored variables. A frame that fits is still sent in a single call.
+// 批量帧按 ARESPLOT_MONITOR_BATCH_SIZE 个采样或缓冲区装满 (以先到者为准) 发送; 单个采样超过缓冲区时每帧一个采样。
+// A batch is sent after ARESPLOT_MONITOR_BATCH_SIZE samples or when the buffer is full, whichever comes first;
+// if one sample exceeds the buffer, each frame carries one sample.
 #define ARESPLOT_SHARED_BUFFER_SIZE (128) 
 
+// 每个 CMD_MONITOR_DATA_BATCH 帧打包的采样数 (1: 禁用批量, 每个采样单独以 CMD_MONITOR_DATA 发送)
+// Number of samples packed into one CMD_MONITOR_DATA_BATCH frame (1: batching disabled, each sample is sent as its own CMD_MONITOR_DATA)
+// 批量帧共用一个帧头和一个基准时间戳, 可大幅降低小变量集在高采样率下的协议开销。
+// A batch shares one frame header and one base timestamp, which greatly reduces overhead for small variable sets at high rates.
+#define ARESPLOT_MONITOR_BATCH_SIZE (1) // 最大 255 Max 255
+
+// 批量帧最长累积时间 (毫秒), 达到后即使未满也立即发送, 用于限制低采样率下的显示延迟
+// Maximum time span (ms) a batch may cover before it is sent even if not full; bounds display latency at low sample rates
+#define ARESPLOT_MONITOR_BATCH_MAX_LATENCY_MS (50)
+
+// 是否支持原始 (原生宽度) 编码 (1: 启用, 0: 禁用)
+// Support raw (native-width) value encoding (1: enable, 0: disable)
+// 上位机在 CMD_START_MONITOR 中请求后, 每个变量按原始宽度发送 (如 BOOL/INT8 为 1 字节, FLOAT64 为 8 字节) 而不是统一转换为 FP32。
+// When requested by the host in CMD_START_MONITOR, each variable is sent at its original width (e.g. 1 byte for BOOL/INT8, 8 for FLOAT64) instead of being widened to FP32.
+#define ARESPLOT_ENABLE_RAW_ENCODING (1)
+
+// 是否支持压缩监控数据流 (1: 启用, 0: 禁用)
+// Support the compressed monitor data stream (1: enable, 0: disable)
+// 上位机在 CMD_START_MONITOR 中请求后, 采样以 CMD_MONITOR_DATA_COMPRESSED 发送: 浮点值与上一采样异或, 整数值 (原始编码) 取 zigzag 差分,
+// 每个值只发送非零的低位字节。缓慢变化的变量 (设定值, 标志, 积分器) 通常只需 0~2 字节。
+// When requested by the host in CMD_START_MONITOR, samples are sent as CMD_MONITOR_DATA_COMPRESSED: float values are XORed with the
+// previous sample and integer values (raw encoding) become zigzag deltas; only the non-zero low bytes of each value are sent.
+// Slowly changing variables (setpoints, flags, integrators) usually take 0-2 bytes.
+#define ARESPLOT_ENABLE_COMPRESSION (1)
+
+// 压缩流的关键帧间隔 (采样数)。关键帧不依赖之前的数据, 上位机丢帧后在下一个关键帧重新同步。
+// Keyframe interval of the compressed stream (samples). A keyframe does not depend on earlier data, so after a loss the host resyncs on the next one.
+#define ARESPLOT_COMPRESSION_KEYFRAME_INTERVAL (64)
+
+// 是否支持按变量分频 (1: 启用, 0: 禁用)
+// Support per-variable dividers (1: enable, 0: disable)
+// 上位机可在 CMD_START_MONITOR 中为每个变量指定分频系数 D, 该变量只在每 D 个采样中发送一次, 每个采样前附带通道位图。
+// 慢变量 (温度, 状态枚举) 因此不再占用与快变量 (电流环信号) 相同的带宽。
+// The host may give each variable a divider D in CMD_START_MONITOR: the variable is then sent in only one of every D samples,
+// and each sample is preceded by a channel bitmap. Slow variables (temperatures, state enums) no longer take the same
+// bandwidth as fast ones (current-loop signals).
+#define ARESPLOT_ENABLE_CHANNEL_DIVIDERS (1)
+
+// 是否支持数据帧序号 (1: 启用, 0: 禁用)
+// Support data frame sequence numbers (1: enable, 0: disable)
+// 上位机在 CMD_START_MONITOR 中请求后, 每个 CMD_MONITOR_DATA / CMD_MONITOR_DATA_BATCH 帧附带 1 字节滚动序号,
+// 上位机据此统计链路上丢失和重复的帧 (CMD_MONITOR_DATA_COMPRESSED 本身已带 FrameSeq)。
+// When requested by the host in CMD_START_MONITOR, every CMD_MONITOR_DATA / CMD_MONITOR_DATA_BATCH frame carries a 1-byte
+// rolling sequence number, from which the host counts frames lost or duplicated on the link (CMD_MONITOR_DATA_COMPRESSED already has FrameSeq).
+#define ARESPLOT_ENABLE_SEQUENCE (1)
+
+// 是否支持块描述 (1: 启用, 0: 禁用)
+// Support block descriptors (1: enable, 0: disable)
+// 上位机在 CMD_START_MONITOR 中请求后, 一个变量描述可以代表一段同类型的连续数组 (地址 + 类型 + 元素数), 每个元素占一个通道。
+// 三相电流/电压等数组因此只需一个描述, 而不是每个元素各一个。
+// When requested by the host in CMD_START_MONITOR, one variable descriptor may stand for a contiguous array of one type
+// (address + type + element count), each element taking one channel. Arrays such as 3-phase currents/voltages then need a
+// single descriptor instead of one per element.
+#define ARESPLOT_ENABLE_BLOCK_DESCRIPTORS (1)
+
+// 是否支持包络 (最小/最大/平均值) 聚合 (1: 启用, 0: 禁用; 启用时 ARESPLOT_MAX_VARS_TO_MONITOR 最大 84)
+// Support envelope (min/max/mean) aggregation (1: enable, 0: disable; ARESPLOT_MAX_VARS_TO_MONITOR is at most 84 when enabled)
+// 上位机在 CMD_START_MONITOR 中请求后, MCU 仍按设定的采样率采样, 但把每 W 个采样累加为一个窗口, 每个窗口只发送一次各变量的
+// 平均值、最小值与最大值 (可选附带窗口内采样数)。采样率降到链路可承受的水平后, 采样之间的尖峰因此不会丢失。
+// When requested by the host in CMD_START_MONITOR, the MCU still samples at the set rate but folds every W samples into a
+// window and sends only the mean, min and max of each variable once per window (optionally with the window's sample count).
+// Spikes between the samples that would otherwise reach the link are no longer lost when the link cannot carry the full rate.
+#define ARESPLOT_ENABLE_ENVELOPE (1)
+
+// 是否支持打包发送 BOOL 变量 (1: 启用, 0: 禁用)
+// Support bit-packed BOOL variables (1: enable, 0: disable)
+// 上位机在 CMD_START_MONITOR 中请求后, 所有 BOOL 变量不再各占一个值 (FP32 下 4 字节), 而是按逻辑分析仪的方式集中为采样末尾的
+// 位图, 8 个标志只占 1 字节。
+// When requested by the host in CMD_START_MONITOR, BOOL variables no longer take one value each (4 bytes in FP32) but are
+// gathered logic-analyzer style into a bitmap at the end of the sample, 8 flags to the byte.
+#define ARESPLOT_ENABLE_PACKED_BOOLS (1)
+
+// 是否合并连续内存的读取 (1: 启用, 0: 禁用)
+// Coalesce reads of contiguous memory (1: enable, 0: disable)
+// 编译采样计划时, 地址相邻的变量 (块描述的元素, 或 ELF 中相邻的标量) 合并为一次 memcpy, 读取步骤更少, 且这些值几乎来自同一时刻。
+// 若监控的外设寄存器必须按其自身宽度访问, 请设为 0。
+// While compiling the sampling plan, variables adjacent in memory (elements of a block, or scalars adjacent in the ELF) are
+// merged into one memcpy: fewer read steps, and the values come from practically the same instant.
+// Set to 0 if monitored peripheral registers must be accessed at their own width.
+#define ARESPLOT_ENABLE_COALESCED_READS (1)
+
+// 是否启用中断驱动采样 (1: 启用, 0: 禁用)
+// Enable ISR-driven sampling (1: enable, 0: disable)
+// 启用后由用户在硬件定时器中断中调用 aresplot_sample_now(), 采样快照写入无锁环形缓冲区, aresplot_service_tick() 只负责组帧发送。
+// When enabled, the user calls aresplot_sample_now() from a hardware timer ISR; snapshots go into a lock-free ring
+// buffer and aresplot_service_tick() only drains it into TX frames.
+#define ARESPLOT_ENABLE_ISR_SAMPLING (0)
+
+// aresplot_sample_now() 的调用频率 (Hz), 即定时器中断频率。CMD_SET_SAMPLE_RATE 据此计算抽取比。
+// Rate (Hz) at which aresplot_sample_now() is called, i.e. the timer ISR rate. CMD_SET_SAMPLE_RATE derives the decimation from it.
+#define ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ (10000)
+
+// 采样环形缓冲区槽数 (2 的幂, 最大 128), 决定 aresplot_service_tick() 可停顿多少个采样周期而不丢采样
+// Number of sample ring slots (power of two, max 128); sets how many sample periods aresplot_service_tick() may stall without losing samples
+#define ARESPLOT_SAMPLE_RING_SIZE (16)
+
 // 是否启用可选的 CMD_ERROR_REPORT 功能 (1: 启用, 0: 禁用)
 // Enable optional CMD_ERROR_REPORT feature (1: enable, 0: disable)
 #define ARESPLOT_ENABLE_ERROR_REPORT (0)
@@ -27,6 +128,163 @@
 // Default sampling period (milliseconds) - if CMD_SET_SAMPLE_RATE is not called
 #define ARESPLOT_DEFAULT_SAMPLE_PERIOD_MS (10) // e.g., 10ms for 100Hz
 
+// 是否使用微秒时基调度采样 (1: 启用, 需实现 aresplot_user_get_tick_us(); 0: 使用毫秒时基)
+// Schedule sampling on a microsecond time base (1: enable, requires aresplot_user_get_tick_us(); 0: millisecond time base)
+// 采样周期以相位累加器表示, 任意采样率 (如 300 Hz) 的平均值都是精确的; 毫秒时基下最高 1 kHz。
+// The sample period is kept in a phase accumulator so any rate (e.g. 300 Hz) is exact on average; the ms time base tops out at 1 kHz.
+#define ARESPLOT_ENABLE_TICK_US (0)
+
+// 是否启用异步 (DMA) 发送缓冲池 (1: 启用, 0: 禁用, 使用单个发送缓冲区, 发送回调返回后即可复用)
+// Enable the asynchronous (DMA) transmit buffer pool (1: enable, 0: disable; a single TX buffer is reused once the send callback returns)
+// 启用后每帧在缓冲池的一个缓冲区中组装并直接交给 aresplot_user_send_packet(), 该缓冲区在用户调用 aresplot_tx_complete() 前保持不变,
+// 因此 DMA 传输期间可继续排队后续帧而无需拷贝。发送回调可返回 0 表示忙, 帧保留在队列中稍后重试。
+// When enabled, each frame is assembled in a pool buffer and handed to aresplot_user_send_packet() in place. The buffer stays untouched
+// until the user calls aresplot_tx_complete(), so further frames can be queued without copying while DMA runs.
+// The send callback may return 0 for busy; the frame then stays queued and is retried later.
+#define ARESPLOT_ENABLE_ASYNC_TX (0)
+
+// 发送缓冲区数量 (2 的幂, 最大 128; 2 即乒乓缓冲), 每个缓冲区大小为 ARESPLOT_SHARED_BUFFER_SIZE
+// Number of TX buffers (power of two, max 128; 2 is a ping-pong buffer), each ARESPLOT_SHARED_BUFFER_SIZE bytes
+#define ARESPLOT_TX_BUFFER_COUNT (2)
+
+// 低 RAM 配置 (1: 启用, 0: 禁用; 需 ARESPLOT_ENABLE_ASYNC_TX 为 0)
+// Low-RAM profile (1: enable, 0: disable; requires ARESPLOT_ENABLE_ASYNC_TX to be 0)
+// 批量帧直接在唯一的发送缓冲区中累积, 不再另占一个约 ARESPLOT_SHARED_BUFFER_SIZE 字节的批量缓冲区; 其他帧 (ACK、错误报告等)
+// 使用该缓冲区前先发出未完成的批量, 因此批量可能提前发送。一个采样的数据帧须能放入发送缓冲区。
+// 各配置的 RAM 与栈占用见 aresplot.md, 可在 host/ 下用 make footprint 测量。
+// Batches accumulate in place in the single TX buffer instead of a separate batch buffer of about ARESPLOT_SHARED_BUFFER_SIZE
+// bytes; any other frame (ACK, error report, ...) sends a pending batch before taking the buffer, so batches may go out early.
+// A single-sample data frame must fit in the TX buffer.
+// The RAM and stack footprint of each configuration is listed in aresplot.md and measured by make footprint in host/.
+#define ARESPLOT_ENABLE_LOW_RAM (0)
+
+// 是否合并发送 (1: 启用, 0: 禁用; 不能与 ARESPLOT_ENABLE_LOW_RAM 同时启用)
+// Enable TX coalescing (1: enable, 0: disable; cannot be combined with ARESPLOT_ENABLE_LOW_RAM)
+// 启用后任意类型的帧 (ACK、错误报告、监控数据等) 首尾相接地写入发送缓冲区, 写满 ARESPLOT_TX_COALESCE_MTU 字节或最早的字节等待了
+// ARESPLOT_TX_COALESCE_MAX_LATENCY_MS 后才调用一次 aresplot_user_send_packet(), 帧可跨两次发送。适用于每次发送都占用一个事务的链路,
+// 如 USB 全速 CDC (每 1 ms 帧最多 64 字节的包): 短帧不再各占一个短包。
+// When enabled, frames of every kind (ACK, error report, monitor data, ...) are written back to back into the TX buffer, and
+// aresplot_user_send_packet() is called once ARESPLOT_TX_COALESCE_MTU bytes are written or the oldest byte has waited
+// ARESPLOT_TX_COALESCE_MAX_LATENCY_MS; a frame may span two sends. Meant for links where every send costs a transaction,
+// such as USB full-speed CDC (packets of up to 64 bytes per 1 ms frame): short frames no longer take a short packet each.
+#define ARESPLOT_ENABLE_TX_COALESCE (0)
+
+// 合并发送的最大包长 (字节, 16..ARESPLOT_SHARED_BUFFER_SIZE) Max packet length of coalesced sends (bytes, 16..ARESPLOT_SHARED_BUFFER_SIZE)
+#define ARESPLOT_TX_COALESCE_MTU (64)
+
+// 未满的包最多等待的时间 (毫秒; 0: 每次 aresplot_service_tick() 结束时发送) Max time a partial packet waits (ms; 0: sent at the end of every aresplot_service_tick())
+#define ARESPLOT_TX_COALESCE_MAX_LATENCY_MS (1)
+
+// 是否启用工作通知回调 (1: 启用, 需实现 aresplot_user_notify(); 0: 禁用)
+// Enable the work notification callback (1: enable, requires aresplot_user_notify(); 0: disable)
+// MCU 在收到完整的帧 (其 ACK 因此入队)、排队了错误报告、中断采样写入了第一个待发送采样, 或有工作在等待时释放了发送缓冲区后调用该回调。
+// 配合 aresplot_service_tick() 返回的等待时间, RTOS 任务可阻塞在定时器或任务通知上, 只在有工作时被唤醒, 而不必以数据发送频率轮询。
+// The MCU calls it once a complete frame arrives (so its ACK is queued), an error report is queued, the ISR sampler
+// stores the first sample waiting to be sent, or a TX buffer frees up while work is waiting. Together with the wait time
+// returned by aresplot_service_tick(), an RTOS task can block on a timer or task notification and wake only when there
+// is work, instead of polling at the data rate.
+#define ARESPLOT_ENABLE_NOTIFY (0)
+
+// 是否按链路字节预算自动限制采样率 (1: 启用, 0: 禁用)
+// Automatically limit the sample rate to a link byte budget (1: enable, 0: disable)
+// 启用后 MCU 按当前监控布局估算每个采样在链路上占用的字节数 (帧头帧尾按每帧容纳的采样数分摊, 因此批量帧允许更高的采样率),
+// 请求的采样率 × 每采样字节数超出 ARESPLOT_LINK_BUDGET_BYTES_PER_SEC 时自动降低采样率, 而不是让驱动的发送队列无限增长或静默丢弃采样。
+// 实际采样率通过 CMD_SET_SAMPLE_RATE 与 CMD_START_MONITOR 的 ACK 报告给上位机, 时间戳与速率估计因此保持正确。
+// 压缩流按未压缩的大小估算, 因此结果偏保守。
+// When enabled, the MCU estimates the link bytes each sample takes in the current monitor layout (frame header and
+// trailer spread over the samples one frame carries, so batching allows a higher rate), and lowers the sample rate
+// whenever rate x bytes per sample would exceed ARESPLOT_LINK_BUDGET_BYTES_PER_SEC, instead of letting the driver's
+// TX queue grow without bound or drop samples silently. The achieved rate is reported to the host in the
+// CMD_SET_SAMPLE_RATE and CMD_START_MONITOR ACKs, so timestamps and rate estimates stay correct. The compressed
+// stream is estimated at its uncompressed size, so the limit is conservative there.
+#define ARESPLOT_ENABLE_RATE_LIMIT (0)
+
+// 监控数据流可用的链路字节预算 (字节/秒), 应为 ACK 等其他帧留出余量; 例如 115200 8N1 的链路容量约为 11520 字节/秒
+// Link byte budget for the monitor stream (bytes/s); leave headroom for ACKs and other frames. A 115200 8N1 link carries about 11520 bytes/s
+#define ARESPLOT_LINK_BUDGET_BYTES_PER_SEC (10000)
+
+// 是否启用触发抓取 (1: 启用, 0: 禁用)
+// Enable triggered capture (1: enable, 0: disable)
+// 上位机用 CMD_CAPTURE_ARM 布防后, MCU 以全速率 (中断采样时为每次 aresplot_sample_now() 调用, 否则为当前采样率) 把采样写入抓取缓冲区,
+// 某个监控变量满足触发条件后再采集设定数量的采样并冻结, 然后以链路允许的速度用 CMD_CAPTURE_DATA 分块发出。
+// 布防到发送完成期间连续数据流暂停。
+// Once the host arms it with CMD_CAPTURE_ARM, the MCU writes samples into the capture buffer at the full rate (every
+// aresplot_sample_now() call in ISR mode, the current sample rate otherwise). When a monitored variable meets the trigger
+// condition it takes the requested post-trigger samples, freezes the buffer and streams it out in CMD_CAPTURE_DATA blocks
+// at whatever speed the link allows. The continuous stream pauses from arming until the capture has been sent.
+#define ARESPLOT_ENABLE_CAPTURE (0)
+
+// 抓取缓冲区大小 (字节), 可容纳 ARESPLOT_CAPTURE_BUFFER_SIZE / 每采样字节数 个采样 (触发前 + 触发采样 + 触发后)
+// Capture buffer size (bytes); holds ARESPLOT_CAPTURE_BUFFER_SIZE / bytes-per-sample samples (pre-trigger + trigger sample + post-trigger)
+#define ARESPLOT_CAPTURE_BUFFER_SIZE (4096)
+
+// 是否启用运行统计与 CMD_GET_STATS 查询 (1: 启用, 0: 禁用)
+// Enable runtime statistics and the CMD_GET_STATS query (1: enable, 0: disable)
+// MCU 统计已发送的帧, 因无空闲发送缓冲区而丢弃的采样, 被覆盖的 ACK, 接收校验和错误与错过的采样截止时刻, 上位机用 CMD_GET_STATS 读取,
+// 据此评估采样率与变量数量是否在实时预算之内。
+// The MCU counts frames sent, samples dropped because no TX buffer was free, overwritten ACKs, RX checksum errors and missed
+// sample deadlines. The host reads them with CMD_GET_STATS to check sample rates and variable counts against the real-time budget.
+#define ARESPLOT_ENABLE_STATS (1)
+
+// 是否统计服务函数的 CPU 周期 (1: 启用, 需实现 aresplot_user_get_cycles(); 0: 禁用)
+// Measure the CPU cycles spent in the service functions (1: enable, requires aresplot_user_get_cycles(); 0: disable)
+// 记录每次 aresplot_service_tick() 与 aresplot_rx_feed_byte() / aresplot_rx_feed_packet() 调用的最小/平均/最大周期数。
+// Records the min/avg/max cycles of each aresplot_service_tick() and aresplot_rx_feed_byte() / aresplot_rx_feed_packet() call.
+#define ARESPLOT_ENABLE_STATS_CYCLES (0)
+
+// 周期计数器频率 (Hz, 0: 未知), 随统计发给上位机用于换算时间与负载; 可以是运行时表达式, 如 SystemCoreClock
+// Cycle counter frequency (Hz, 0: unknown), reported with the statistics so the host can convert to time and load; may be a runtime expression such as SystemCoreClock
+#define ARESPLOT_STATS_CYCLE_COUNTER_HZ (0)
+
+// 是否支持批量写变量 CMD_SET_VARIABLES (1: 启用, 0: 禁用)
+// Support the batched variable write CMD_SET_VARIABLES (1: enable, 0: disable)
+// 一帧携带多组 (地址, 类型, 值), 全部校验通过后在同一个临界区内写入, 并以一个带逐项状态位图的 ACK 应答。
+// 级联 PID 等整组参数因此一次往返即可更新, 控制器也不会运行在新旧参数混合的状态。
+// One frame carries several (address, type, value) entries; once all of them check out they are written inside one
+// critical section and answered with a single ACK carrying a per-entry status bitmap. A whole parameter set (e.g. a
+// cascaded PID) then takes one round trip, and the controller never runs on a mix of old and new values.
+#define ARESPLOT_ENABLE_SET_VARIABLES (1)
+
+// CMD_SET_VARIABLES 每帧最多的写入项数 (1..255), 接收缓冲区随之增大到 1 + 9 * N 字节
+// Max entries per CMD_SET_VARIABLES frame (1..255); the RX buffer grows to 1 + 9 * N bytes accordingly
+#define ARESPLOT_SET_VARIABLES_MAX_ENTRIES (16)
+
+// 是否支持时间同步 CMD_TIME_SYNC (1: 启用, 0: 禁用)
+// Support the time synchronization command CMD_TIME_SYNC (1: enable, 0: disable)
+// 上位机周期性地发出带令牌的请求, MCU 返回发出应答时的 64 位时基 (32 位时基加回绕计数) 及请求在 MCU 内的停留时间, 上位机据此
+// 连续估计时钟偏移与频偏, 长时间记录时时间轴既不漂移也不跳变。启用 ARESPLOT_ENABLE_TICK_US 时返回微秒时基,
+// 此时 aresplot_user_get_tick_us() 与 aresplot_user_get_tick_ms() 须来自同一时钟源, 二者之间不能有相对漂移。
+// The host periodically sends a request carrying a token; the MCU replies with the 64-bit tick (the 32-bit tick plus a
+// wrap count) at which it sent the reply and how long the request waited on the MCU. The host uses these to track clock offset and skew
+// continuously, so long recordings neither drift nor jump. With ARESPLOT_ENABLE_TICK_US the microsecond tick is returned;
+// aresplot_user_get_tick_us() and aresplot_user_get_tick_ms() must then run from the same clock with no relative drift.
+#define ARESPLOT_ENABLE_TIME_SYNC (1)
+
+// ACK 队列深度 (1..16): 在下一次 aresplot_service_tick() 之前最多可缓存的 ACK 数, 满时新命令不执行而回复 STATUS_ERROR_BUSY
+// ACK queue depth (1..16): ACKs that can wait for the next aresplot_service_tick(); when full a new command is not executed
+// and is answered with STATUS_ERROR_BUSY
+// 上位机可以连续发出多条命令而不必逐条等待 ACK (例如会话开始时的设置采样率 + 开始监控 + 批量写变量), 各条 ACK 都不会丢失。
+// 1 即为只有一个 ACK 槽位的旧行为。
+// The host can send several commands back to back without waiting for each ACK (e.g. set rate + start monitor + a
+// batch of writes at session start), and none of the ACKs is lost. 1 gives the old single-slot behaviour.
+#define ARESPLOT_ACK_QUEUE_SIZE (4)
+
+// 是否支持命令标签 (1: 启用, 0: 禁用)
+// Support command tags (1: enable, 0: disable)
+// 命令ID的 bit 6 置位时, Payload 的第一个字节为标签, MCU 在对应的 ACK 中原样返回, 使流水线发出的命令与 ACK 一一对应。
+// With bit 6 of the command ID set, the first payload byte is a tag that the MCU echoes in the matching ACK, so
+// pipelined commands can be matched to their ACKs one to one.
+#define ARESPLOT_ENABLE_COMMAND_TAGS (1)
+
+// 是否提供默认实例 (1: 启用, 0: 禁用)
+// Provide the default instance (1: enable, 0: disable)
+// 启用后 aresplot_init() / aresplot_service_tick() 等函数操作一个内置实例, 其回调为 aresplot_user_* 函数。
+// 需要多个实例 (例如每个核、每条链路一个) 时用 aresplot_ctx_t 及 aresplot_ctx_* 函数; 禁用后无需实现 aresplot_user_* 函数。
+// When enabled, aresplot_init(), aresplot_service_tick() and friends operate on a built-in instance whose callbacks are
+// the aresplot_user_* functions. Use aresplot_ctx_t and the aresplot_ctx_* functions for several instances (e.g. one per
+// core or link); when disabled, the aresplot_user_* functions need not exist.
+#define ARESPLOT_ENABLE_DEFAULT_INSTANCE (1)
+
 // --- 协议常量 Protocol Constants (与 aresplot.md 一致) ---
 #define ARESPLOT_SOP (0xA5) // 帧起始符 Start of Packet
 #define ARESPLOT_EOP (0x5A) // 帧结束符 End of Packet
@@ -35,10 +293,78 @@
 #define ARESPLOT_CMD_START_MONITOR    (0x01) // 请求开始/更新/停止监控变量
 #define ARESPLOT_CMD_SET_VARIABLE     (0x02) // 请求设置变量值
 #define ARESPLOT_CMD_SET_SAMPLE_RATE  (0x03) // (可选) 设置采样率
+#if ARESPLOT_ENABLE_CAPTURE
+#define ARESPLOT_CMD_CAPTURE_ARM      (0x04) // (可选) 布防触发抓取
+#define ARESPLOT_CMD_CAPTURE_CANCEL   (0x05) // (可选) 取消触发抓取
+#endif
+#if ARESPLOT_ENABLE_STATS
+#define ARESPLOT_CMD_GET_STATS        (0x06) // (可选) 查询运行统计
+
+// CMD_GET_STATS 标志位 CMD_GET_STATS flags
+#define ARESPLOT_GET_STATS_FLAG_RESET (0x01) // 应答后清零统计 Clear the statistics after replying
+#endif
+#if ARESPLOT_ENABLE_SET_VARIABLES
+#define ARESPLOT_CMD_SET_VARIABLES    (0x07) // (可选) 原子地批量设置变量值
+#endif
+#if ARESPLOT_ENABLE_TIME_SYNC
+#define ARESPLOT_CMD_TIME_SYNC        (0x08) // (可选) 时间同步请求
+#endif
+
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+// 命令ID中的标签标志: 置位时 Payload 以 1 字节标签开始, ACK 的 AckCmdID 同样置位并在 Status 之后返回该标签
+// Tag flag in a command ID: the payload starts with a 1-byte tag; the ACK sets the same bit in AckCmdID and echoes the tag after Status
+#define ARESPLOT_CMD_FLAG_TAGGED      (0x40)
+#endif
+
+// CMD_START_MONITOR 可选 Options 字节的标志位 Flag bits of the optional CMD_START_MONITOR Options byte
+#define ARESPLOT_START_MONITOR_OPT_RAW_ENCODING (0x01) // 按原始宽度发送变量值 Send values at their original width
+#define ARESPLOT_START_MONITOR_OPT_COMPRESSION  (0x02) // 以压缩数据流发送 Send the compressed monitor stream
+#define ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS (0x04) // Options 之后附带各变量的分频系数 A per-variable divider table follows Options
+#define ARESPLOT_START_MONITOR_OPT_SEQUENCE (0x08) // 数据帧附带滚动序号 Data frames carry a rolling sequence number
+#define ARESPLOT_START_MONITOR_OPT_BLOCK_DESCRIPTORS (0x10) // 变量列表中可以有块描述 The variable list may contain block descriptors
+#define ARESPLOT_START_MONITOR_OPT_ENVELOPE (0x20) // Options 之后附带包络参数, 每个窗口发送一次包络 Envelope parameters follow Options; one envelope is sent per window
+#define ARESPLOT_START_MONITOR_OPT_PACKED_BOOLS (0x40) // BOOL 变量集中为采样末尾的位图 BOOL variables are gathered into a bitmap at the end of the sample
+
+// 包络参数 EnvelopeFlags 的标志位 Flag bits of the EnvelopeFlags envelope parameter
+#define ARESPLOT_ENVELOPE_FLAG_COUNT (0x01) // 每个窗口最后附带窗口内的采样数 (FP32) Each window ends with its sample count (FP32)
+
+// 变量描述类型字节的标志位: 置位时为块描述, 类型字节后跟 1 字节元素数 Flag in a descriptor's type byte: a block descriptor, followed by a 1-byte element count
+#define ARESPLOT_VAR_DESC_TYPE_BLOCK (0x80)
 
 // MCU -> PC 命令ID (根据最新协议文档 v5)
 #define ARESPLOT_CMD_MONITOR_DATA     (0x81) // 发送监控数据
 #define ARESPLOT_CMD_ACK              (0x82) // 命令确认/应答
+#define ARESPLOT_CMD_MONITOR_DATA_BATCH (0x83) // 发送批量监控数据 (多个连续采样共用一个帧头)
+#define ARESPLOT_CMD_MONITOR_DATA_COMPRESSED (0x84) // 发送压缩的监控数据 (异或/差分编码)
+
+// CMD_MONITOR_DATA_COMPRESSED 的 Flags 字节 Flags byte of CMD_MONITOR_DATA_COMPRESSED
+#define ARESPLOT_COMPRESSED_FLAG_KEYFRAME (0x01) // 第一个采样以零为参考编码 The first sample is coded against zero
+#if ARESPLOT_ENABLE_CAPTURE
+#define ARESPLOT_CMD_CAPTURE_DATA     (0x85) // (可选) 发送触发抓取的数据块
+
+// CMD_CAPTURE_ARM 触发方式 CMD_CAPTURE_ARM trigger modes
+#define ARESPLOT_CAPTURE_TRIGGER_RISING  (0x00) // 上升沿穿越阈值 Rising edge through the threshold
+#define ARESPLOT_CAPTURE_TRIGGER_FALLING (0x01) // 下降沿穿越阈值 Falling edge through the threshold
+#define ARESPLOT_CAPTURE_TRIGGER_ABOVE   (0x02) // 高于阈值 Above the threshold
+#define ARESPLOT_CAPTURE_TRIGGER_BELOW   (0x03) // 低于阈值 Below the threshold
+#define ARESPLOT_CAPTURE_TRIGGER_FORCE   (0x04) // 立即触发 (触发前深度填满后) Immediately (once the pre-trigger depth is filled)
+
+// CMD_CAPTURE_DATA 标志位 CMD_CAPTURE_DATA flags
+#define ARESPLOT_CAPTURE_FLAG_LAST        (0x01) // 本次抓取的最后一块 Last block of the capture
+#define ARESPLOT_CAPTURE_FLAG_TIMING_GAPS (0x02) // 抓取中有错过的采样时刻, 时间轴不完全等距 Sample deadlines were missed; the time axis is not strictly uniform
+#endif
+#if ARESPLOT_ENABLE_STATS
+#define ARESPLOT_CMD_STATS            (0x86) // (可选) 发送运行统计 (CMD_GET_STATS 的应答)
+
+// CMD_STATS 标志位 CMD_STATS flags
+#define ARESPLOT_STATS_FLAG_CYCLES    (0x01) // 周期统计有效 The cycle statistics are valid
+#endif
+#if ARESPLOT_ENABLE_TIME_SYNC
+#define ARESPLOT_CMD_TIME_SYNC_REPLY  (0x87) // (可选) 时间同步应答 (CMD_TIME_SYNC 的应答)
+
+// CMD_TIME_SYNC_REPLY 标志位 CMD_TIME_SYNC_REPLY flags
+#define ARESPLOT_TIME_SYNC_FLAG_TICK_US (0x01) // 时基为微秒 (否则为毫秒) The ticks are in microseconds (otherwise milliseconds)
+#endif
 #if ARESPLOT_ENABLE_ERROR_REPORT
 #define ARESPLOT_CMD_ERROR_REPORT     (0x8F) // (可选) MCU主动错误报告
 #endif
@@ -52,7 +378,7 @@ typedef enum {
     ARES_TYPE_INT32   = 0x04,
     ARES_TYPE_UINT32  = 0x05,
     ARES_TYPE_FLOAT32 = 0x06,
-    ARES_TYPE_FLOAT64 = 0x07, // 注意: MCU端通常转换为float32发送
+    ARES_TYPE_FLOAT64 = 0x07, // 注意: 默认转换为float32发送, 原始编码下按8字节发送 Sent as float32 by default, as 8 bytes in raw encoding
     ARES_TYPE_BOOL    = 0x08
 } aresplot_original_type_t;
 
@@ -66,30 +392,80 @@ typedef enum {
     ARES_STATUS_ERROR_TYPE_UNSUPPORTED  = 0x05, // 不支持的数据类型
     ARES_STATUS_ERROR_RATE_UNACHIEVABLE = 0x06, // (若CMD_SET_SAMPLE_RATE被调用) 无法达到请求的采样率
     ARES_STATUS_ERROR_MCU_BUSY_OR_LIMIT = 0x07, // MCU 繁忙或内部资源限制 (如变量数量超出MCU处理能力)
+    ARES_STATUS_ERROR_BUSY              = 0x08, // ACK 队列已满, 命令未执行, 可稍后重发
     ARES_STATUS_ERROR_GENERAL_FAIL      = 0xFF  // 通用失败
 } aresplot_ack_status_t;
 
-// 存储单个监控变量信息的结构体
-typedef struct {
-    void* ptr;                          // 指向变量内存地址的指针 Pointer to the variable's memory address
-    aresplot_original_type_t type;      // 变量的原始数据类型 Original data type of the variable
-} aresplot_var_info_t;
 
+// --- 实例回调 Instance Callbacks ---
+
+/**
+ * @brief 一个 Aresplot 实例的硬件/系统回调, 由 aresplot_ctx_init() 复制到实例中
+ * Hardware/system callbacks of one Aresplot instance, copied into the instance by aresplot_ctx_init().
+ * 各回调的要求与下面对应的 aresplot_user_* 函数相同, 只是多了第一个参数 user。每个实例 (例如每个核一个,
+ * 各走各的链路) 持有自己的回调, 实例之间不需要加锁; critical_enter / critical_exit 只需屏蔽会访问本实例的上下文 (如本核的中断)。
+ * Each callback has the contract of the matching aresplot_user_* function below, plus user as its first argument.
+ * Every instance (e.g. one per core, each on its own link) holds its own callbacks and instances never lock each other;
+ * critical_enter / critical_exit only need to mask the contexts that touch this instance (e.g. this core's interrupts).
+ */
+typedef struct {
+#if ARESPLOT_ENABLE_ASYNC_TX
+    int (*send_packet)(void* user, const uint8_t* data, uint16_t length);  // 见 See aresplot_user_send_packet()
+#else
+    void (*send_packet)(void* user, const uint8_t* data, uint16_t length); // 见 See aresplot_user_send_packet()
+#endif
+    uint32_t (*get_tick_ms)(void* user);  // 见 See aresplot_user_get_tick_ms()
+#if ARESPLOT_ENABLE_TICK_US
+    uint32_t (*get_tick_us)(void* user);  // 见 See aresplot_user_get_tick_us()
+#endif
+#if ARESPLOT_ENABLE_STATS_CYCLES
+    uint32_t (*get_cycles)(void* user);   // 见 See aresplot_user_get_cycles()
+#endif
+    void (*critical_enter)(void* user);   // 见 See aresplot_user_critical_enter()
+    void (*critical_exit)(void* user);    // 见 See aresplot_user_critical_exit()
+#if ARESPLOT_ENABLE_NOTIFY
+    void (*notify)(void* user);           // 见 See aresplot_user_notify()
+#endif
+    void* user;                           // 原样传给各回调 Passed to every callback unchanged
+} aresplot_callbacks_t;
 
-// --- 用户需要实现的硬件/系统相关回调函数 ---
-// --- User-implemented hardware/system-specific callback functions ---
+#if ARESPLOT_ENABLE_DEFAULT_INSTANCE
+// --- 用户需要实现的硬件/系统相关回调函数 (默认实例) ---
+// --- User-implemented hardware/system-specific callback functions (default instance) ---
 
+#if ARESPLOT_ENABLE_ASYNC_TX
+/**
+ * @brief 启动一个帧的异步发送 (例如 UART DMA, USB packet)
+ * Starts asynchronous transmission of one frame (e.g., UART DMA, USB packet).
+ * 超过 ARESPLOT_SHARED_BUFFER_SIZE 的帧分为连续的多个数据包, 各占一个发送缓冲区。
+ * A frame longer than ARESPLOT_SHARED_BUFFER_SIZE is split into consecutive packets, one per TX buffer.
+ * 启用 ARESPLOT_ENABLE_TX_COALESCE 时一个数据包 (最长 ARESPLOT_TX_COALESCE_MTU) 可含多个帧, 帧也可跨两个数据包。
+ * With ARESPLOT_ENABLE_TX_COALESCE a packet (at most ARESPLOT_TX_COALESCE_MTU) may hold several frames, and a frame may span two packets.
+ * @param data 指向要发送数据的指针, 在对应的 aresplot_tx_complete() 调用前保持不变 Pointer to the data; stays untouched until the matching aresplot_tx_complete() call.
+ * @param length 要发送数据的长度 Length of the data to send.
+ * @return 1: 已接受, 传输完成后须调用一次 aresplot_tx_complete(); 0: 忙, 帧保留在队列中稍后重试
+ * 1: accepted, call aresplot_tx_complete() once the transfer finishes; 0: busy, the frame stays queued and is retried later.
+ * @note 可能在 aresplot_tx_complete() 的调用上下文中被调用 (例如 DMA 发送完成中断)。
+ * May be called from the context aresplot_tx_complete() is called from (e.g., the DMA TX-complete ISR).
+ */
+int aresplot_user_send_packet(const uint8_t* data, uint16_t length);
+#else
 /**
  * @brief 发送一个数据包 (通常是一个完整的Aresplot帧) 到通信接口 (例如 UART DMA, USB packet)
  * Sends a data packet (usually a complete Aresplot frame) to the communication interface (e.g., UART DMA, USB packet).
  * @param data 指向要发送数据的指针 Pointer to the data to send.
  * @param length 要发送数据的长度 Length of the data to send.
- * @note 用户需要确保此函数是非阻塞的，或者在RTOS环境中适当地处理阻塞。
+ * @note 超过 ARESPLOT_SHARED_BUFFER_SIZE 的帧分为连续的多个数据包, 须按调用顺序发送。
+ * Frames longer than ARESPLOT_SHARED_BUFFER_SIZE arrive as consecutive packets, which must be sent in call order.
+ * 启用 ARESPLOT_ENABLE_TX_COALESCE 时一个数据包 (最长 ARESPLOT_TX_COALESCE_MTU) 可含多个帧, 帧也可跨两个数据包。
+ * With ARESPLOT_ENABLE_TX_COALESCE a packet (at most ARESPLOT_TX_COALESCE_MTU) may hold several frames, and a frame may span two packets.
+ * 用户需要确保此函数是非阻塞的，或者在RTOS环境中适当地处理阻塞。
  * The user needs to ensure this function is non-blocking or handles blocking appropriately in an RTOS environment.
  * 如果发送操作是异步的 (例如DMA)，此函数启动传输后即可返回。
  * If the send operation is asynchronous (e.g., DMA), this function can return after initiating the transfer.
  */
 void aresplot_user_send_packet(const uint8_t* data, uint16_t length);
+#endif
 
 /**
  * @brief 获取当前系统时间戳 (例如，毫秒)
@@ -98,6 +474,28 @@ void aresplot_user_send_packet(const uint8_t* data, uint16_t length);
  */
 uint32_t aresplot_user_get_tick_ms(void);
 
+#if ARESPLOT_ENABLE_TICK_US
+/**
+ * @brief 获取当前微秒时间戳 (允许32位回绕), 用于采样调度
+ * Gets the current timestamp in microseconds (32-bit wrap-around allowed), used for sample scheduling.
+ * @return 当前微秒时间戳 Current timestamp in microseconds.
+ * @note 可由 DWT 周期计数器换算, 例如 DWT->CYCCNT / (SystemCoreClock / 1000000)。
+ * Can be derived from the DWT cycle counter, e.g. DWT->CYCCNT / (SystemCoreClock / 1000000).
+ */
+uint32_t aresplot_user_get_tick_us(void);
+#endif
+
+#if ARESPLOT_ENABLE_STATS_CYCLES
+/**
+ * @brief 读取自由运行的 CPU 周期计数器 (允许32位回绕), 用于统计服务函数耗时
+ * Reads a free-running CPU cycle counter (32-bit wrap-around allowed), used to time the service functions.
+ * @return 当前周期计数 Current cycle count.
+ * @note 例如 Cortex-M 上的 DWT->CYCCNT。须可在调用 aresplot_rx_feed_byte() 的中断中调用。
+ * e.g. DWT->CYCCNT on Cortex-M. Must be callable from the ISR that calls aresplot_rx_feed_byte().
+ */
+uint32_t aresplot_user_get_cycles(void);
+#endif
+
 /**
  * @brief (可选, 用于RTOS或需要保护共享资源的关键操作) 进入临界区
  * (Optional, for RTOS or critical operations needing shared resource protection) Enters a critical section.
@@ -110,40 +508,584 @@ void aresplot_user_critical_enter(void);
  */
 void aresplot_user_critical_exit(void);
 
+#if ARESPLOT_ENABLE_NOTIFY
+/**
+ * @brief 通知有新的工作, 需尽快调用 aresplot_service_tick()
+ * Signals new work: aresplot_service_tick() should be called soon.
+ * @note 可能在调用 aresplot_rx_feed_byte() / aresplot_rx_feed_packet()、aresplot_sample_now() 或 aresplot_tx_complete()
+ * 的中断中调用, 因此只应设置事件或任务通知 (例如 FreeRTOS 的 vTaskNotifyGiveFromISR()), 不应直接调用 aresplot_service_tick()。
+ * May be called from the ISRs that call aresplot_rx_feed_byte() / aresplot_rx_feed_packet(), aresplot_sample_now() or
+ * aresplot_tx_complete(), so it should only set an event or task notification (e.g. FreeRTOS vTaskNotifyGiveFromISR()),
+ * never call aresplot_service_tick() directly.
+ */
+void aresplot_user_notify(void);
+#endif
+#endif // ARESPLOT_ENABLE_DEFAULT_INSTANCE
+
+// --- 实例状态 Instance State ---
+// 以下定义决定 aresplot_ctx_t 的大小, 使实例可以由用户静态分配 (例如放在各核自己的 RAM 中); 用户代码不应访问其成员。
+// The definitions below size aresplot_ctx_t so the user can allocate instances statically (e.g. in each core's own RAM);
+// user code must not touch the members.
+
+// 批量帧 Payload 头: Timestamp(4) + SamplePeriodNs(4) + SampleCount(1)
+// Batch payload header: Timestamp(4) + SamplePeriodNs(4) + SampleCount(1)
+#define ARESPLOT_BATCH_HEADER_SIZE (9)
+
+#if (ARESPLOT_MONITOR_BATCH_SIZE < 1) || (ARESPLOT_MONITOR_BATCH_SIZE > 255)
+#error "ARESPLOT_MONITOR_BATCH_SIZE must be in the range 1..255"
+#endif
+
+// 单个变量值的最大字节数 (原始编码下 FLOAT64 为 8) Max bytes of one value (8 for FLOAT64 in raw encoding)
+#if ARESPLOT_ENABLE_RAW_ENCODING
+#define ARESPLOT_MAX_VALUE_SIZE (8)
+#else
+#define ARESPLOT_MAX_VALUE_SIZE (4)
+#endif
+#if ARESPLOT_ENABLE_ENVELOPE
+// 包络窗口的最大值数量: 各变量的平均值、最小值与最大值, 再加窗口内采样数 Max values of an envelope window: mean, min and max of each variable, plus the sample count
+#define ARESPLOT_ENVELOPE_MAX_VALUES (3 * ARESPLOT_MAX_VARS_TO_MONITOR + 1)
+// 一个发送的采样中的最大值数量 Max values in one sample on the wire
+#define ARESPLOT_MAX_WIRE_VALUES (ARESPLOT_ENVELOPE_MAX_VALUES)
+// 一个采样 (所有监控变量, 或一个 FP32 包络窗口) 的最大字节数 Max bytes of one sample (all monitored variables, or one FP32 envelope window)
+#define ARESPLOT_MAX_SAMPLE_BYTES (ARESPLOT_ENVELOPE_MAX_VALUES * 4)
+#else
+#define ARESPLOT_MAX_WIRE_VALUES (ARESPLOT_MAX_VARS_TO_MONITOR)
+// 一个采样 (所有监控变量) 的最大字节数 Max bytes of one sample (all monitored variables)
+#define ARESPLOT_MAX_SAMPLE_BYTES (ARESPLOT_MAX_VARS_TO_MONITOR * ARESPLOT_MAX_VALUE_SIZE)
+#endif
+
+// CMD_MONITOR_DATA_COMPRESSED 头: Timestamp(4) + SamplePeriodNs(4) + SampleCount(1) + Flags(1) + FrameSeq(1)
+// CMD_MONITOR_DATA_COMPRESSED header: Timestamp(4) + SamplePeriodNs(4) + SampleCount(1) + Flags(1) + FrameSeq(1)
+#define ARESPLOT_COMPRESSED_HEADER_SIZE (11)
+// 压缩值格式: 低 4 位为值宽度, 置位 DELTA 时为 zigzag 差分, 否则为异或 Compressed value format: low 4 bits are the width; DELTA selects zigzag delta, otherwise XOR
+#define ARESPLOT_VALUE_FORMAT_WIDTH_MASK (0x0F)
+#define ARESPLOT_VALUE_FORMAT_DELTA      (0x80)
+
+#if ARESPLOT_ENABLE_COMPRESSION
+// 压缩采样中每个值一个长度半字节 A compressed sample carries a length nibble per value
+#define ARESPLOT_MAX_NIBBLE_BYTES ((ARESPLOT_MAX_WIRE_VALUES + 1) / 2)
+#define ARESPLOT_MAX_DATA_HEADER_SIZE (ARESPLOT_COMPRESSED_HEADER_SIZE)
+#if (ARESPLOT_COMPRESSION_KEYFRAME_INTERVAL < 1) || (ARESPLOT_COMPRESSION_KEYFRAME_INTERVAL > 65535)
+#error "ARESPLOT_COMPRESSION_KEYFRAME_INTERVAL must be in the range 1..65535"
+#endif
+#else
+#define ARESPLOT_MAX_NIBBLE_BYTES (0)
+#define ARESPLOT_MAX_DATA_HEADER_SIZE (ARESPLOT_BATCH_HEADER_SIZE + ARESPLOT_ENABLE_SEQUENCE) // 批量头 + FrameSeq Batch header + FrameSeq
+#endif
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+// 分频模式下每个采样前的通道位图 Channel bitmap in front of each sample when dividers are used
+#define ARESPLOT_MAX_CHANNEL_MASK_BYTES ((ARESPLOT_MAX_VARS_TO_MONITOR + 7) / 8)
+#else
+#define ARESPLOT_MAX_CHANNEL_MASK_BYTES (0)
+#endif
+// 编码后采样的最坏情况 Worst-case encoded sample
+#define ARESPLOT_MAX_CODED_SAMPLE_BYTES (ARESPLOT_MAX_SAMPLE_BYTES + ARESPLOT_MAX_NIBBLE_BYTES + ARESPLOT_MAX_CHANNEL_MASK_BYTES)
+// 发送端需要各值的宽度等布局信息 (压缩, 分频或序号) The sender needs the per-value layout (for compression, dividers or sequence numbers)
+#define ARESPLOT_ENABLE_SENDER_LAYOUT (ARESPLOT_ENABLE_COMPRESSION || ARESPLOT_ENABLE_CHANNEL_DIVIDERS || ARESPLOT_ENABLE_SEQUENCE)
+
+#if (ARESPLOT_MAX_VARS_TO_MONITOR < 1) || (ARESPLOT_MAX_VARS_TO_MONITOR > 255)
+#error "ARESPLOT_MAX_VARS_TO_MONITOR must be in the range 1..255"
+#endif
+#if ARESPLOT_ENABLE_ENVELOPE && (ARESPLOT_ENVELOPE_MAX_VALUES > 255)
+#error "ARESPLOT_ENABLE_ENVELOPE requires ARESPLOT_MAX_VARS_TO_MONITOR to be at most 84"
+#endif
+#if ARESPLOT_SHARED_BUFFER_SIZE < 16
+#error "ARESPLOT_SHARED_BUFFER_SIZE must be at least 16"
+#endif
+#if ARESPLOT_ENABLE_TX_COALESCE && ((ARESPLOT_TX_COALESCE_MTU < 16) || (ARESPLOT_TX_COALESCE_MTU > ARESPLOT_SHARED_BUFFER_SIZE))
+#error "ARESPLOT_TX_COALESCE_MTU must be in the range 16..ARESPLOT_SHARED_BUFFER_SIZE"
+#endif
+#if ARESPLOT_ENABLE_TX_COALESCE && ARESPLOT_ENABLE_LOW_RAM
+#error "ARESPLOT_ENABLE_TX_COALESCE cannot be combined with ARESPLOT_ENABLE_LOW_RAM"
+#endif
+// 每次发送的最大字节数: 帧按此分块 Max bytes per send: frames are split into chunks of this size
+#if ARESPLOT_ENABLE_TX_COALESCE
+#define ARESPLOT_TX_CHUNK_SIZE ARESPLOT_TX_COALESCE_MTU
+#else
+#define ARESPLOT_TX_CHUNK_SIZE ARESPLOT_SHARED_BUFFER_SIZE
+#endif
+// 单个采样的数据帧能放入一个发送缓冲区时直接在其中编码, 不经过栈上的 Payload (合并发送时帧从块中间开始, 不适用)
+// A single-sample data frame is encoded straight into the TX buffer, bypassing a payload on the stack, when it fits one buffer
+// (not with coalescing, where a frame starts mid-chunk)
+#define ARESPLOT_MONITOR_FRAME_IN_PLACE \
+    (!ARESPLOT_ENABLE_TX_COALESCE && (6 + ARESPLOT_MAX_DATA_HEADER_SIZE + ARESPLOT_MAX_CODED_SAMPLE_BYTES) <= ARESPLOT_SHARED_BUFFER_SIZE)
+#if ARESPLOT_ENABLE_LOW_RAM && ARESPLOT_ENABLE_ASYNC_TX
+#error "ARESPLOT_ENABLE_LOW_RAM requires ARESPLOT_ENABLE_ASYNC_TX to be 0"
+#endif
+#if ARESPLOT_ENABLE_LOW_RAM && !ARESPLOT_MONITOR_FRAME_IN_PLACE
+#error "ARESPLOT_ENABLE_LOW_RAM requires a single-sample data frame to fit in ARESPLOT_SHARED_BUFFER_SIZE"
+#endif
+#if ARESPLOT_ENABLE_SET_VARIABLES && \
+    ((ARESPLOT_SET_VARIABLES_MAX_ENTRIES < 1) || (ARESPLOT_SET_VARIABLES_MAX_ENTRIES > 255))
+#error "ARESPLOT_SET_VARIABLES_MAX_ENTRIES must be in the range 1..255"
+#endif
+#if ARESPLOT_ENABLE_RATE_LIMIT && (ARESPLOT_LINK_BUDGET_BYTES_PER_SEC < 1)
+#error "ARESPLOT_LINK_BUDGET_BYTES_PER_SEC must be at least 1"
+#endif
+#if (ARESPLOT_ACK_QUEUE_SIZE < 1) || (ARESPLOT_ACK_QUEUE_SIZE > 16)
+#error "ARESPLOT_ACK_QUEUE_SIZE must be in the range 1..16"
+#endif
+
+// CMD_START_MONITOR 的最大 Payload (255 个块描述 + Options + 分频表; 包络参数只有 3 字节), 边接收边解析, 不占用接收缓冲区
+// Max CMD_START_MONITOR payload (255 block descriptors + Options + divider table; envelope parameters are only 3 bytes);
+// parsed as it arrives, bypassing the RX buffer
+#define ARESPLOT_START_MONITOR_MAX_PAYLOAD (1 + 255 * 6 + 1 + 255)
+// 其余命令的 Payload 接收缓冲区 (单项命令最长为 CMD_CAPTURE_ARM 的 10 字节, 另需容纳 CMD_SET_VARIABLES)
+// RX buffer for the payload of every other command (longest single command: CMD_CAPTURE_ARM, 10 bytes; CMD_SET_VARIABLES must fit too)
+#if ARESPLOT_ENABLE_SET_VARIABLES && (1 + 9 * ARESPLOT_SET_VARIABLES_MAX_ENTRIES) > 16
+#define ARESPLOT_RX_PAYLOAD_BUFFER_SIZE (1 + 9 * ARESPLOT_SET_VARIABLES_MAX_ENTRIES)
+#else
+#define ARESPLOT_RX_PAYLOAD_BUFFER_SIZE (16)
+#endif
+
+// ACK 在 AckCmdID, Status (及标签) 之后的附加数据: 实际采样率 (FP32), 或 CMD_SET_VARIABLES 的状态位图
+// Extra ACK data after AckCmdID, Status (and the tag): the achieved sample rate (FP32), or the CMD_SET_VARIABLES status bitmap
+#if ARESPLOT_ENABLE_SET_VARIABLES && ((ARESPLOT_SET_VARIABLES_MAX_ENTRIES + 7) / 8) > 4
+#define ARESPLOT_ACK_EXTRA_MAX ((ARESPLOT_SET_VARIABLES_MAX_ENTRIES + 7) / 8)
+#else
+#define ARESPLOT_ACK_EXTRA_MAX (4)
+#endif
+
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+// 批量帧 Payload 容量: 受 K 个最大采样和发送缓冲区两者限制, 但至少能容纳一个采样
+// Batch payload capacity: bounded by K full-size samples and by the TX buffer, but always holds at least one sample
+#if (ARESPLOT_MAX_DATA_HEADER_SIZE + ARESPLOT_MONITOR_BATCH_SIZE * ARESPLOT_MAX_CODED_SAMPLE_BYTES) < (ARESPLOT_SHARED_BUFFER_SIZE - 6)
+#define ARESPLOT_BATCH_PAYLOAD_CAPACITY (ARESPLOT_MAX_DATA_HEADER_SIZE + ARESPLOT_MONITOR_BATCH_SIZE * ARESPLOT_MAX_CODED_SAMPLE_BYTES)
+#elif (ARESPLOT_MAX_DATA_HEADER_SIZE + ARESPLOT_MAX_CODED_SAMPLE_BYTES) > (ARESPLOT_SHARED_BUFFER_SIZE - 6)
+#define ARESPLOT_BATCH_PAYLOAD_CAPACITY (ARESPLOT_MAX_DATA_HEADER_SIZE + ARESPLOT_MAX_CODED_SAMPLE_BYTES)
+#else
+#define ARESPLOT_BATCH_PAYLOAD_CAPACITY (ARESPLOT_SHARED_BUFFER_SIZE - 6)
+#endif
+#endif
+
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+#if (ARESPLOT_SAMPLE_RING_SIZE < 2) || (ARESPLOT_SAMPLE_RING_SIZE > 128) || \
+    ((ARESPLOT_SAMPLE_RING_SIZE & (ARESPLOT_SAMPLE_RING_SIZE - 1)) != 0)
+#error "ARESPLOT_SAMPLE_RING_SIZE must be a power of two in the range 2..128"
+#endif
+#if (ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ < 1) || (ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ > 1000000)
+#error "ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ must be in the range 1..1000000"
+#endif
+#endif
+
+#if ARESPLOT_ENABLE_CAPTURE
+// CMD_CAPTURE_DATA 头: TriggerTimestamp(4) + SamplePeriodNs(4) + CaptureId(1) + Flags(1) + PreSamples(2) + StartIndex(2) + SampleCount(1)
+#define ARESPLOT_CAPTURE_HEADER_SIZE (15)
+#if ARESPLOT_CAPTURE_BUFFER_SIZE < ARESPLOT_MAX_SAMPLE_BYTES
+#error "ARESPLOT_CAPTURE_BUFFER_SIZE must hold at least one full sample"
+#endif
+#endif
+
+#if ARESPLOT_ENABLE_STATS
+// CMD_STATS Payload: Flags(1) + ElapsedMs(4) + FramesSent(4) + SamplesDropped(4) + AcksOverwritten(4) + RxChecksumErrors(4) +
+// DeadlineOverruns(4) + CycleCounterHz(4), 之后服务函数与接收函数各一组 Calls/Min/Avg/Max(4*4)
+// DeadlineOverruns(4) + CycleCounterHz(4), then one Calls/Min/Avg/Max(4*4) group each for the tick and RX functions
+#define ARESPLOT_STATS_PAYLOAD_SIZE (29 + 2 * 16)
+#endif
+#if ARESPLOT_ENABLE_TIME_SYNC
+// CMD_TIME_SYNC Payload: Token(8), 由上位机定义, MCU 原样返回 Defined by the host and echoed by the MCU
+#define ARESPLOT_TIME_SYNC_TOKEN_SIZE (8)
+// CMD_TIME_SYNC_REPLY Payload: Token(8) + Flags(1) + TxTick(8) + Turnaround(4) + TxTickMs(4)
+#define ARESPLOT_TIME_SYNC_REPLY_SIZE (ARESPLOT_TIME_SYNC_TOKEN_SIZE + 1 + 8 + 4 + 4)
+#endif
+#if ARESPLOT_ENABLE_STATS_CYCLES && !ARESPLOT_ENABLE_STATS
+#error "ARESPLOT_ENABLE_STATS_CYCLES requires ARESPLOT_ENABLE_STATS"
+#endif
+
+#if ARESPLOT_ENABLE_ASYNC_TX
+#if (ARESPLOT_TX_BUFFER_COUNT < 2) || (ARESPLOT_TX_BUFFER_COUNT > 128) || \
+    ((ARESPLOT_TX_BUFFER_COUNT & (ARESPLOT_TX_BUFFER_COUNT - 1)) != 0)
+#error "ARESPLOT_TX_BUFFER_COUNT must be a power of two in the range 2..128"
+#endif
+// 分块的帧须能同时放入缓冲池; 合并发送时帧可能从几乎写满的块开始
+// A chunked frame must fit in the pool at once; with coalescing it may start in an almost full chunk
+#if ARESPLOT_ENABLE_TX_COALESCE
+#define ARESPLOT_TX_POOL_FRAME_CAPACITY (ARESPLOT_TX_BUFFER_COUNT * ARESPLOT_TX_CHUNK_SIZE - (ARESPLOT_TX_CHUNK_SIZE - 1))
+#else
+#define ARESPLOT_TX_POOL_FRAME_CAPACITY (ARESPLOT_TX_BUFFER_COUNT * ARESPLOT_SHARED_BUFFER_SIZE)
+#endif
+#if (6 + ARESPLOT_MAX_DATA_HEADER_SIZE + ARESPLOT_MAX_CODED_SAMPLE_BYTES) > ARESPLOT_TX_POOL_FRAME_CAPACITY
+#error "The TX buffer pool (ARESPLOT_TX_BUFFER_COUNT) is too small for one sample of ARESPLOT_MAX_VARS_TO_MONITOR variables"
+#endif
+#if ARESPLOT_ENABLE_CAPTURE && \
+    (6 + ARESPLOT_CAPTURE_HEADER_SIZE + ARESPLOT_MAX_SAMPLE_BYTES) > ARESPLOT_TX_POOL_FRAME_CAPACITY
+#error "The TX buffer pool (ARESPLOT_TX_BUFFER_COUNT) is too small for a CMD_CAPTURE_DATA frame"
+#endif
+#if ARESPLOT_ENABLE_STATS && (6 + ARESPLOT_STATS_PAYLOAD_SIZE) > ARESPLOT_TX_POOL_FRAME_CAPACITY
+#error "The TX buffer pool (ARESPLOT_TX_BUFFER_COUNT) is too small for a CMD_STATS frame"
+#endif
+#if ARESPLOT_ENABLE_TIME_SYNC && (6 + ARESPLOT_TIME_SYNC_REPLY_SIZE) > ARESPLOT_TX_POOL_FRAME_CAPACITY
+#error "The TX buffer pool (ARESPLOT_TX_BUFFER_COUNT) is too small for a CMD_TIME_SYNC_REPLY frame"
+#endif
+#if (6 + 3 + ARESPLOT_ACK_EXTRA_MAX) > ARESPLOT_TX_POOL_FRAME_CAPACITY
+#error "The TX buffer pool (ARESPLOT_TX_BUFFER_COUNT) is too small for a CMD_ACK frame"
+#endif
+#if ARESPLOT_SHARED_BUFFER_SIZE > ARESPLOT_TX_POOL_FRAME_CAPACITY
+#error "The TX buffer pool (ARESPLOT_TX_BUFFER_COUNT) is too small for frames of ARESPLOT_SHARED_BUFFER_SIZE bytes"
+#endif
+#endif
+
+// 接收状态机
+typedef enum {
+    ARES_RX_STATE_WAIT_SOP,
+    ARES_RX_STATE_WAIT_CMD,
+    ARES_RX_STATE_WAIT_LEN1,
+    ARES_RX_STATE_WAIT_LEN2,
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+    ARES_RX_STATE_WAIT_TAG,
+#endif
+    ARES_RX_STATE_WAIT_PAYLOAD,
+    ARES_RX_STATE_WAIT_CHECKSUM,
+    ARES_RX_STATE_WAIT_EOP
+} aresplot_rx_state_t;
+
+// 采样计划读取函数: 读取 src 处的变量 (合并读取时为 len 个连续元素或字节) 并按发送编码写入 dst
+// Sampling plan reader: reads the variable at src (len contiguous elements or bytes for a coalesced read) and writes it to dst in the wire encoding
+typedef void (*aresplot_plan_reader_t)(const volatile void* src, uint8_t* dst, uint16_t len);
+
+// 采样计划中的一步 (一个监控变量, 或地址连续的一段变量) One step of the sampling plan (one monitored variable, or a run of contiguous ones)
+typedef struct {
+    aresplot_plan_reader_t read; // 按类型和编码选定的读取函数 Reader chosen by type and encoding
+    const volatile void* src;    // 变量地址 (空地址已替换为零值) Variable address (NULL replaced by a zero source)
+    uint16_t offset;             // 在采样中的字节偏移 Byte offset within the sample
+    uint16_t len;                // 读取长度: FP32 编码为元素数, 原始编码为字节数, 打包 BOOL 为 (个数 << 3) | 起始位
+                                 // Read length: elements for FP32 encoding, bytes for raw encoding, (count << 3) | first bit for packed BOOLs
+} aresplot_plan_step_t;
+
+// 由 CMD_START_MONITOR 编译的采样计划, 采样时只需依次执行各步
+// Sampling plan compiled from CMD_START_MONITOR; taking a sample just walks the steps
+typedef struct {
+    aresplot_plan_step_t steps[ARESPLOT_MAX_VARS_TO_MONITOR];
+    uint8_t  num_steps;    // 读取步骤数 (合并读取后可少于变量数) Number of read steps (may be fewer than the variables once reads are coalesced)
+    uint8_t  num_values;   // 监控变量数量 Number of monitored variables
+    uint16_t sample_bytes; // 每个采样的字节数 Bytes per sample
+    uint8_t  options;      // 已接受的 CMD_START_MONITOR 选项 Accepted CMD_START_MONITOR options
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    uint8_t  num_wire_values; // 采样中的值数量, 打包的 BOOL 位图每字节算一个 Values in the sample; each byte of the packed BOOL bitmap counts as one
+#endif
+#if ARESPLOT_ENABLE_SENDER_LAYOUT
+    uint8_t  value_formats[ARESPLOT_MAX_VARS_TO_MONITOR]; // 各值的宽度与压缩格式 (ARESPLOT_VALUE_FORMAT_*) Width and compressed format of each value
+#endif
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+    uint8_t  dividers[ARESPLOT_MAX_VARS_TO_MONITOR]; // 各变量的分频系数 (1..255) Divider of each variable (1..255)
+#endif
+    uint8_t  value_types[ARESPLOT_MAX_VARS_TO_MONITOR]; // 各变量的原始类型 Original type of each variable
+#if ARESPLOT_ENABLE_ENVELOPE
+    uint16_t envelope_window; // 每个包络窗口的采样数 (0: 不聚合) Samples per envelope window (0: no aggregation)
+    uint8_t  envelope_flags;  // ARESPLOT_ENVELOPE_FLAG_*
+#endif
+} aresplot_sample_plan_t;
+
+// ACK 发送相关
+// ACK transmit related
+typedef struct {
+    uint8_t cmd;       // 要ACK的命令ID (带标签时含 ARESPLOT_CMD_FLAG_TAGGED) Command ID being ACKed (with ARESPLOT_CMD_FLAG_TAGGED when tagged)
+    uint8_t status;    // 要发送的ACK状态 ACK status to send
+    uint8_t tag;       // 命令标签 (仅带标签时有效) Command tag (only valid when tagged)
+    uint8_t extra_len; // ACK附加数据的字节数 Bytes of extra ACK data
+    uint8_t extra[ARESPLOT_ACK_EXTRA_MAX]; // ACK附加数据 (实际采样率或状态位图) Extra ACK data (achieved rate or status bitmap)
+} aresplot_ack_entry_t;
+
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+// 中断采样环形缓冲区的一个槽位 One slot of the ISR sample ring
+typedef struct {
+    uint32_t timestamp_ms;  // 采样时间戳 Sample timestamp
+    uint32_t seq;           // 采样序号, 用于发现丢失的采样 Sample sequence number, used to detect dropped samples
+    uint8_t  config_gen;    // 采样所属的监控配置代数 Monitor config generation of the sample
+    uint16_t values_len;    // 采样值字节数 Number of value bytes
+    uint8_t  values[ARESPLOT_MAX_SAMPLE_BYTES]; // 已编码的采样值 Encoded sample values
+} aresplot_sample_slot_t;
+#endif
+
+#if ARESPLOT_ENABLE_STATS
+#if ARESPLOT_ENABLE_STATS_CYCLES
+// 一个函数的周期统计 Cycle statistics of one function
+typedef struct {
+    uint32_t count; // 调用次数 Calls
+    uint32_t min;   // 最少周期数 Fewest cycles
+    uint32_t max;   // 最多周期数 Most cycles
+    uint64_t sum;   // 周期数总和 (用于平均值) Total cycles (for the average)
+} aresplot_cycle_stats_t;
+#endif
+
+// 每个计数只在一个上下文中递增 (接收相关在接收中断, 其余在主循环或采样中断), 主循环在临界区内读取和清零
+// Each counter is bumped from one context only (RX ones from the RX ISR, the rest from the main loop or the sampling ISR);
+// the main loop reads and clears them inside a critical section
+typedef struct {
+    uint32_t frames_sent;        // 已发送 (或已排队) 的帧 Frames sent (or queued)
+    uint32_t samples_dropped;    // 因无空闲发送缓冲区 (中断采样时为环形缓冲区满) 而丢弃的采样 Samples dropped because no TX buffer was free (ring full in ISR mode)
+    uint32_t acks_overwritten;   // ACK 队列满时溢出槽中被更新的回复覆盖的回复 Replies in the overflow slot overwritten by a newer one while the ACK queue was full
+    uint32_t rx_checksum_errors; // 接收校验和错误 RX checksum errors
+    uint32_t deadline_overruns;  // 晚于截止时刻一个周期以上的采样 Samples taken more than one period past their deadline
+#if ARESPLOT_ENABLE_STATS_CYCLES
+    aresplot_cycle_stats_t tick_cycles; // aresplot_service_tick()
+    aresplot_cycle_stats_t rx_cycles;   // aresplot_rx_feed_byte() / aresplot_rx_feed_packet()
+#endif
+} aresplot_stats_t;
+#endif
+
+// 一个 Aresplot 实例的全部状态 All state of one Aresplot instance
+typedef struct aresplot_ctx {
+    aresplot_callbacks_t callbacks; // 实例回调 Instance callbacks
+
+    volatile aresplot_rx_state_t rx_state; // 当前接收状态 Current receive state
+    uint8_t  rx_payload_buffer[ARESPLOT_RX_PAYLOAD_BUFFER_SIZE]; // 接收缓冲区仅用于Payload (CMD_START_MONITOR 除外) Receive buffer for payload only (except CMD_START_MONITOR)
+    uint16_t rx_payload_len;      // 当前帧的Payload长度 Payload length of the current frame
+    uint16_t rx_payload_idx;      // 当前接收的Payload字节计数 Payload byte counter
+    uint8_t  rx_cmd;              // 当前帧的命令ID Command ID of the current frame
+    uint8_t  rx_checksum_calculated; // 计算出的校验和 Calculated checksum
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+    uint8_t  rx_tagged;           // 当前帧是否带标签 Whether the current frame carries a tag
+    uint8_t  rx_tag;              // 当前帧的标签 Tag of the current frame
+#endif
+
+    // CMD_START_MONITOR 流式解析状态: 变量列表直接写入未发布的采样计划, 帧校验通过后才编译并发布
+    // CMD_START_MONITOR streaming parse state: the variable list goes straight into the unpublished sampling plan,
+    // which is only compiled and published once the frame checks out
+    uint8_t  rx_start_plan;         // 目标计划索引 Target plan index
+    uint8_t  rx_start_num_vars;     // 请求的变量描述数 (NumVariables) Requested descriptor count (NumVariables)
+    uint8_t  rx_start_desc;         // 已接收的变量描述数 Descriptors received so far
+    uint16_t rx_start_vars_end;     // 变量列表之后的 Payload 偏移 (即 Options 的位置, 列表结束前未知) Payload offset just past the variable list (where Options is; unknown until the list ends)
+    uint16_t rx_start_var;          // 已展开的变量 (通道) 数 Variables (channels) expanded so far
+    uint8_t  rx_start_field;        // 变量描述内的字节序号 (0..5) Byte index within the variable descriptor (0..5)
+    uint32_t rx_start_addr;         // 正在接收的变量地址 Address of the variable being received
+    uint8_t  rx_start_type;         // 正在接收的类型字节 Type byte being received
+    uint8_t  rx_start_blocks;       // 变量列表中是否有块描述 Whether the variable list contains block descriptors
+    uint8_t  rx_start_error;        // 解析变量列表时发现的错误 (ARES_STATUS_OK: 无) Error found while parsing the variable list (ARES_STATUS_OK: none)
+    uint8_t  rx_start_options;      // Options 字节 (未提供时为 0) Options byte (0 when absent)
+#if ARESPLOT_ENABLE_ENVELOPE
+    uint16_t rx_start_envelope_window; // 包络参数 WindowSamples Envelope parameter WindowSamples
+    uint8_t  rx_start_envelope_flags;  // 包络参数 EnvelopeFlags Envelope parameter EnvelopeFlags
+#endif
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+    volatile uint8_t rx_start_locked_plan; // 正在写入的计划索引 + 1 (0: 无), 主循环采样暂不切换到该计划 Plan being written + 1 (0: none); the main-loop sampler holds off switching to it
+#endif
+
+    // 监控变量列表 (双缓冲采样计划: 在未发布的计划中编译, 再在临界区内切换索引)
+    // Monitored variable list (double-buffered sampling plan: compiled into the unpublished plan, then the index is swapped in a critical section)
+    aresplot_sample_plan_t sample_plans[2];
+    volatile uint8_t active_plan;    // 已发布的采样计划索引 Index of the published sampling plan
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+    volatile uint8_t reading_plan;   // 主循环采样最近读取的计划索引, 编译时不得覆盖 Plan last taken by the main-loop sampler; must not be overwritten while compiling
+#endif
+    uint8_t num_monitor_vars;      // 当前正在监控的变量数量 Number of currently monitored variables
+    volatile uint8_t monitoring_active; // 监控是否激活标志 Flag indicating if monitoring is active
+    volatile uint8_t monitor_config_gen; // 监控配置代数, 变量集或采样率改变时递增 Monitor config generation, bumped when the variable set or rate changes
+#if ARESPLOT_ENABLE_RATE_LIMIT
+    uint32_t requested_rate_hz;    // 上位机请求的采样率 (0: 默认采样率), 监控布局改变时据此重新限制 Rate requested by the host (0: the default); limited afresh whenever the layout changes
+#endif
+
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+    // 采样调度 (相位累加器): 采样周期 = period_int + period_rem / period_den 个调度时基单位
+    // Sample scheduling (phase accumulator): period = period_int + period_rem / period_den scheduler ticks
+    uint32_t sched_period_int;     // 周期整数部分 Integer part of the period
+    uint32_t sched_period_rem;     // 周期小数部分的分子 Numerator of the fractional part
+    uint32_t sched_period_den;     // 周期小数部分的分母 Denominator of the fractional part
+    uint32_t sched_phase;          // 累积的小数部分 (0..period_den-1) Accumulated fraction (0..period_den-1)
+    uint32_t sched_period_ns;      // 名义采样周期 (纳秒) Nominal sampling period (ns)
+    uint32_t sched_next_tick;      // 下一次采样的截止时刻 Deadline of the next sample
+    uint8_t  sched_contiguous;     // 下一次采样是否紧接上一次 (未跳过截止时刻) Whether the next sample directly follows the last one (no deadline skipped)
+#endif
+
+#if ARESPLOT_ENABLE_ASYNC_TX
+    // 发送缓冲池 (用于 ACK, Monitor Data, Error Report), 按 FIFO 顺序使用: 组装 (write) -> 用户接受 (send) -> 发送完成 (done)
+    // Transmit buffer pool (for ACK, Monitor Data, Error Report), used in FIFO order: assembled (write) -> accepted (send) -> completed (done)
+    uint8_t  tx_pool[ARESPLOT_TX_BUFFER_COUNT][ARESPLOT_TX_CHUNK_SIZE];
+    uint16_t tx_pool_len[ARESPLOT_TX_BUFFER_COUNT]; // 各缓冲区中的帧长度 Frame length in each buffer
+    volatile uint8_t tx_write_count; // 已组装的帧数 (仅主循环写) Frames assembled (written by the main loop only)
+    volatile uint8_t tx_send_count;  // 已被用户接受的帧数 Frames accepted by the user
+    volatile uint8_t tx_done_count;  // 已发送完成的帧数 (仅 aresplot_tx_complete() 写) Frames completed (written by aresplot_tx_complete() only)
+    volatile uint8_t tx_pumping;     // 正在向用户提交帧, 防止重入 Handing frames to the user; guards against re-entry
+#if ARESPLOT_ENABLE_NOTIFY
+    volatile uint8_t tx_waiting;     // 有工作在等待空闲发送缓冲区, 发送完成时通知 Work waits for a free TX buffer; notify on completion
+#endif
+#else
+    // 发送组装缓冲区 (用于 ACK, Monitor Data, Error Report)
+    // Transmit assembly buffer (for ACK, Monitor Data, Error Report)
+    uint8_t tx_assembly_buffer[ARESPLOT_TX_CHUNK_SIZE];
+#endif
+    // 分块组帧状态 (仅主循环访问) Chunked frame assembly state (main loop only)
+    uint8_t* tx_chunk;          // 当前块的发送缓冲区 TX buffer of the current chunk
+    uint16_t tx_chunk_len;      // 当前块已写入的字节数 Bytes written to the current chunk
+    uint8_t  tx_frame_checksum; // 累积的校验和 Running checksum
+#if ARESPLOT_ENABLE_TX_COALESCE
+    uint8_t  tx_chunk_open;      // 当前块中有已结束的帧等待合并发送 Finished frames wait in the current chunk to be sent together
+    uint32_t tx_chunk_opened_ms; // 这些帧中最早一个结束的时刻 When the first of them was finished
+#endif
+
+    aresplot_ack_entry_t ack_queue[ARESPLOT_ACK_QUEUE_SIZE]; // 等待发送的ACK (先进先出) ACKs waiting to be sent (FIFO)
+    uint8_t ack_queue_head;           // 最早的ACK的索引 Index of the oldest ACK
+    volatile uint8_t ack_queue_count; // 等待发送的ACK数 Number of ACKs waiting to be sent
+    // 队列满时未执行命令的回复 (BUSY 或校验和错误), 队首发出后排到队尾; 仅在队列满时有效
+    // Reply to a command not executed while the queue was full (BUSY or a checksum error); it joins the tail once the
+    // head is sent. Only valid while the queue is full
+    uint8_t ack_overflow_cmd;
+    uint8_t ack_overflow_status;
+    uint8_t ack_overflow_tag;
+    volatile uint8_t ack_overflow_pending;
+
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+    // 批量帧累积状态 (仅在 aresplot_service_tick 上下文中访问, 复位请求除外)
+    // Batch accumulation state (only touched from aresplot_service_tick context, except the reset request)
+#if !ARESPLOT_ENABLE_LOW_RAM
+    uint8_t  batch_payload_buffer[ARESPLOT_BATCH_PAYLOAD_CAPACITY]; // 低 RAM 配置下位于发送缓冲区中 In the TX buffer in the low-RAM profile
+#endif
+    uint16_t batch_payload_len;     // 当前批量Payload长度 Current batch payload length
+    uint8_t  batch_sample_count;    // 当前批量中的采样数 Samples in the current batch
+    uint32_t batch_base_time_ms;    // 批量中第一个采样的时间戳 Timestamp of the first sample in the batch
+    uint8_t  batch_config_gen;      // 批量中采样所属的监控配置代数 Monitor config generation of the samples in the batch
+    uint8_t  batch_cmd;             // 批量帧的命令ID (普通或压缩) Command ID of the batch frame (plain or compressed)
+#endif
+
+#if ARESPLOT_ENABLE_SENDER_LAYOUT
+    // 发送端采样布局 (仅由发送端访问, 在监控配置改变后从已发布的采样计划复制)
+    // Sender-side sample layout (sender only; copied from the published plan after a config change)
+    uint8_t  layout_config_gen;     // 布局所属的监控配置代数 Monitor config generation of the layout
+    uint8_t  layout_options;        // 当前配置的 CMD_START_MONITOR 选项 CMD_START_MONITOR options of the current config
+    uint8_t  layout_num_values;     // 每个采样的值数量 Values per sample
+    uint8_t  layout_value_formats[ARESPLOT_MAX_WIRE_VALUES]; // 各值的宽度与压缩格式 Width and compressed format of each value
+#endif
+
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+    uint8_t  layout_dividers[ARESPLOT_MAX_VARS_TO_MONITOR];   // 各变量的分频系数 Divider of each variable
+    uint8_t  channel_countdown[ARESPLOT_MAX_VARS_TO_MONITOR]; // 各变量距下一次发送的采样数 (0: 本采样发送) Samples until each variable is sent next (0: in this sample)
+#endif
+
+#if ARESPLOT_ENABLE_COMPRESSION
+    // 压缩编码器状态 (仅由发送端访问) Compressed stream encoder state (sender side only)
+    uint8_t  codec_prev[ARESPLOT_MAX_SAMPLE_BYTES]; // 参考采样 (上一个编码的采样) Reference sample (the last one coded)
+    uint16_t codec_samples_since_key; // 距上一个关键帧的采样数 Samples since the last keyframe
+    uint8_t  codec_need_key;        // 下一帧必须是关键帧 (参考链已断开) The next frame must be a keyframe (the reference chain is broken)
+    uint8_t  codec_frame_seq;       // 下一个压缩帧的序号 Sequence number of the next compressed frame
+#endif
+
+#if ARESPLOT_ENABLE_SEQUENCE
+    uint8_t  stream_frame_seq;      // 下一个 CMD_MONITOR_DATA / CMD_MONITOR_DATA_BATCH 帧的序号 (仅发送端访问) Sequence number of the next CMD_MONITOR_DATA / CMD_MONITOR_DATA_BATCH frame (sender only)
+#endif
+
+#if ARESPLOT_ENABLE_ENVELOPE
+    // 包络窗口累加器 (中断采样时仅由 aresplot_sample_now() 访问, 否则仅由主循环访问)
+    // Envelope window accumulators (touched only by aresplot_sample_now() in ISR mode, by the main loop otherwise)
+    float    envelope_min[ARESPLOT_MAX_VARS_TO_MONITOR]; // 各变量的最小值 Minimum of each variable
+    float    envelope_max[ARESPLOT_MAX_VARS_TO_MONITOR]; // 各变量的最大值 Maximum of each variable
+    float    envelope_sum[ARESPLOT_MAX_VARS_TO_MONITOR]; // 各变量的总和 (用于平均值) Sum of each variable (for the mean)
+    uint32_t envelope_start_ms;     // 窗口第一个采样的时间戳 Timestamp of the window's first sample
+    uint16_t envelope_count;        // 窗口内已累加的采样数 Samples folded into the window so far
+    uint8_t  envelope_config_gen;   // 窗口所属的监控配置代数 Monitor config generation of the window
+    uint8_t  envelope_contiguous;   // 窗口是否紧接上一个窗口 Whether the window directly follows the previous one
+#endif
+
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+    // 单生产者 (aresplot_sample_now) / 单消费者 (aresplot_service_tick) 环形缓冲区, head/tail 为自由递增计数
+    // Single-producer (aresplot_sample_now) / single-consumer (aresplot_service_tick) ring; head/tail are free-running counters
+    aresplot_sample_slot_t sample_ring[ARESPLOT_SAMPLE_RING_SIZE];
+    volatile uint8_t sample_ring_head;   // 仅由生产者写 Written only by the producer
+    volatile uint8_t sample_ring_tail;   // 仅由消费者写 Written only by the consumer
+    volatile uint32_t isr_decimation;    // 每多少次调用采样一次 Take a sample every this many calls
+    volatile uint32_t isr_sample_period_ns; // 抽取后的采样周期 (纳秒) Sample period after decimation (ns)
+    uint32_t isr_call_count;             // 抽取计数 (仅中断内访问) Decimation counter (ISR only)
+    uint32_t isr_sample_seq;             // 最近一次采样的序号 (仅中断内访问) Sequence number of the latest sample (ISR only)
+    uint32_t ring_last_seq;              // 最近一次发送的采样序号 (仅消费者访问) Sequence number of the last sent sample (consumer only)
+#endif
+
+#if ARESPLOT_ENABLE_CAPTURE
+    // ARMED/TRIGGERED 状态下由采样端 (中断采样时为 aresplot_sample_now()) 独占, DONE 状态下由发送端独占
+    // Owned by the sampler (aresplot_sample_now() in ISR mode) while ARMED/TRIGGERED, and by the sender while DONE
+    uint8_t  capture_buffer[ARESPLOT_CAPTURE_BUFFER_SIZE];
+    volatile uint8_t capture_state;   // aresplot_capture_state_t
+    uint8_t  capture_config_gen;      // 布防时的监控配置代数, 配置改变即取消抓取 Monitor config generation at arming; a config change cancels the capture
+    uint8_t  capture_id;              // 抓取编号, 每次布防递增 Capture number, bumped on every arm
+    uint16_t capture_sample_bytes;    // 每个采样的字节数 Bytes per sample
+    uint16_t capture_capacity;        // 缓冲区可容纳的采样数 Samples the buffer can hold
+    uint16_t capture_write_slot;      // 下一个写入的槽位 Slot written next
+    uint16_t capture_filled;          // 有效采样数 (不超过容量) Valid samples (at most the capacity)
+    uint16_t capture_pre;             // 触发前采样数 Pre-trigger samples
+    uint16_t capture_total;           // 需发送的采样数 (触发前 + 1 + 触发后) Samples to send (pre + 1 + post)
+    uint16_t capture_post_left;       // 尚需采集的触发后采样数 Post-trigger samples still to take
+    uint16_t capture_trigger_slot;    // 触发采样所在槽位 Slot of the trigger sample
+    uint16_t capture_send_index;      // 已发送的采样数 Samples sent so far
+    uint32_t capture_trigger_time_ms; // 触发采样的时间戳 Timestamp of the trigger sample
+    uint32_t capture_period_ns;       // 抓取的采样周期 (纳秒) Capture sample period (ns)
+    uint8_t  capture_mode;            // ARESPLOT_CAPTURE_TRIGGER_* Trigger mode
+    uint8_t  capture_trigger_type;    // 触发变量在采样中的编码类型 Wire type of the trigger variable in the sample
+    uint8_t  capture_trigger_mask;    // BOOL 触发变量的位掩码 (打包时只有一位) Bit mask of a BOOL trigger variable (a single bit when packed)
+    uint16_t capture_trigger_offset;  // 触发变量在采样中的字节偏移 Byte offset of the trigger variable in the sample
+    float    capture_threshold;       // 触发阈值 Trigger threshold
+    float    capture_last_value;      // 上一个采样中触发变量的值 (用于边沿判断) Trigger variable in the previous sample (for edges)
+    uint8_t  capture_has_last;        // capture_last_value 是否有效 Whether capture_last_value is valid
+    uint8_t  capture_flags;           // 累积的 ARESPLOT_CAPTURE_FLAG_TIMING_GAPS Accumulated ARESPLOT_CAPTURE_FLAG_TIMING_GAPS
+#endif
+
+#if ARESPLOT_ENABLE_STATS
+    aresplot_stats_t stats;
+    uint32_t stats_reset_ms;           // 上次清零统计的时刻 When the statistics were last cleared
+    volatile uint8_t stats_pending;    // 是否有统计应答等待发送 Flag indicating if a statistics reply is pending
+    uint8_t  stats_reset_requested;    // 应答后清零统计 Clear the statistics after the reply
+#endif
+
+#if ARESPLOT_ENABLE_TIME_SYNC
+    volatile uint8_t time_sync_pending; // 是否有时间同步应答等待发送 Flag indicating if a time sync reply is pending
+    uint8_t  time_sync_token[ARESPLOT_TIME_SYNC_TOKEN_SIZE]; // 待返回的令牌 Token to echo
+    uint32_t time_sync_rx_tick;        // 收到请求时的时基 Tick at which the request was received
+    uint32_t time_last_tick;           // 上次应答的时基, 用于检测回绕 Tick of the last reply, for wrap detection
+    uint32_t time_epoch;               // 时基回绕次数 Number of tick wrap-arounds
+#endif
+
+#if ARESPLOT_ENABLE_ERROR_REPORT
+    // 错误报告发送相关
+    // Error report transmit related
+    volatile uint8_t error_report_pending; // 是否有错误报告等待发送
+    uint8_t  error_report_code_to_send;    // 要发送的错误码
+    char     error_report_msg_to_send[ARESPLOT_SHARED_BUFFER_SIZE - 7]; // 错误消息缓冲区 (最大可能长度)
+    uint8_t  error_report_msg_len_to_send; // 错误消息长度
+#endif
+} aresplot_ctx_t;
+
 // --- Aresplot 服务函数 API ---
 // --- Aresplot Service Function API ---
 
+// aresplot_service_tick() 的返回值: 在新的帧或通知到来前无事可做
+// Return value of aresplot_service_tick(): nothing to do until a new frame or notification arrives
+#define ARESPLOT_WAIT_FOREVER (0xFFFFFFFFU)
+
 /**
- * @brief 初始化 Aresplot 服务
- * Initializes the Aresplot service.
- * 应在系统启动时调用一次。
- * Should be called once at system startup.
+ * @brief 初始化一个 Aresplot 实例
+ * Initializes an Aresplot instance.
+ * 应在使用实例前调用一次。各实例完全独立, 可以分别在不同的核上、通过不同的链路运行。
+ * Should be called once before the instance is used. Instances are fully independent and may run on different cores over different links.
+ * @param ctx 实例 (由用户分配, 无需预先清零) The instance (allocated by the user; need not be zeroed).
+ * @param callbacks 实例的回调, 复制到实例中 The instance's callbacks, copied into the instance.
  */
-void aresplot_init(void);
+void aresplot_ctx_init(aresplot_ctx_t* ctx, const aresplot_callbacks_t* callbacks);
 
 /**
- * @brief 向 Aresplot 服务喂入一个从通信接口接收到的字节 (用于基于字节流的接收)
- * Feeds a byte received from the communication interface to the Aresplot service (for byte-stream based reception).
+ * @brief 向实例喂入一个从通信接口接收到的字节 (用于基于字节流的接收)
+ * Feeds a byte received from the communication interface to the instance (for byte-stream based reception).
  * 应在每次接收到一个字节时调用 (例如，在 UART RX 中断处理程序中，如果未使用DMA/packet-based interface)。
  * Should be called every time a byte is received (e.g., in UART RX interrupt handler if not using DMA/packet-based interface).
+ * @param ctx 实例 The instance.
  * @param byte 接收到的字节 The received byte.
  */
-void aresplot_rx_feed_byte(uint8_t byte);
+void aresplot_ctx_rx_feed_byte(aresplot_ctx_t* ctx, uint8_t byte);
 
 /**
- * @brief 向 Aresplot 服务喂入一个从通信接口接收到的数据包 (用于基于包的接收, 如DMA, USB)
- * Feeds a data packet received from the communication interface to the Aresplot service (for packet-based reception, e.g., DMA, USB).
+ * @brief 向实例喂入一个从通信接口接收到的数据包 (用于基于包的接收, 如DMA, USB)
+ * Feeds a data packet received from the communication interface to the instance (for packet-based reception, e.g., DMA, USB).
+ * @param ctx 实例 The instance.
  * @param data 指向接收到的数据包的指针 Pointer to the received data packet.
  * @param length 数据包的长度 Length of the data packet.
- * @note 此函数会迭代调用 aresplot_rx_feed_byte 来处理包内数据。
- * This function iterates through the packet and calls aresplot_rx_feed_byte for each byte.
+ * @note 帧头和帧尾逐字节经过与 aresplot_ctx_rx_feed_byte 相同的状态机; 寻找 SOP 和接收 Payload 则按块处理
+ * (块搜索, 一次拷贝, 按字计算校验和), 帧可以任意跨包。
+ * Frame headers and trailers go byte by byte through the same state machine as aresplot_ctx_rx_feed_byte; the SOP
+ * search and the payload are handled in blocks (block search, single copy, word-at-a-time checksum). Frames may
+ * span packets arbitrarily.
  */
-void aresplot_rx_feed_packet(const uint8_t* data, uint16_t length);
+void aresplot_ctx_rx_feed_packet(aresplot_ctx_t* ctx, const uint8_t* data, uint16_t length);
 
 
 /**
- * @brief Aresplot 服务的主处理函数/周期性任务
- * Main processing function / periodic task for the Aresplot service.
+ * @brief 实例的主处理函数/周期性任务
+ * Main processing function / periodic task of the instance.
  * 此函数负责发送挂起的ACK帧和定期的监控数据帧。
  * This function is responsible for sending pending ACK frames and periodic monitor data frames.
  * - 对于裸机系统: 应从主循环中定期调用，或者通过定时器中断标志触发调用。
@@ -154,99 +1096,462 @@ void aresplot_rx_feed_packet(const uint8_t* data, uint16_t length);
  * or triggered by a timer interrupt flag. Its calling frequency
  * should be faster than or equal to the data sending frequency.
  * - For RTOS systems: Can be the body of a low-priority task.
+ *
+ * 若启用 ARESPLOT_ENABLE_ISR_SAMPLING, 本函数不再采样, 只把 aresplot_ctx_sample_now() 采集的数据组帧发送。
+ * If ARESPLOT_ENABLE_ISR_SAMPLING is enabled, this function no longer samples; it only sends what aresplot_ctx_sample_now() captured.
+ *
+ * 也可以按返回值调度: 等待返回的时间 (或直到 notify 回调被调用) 后再次调用, 期间不会错过采样截止时刻。
+ * It can also be scheduled by its return value: call it again once the returned time has passed (or the notify
+ * callback fired); no sample deadline is missed meanwhile.
+ * @param ctx 实例 The instance.
+ * @return 距下一次需要调用的时间, 单位为采样调度时基 (毫秒, 启用 ARESPLOT_ENABLE_TICK_US 时为微秒)。0: 仍有工作, 应尽快再次调用;
+ * ARESPLOT_WAIT_FOREVER: 在新的帧或通知到来前无事可做。
+ * Time until the next call is needed, in sample scheduler ticks (ms, or us with ARESPLOT_ENABLE_TICK_US). 0: work
+ * remains, call again as soon as possible; ARESPLOT_WAIT_FOREVER: nothing to do until a new frame or notification arrives.
+ * @note 在 ARESPLOT_ENABLE_NOTIFY 为 0 时, 收到的命令不会唤醒调用者, 因此等待时间应设上限 (例如命令响应所能容忍的延迟)。
+ * 启用异步发送但未启用通知时, 等待空闲发送缓冲区的工作返回 0。
+ * With ARESPLOT_ENABLE_NOTIFY at 0 incoming commands do not wake the caller, so cap the wait (e.g. at the command
+ * latency you can tolerate). With async TX but no notifications, work waiting for a free TX buffer returns 0.
+ */
+uint32_t aresplot_ctx_service_tick(aresplot_ctx_t* ctx);
+
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+/**
+ * @brief 采集一次监控变量快照 (在硬件定时器中断中调用)
+ * Takes a snapshot of the monitored variables (call from a hardware timer ISR).
+ * 应以 ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ 的固定频率调用, 每 N 次调用 (由 CMD_SET_SAMPLE_RATE 决定) 采样一次。
+ * 快照写入单生产者/单消费者环形缓冲区, 由 aresplot_ctx_service_tick() 发送; 缓冲区满时丢弃该采样。
+ * Must be called at the fixed rate ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ; every N-th call (set by CMD_SET_SAMPLE_RATE)
+ * takes a sample. Snapshots go into a single-producer/single-consumer ring drained by aresplot_ctx_service_tick();
+ * the sample is dropped if the ring is full.
+ * @param ctx 实例 The instance.
+ * @note 本函数不调用 critical_enter 回调。要求 critical_enter 能屏蔽调用本函数的中断, 且 get_tick_ms 可在该中断中调用。
+ * 每个实例只能从一个中断上下文调用。
+ * This function does not call the critical_enter callback. critical_enter must mask the calling interrupt and
+ * get_tick_ms must be callable from it. Call from one interrupt context per instance only.
+ */
+void aresplot_ctx_sample_now(aresplot_ctx_t* ctx);
+#endif
+
+#if ARESPLOT_ENABLE_ASYNC_TX
+/**
+ * @brief 通知一个帧已发送完毕 (在 DMA 发送完成中断或回调中调用)
+ * Signals that one frame has been transmitted (call from the DMA TX-complete ISR or callback).
+ * 释放最早被接受的发送缓冲区, 并立即把下一个排队的帧交给 send_packet 回调, 使帧背靠背发送。
+ * Releases the oldest accepted TX buffer and immediately hands the next queued frame to the send_packet callback, so frames go out back to back.
+ * @param ctx 实例 The instance.
+ * @note 每个被接受的帧调用一次, 也可在 send_packet 回调内同步调用 (阻塞式发送)。本函数不调用 critical_enter 回调;
+ * 若在中断中调用, 要求 critical_enter 能屏蔽该中断。
+ * Call once per accepted frame; it may also be called synchronously from inside the send_packet callback (blocking send).
+ * This function does not call the critical_enter callback; if called from an ISR, critical_enter must mask that interrupt.
+ */
+void aresplot_ctx_tx_complete(aresplot_ctx_t* ctx);
+#endif
+
+#if ARESPLOT_ENABLE_TX_COALESCE
+/**
+ * @brief 立即发送合并中的未满数据包, 不等待 ARESPLOT_TX_COALESCE_MAX_LATENCY_MS
+ * Sends the partial packet being coalesced right away instead of waiting for ARESPLOT_TX_COALESCE_MAX_LATENCY_MS.
+ * @param ctx 实例 The instance.
+ * @note 与 aresplot_service_tick() 在同一上下文中调用, 例如进入低功耗模式或断开链路之前。
+ * Call from the same context as aresplot_service_tick(), e.g. before entering a low-power mode or closing the link.
  */
-void aresplot_service_tick(void);
+void aresplot_ctx_tx_flush(aresplot_ctx_t* ctx);
+#endif
 
 
 #if ARESPLOT_ENABLE_ERROR_REPORT
 /**
  * @brief (可选) 发送一个错误报告给上位机
  * (Optional) Sends an error report to the host PC.
+ * @param ctx 实例 The instance.
  * @param error_code 错误码 Error code.
  * @param message 可选的错误消息 (可以为 NULL) Optional error message (can be NULL).
  * @param msg_len 错误消息的长度 (如果 message 为 NULL, 则为 0) Length of the error message (0 if message is NULL).
  * @return 如果成功将错误报告加入发送队列则返回1, 否则返回0 (例如队列满)
  * Returns 1 if the error report was successfully queued for sending, 0 otherwise (e.g., queue full).
  */
-int aresplot_report_error(uint8_t error_code, const char* message, uint8_t msg_len);
+int aresplot_ctx_report_error(aresplot_ctx_t* ctx, uint8_t error_code, const char* message, uint8_t msg_len);
 #endif
 
+#if ARESPLOT_ENABLE_DEFAULT_INSTANCE
+// --- 默认实例 Default Instance ---
+// 以下函数在内置的默认实例上调用对应的 aresplot_ctx_* 函数, 默认实例的回调为 aresplot_user_* 函数。
+// Each function below calls the matching aresplot_ctx_* function on the built-in default instance, whose callbacks
+// are the aresplot_user_* functions.
+
+void aresplot_init(void);
+void aresplot_rx_feed_byte(uint8_t byte);
+void aresplot_rx_feed_packet(const uint8_t* data, uint16_t length);
+uint32_t aresplot_service_tick(void);
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+void aresplot_sample_now(void);
+#endif
+#if ARESPLOT_ENABLE_ASYNC_TX
+void aresplot_tx_complete(void);
+#endif
+#if ARESPLOT_ENABLE_TX_COALESCE
+void aresplot_tx_flush(void);
+#endif
+#if ARESPLOT_ENABLE_ERROR_REPORT
+int aresplot_report_error(uint8_t error_code, const char* message, uint8_t msg_len);
+#endif
+#endif
 #endif // ARESPLOT_MCU_H
 
 // aresplot_mcu.c
 
 #include "aresplot_mcu.h"
-#include <string.h> // For memcpy (如果不想用，可以手动实现 If not desired, can be implemented manually)
-
-// --- 内部状态变量 Internal State Variables ---
-
-// 接收状态机
-typedef enum {
-    ARES_RX_STATE_WAIT_SOP,
-    ARES_RX_STATE_WAIT_CMD,
-    ARES_RX_STATE_WAIT_LEN1,
-    ARES_RX_STATE_WAIT_LEN2,
-    ARES_RX_STATE_WAIT_PAYLOAD,
-    ARES_RX_STATE_WAIT_CHECKSUM,
-    ARES_RX_STATE_WAIT_EOP
-} aresplot_rx_state_t;
+#include <string.h> // For memcpy, memchr (如果不想用，可以手动实现 If not desired, can be implemented manually)
 
-static volatile aresplot_rx_state_t g_rx_state; // 当前接收状态 Current receive state
-static uint8_t  g_rx_payload_buffer[ARESPLOT_SHARED_BUFFER_SIZE]; // 接收缓冲区仅用于Payload Receive buffer for payload only
-static uint16_t g_rx_payload_len;      // 当前帧的Payload长度 Payload length of the current frame
-static uint16_t g_rx_payload_idx;      // 当前接收的Payload字节计数 Payload byte counter
-static uint8_t  g_rx_cmd;              // 当前帧的命令ID Command ID of the current frame
-static uint8_t  g_rx_checksum_calculated; // 计算出的校验和 Calculated checksum
-
-// 监控变量列表
-static aresplot_var_info_t g_monitor_vars[ARESPLOT_MAX_VARS_TO_MONITOR]; // 存储被监控变量信息的数组 Array to store monitored variable info
-static uint8_t g_num_monitor_vars;      // 当前正在监控的变量数量 Number of currently monitored variables
-static volatile uint8_t g_monitoring_active; // 监控是否激活标志 Flag indicating if monitoring is active
+// 协议地址到指针的转换, 主机仿真或需要地址重映射的目标可在编译时覆盖
+// Protocol address to pointer conversion; host simulation or targets that remap addresses may override it at compile time
+#ifndef ARESPLOT_ADDR_TO_PTR
+#define ARESPLOT_ADDR_TO_PTR(addr) ((void*)(uintptr_t)(addr))
+#endif
 
-// 数据发送定时
-static uint32_t g_sample_period_ms;     // 采样周期 (毫秒) Sampling period (ms)
-static uint32_t g_last_sample_time_ms;  // 上次采样时间戳 Last sample timestamp
+// 实例回调 Instance callbacks
+#define ARESPLOT_SEND_PACKET(ctx, data, length) ((ctx)->callbacks.send_packet((ctx)->callbacks.user, (data), (length)))
+#define ARESPLOT_GET_TICK_MS(ctx) ((ctx)->callbacks.get_tick_ms((ctx)->callbacks.user))
+#if ARESPLOT_ENABLE_TICK_US
+#define ARESPLOT_GET_TICK_US(ctx) ((ctx)->callbacks.get_tick_us((ctx)->callbacks.user))
+#endif
+#if ARESPLOT_ENABLE_STATS_CYCLES
+#define ARESPLOT_GET_CYCLES(ctx) ((ctx)->callbacks.get_cycles((ctx)->callbacks.user))
+#endif
+#define ARESPLOT_CRITICAL_ENTER(ctx) ((ctx)->callbacks.critical_enter((ctx)->callbacks.user))
+#define ARESPLOT_CRITICAL_EXIT(ctx) ((ctx)->callbacks.critical_exit((ctx)->callbacks.user))
+#if ARESPLOT_ENABLE_NOTIFY
+#define ARESPLOT_NOTIFY(ctx) ((ctx)->callbacks.notify((ctx)->callbacks.user))
+#else
+#define ARESPLOT_NOTIFY(ctx) ((void)(ctx))
+#endif
 
-// 发送组装缓冲区 (用于 ACK, Monitor Data, Error Report)
-// Transmit assembly buffer (for ACK, Monitor Data, Error Report)
-static uint8_t g_tx_assembly_buffer[ARESPLOT_SHARED_BUFFER_SIZE]; 
+// 采样调度时基频率 (Hz) Sample scheduler time base (Hz)
+#if ARESPLOT_ENABLE_TICK_US
+#define ARESPLOT_SCHED_TICK_HZ (1000000U)
+#else
+#define ARESPLOT_SCHED_TICK_HZ (1000U)
+#endif
 
-// ACK 发送相关
-// ACK transmit related
-static volatile uint8_t g_ack_pending; // 是否有ACK等待发送 Flag indicating if an ACK is pending
-static uint8_t  g_ack_cmd_to_ack;      // 要ACK的命令ID
-static aresplot_ack_status_t g_ack_status_to_send; // 要发送的ACK状态
+// 本实现支持的 CMD_START_MONITOR 选项 CMD_START_MONITOR options supported by this build
+#if ARESPLOT_ENABLE_RAW_ENCODING
+#define ARESPLOT_SUPPORTED_OPT_RAW (ARESPLOT_START_MONITOR_OPT_RAW_ENCODING)
+#else
+#define ARESPLOT_SUPPORTED_OPT_RAW (0)
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+#define ARESPLOT_SUPPORTED_OPT_COMPRESSION (ARESPLOT_START_MONITOR_OPT_COMPRESSION)
+#else
+#define ARESPLOT_SUPPORTED_OPT_COMPRESSION (0)
+#endif
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+#define ARESPLOT_SUPPORTED_OPT_CHANNEL_DIVIDERS (ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS)
+#else
+#define ARESPLOT_SUPPORTED_OPT_CHANNEL_DIVIDERS (0)
+#endif
+#if ARESPLOT_ENABLE_SEQUENCE
+#define ARESPLOT_SUPPORTED_OPT_SEQUENCE (ARESPLOT_START_MONITOR_OPT_SEQUENCE)
+#else
+#define ARESPLOT_SUPPORTED_OPT_SEQUENCE (0)
+#endif
+#if ARESPLOT_ENABLE_BLOCK_DESCRIPTORS
+#define ARESPLOT_SUPPORTED_OPT_BLOCK_DESCRIPTORS (ARESPLOT_START_MONITOR_OPT_BLOCK_DESCRIPTORS)
+#else
+#define ARESPLOT_SUPPORTED_OPT_BLOCK_DESCRIPTORS (0)
+#endif
+#if ARESPLOT_ENABLE_ENVELOPE
+#define ARESPLOT_SUPPORTED_OPT_ENVELOPE (ARESPLOT_START_MONITOR_OPT_ENVELOPE)
+#else
+#define ARESPLOT_SUPPORTED_OPT_ENVELOPE (0)
+#endif
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+#define ARESPLOT_SUPPORTED_OPT_PACKED_BOOLS (ARESPLOT_START_MONITOR_OPT_PACKED_BOOLS)
+#else
+#define ARESPLOT_SUPPORTED_OPT_PACKED_BOOLS (0)
+#endif
+#define ARESPLOT_SUPPORTED_START_MONITOR_OPTIONS (ARESPLOT_SUPPORTED_OPT_RAW | ARESPLOT_SUPPORTED_OPT_COMPRESSION | \
+                                                  ARESPLOT_SUPPORTED_OPT_CHANNEL_DIVIDERS | ARESPLOT_SUPPORTED_OPT_SEQUENCE | \
+                                                  ARESPLOT_SUPPORTED_OPT_BLOCK_DESCRIPTORS | ARESPLOT_SUPPORTED_OPT_ENVELOPE | \
+                                                  ARESPLOT_SUPPORTED_OPT_PACKED_BOOLS)
 
-#if ARESPLOT_ENABLE_ERROR_REPORT
-// 错误报告发送相关
-// Error report transmit related
-static volatile uint8_t g_error_report_pending; // 是否有错误报告等待发送
-static uint8_t  g_error_report_code_to_send;    // 要发送的错误码
-static char     g_error_report_msg_to_send[ARESPLOT_SHARED_BUFFER_SIZE - 7]; // 错误消息缓冲区 (最大可能长度)
-static uint8_t  g_error_report_msg_len_to_send; // 错误消息长度
+// 环形缓冲区的内存屏障。单核MCU上编译器屏障即可; 多核或带写缓冲的系统可在包含本文件前定义为 __DMB() 等。
+// Memory barrier for the ring buffer. A compiler barrier is enough on single-core MCUs; multi-core systems or
+// systems with write buffers can define it as __DMB() or similar before this point.
+#ifndef ARESPLOT_MEMORY_BARRIER
+#if defined(__GNUC__) || defined(__clang__)
+#define ARESPLOT_MEMORY_BARRIER() __asm__ volatile ("" ::: "memory")
+#else
+#define ARESPLOT_MEMORY_BARRIER() do { } while (0)
+#endif
+#endif
+
+// --- 内部状态变量 Internal State Variables ---
+
+#if ARESPLOT_ENABLE_CAPTURE
+// 触发抓取状态 Triggered capture state
+typedef enum {
+    ARES_CAPTURE_IDLE,      // 未布防 Not armed
+    ARES_CAPTURE_ARMED,     // 循环写入缓冲区并等待触发 Writing the buffer circularly, waiting for the trigger
+    ARES_CAPTURE_TRIGGERED, // 已触发, 正在采集触发后采样 Triggered, taking post-trigger samples
+    ARES_CAPTURE_DONE       // 缓冲区已冻结, 正在发送 Buffer frozen, being sent
+} aresplot_capture_state_t;
 #endif
 
 
 // --- 内部辅助函数 Internal Helper Functions ---
 
+#if ARESPLOT_ENABLE_LOW_RAM && ARESPLOT_MONITOR_BATCH_SIZE > 1
+static uint8_t flush_monitor_batch(aresplot_ctx_t* ctx);
+#endif
+
+#if ARESPLOT_ENABLE_ASYNC_TX
+/**
+ * @brief 把排队的帧按顺序交给 aresplot_user_send_packet(), 直到用户报告忙或队列为空
+ * Hands queued frames to aresplot_user_send_packet() in order until the user reports busy or the queue is empty.
+ * @note 主循环在临界区内调用, aresplot_tx_complete() 在被临界区屏蔽的上下文中调用, 因此不会并发执行。
+ * The main loop calls this inside a critical section and aresplot_tx_complete() runs in a context masked by it, so it never runs concurrently.
+ */
+static void tx_pump_queue(aresplot_ctx_t* ctx) {
+    if (ctx->tx_pumping) {
+        return; // 帧在 aresplot_user_send_packet() 内同步完成, 由外层循环继续 Completed synchronously inside the send callback; the outer loop carries on
+    }
+    ctx->tx_pumping = 1;
+    while (ctx->tx_send_count != ctx->tx_write_count) {
+        uint8_t slot = (uint8_t)(ctx->tx_send_count & (ARESPLOT_TX_BUFFER_COUNT - 1));
+        // 先标记为已接受, 使回调内同步调用的 aresplot_tx_complete() 能找到该帧
+        // Mark as accepted first so an aresplot_tx_complete() called synchronously from the callback finds this frame
+        ctx->tx_send_count = (uint8_t)(ctx->tx_send_count + 1);
+        if (!ARESPLOT_SEND_PACKET(ctx, ctx->tx_pool[slot], ctx->tx_pool_len[slot])) {
+            ctx->tx_send_count = (uint8_t)(ctx->tx_send_count - 1); // 忙: 帧保留在队列中 Busy: the frame stays queued
+            break;
+        }
+    }
+    ctx->tx_pumping = 0;
+}
+#endif
+
+/**
+ * @brief 获取用于组装下一帧的发送缓冲区
+ * Gets the TX buffer the next frame is assembled in.
+ * @return 缓冲区指针, 若缓冲池已满则返回 NULL Pointer to the buffer, or NULL if the pool is full.
+ */
+static uint8_t* tx_acquire_buffer(aresplot_ctx_t* ctx) {
+#if ARESPLOT_ENABLE_ASYNC_TX
+    if ((uint8_t)(ctx->tx_write_count - ctx->tx_done_count) >= ARESPLOT_TX_BUFFER_COUNT) {
+        return NULL; // 所有缓冲区都在排队或发送中 Every buffer is queued or in flight
+    }
+    return ctx->tx_pool[ctx->tx_write_count & (ARESPLOT_TX_BUFFER_COUNT - 1)];
+#else
+#if ARESPLOT_ENABLE_LOW_RAM && ARESPLOT_MONITOR_BATCH_SIZE > 1
+    (void)flush_monitor_batch(ctx); // 缓冲区中可能有未完成的批量 The buffer may hold a pending batch
+#endif
+    return ctx->tx_assembly_buffer;
+#endif
+}
+
 /**
- * @brief 计算帧校验和 (从CMD到PAYLOAD尾)
- * Calculates the frame checksum (from CMD to end of PAYLOAD).
+ * @brief 检查是否有空闲的发送缓冲区 (只有主循环占用缓冲区, 因此检查结果在组帧前一直有效)
+ * Checks whether a TX buffer is free (only the main loop claims buffers, so the result holds until the frame is assembled).
+ * @return 1: 有空闲缓冲区, 0: 无 1 if a buffer is free, 0 otherwise.
+ */
+static uint8_t tx_buffer_available(aresplot_ctx_t* ctx) {
+#if ARESPLOT_ENABLE_ASYNC_TX
+    return (uint8_t)(tx_acquire_buffer(ctx) != NULL);
+#else
+    (void)ctx;
+    return 1; // 同步发送时唯一的缓冲区总是空闲 (且检查可能在临界区内, 不得发送批量) The only buffer is always free with synchronous TX (and the check may run in a critical section, where no batch may be sent)
+#endif
+}
+
+/**
+ * @brief 交出当前块: 启用异步发送时进入发送队列, 否则直接发送
+ * Hands off the current chunk: queued with ARESPLOT_ENABLE_ASYNC_TX, sent directly otherwise.
+ */
+static void tx_flush_chunk(aresplot_ctx_t* ctx) {
+#if ARESPLOT_ENABLE_ASYNC_TX
+    ctx->tx_pool_len[ctx->tx_write_count & (ARESPLOT_TX_BUFFER_COUNT - 1)] = ctx->tx_chunk_len;
+    ARESPLOT_MEMORY_BARRIER(); // 先写完块再发布 Publish the chunk only after it is fully written
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    ctx->tx_write_count = (uint8_t)(ctx->tx_write_count + 1);
+    tx_pump_queue(ctx);
+    ARESPLOT_CRITICAL_EXIT(ctx);
+#else
+    ARESPLOT_SEND_PACKET(ctx, ctx->tx_chunk, ctx->tx_chunk_len);
+#endif
+    ctx->tx_chunk_len = 0;
+#if ARESPLOT_ENABLE_TX_COALESCE
+    ctx->tx_chunk_open = 0;
+#endif
+}
+
+/**
+ * @brief 向当前帧追加字节 (不计入校验和), 当前块写满时交出并换用下一个缓冲区
+ * Appends bytes to the current frame (not checksummed), handing off the chunk and moving to the next buffer when full.
+ * @param data 数据 Data.
+ * @param len 字节数 Number of bytes.
+ */
+static void tx_frame_append(aresplot_ctx_t* ctx, const uint8_t* data, uint16_t len) {
+    while (len > 0) {
+        uint16_t n;
+        if (ctx->tx_chunk_len == ARESPLOT_TX_CHUNK_SIZE) {
+            tx_flush_chunk(ctx);
+#if ARESPLOT_ENABLE_ASYNC_TX
+            ctx->tx_chunk = tx_acquire_buffer(ctx); // tx_frame_begin() 已确认缓冲区足够 tx_frame_begin() made sure enough buffers are free
+#else
+            // 同步发送时下一块复用同一缓冲区 (低 RAM 配置下其中不会有批量) With synchronous TX the next chunk reuses the same buffer (which holds no batch in the low-RAM profile)
+#endif
+        }
+        n = (uint16_t)(ARESPLOT_TX_CHUNK_SIZE - ctx->tx_chunk_len);
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&ctx->tx_chunk[ctx->tx_chunk_len], data, n);
+        ctx->tx_chunk_len = (uint16_t)(ctx->tx_chunk_len + n);
+        data += n;
+        len = (uint16_t)(len - n);
+    }
+}
+
+/**
+ * @brief 开始组装一帧: 写入 SOP, CMD, LEN 并初始化校验和
+ * Starts assembling a frame: writes SOP, CMD and LEN and seeds the checksum.
  * @param cmd 命令ID Command ID.
  * @param len Payload长度 Payload length.
- * @param payload 指向Payload数据的指针 Pointer to payload data.
- * @return 计算得到的校验和 Calculated checksum.
- */
-static uint8_t calculate_checksum(uint8_t cmd, uint16_t len, const uint8_t* payload) {
-    uint8_t checksum = 0;
-    checksum ^= cmd;
-    checksum ^= (uint8_t)(len & 0xFF);
-    checksum ^= (uint8_t)((len >> 8) & 0xFF);
+ * @return 1: 已开始, 0: 空闲发送缓冲区不足以容纳整帧 1 if started, 0 if too few TX buffers are free for the whole frame.
+ * @note 帧必须由 tx_frame_write() 写满 len 字节并由 tx_frame_end() 结束, 期间不得开始其他帧。
+ * The frame must be filled with exactly len bytes through tx_frame_write() and closed by tx_frame_end(), with no other frame started in between.
+ */
+static uint8_t tx_frame_begin(aresplot_ctx_t* ctx, uint8_t cmd, uint16_t len) {
+    uint8_t header[4];
+#if ARESPLOT_ENABLE_ASYNC_TX
+    // 合并发送时帧接在当前块已有的字节之后 With coalescing the frame follows the bytes already in the current chunk
+    uint32_t chunks = ((uint32_t)ctx->tx_chunk_len + len + 6 + ARESPLOT_TX_CHUNK_SIZE - 1) / ARESPLOT_TX_CHUNK_SIZE;
+    if (chunks > (uint8_t)(ARESPLOT_TX_BUFFER_COUNT - (uint8_t)(ctx->tx_write_count - ctx->tx_done_count))) {
+        return 0; // 整帧放不下, 由调用者保留该帧 The whole frame does not fit; the caller holds it back
+    }
+#endif
+    ctx->tx_chunk = tx_acquire_buffer(ctx);
+    if (ctx->tx_chunk == NULL) {
+        return 0; // 缓冲池已满, 由调用者保留该帧 Pool full; the caller holds the frame back
+    }
+#if !ARESPLOT_ENABLE_TX_COALESCE
+    ctx->tx_chunk_len = 0;
+#endif
+    header[0] = ARESPLOT_SOP;
+    header[1] = cmd;
+    header[2] = (uint8_t)(len & 0xFF);        // LEN (Little Endian)
+    header[3] = (uint8_t)((len >> 8) & 0xFF);
+    ctx->tx_frame_checksum = (uint8_t)(header[1] ^ header[2] ^ header[3]);
+    tx_frame_append(ctx, header, sizeof(header));
+    return 1;
+}
+
+/**
+ * @brief 向当前帧写入 Payload 字节并累积校验和
+ * Writes payload bytes to the current frame and accumulates the checksum.
+ * @param data Payload 数据 Payload data.
+ * @param len 字节数 Number of bytes.
+ */
+static void tx_frame_write(aresplot_ctx_t* ctx, const uint8_t* data, uint16_t len) {
+    for (uint16_t i = 0; i < len; ++i) {
+        ctx->tx_frame_checksum ^= data[i];
+    }
+    tx_frame_append(ctx, data, len);
+}
+
+/**
+ * @brief 写入 CHECKSUM 和 EOP 并交出最后一块 (合并发送时未写满的块留给后续的帧)
+ * Writes CHECKSUM and EOP and hands off the last chunk (with coalescing a partial chunk is left for the frames that follow).
+ */
+static void tx_frame_end(aresplot_ctx_t* ctx) {
+    uint8_t trailer[2];
+    trailer[0] = ctx->tx_frame_checksum;
+    trailer[1] = ARESPLOT_EOP;
+    tx_frame_append(ctx, trailer, sizeof(trailer));
+#if ARESPLOT_ENABLE_TX_COALESCE
+    if (ctx->tx_chunk_len < ARESPLOT_TX_CHUNK_SIZE) {
+        if (!ctx->tx_chunk_open) {
+            ctx->tx_chunk_open = 1;
+            ctx->tx_chunk_opened_ms = ARESPLOT_GET_TICK_MS(ctx);
+        }
+    } else {
+        tx_flush_chunk(ctx);
+    }
+#else
+    tx_flush_chunk(ctx);
+#endif
+#if ARESPLOT_ENABLE_STATS
+    ctx->stats.frames_sent++;
+#endif
+}
+
+#if ARESPLOT_ENABLE_TX_COALESCE
+/**
+ * @brief 块中最早的帧等待了 ARESPLOT_TX_COALESCE_MAX_LATENCY_MS 后交出未写满的块
+ * Hands off a partial chunk once its first frame has waited ARESPLOT_TX_COALESCE_MAX_LATENCY_MS.
+ */
+static void tx_coalesce_poll(aresplot_ctx_t* ctx) {
+    if (ctx->tx_chunk_open &&
+        (uint32_t)(ARESPLOT_GET_TICK_MS(ctx) - ctx->tx_chunk_opened_ms) >= ARESPLOT_TX_COALESCE_MAX_LATENCY_MS) {
+        tx_flush_chunk(ctx);
+    }
+}
+#endif
+
+#if ARESPLOT_MONITOR_FRAME_IN_PLACE || ARESPLOT_ENABLE_LOW_RAM
+/**
+ * @brief 在指定的发送缓冲区中开始一个原地组装的帧: 写入 SOP 与 CMD, Payload 由调用者直接写入
+ * Starts a frame assembled in place in the given TX buffer: writes SOP and CMD; the caller writes the payload directly.
+ * @param buffer 发送缓冲区 TX buffer.
+ * @param cmd 命令ID Command ID.
+ * @return Payload 的写入位置 Where the payload goes.
+ * @note 整帧须能放入一个发送缓冲区, 并由 tx_frame_end_in_place() 结束。
+ * The whole frame must fit in one TX buffer and be closed by tx_frame_end_in_place().
+ */
+static uint8_t* tx_frame_start_in_buffer(aresplot_ctx_t* ctx, uint8_t* buffer, uint8_t cmd) {
+    ctx->tx_chunk = buffer;
+    buffer[0] = ARESPLOT_SOP;
+    buffer[1] = cmd;
+    return &buffer[4];
+}
+
+#if ARESPLOT_MONITOR_FRAME_IN_PLACE && ARESPLOT_MONITOR_BATCH_SIZE <= 1 // 仅用于单采样数据帧 Only used for single-sample data frames
+/**
+ * @brief 在下一个发送缓冲区中开始一个原地组装的帧
+ * Starts a frame assembled in place in the next TX buffer.
+ * @param cmd 命令ID Command ID.
+ * @return Payload 的写入位置, 无空闲发送缓冲区时为 NULL Where the payload goes, or NULL if no TX buffer is free.
+ * @note 同 tx_frame_start_in_buffer(): 整帧须能放入一个发送缓冲区。 As for tx_frame_start_in_buffer(): the whole frame must fit in one TX buffer.
+ */
+static uint8_t* tx_frame_begin_in_place(aresplot_ctx_t* ctx, uint8_t cmd) {
+    uint8_t* buffer = tx_acquire_buffer(ctx);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    return tx_frame_start_in_buffer(ctx, buffer, cmd);
+}
+#endif
+
+/**
+ * @brief 结束原地组装的帧: 写入 LEN, 计算校验和并交出
+ * Closes a frame assembled in place: writes LEN, computes the checksum and hands the frame off.
+ * @param len 已写入的 Payload 长度 Payload length written.
+ */
+static void tx_frame_end_in_place(aresplot_ctx_t* ctx, uint16_t len) {
+    uint8_t* buffer = ctx->tx_chunk;
+    uint8_t checksum;
+    buffer[2] = (uint8_t)(len & 0xFF);        // LEN (Little Endian)
+    buffer[3] = (uint8_t)((len >> 8) & 0xFF);
+    checksum = (uint8_t)(buffer[1] ^ buffer[2] ^ buffer[3]);
     for (uint16_t i = 0; i < len; ++i) {
-        checksum ^= payload[i];
+        checksum ^= buffer[4 + i];
     }
-    return checksum;
+    ctx->tx_frame_checksum = checksum;
+    ctx->tx_chunk_len = (uint16_t)(4 + len);
+    tx_frame_end(ctx);
 }
+#endif
 
 /**
  * @brief 组装并发送一个完整的帧 (通过 aresplot_user_send_packet)
@@ -254,456 +1559,3085 @@ static uint8_t calculate_checksum(uint8_t cmd, uint16_t len, const uint8_t* payl
  * @param cmd 命令ID Command ID.
  * @param payload 指向Payload数据的指针 (可以为NULL如果len为0) Pointer to payload data (can be NULL if len is 0).
  * @param len Payload长度 Payload length.
- * @note 此函数内部使用全局的 g_tx_assembly_buffer 进行帧组装。
- * This function uses the global g_tx_assembly_buffer for frame assembly internally.
- * 调用此函数前应确保 g_tx_assembly_buffer 未被其他发送操作占用 (通过 pending 标志等机制)。
- * Ensure g_tx_assembly_buffer is not in use by other send operations before calling (e.g. via pending flags).
- */
-static void assemble_and_send_frame_internal(uint8_t cmd, const uint8_t* payload, uint16_t len) {
-    uint16_t frame_idx = 0;
-    uint16_t total_frame_len = 1 + 1 + 2 + len + 1 + 1; // SOP+CMD+LEN+Payload+CS+EOP
-
-    if (total_frame_len > ARESPLOT_SHARED_BUFFER_SIZE) {
-        // 帧太大无法组装，这通常不应发生如果 ARESPLOT_SHARED_BUFFER_SIZE 设置正确
-        // Frame too large to assemble, should not happen if ARESPLOT_SHARED_BUFFER_SIZE is set correctly
-        return; 
-    }
-
-    // 1. SOP
-    g_tx_assembly_buffer[frame_idx++] = ARESPLOT_SOP;
-    // 2. CMD
-    g_tx_assembly_buffer[frame_idx++] = cmd;
-    // 3. LEN (Little Endian)
-    g_tx_assembly_buffer[frame_idx++] = (uint8_t)(len & 0xFF);
-    g_tx_assembly_buffer[frame_idx++] = (uint8_t)((len >> 8) & 0xFF);
-    // 4. PAYLOAD
+ * @return 1: 帧已发送或已排队, 0: 无空闲发送缓冲区 1 if the frame was sent or queued, 0 if no TX buffer is free.
+ * @note 帧直接在 tx_acquire_buffer() 返回的缓冲区中组装, 超过 ARESPLOT_SHARED_BUFFER_SIZE 时分块。启用 ARESPLOT_ENABLE_ASYNC_TX 时
+ * 各块进入发送队列, 否则 tx_assembly_buffer 在 aresplot_user_send_packet() 返回后即被复用。
+ * The frame is assembled directly in the buffer returned by tx_acquire_buffer(), in chunks when it exceeds ARESPLOT_SHARED_BUFFER_SIZE.
+ * With ARESPLOT_ENABLE_ASYNC_TX the chunks join the TX queue; otherwise tx_assembly_buffer is reused as soon as
+ * aresplot_user_send_packet() returns.
+ */
+static uint8_t assemble_and_send_frame_internal(aresplot_ctx_t* ctx, uint8_t cmd, const uint8_t* payload, uint16_t len) {
+    if (!tx_frame_begin(ctx, cmd, len)) {
+        return 0;
+    }
     if (payload && len > 0) {
-        memcpy(&g_tx_assembly_buffer[frame_idx], payload, len);
-        frame_idx += len;
+        tx_frame_write(ctx, payload, len);
     }
-    // 5. CHECKSUM
-    g_tx_assembly_buffer[frame_idx++] = calculate_checksum(cmd, len, payload);
-    // 6. EOP
-    g_tx_assembly_buffer[frame_idx++] = ARESPLOT_EOP;
-
-    aresplot_user_send_packet(g_tx_assembly_buffer, frame_idx);
+    tx_frame_end(ctx);
+    return 1;
 }
 
 
 /**
- * @brief 标记一个ACK响应等待发送 (实际发送在 aresplot_service_tick 中完成)
- * Flags an ACK response to be sent (actual sending happens in aresplot_service_tick).
+ * @brief 将一个附带附加数据的ACK放入队列等待发送 (实际发送在 aresplot_service_tick 中完成)
+ * Queues an ACK with extra data after the status (actual sending happens in aresplot_service_tick).
+ * 当前帧带标签时, ACK 同样带上该标签。队列已满时只有未执行的命令会到这里 (BUSY、校验和错误或应答帧命令的参数错误),
+ * 其回复 (不含附加数据) 放入溢出槽, 已执行命令的 ACK 不会被覆盖。
+ * When the current frame is tagged the ACK carries the same tag. Only commands that were not executed get here while the
+ * queue is full (BUSY, a checksum error, or an invalid payload of a reply-frame command); their reply (without extra
+ * data) goes to the overflow slot, so no executed command loses its ACK.
  * @param ack_cmd_id 被ACK的命令ID The command ID being ACKed.
  * @param status ACK状态码 ACK status code.
+ * @param extra 附加数据 Extra data.
+ * @param extra_len 附加数据字节数 (不超过 ARESPLOT_ACK_EXTRA_MAX) Bytes of extra data (at most ARESPLOT_ACK_EXTRA_MAX).
  */
-static void queue_ack_response(uint8_t ack_cmd_id, aresplot_ack_status_t status) {
-    aresplot_user_critical_enter();
-    // 如果有其他发送操作正在等待 (例如错误报告)，ACK可以优先，或者简单覆盖/排队
-    // For simplicity, if another ACK is pending, this new one overwrites it.
-    g_ack_cmd_to_ack = ack_cmd_id;
-    g_ack_status_to_send = status;
-    g_ack_pending = 1;
-    aresplot_user_critical_exit();
+static void queue_ack_response_extra(aresplot_ctx_t* ctx, uint8_t ack_cmd_id, aresplot_ack_status_t status, const uint8_t* extra, uint8_t extra_len) {
+    aresplot_ack_entry_t* entry;
+    uint8_t count;
+
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    count = ctx->ack_queue_count;
+    if (count >= ARESPLOT_ACK_QUEUE_SIZE) {
+#if ARESPLOT_ENABLE_STATS
+        if (ctx->ack_overflow_pending) {
+            ctx->stats.acks_overwritten++; // 溢出槽中较早的回复丢失 The older reply in the overflow slot is lost
+        }
+#endif
+        ctx->ack_overflow_cmd = ack_cmd_id;
+        ctx->ack_overflow_status = (uint8_t)status;
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+        if (ctx->rx_tagged) {
+            ctx->ack_overflow_cmd |= ARESPLOT_CMD_FLAG_TAGGED;
+            ctx->ack_overflow_tag = ctx->rx_tag;
+        }
+#endif
+        ctx->ack_overflow_pending = 1;
+        ARESPLOT_CRITICAL_EXIT(ctx);
+        ARESPLOT_NOTIFY(ctx);
+        return;
+    }
+    entry = &ctx->ack_queue[(ctx->ack_queue_head + count) % ARESPLOT_ACK_QUEUE_SIZE];
+    entry->cmd = ack_cmd_id;
+    entry->status = (uint8_t)status;
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+    if (ctx->rx_tagged) {
+        entry->cmd |= ARESPLOT_CMD_FLAG_TAGGED;
+        entry->tag = ctx->rx_tag;
+    }
+#endif
+    if (extra_len > 0) {
+        memcpy(entry->extra, extra, extra_len);
+    }
+    entry->extra_len = extra_len;
+    ctx->ack_queue_count = (uint8_t)(count + 1);
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    ARESPLOT_NOTIFY(ctx);
 }
 
+/**
+ * @brief 将一个ACK响应放入队列等待发送
+ * Queues an ACK response to be sent.
+ * @param ack_cmd_id 被ACK的命令ID The command ID being ACKed.
+ * @param status ACK状态码 ACK status code.
+ */
+static void queue_ack_response(aresplot_ctx_t* ctx, uint8_t ack_cmd_id, aresplot_ack_status_t status) {
+    queue_ack_response_extra(ctx, ack_cmd_id, status, NULL, 0);
+}
 
 /**
- * @brief 处理接收到的 CMD_START_MONITOR 命令
- * Processes a received CMD_START_MONITOR command.
+ * @brief 将一个附带实际采样率的ACK放入队列 (CMD_SET_SAMPLE_RATE, 或启用速率限制时的 CMD_START_MONITOR)
+ * Queues an ACK that carries the achieved sample rate (CMD_SET_SAMPLE_RATE, or CMD_START_MONITOR with rate limiting).
+ * @param ack_cmd_id 被ACK的命令ID The command ID being ACKed.
+ * @param status ACK状态码 ACK status code.
+ * @param achieved_rate_hz 实际采样率 (Hz) Achieved sample rate (Hz).
  */
-static void handle_cmd_start_monitor(void) {
-    uint8_t num_vars_requested = g_rx_payload_buffer[0]; // Payload的第一个字节是NumVariables
-    aresplot_ack_status_t status = ARES_STATUS_OK;
+static void queue_sample_rate_ack_response(aresplot_ctx_t* ctx, uint8_t ack_cmd_id, aresplot_ack_status_t status, float achieved_rate_hz) {
+    uint8_t rate[sizeof(float)];
+    memcpy(rate, &achieved_rate_hz, sizeof(rate)); // 实际采样率 FP32 Achieved rate as FP32
+    queue_ack_response_extra(ctx, ack_cmd_id, status, rate, sizeof(rate));
+}
 
-    aresplot_user_critical_enter(); 
-    g_monitoring_active = 0; 
-    g_num_monitor_vars = 0;
+#if ARESPLOT_ENABLE_STATS
+/**
+ * @brief 清零运行统计 (调用者负责临界区)
+ * Clears the runtime statistics (caller handles the critical section).
+ * @param now_ms 当前时间戳 (毫秒), 作为新统计窗口的起点 Current timestamp (ms), the start of the new statistics window.
+ */
+static void stats_reset(aresplot_ctx_t* ctx, uint32_t now_ms) {
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->stats_reset_ms = now_ms;
+}
 
-    if (num_vars_requested == 0) {
-        status = ARES_STATUS_OK;
-    } else if (num_vars_requested > ARESPLOT_MAX_VARS_TO_MONITOR) {
-        status = ARES_STATUS_ERROR_MCU_BUSY_OR_LIMIT; 
-    } else {
-        if (g_rx_payload_len != (1 + num_vars_requested * 5)) {
-            status = ARES_STATUS_ERROR_INVALID_PAYLOAD;
-        } else {
-            g_num_monitor_vars = num_vars_requested;
-            for (uint8_t i = 0; i < g_num_monitor_vars; ++i) {
-                uint8_t* p_var_info_payload = &g_rx_payload_buffer[1 + i * 5];
-                
-                uint32_t temp_addr = (uint32_t)p_var_info_payload[0] |
-                                    ((uint32_t)p_var_info_payload[1] << 8) |
-                                    ((uint32_t)p_var_info_payload[2] << 16) |
-                                    ((uint32_t)p_var_info_payload[3] << 24);
-                g_monitor_vars[i].ptr = (void*)temp_addr;
-                g_monitor_vars[i].type = (aresplot_original_type_t)p_var_info_payload[4];
-            }
-            g_monitoring_active = 1;
-            g_last_sample_time_ms = aresplot_user_get_tick_ms(); 
-            status = ARES_STATUS_OK;
-        }
+#if ARESPLOT_ENABLE_STATS_CYCLES
+/**
+ * @brief 记录一次函数调用的周期数
+ * Records the cycles of one function call.
+ * @param stats 该函数的周期统计 Cycle statistics of the function.
+ * @param cycles 本次调用的周期数 Cycles of this call.
+ */
+static void stats_record_cycles(aresplot_cycle_stats_t* stats, uint32_t cycles) {
+    if (stats->count == 0 || cycles < stats->min) {
+        stats->min = cycles;
     }
-    aresplot_user_critical_exit();
-    queue_ack_response(ARESPLOT_CMD_START_MONITOR, status);
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+    stats->sum += cycles;
+    stats->count++;
 }
+#endif
 
 /**
- * @brief 处理接收到的 CMD_SET_VARIABLE 命令
- * Processes a received CMD_SET_VARIABLE command.
+ * @brief 以小端序写入 32 位整数
+ * Writes a 32-bit integer in little-endian order.
+ * @param out 目标 Destination.
+ * @param value 数值 Value.
+ * @return 下一个写入位置 Next write position.
  */
-static void handle_cmd_set_variable(void) {
-    if (g_rx_payload_len != 9) {
-        queue_ack_response(ARESPLOT_CMD_SET_VARIABLE, ARES_STATUS_ERROR_INVALID_PAYLOAD);
-        return;
-    }
+static uint8_t* stats_put_u32(uint8_t* out, uint32_t value) {
+    out[0] = (uint8_t)(value & 0xFF);
+    out[1] = (uint8_t)((value >> 8) & 0xFF);
+    out[2] = (uint8_t)((value >> 16) & 0xFF);
+    out[3] = (uint8_t)((value >> 24) & 0xFF);
+    return out + 4;
+}
 
-    void* addr;
-    aresplot_original_type_t original_type;
-    float float_val;
-    uint8_t* p_payload = g_rx_payload_buffer; 
+#if ARESPLOT_ENABLE_STATS_CYCLES
+/**
+ * @brief 写入一个函数的 Calls/Min/Avg/Max 周期统计
+ * Writes the Calls/Min/Avg/Max cycle statistics of one function.
+ * @param out 目标 Destination.
+ * @param stats 周期统计 Cycle statistics.
+ * @return 下一个写入位置 Next write position.
+ */
+static uint8_t* stats_put_cycles(uint8_t* out, const aresplot_cycle_stats_t* stats) {
+    out = stats_put_u32(out, stats->count);
+    out = stats_put_u32(out, stats->min);
+    out = stats_put_u32(out, stats->count ? (uint32_t)(stats->sum / stats->count) : 0);
+    return stats_put_u32(out, stats->max);
+}
+#endif
 
-    uint32_t temp_addr = (uint32_t)p_payload[0] |
-                        ((uint32_t)p_payload[1] << 8) |
-                        ((uint32_t)p_payload[2] << 16) |
-                        ((uint32_t)p_payload[3] << 24);
-    addr = (void*)temp_addr;
+/**
+ * @brief 发送 CMD_STATS 应答, 成功后按请求清零统计
+ * Sends the CMD_STATS reply and, once it is out, clears the statistics if requested.
+ * @note 无空闲发送缓冲区时应答保持挂起, 下次调用重试。
+ * The reply stays pending while no TX buffer is free and is retried on the next call.
+ */
+static void send_stats_frame(aresplot_ctx_t* ctx) {
+    uint8_t payload[ARESPLOT_STATS_PAYLOAD_SIZE];
+    uint8_t* out = payload;
+    aresplot_stats_t snapshot;
+    uint32_t now_ms = ARESPLOT_GET_TICK_MS(ctx);
 
-    original_type = (aresplot_original_type_t)p_payload[4];
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    snapshot = ctx->stats; // 接收计数在中断中递增, 整体拷贝以保持一致 RX counters change in the ISR; copy them as a whole to stay consistent
+    ARESPLOT_CRITICAL_EXIT(ctx);
 
-    uint8_t temp_float_bytes[4];
-    temp_float_bytes[0] = p_payload[5];
-    temp_float_bytes[1] = p_payload[6];
-    temp_float_bytes[2] = p_payload[7];
-    temp_float_bytes[3] = p_payload[8];
-    memcpy(&float_val, temp_float_bytes, sizeof(float));
+    *out++ = ARESPLOT_ENABLE_STATS_CYCLES ? ARESPLOT_STATS_FLAG_CYCLES : 0;
+    out = stats_put_u32(out, now_ms - ctx->stats_reset_ms);
+    out = stats_put_u32(out, snapshot.frames_sent);
+    out = stats_put_u32(out, snapshot.samples_dropped);
+    out = stats_put_u32(out, snapshot.acks_overwritten);
+    out = stats_put_u32(out, snapshot.rx_checksum_errors);
+    out = stats_put_u32(out, snapshot.deadline_overruns);
+    out = stats_put_u32(out, (uint32_t)(ARESPLOT_STATS_CYCLE_COUNTER_HZ));
+#if ARESPLOT_ENABLE_STATS_CYCLES
+    out = stats_put_cycles(out, &snapshot.tick_cycles);
+    out = stats_put_cycles(out, &snapshot.rx_cycles);
+#else
+    memset(out, 0, 2 * 16);
+#endif
 
-    aresplot_user_critical_enter(); 
-    switch (original_type) {
-        case ARES_TYPE_INT8:    *(volatile int8_t*)addr = (int8_t)float_val; break;
-        case ARES_TYPE_UINT8:   *(volatile uint8_t*)addr = (uint8_t)float_val; break;
-        case ARES_TYPE_INT16:   *(volatile int16_t*)addr = (int16_t)float_val; break;
-        case ARES_TYPE_UINT16:  *(volatile uint16_t*)addr = (uint16_t)float_val; break;
-        case ARES_TYPE_INT32:   *(volatile int32_t*)addr = (int32_t)float_val; break;
-        case ARES_TYPE_UINT32:  *(volatile uint32_t*)addr = (uint32_t)float_val; break;
-        case ARES_TYPE_FLOAT32: *(volatile float*)addr = float_val; break;
-        case ARES_TYPE_BOOL:    *(volatile uint8_t*)addr = (float_val != 0.0f) ? 1 : 0; break;
-        default:
-            aresplot_user_critical_exit();
-            queue_ack_response(ARESPLOT_CMD_SET_VARIABLE, ARES_STATUS_ERROR_TYPE_UNSUPPORTED);
-            return;
+    if (!assemble_and_send_frame_internal(ctx, ARESPLOT_CMD_STATS, payload, sizeof(payload))) {
+        return;
     }
-    aresplot_user_critical_exit();
-    queue_ack_response(ARESPLOT_CMD_SET_VARIABLE, ARES_STATUS_OK);
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    ctx->stats_pending = 0;
+    if (ctx->stats_reset_requested) {
+        stats_reset(ctx, now_ms);
+    }
+    ARESPLOT_CRITICAL_EXIT(ctx);
 }
+#endif
 
+#if ARESPLOT_ENABLE_TIME_SYNC
 /**
- * @brief 处理接收到的 CMD_SET_SAMPLE_RATE 命令
- * Processes a received CMD_SET_SAMPLE_RATE command.
+ * @brief 读取时间同步所用的时基 (微秒或毫秒)
+ * Reads the time base used for time synchronization (microseconds or milliseconds).
  */
-static void handle_cmd_set_sample_rate(void) {
-    if (g_rx_payload_len != 4) {
-        queue_ack_response(ARESPLOT_CMD_SET_SAMPLE_RATE, ARES_STATUS_ERROR_INVALID_PAYLOAD);
-        return;
-    }
+static uint32_t time_sync_get_tick(aresplot_ctx_t* ctx) {
+#if ARESPLOT_ENABLE_TICK_US
+    return ARESPLOT_GET_TICK_US(ctx);
+#else
+    return ARESPLOT_GET_TICK_MS(ctx);
+#endif
+}
 
-    uint32_t rate_hz;
-    uint8_t* p_payload = g_rx_payload_buffer; 
+/**
+ * @brief 发送 CMD_TIME_SYNC_REPLY 应答
+ * Sends the CMD_TIME_SYNC_REPLY reply.
+ * @note 32 位时基在这里扩展为 64 位, 两次同步请求的间隔须小于一个回绕周期 (毫秒时基约 49 天, 微秒时基约 71 分钟)。
+ * 无空闲发送缓冲区时应答保持挂起, 下次调用重试, TxTick 随之更新。
+ * The 32-bit tick is extended to 64 bits here, so consecutive sync requests must be less than one wrap period apart
+ * (about 49 days on the ms tick, about 71 minutes on the us tick). The reply stays pending while no TX buffer is free
+ * and is retried on the next call, with a fresh TxTick.
+ */
+static void send_time_sync_reply(aresplot_ctx_t* ctx) {
+    uint8_t payload[ARESPLOT_TIME_SYNC_REPLY_SIZE];
+    uint8_t* out = payload;
+    uint32_t rx_tick;
+    uint32_t tx_tick;
+    uint32_t tx_tick_ms;
+    uint32_t words[4];
+    uint8_t i;
 
-    rate_hz = (uint32_t)p_payload[0] |
-              ((uint32_t)p_payload[1] << 8) |
-              ((uint32_t)p_payload[2] << 16) |
-              ((uint32_t)p_payload[3] << 24);
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    memcpy(out, ctx->time_sync_token, ARESPLOT_TIME_SYNC_TOKEN_SIZE); // 令牌与时刻在中断中写入 Written in the ISR
+    rx_tick = ctx->time_sync_rx_tick;
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    out += ARESPLOT_TIME_SYNC_TOKEN_SIZE;
+    tx_tick = time_sync_get_tick(ctx);
+    tx_tick_ms = ARESPLOT_GET_TICK_MS(ctx);
 
-    aresplot_user_critical_enter();
-    if (rate_hz == 0) { 
-        g_sample_period_ms = ARESPLOT_DEFAULT_SAMPLE_PERIOD_MS;
-    } else {
-        uint32_t period_ms = 1000 / rate_hz;
-        if (period_ms == 0 && rate_hz !=0 ) period_ms = 1; 
-        g_sample_period_ms = period_ms;
+    if (tx_tick < ctx->time_last_tick) {
+        ctx->time_epoch++;
+    }
+    ctx->time_last_tick = tx_tick;
+
+    *out++ = ARESPLOT_ENABLE_TICK_US ? ARESPLOT_TIME_SYNC_FLAG_TICK_US : 0;
+    words[0] = tx_tick;
+    words[1] = ctx->time_epoch;
+    words[2] = tx_tick - rx_tick; // 请求在 MCU 内的停留时间 How long the request waited on the MCU
+    words[3] = tx_tick_ms;
+    for (i = 0; i < 4 * 4; i++) {
+        out[i] = (uint8_t)(words[i / 4] >> (8 * (i % 4)));
     }
-    g_last_sample_time_ms = aresplot_user_get_tick_ms(); 
-    aresplot_user_critical_exit();
 
-    queue_ack_response(ARESPLOT_CMD_SET_SAMPLE_RATE, ARES_STATUS_OK);
+    if (!assemble_and_send_frame_internal(ctx, ARESPLOT_CMD_TIME_SYNC_REPLY, payload, sizeof(payload))) {
+        return;
+    }
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    ctx->time_sync_pending = 0;
+    ARESPLOT_CRITICAL_EXIT(ctx);
 }
+#endif
 
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+/**
+ * @brief 读取采样调度时基
+ * Reads the sample scheduler time base.
+ */
+static uint32_t sched_get_tick(aresplot_ctx_t* ctx) {
+#if ARESPLOT_ENABLE_TICK_US
+    return ARESPLOT_GET_TICK_US(ctx);
+#else
+    return ARESPLOT_GET_TICK_MS(ctx);
+#endif
+}
 
 /**
- * @brief 处理一个完整的、校验通过的帧
- * Processes a complete, checksum-verified frame.
+ * @brief 从当前时刻重新开始采样调度 (调用者负责临界区)
+ * Restarts the sample schedule from now (caller handles the critical section).
  */
-static void process_received_frame(void) {
-    switch (g_rx_cmd) {
-        case ARESPLOT_CMD_START_MONITOR:
-            handle_cmd_start_monitor();
-            break;
-        case ARESPLOT_CMD_SET_VARIABLE:
-            handle_cmd_set_variable();
-            break;
-        case ARESPLOT_CMD_SET_SAMPLE_RATE:
-            handle_cmd_set_sample_rate();
-            break;
-        default:
-            queue_ack_response(g_rx_cmd, ARES_STATUS_ERROR_UNKNOWN_CMD);
-            break;
-    }
+static void restart_sample_schedule(aresplot_ctx_t* ctx) {
+    ctx->sched_phase = 0;
+    ctx->sched_next_tick = sched_get_tick(ctx) + ctx->sched_period_int;
+    ctx->sched_contiguous = 0;
 }
 
-// --- 公共 API 函数实现 Public API Function Implementations ---
+/**
+ * @brief 设置采样周期为 num / den 个调度时基单位 (调用者负责临界区)
+ * Sets the sampling period to num / den scheduler ticks (caller handles the critical section).
+ * @param num 周期分子 Period numerator.
+ * @param den 周期分母, 且 num >= den Period denominator, with num >= den.
+ */
+static void set_sample_schedule(aresplot_ctx_t* ctx, uint32_t num, uint32_t den) {
+    const uint32_t ns_per_tick = 1000000000U / ARESPLOT_SCHED_TICK_HZ;
+    ctx->sched_period_int = num / den;
+    ctx->sched_period_rem = num % den;
+    ctx->sched_period_den = den;
+    ctx->sched_period_ns = (num > 0xFFFFFFFFU / ns_per_tick) ? 0xFFFFFFFFU : (ns_per_tick * num) / den;
+    restart_sample_schedule(ctx);
+}
 
-void aresplot_init(void) {
-    g_rx_state = ARES_RX_STATE_WAIT_SOP;
-    g_num_monitor_vars = 0;
-    g_monitoring_active = 0;
-    g_sample_period_ms = ARESPLOT_DEFAULT_SAMPLE_PERIOD_MS;
-    g_last_sample_time_ms = 0; 
-    g_ack_pending = 0;
-#if ARESPLOT_ENABLE_ERROR_REPORT
-    g_error_report_pending = 0;
-#endif
+/**
+ * @brief 采样后推进到下一个截止时刻 (调用者负责临界区)
+ * Advances to the next deadline after a sample (caller handles the critical section).
+ * @param now 当前调度时基 Current scheduler tick.
+ * @note 截止时刻按名义周期累加, 调用延迟不会累积为频率误差; 落后超过一个周期时跳过错过的采样而不是连续补采。
+ * Deadlines advance by the nominal period, so call latency never accumulates into a rate error; when more than
+ * one period behind, the missed samples are skipped rather than taken back to back.
+ */
+static void advance_sample_schedule(aresplot_ctx_t* ctx, uint32_t now) {
+    ctx->sched_next_tick += ctx->sched_period_int;
+    ctx->sched_phase += ctx->sched_period_rem;
+    if (ctx->sched_phase >= ctx->sched_period_den) {
+        ctx->sched_phase -= ctx->sched_period_den;
+        ctx->sched_next_tick++;
+    }
+    if ((int32_t)(now - ctx->sched_next_tick) >= 0) {
+        ctx->sched_next_tick = now + ctx->sched_period_int;
+        ctx->sched_contiguous = 0;
+    } else {
+        ctx->sched_contiguous = 1;
+    }
 }
+#endif
 
-void aresplot_rx_feed_byte(uint8_t byte) {
-    switch (g_rx_state) {
-        case ARES_RX_STATE_WAIT_SOP:
-            if (byte == ARESPLOT_SOP) {
-                g_rx_state = ARES_RX_STATE_WAIT_CMD;
-                g_rx_checksum_calculated = 0; 
-            }
-            break;
+// --- 采样计划 Sampling Plan ---
 
-        case ARES_RX_STATE_WAIT_CMD:
-            g_rx_cmd = byte;
-            g_rx_checksum_calculated ^= byte;
-            g_rx_state = ARES_RX_STATE_WAIT_LEN1;
-            break;
+// 空地址变量的读取源 (按最宽类型对齐), 使读取函数无需判空 Read source for NULL variables (aligned for the widest type), so readers need no NULL check
+static const double g_plan_zero_source = 0.0;
 
-        case ARES_RX_STATE_WAIT_LEN1:
-            g_rx_payload_len = byte; // LSB
-            g_rx_checksum_calculated ^= byte;
-            g_rx_state = ARES_RX_STATE_WAIT_LEN2;
-            break;
+// 按 aresplot_original_type_t 索引的变量宽度 Variable widths indexed by aresplot_original_type_t
+static const uint8_t g_type_sizes[ARES_TYPE_BOOL + 1] = { 1, 1, 2, 2, 4, 4, 4, 8, 1 };
 
-        case ARES_RX_STATE_WAIT_LEN2:
-            g_rx_payload_len |= ((uint16_t)byte << 8); // MSB
-            g_rx_checksum_calculated ^= byte;
-            if (g_rx_payload_len > sizeof(g_rx_payload_buffer)) { 
-                g_rx_state = ARES_RX_STATE_WAIT_SOP; 
-            } else if (g_rx_payload_len == 0) {
-                g_rx_state = ARES_RX_STATE_WAIT_CHECKSUM;
-            } else {
-                g_rx_payload_idx = 0;
-                g_rx_state = ARES_RX_STATE_WAIT_PAYLOAD;
-            }
-            break;
+// FP32 编码读取函数: 读取原始类型并转换为 FP32 FP32 readers: read the original type and convert it to FP32
+#define ARESPLOT_DEFINE_FP32_READER(name, ctype) \
+    static void name(const volatile void* src, uint8_t* dst, uint16_t len) { \
+        float v = (float)(*(const volatile ctype*)src); \
+        (void)len; \
+        memcpy(dst, &v, sizeof(v)); \
+    }
+ARESPLOT_DEFINE_FP32_READER(plan_read_int8_fp32, int8_t)
+ARESPLOT_DEFINE_FP32_READER(plan_read_uint8_fp32, uint8_t)
+ARESPLOT_DEFINE_FP32_READER(plan_read_int16_fp32, int16_t)
+ARESPLOT_DEFINE_FP32_READER(plan_read_uint16_fp32, uint16_t)
+ARESPLOT_DEFINE_FP32_READER(plan_read_int32_fp32, int32_t)
+ARESPLOT_DEFINE_FP32_READER(plan_read_uint32_fp32, uint32_t)
+ARESPLOT_DEFINE_FP32_READER(plan_read_float32_fp32, float)
+ARESPLOT_DEFINE_FP32_READER(plan_read_float64_fp32, double)
+#undef ARESPLOT_DEFINE_FP32_READER
 
-        case ARES_RX_STATE_WAIT_PAYLOAD:
-            g_rx_payload_buffer[g_rx_payload_idx++] = byte; 
-            g_rx_checksum_calculated ^= byte;
-            if (g_rx_payload_idx >= g_rx_payload_len) {
-                g_rx_state = ARES_RX_STATE_WAIT_CHECKSUM;
-            }
-            break;
+static void plan_read_bool_fp32(const volatile void* src, uint8_t* dst, uint16_t len) {
+    float v = (*(const volatile uint8_t*)src) ? 1.0f : 0.0f;
+    (void)len;
+    memcpy(dst, &v, sizeof(v));
+}
 
-        case ARES_RX_STATE_WAIT_CHECKSUM:
-            if (byte == g_rx_checksum_calculated) { 
-                g_rx_state = ARES_RX_STATE_WAIT_EOP;
-            } else { 
-                queue_ack_response(g_rx_cmd, ARES_STATUS_ERROR_CHECKSUM); 
-                g_rx_state = ARES_RX_STATE_WAIT_SOP; 
-            }
-            break;
+static void plan_read_unknown_fp32(const volatile void* src, uint8_t* dst, uint16_t len) {
+    float v = 0.0f; // 未知类型发送 0 Unknown types are sent as 0
+    (void)src;
+    (void)len;
+    memcpy(dst, &v, sizeof(v));
+}
 
-        case ARES_RX_STATE_WAIT_EOP:
-            if (byte == ARESPLOT_EOP) { 
-                process_received_frame();
-            }
-            g_rx_state = ARES_RX_STATE_WAIT_SOP;
-            break;
+// 按 aresplot_original_type_t 索引的 FP32 读取函数表 FP32 reader table indexed by aresplot_original_type_t
+static const aresplot_plan_reader_t g_fp32_readers[ARES_TYPE_BOOL + 1] = {
+    plan_read_int8_fp32,    // ARES_TYPE_INT8
+    plan_read_uint8_fp32,   // ARES_TYPE_UINT8
+    plan_read_int16_fp32,   // ARES_TYPE_INT16
+    plan_read_uint16_fp32,  // ARES_TYPE_UINT16
+    plan_read_int32_fp32,   // ARES_TYPE_INT32
+    plan_read_uint32_fp32,  // ARES_TYPE_UINT32
+    plan_read_float32_fp32, // ARES_TYPE_FLOAT32
+    plan_read_float64_fp32, // ARES_TYPE_FLOAT64
+    plan_read_bool_fp32     // ARES_TYPE_BOOL
+};
 
-        default: 
-            g_rx_state = ARES_RX_STATE_WAIT_SOP;
-            break;
+#if ARESPLOT_ENABLE_COALESCED_READS
+// FP32 编码的合并读取: 一次 memcpy 把 len 个连续元素快照到本段输出的末尾, 再从前往后展宽为 FP32。
+// 元素不宽于 4 字节, 所以写入第 i 个 FP32 时不会覆盖尚未转换的元素。
+// Coalesced FP32 readers: one memcpy snapshots the len contiguous elements into the tail of this run's output, which is
+// then widened to FP32 front to back. Elements are at most 4 bytes wide, so writing FP32 i never clobbers an unconverted element.
+#define ARESPLOT_DEFINE_FP32_RUN_READER(name, ctype, to_fp32) \
+    static void name(const volatile void* src, uint8_t* dst, uint16_t len) { \
+        uint8_t* raw = dst + (uint16_t)(len * (4 - sizeof(ctype))); \
+        memcpy(raw, (const void*)src, (size_t)len * sizeof(ctype)); \
+        for (uint16_t i = 0; i < len; ++i) { \
+            ctype x; \
+            memcpy(&x, raw + i * sizeof(ctype), sizeof(x)); \
+            float v = to_fp32(x); \
+            memcpy(dst + 4 * i, &v, sizeof(v)); \
+        } \
     }
+#define ARESPLOT_BOOL_TO_FP32(x) ((x) ? 1.0f : 0.0f)
+ARESPLOT_DEFINE_FP32_RUN_READER(plan_read_int8_fp32_run, int8_t, (float))
+ARESPLOT_DEFINE_FP32_RUN_READER(plan_read_uint8_fp32_run, uint8_t, (float))
+ARESPLOT_DEFINE_FP32_RUN_READER(plan_read_int16_fp32_run, int16_t, (float))
+ARESPLOT_DEFINE_FP32_RUN_READER(plan_read_uint16_fp32_run, uint16_t, (float))
+ARESPLOT_DEFINE_FP32_RUN_READER(plan_read_int32_fp32_run, int32_t, (float))
+ARESPLOT_DEFINE_FP32_RUN_READER(plan_read_uint32_fp32_run, uint32_t, (float))
+ARESPLOT_DEFINE_FP32_RUN_READER(plan_read_bool_fp32_run, uint8_t, ARESPLOT_BOOL_TO_FP32)
+#undef ARESPLOT_BOOL_TO_FP32
+#undef ARESPLOT_DEFINE_FP32_RUN_READER
+
+static void plan_read_float32_fp32_run(const volatile void* src, uint8_t* dst, uint16_t len) {
+    memcpy(dst, (const void*)src, (size_t)len * sizeof(float)); // 已是 FP32 Already FP32
 }
 
-void aresplot_rx_feed_packet(const uint8_t* data, uint16_t length) {
-    for (uint16_t i = 0; i < length; ++i) {
-        aresplot_rx_feed_byte(data[i]);
+static void plan_read_float64_fp32_run(const volatile void* src, uint8_t* dst, uint16_t len) {
+    // FLOAT64 比 FP32 宽, 无法在输出中就地快照, 逐个读取 FLOAT64 is wider than FP32 and cannot be snapshotted in place, so read one by one
+    const volatile double* in = (const volatile double*)src;
+    for (uint16_t i = 0; i < len; ++i) {
+        float v = (float)in[i];
+        memcpy(dst + 4 * i, &v, sizeof(v));
     }
 }
 
+// 按 aresplot_original_type_t 索引的 FP32 合并读取函数表 Coalesced FP32 reader table indexed by aresplot_original_type_t
+static const aresplot_plan_reader_t g_fp32_run_readers[ARES_TYPE_BOOL + 1] = {
+    plan_read_int8_fp32_run, plan_read_uint8_fp32_run, plan_read_int16_fp32_run, plan_read_uint16_fp32_run,
+    plan_read_int32_fp32_run, plan_read_uint32_fp32_run, plan_read_float32_fp32_run, plan_read_float64_fp32_run,
+    plan_read_bool_fp32_run
+};
+#endif
 
-static void send_monitor_data_payload_assembly(uint8_t* out_payload_buffer, uint16_t* out_payload_len) {
-    uint32_t timestamp;
-    uint16_t payload_idx = 0;
-    float temp_float_val;
-    uint8_t current_num_vars; 
-    aresplot_var_info_t local_monitor_vars[ARESPLOT_MAX_VARS_TO_MONITOR];
+#if ARESPLOT_ENABLE_RAW_ENCODING
+// 原始编码读取函数: 按原始宽度原样拷贝 (假设MCU为小端序, 与 FP32 路径相同)
+// Raw readers: copy the original width as is (assumes a little-endian MCU, same as the FP32 path)
+static void plan_read_raw8(const volatile void* src, uint8_t* dst, uint16_t len) {
+    (void)len;
+    dst[0] = *(const volatile uint8_t*)src;
+}
 
-    aresplot_user_critical_enter(); 
-    if (!g_monitoring_active || g_num_monitor_vars == 0) {
-        aresplot_user_critical_exit();
-        *out_payload_len = 0;
-        return;
-    }
-    current_num_vars = g_num_monitor_vars; 
-    for(uint8_t i=0; i < current_num_vars; ++i) {
-        local_monitor_vars[i] = g_monitor_vars[i];
-    }
-    aresplot_user_critical_exit(); 
+static void plan_read_raw16(const volatile void* src, uint8_t* dst, uint16_t len) {
+    uint16_t v = *(const volatile uint16_t*)src;
+    (void)len;
+    memcpy(dst, &v, sizeof(v));
+}
 
-    timestamp = aresplot_user_get_tick_ms();
+static void plan_read_raw32(const volatile void* src, uint8_t* dst, uint16_t len) {
+    uint32_t v = *(const volatile uint32_t*)src;
+    (void)len;
+    memcpy(dst, &v, sizeof(v));
+}
 
-    out_payload_buffer[payload_idx++] = (uint8_t)(timestamp & 0xFF);
-    out_payload_buffer[payload_idx++] = (uint8_t)((timestamp >> 8) & 0xFF);
-    out_payload_buffer[payload_idx++] = (uint8_t)((timestamp >> 16) & 0xFF);
-    out_payload_buffer[payload_idx++] = (uint8_t)((timestamp >> 24) & 0xFF);
+static void plan_read_raw64(const volatile void* src, uint8_t* dst, uint16_t len) {
+    double v = *(const volatile double*)src;
+    (void)len;
+    memcpy(dst, &v, sizeof(v));
+}
 
-    for (uint8_t i = 0; i < current_num_vars; ++i) {
-        if (local_monitor_vars[i].ptr == NULL) { 
-             temp_float_val = 0.0f; 
-        } else {
-            switch (local_monitor_vars[i].type) {
-                case ARES_TYPE_INT8:    temp_float_val = (float)(*(volatile int8_t*)local_monitor_vars[i].ptr); break;
-                case ARES_TYPE_UINT8:   temp_float_val = (float)(*(volatile uint8_t*)local_monitor_vars[i].ptr); break;
-                case ARES_TYPE_INT16:   temp_float_val = (float)(*(volatile int16_t*)local_monitor_vars[i].ptr); break;
-                case ARES_TYPE_UINT16:  temp_float_val = (float)(*(volatile uint16_t*)local_monitor_vars[i].ptr); break;
-                case ARES_TYPE_INT32:   temp_float_val = (float)(*(volatile int32_t*)local_monitor_vars[i].ptr); break;
-                case ARES_TYPE_UINT32:  temp_float_val = (float)(*(volatile uint32_t*)local_monitor_vars[i].ptr); break;
-                case ARES_TYPE_FLOAT32: temp_float_val = (*(volatile float*)local_monitor_vars[i].ptr); break;
-                case ARES_TYPE_BOOL:    temp_float_val = (*(volatile uint8_t*)local_monitor_vars[i].ptr) ? 1.0f : 0.0f; break;
-                default: temp_float_val = 0.0f; break; 
-            }
-        }
-        
-        uint8_t temp_float_bytes[4]; // Temporary buffer for float bytes
-        memcpy(temp_float_bytes, &temp_float_val, sizeof(float));
-        out_payload_buffer[payload_idx++] = temp_float_bytes[0];
-        out_payload_buffer[payload_idx++] = temp_float_bytes[1];
-        out_payload_buffer[payload_idx++] = temp_float_bytes[2];
-        out_payload_buffer[payload_idx++] = temp_float_bytes[3];
-    }
-    *out_payload_len = 4 + current_num_vars * 4;
+#if ARESPLOT_ENABLE_COALESCED_READS
+// 原始编码下连续的变量在采样中也连续, 整段 len 字节一次拷贝 (类型可以不同)
+// In raw encoding contiguous variables stay contiguous in the sample, so the whole run of len bytes is one copy (types may differ)
+static void plan_read_raw_run(const volatile void* src, uint8_t* dst, uint16_t len) {
+    memcpy(dst, (const void*)src, len);
 }
+#endif
 
+// 按 aresplot_original_type_t 索引的原始编码读取函数表 Raw reader table indexed by aresplot_original_type_t
+static const aresplot_plan_reader_t g_raw_readers[ARES_TYPE_BOOL + 1] = {
+    plan_read_raw8, plan_read_raw8, plan_read_raw16, plan_read_raw16,
+    plan_read_raw32, plan_read_raw32, plan_read_raw32, plan_read_raw64, plan_read_raw8
+};
+#endif
 
-void aresplot_service_tick(void) {
-    uint32_t current_time_ms;
-    uint8_t ack_cmd_to_process = 0;
-    aresplot_ack_status_t status_to_process = ARES_STATUS_OK;
-    uint8_t process_ack = 0;
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+// 打包 BOOL 读取函数: 把 (len >> 3) 个连续的 BOOL 写入位图, 从 dst 的第 (len & 7) 位开始; 每一位都被写入, 无需先清零位图
+// Packed BOOL reader: writes (len >> 3) contiguous BOOLs into the bitmap, starting at bit (len & 7) of dst; every bit is
+// written, so the bitmap needs no clearing first
+static void plan_read_bool_bits(const volatile void* src, uint8_t* dst, uint16_t len) {
+    const volatile uint8_t* in = (const volatile uint8_t*)src;
+    uint8_t bit = (uint8_t)(len & 7);
 
-#if ARESPLOT_ENABLE_ERROR_REPORT
-    uint8_t error_code_to_process = 0;
-    char error_msg_to_process[ARESPLOT_SHARED_BUFFER_SIZE - 7];
-    uint8_t error_msg_len_to_process = 0;
-    uint8_t process_error_report = 0;
+    for (uint16_t i = 0; i < (uint16_t)(len >> 3); ++i) {
+        uint8_t mask = (uint8_t)(1U << bit);
+        *dst = in[i] ? (uint8_t)(*dst | mask) : (uint8_t)(*dst & ~mask);
+        if (++bit == 8) {
+            bit = 0;
+            dst++;
+        }
+    }
+}
+#endif
+
+/**
+ * @brief 将流式接收到计划中的 CMD_START_MONITOR 变量列表编译为采样计划
+ * Compiles the CMD_START_MONITOR variable list, already streamed into the plan, into a sampling plan.
+ * @param plan 采样计划 (必须是未发布的那一个), 其 src, value_types 和 dividers 已由 start_monitor_rx_byte() 按变量填入
+ * Sampling plan (must be the unpublished one), whose src, value_types and dividers were filled in per variable by start_monitor_rx_byte().
+ * @param num_vars 变量数量 Number of variables.
+ * @param options CMD_START_MONITOR 选项 CMD_START_MONITOR options.
+ * @return ARES_STATUS_OK 或错误码 ARES_STATUS_OK or an error code.
+ * @note 类型分派和空地址检查都在这里完成一次, 采样时不再逐变量判断。启用 ARESPLOT_ENABLE_COALESCED_READS 时, 地址紧接上一变量的变量
+ * (FP32 编码下还须类型相同) 并入上一步; 步骤数不超过变量数, 所以步骤可以就地覆盖已读过的 steps[i].src。
+ * Type dispatch and NULL checks happen once here instead of per variable on every sample. With ARESPLOT_ENABLE_COALESCED_READS,
+ * a variable that starts right where the previous one ends (and, for FP32 encoding, has the same type) joins the previous step;
+ * there are never more steps than variables, so steps overwrite steps[i].src entries that have already been read.
+ * 设置 PACKED_BOOLS 时 BOOL 变量不占值, 而是依次写入其他值之后的位图, 相邻的 BOOL 合并为一步。
+ * With PACKED_BOOLS, BOOL variables take no value of their own but go in order into the bitmap after the other values;
+ * adjacent BOOLs join one step.
+ */
+static aresplot_ack_status_t compile_sample_plan(aresplot_sample_plan_t* plan, uint8_t num_vars, uint8_t options) {
+    uint16_t offset = 0;
+    uint8_t num_steps = 0;
+    uint8_t num_wire = 0; // 已排列的值 (不含打包的 BOOL) Values laid out so far (packed BOOLs excluded)
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    uint8_t packed = (uint8_t)((options & ARESPLOT_START_MONITOR_OPT_PACKED_BOOLS) != 0);
+    uint16_t bitmap_offset = 0; // 位图在采样中的字节偏移 Byte offset of the bitmap within the sample
+    uint8_t num_bools = 0;      // 已写入位图的 BOOL 数 BOOLs placed in the bitmap so far
+#endif
+#if ARESPLOT_ENABLE_COALESCED_READS
+    aresplot_plan_step_t* run = NULL; // 可继续合并的上一步 Previous step that may still be extended
+    uintptr_t run_end = 0;            // 上一步读取区域的结束地址 End address of the previous step's read
+    uint8_t run_type = 0;             // 上一步的变量类型 Variable type of the previous step
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    // 打包的 BOOL 与其他值分开合并: 两者在采样中各自连续 Packed BOOLs coalesce apart from the other values: each is contiguous on its own in the sample
+    aresplot_plan_step_t* bool_run = NULL;
+    uintptr_t bool_run_end = 0;
+#endif
+#endif
+
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    // 位图位于所有其他值之后 The bitmap follows every other value
+    for (uint8_t i = 0; packed && i < num_vars; ++i) {
+        uint8_t type = plan->value_types[i];
+        if (type != ARES_TYPE_BOOL) {
+#if ARESPLOT_ENABLE_RAW_ENCODING
+            if ((options & ARESPLOT_START_MONITOR_OPT_RAW_ENCODING) && type <= ARES_TYPE_BOOL) {
+                bitmap_offset = (uint16_t)(bitmap_offset + g_type_sizes[type]);
+                continue;
+            }
+#endif
+            bitmap_offset = (uint16_t)(bitmap_offset + 4);
+        }
+    }
+#endif
+
+    for (uint8_t i = 0; i < num_vars; ++i) {
+        const volatile void* src = plan->steps[i].src;
+        uint8_t type = plan->value_types[i];
+        uint8_t raw = 0;
+        aresplot_plan_reader_t read;
+        uint8_t width; // 在采样中的宽度 Width in the sample
+#if ARESPLOT_ENABLE_SENDER_LAYOUT
+        uint8_t format = 4; // FP32 值: 异或 FP32 values: XOR
+#endif
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+        if (!(options & ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS)) {
+            plan->dividers[i] = 1;
+        } else if (plan->dividers[i] == 0) {
+            return ARES_STATUS_ERROR_INVALID_PAYLOAD;
+        }
+#endif
+#if ARESPLOT_ENABLE_RAW_ENCODING
+        if (options & ARESPLOT_START_MONITOR_OPT_RAW_ENCODING) {
+            // 原始编码下上位机按类型宽度解码, 未知类型无法发送 Raw decoding relies on type widths, so unknown types cannot be sent
+            if (type > ARES_TYPE_BOOL) {
+                return ARES_STATUS_ERROR_TYPE_UNSUPPORTED;
+            }
+            raw = 1;
+            read = g_raw_readers[type];
+            width = g_type_sizes[type];
+#if ARESPLOT_ENABLE_SENDER_LAYOUT
+            // 整数差分更紧凑, 浮点的小变化则集中在低位 Integers compress best as deltas; small float changes stay in the low bits
+            format = (uint8_t)(width |
+                ((type == ARES_TYPE_FLOAT32 || type == ARES_TYPE_FLOAT64) ? 0 : ARESPLOT_VALUE_FORMAT_DELTA));
+#endif
+        } else
+#endif
+        {
+            read = (type <= ARES_TYPE_BOOL) ? g_fp32_readers[type] : plan_read_unknown_fp32;
+            width = 4;
+        }
+
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+        if (packed && type == ARES_TYPE_BOOL) {
+#if ARESPLOT_ENABLE_COALESCED_READS
+            if (src == (const volatile void*)&g_plan_zero_source) {
+                bool_run = NULL;
+            } else if (bool_run != NULL && (uintptr_t)src == bool_run_end) {
+                // 延续上一段 BOOL: 位在位图中同样连续 Extends the previous BOOL run: the bits are contiguous in the bitmap too
+                bool_run->len = (uint16_t)(bool_run->len + 8);
+                bool_run_end++;
+                num_bools++;
+                continue;
+            }
+#endif
+            aresplot_plan_step_t* step = &plan->steps[num_steps++];
+            step->read = plan_read_bool_bits;
+            step->src = src;
+            step->offset = (uint16_t)(bitmap_offset + num_bools / 8);
+            step->len = (uint16_t)(8 | (num_bools & 7)); // 1 个 BOOL One BOOL
+#if ARESPLOT_ENABLE_COALESCED_READS
+            if (src != (const volatile void*)&g_plan_zero_source) {
+                bool_run = step;
+                bool_run_end = (uintptr_t)src + 1;
+            }
+#endif
+            num_bools++;
+            continue;
+        }
+#endif
+#if ARESPLOT_ENABLE_SENDER_LAYOUT
+        plan->value_formats[num_wire] = format; // num_wire <= i: 不会覆盖尚未读取的项 Never overwrites an entry not yet read
+#endif
+        num_wire++;
+
+#if ARESPLOT_ENABLE_COALESCED_READS
+        // 空地址 (零值源) 和未知类型没有可合并的内存区域 NULL variables (zero source) and unknown types have no memory region to merge
+        if (src == (const volatile void*)&g_plan_zero_source || type > ARES_TYPE_BOOL) {
+            run = NULL;
+        } else if (run != NULL && (uintptr_t)src == run_end && (raw || type == run_type)) {
+            run->len = (uint16_t)(run->len + (raw ? width : 1));
+#if ARESPLOT_ENABLE_RAW_ENCODING
+            run->read = raw ? plan_read_raw_run : g_fp32_run_readers[type];
+#else
+            run->read = g_fp32_run_readers[type];
+#endif
+            run_end += g_type_sizes[type];
+            offset += width;
+            continue;
+        }
+#endif
+        aresplot_plan_step_t* step = &plan->steps[num_steps++];
+        step->read = read;
+        step->src = src;
+        step->offset = offset;
+        step->len = raw ? width : 1;
+#if ARESPLOT_ENABLE_COALESCED_READS
+        if (type <= ARES_TYPE_BOOL && src != (const volatile void*)&g_plan_zero_source) {
+            run = step;
+            run_end = (uintptr_t)src + g_type_sizes[type];
+            run_type = type;
+        }
+#endif
+        offset += width;
+    }
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    if (packed) {
+        // 位图的每个字节按 1 字节的值异或压缩 Each bitmap byte is compressed as a 1-byte XOR value
+        for (uint8_t j = 0; j < (uint8_t)((num_bools + 7) / 8); ++j) {
+#if ARESPLOT_ENABLE_SENDER_LAYOUT
+            plan->value_formats[num_wire] = 1;
+#endif
+            num_wire++;
+        }
+        offset = (uint16_t)(bitmap_offset + (num_bools + 7) / 8);
+    }
+    plan->num_wire_values = num_wire;
+#endif
+    (void)num_wire;
+    plan->num_steps = num_steps;
+    plan->num_values = num_vars;
+    plan->sample_bytes = offset;
+    plan->options = options;
+    return ARES_STATUS_OK;
+}
+
+/**
+ * @brief 执行采样计划, 把所有监控变量的当前值写入输出缓冲区
+ * Runs a sampling plan, writing the current value of every monitored variable to the output buffer.
+ * @param plan 采样计划 Sampling plan.
+ * @param out_values 输出缓冲区, 至少 ARESPLOT_MAX_SAMPLE_BYTES 字节 Output buffer, at least ARESPLOT_MAX_SAMPLE_BYTES bytes.
+ * @return 写入的字节数 Number of bytes written.
+ */
+static uint16_t run_sample_plan(const aresplot_sample_plan_t* plan, uint8_t* out_values) {
+    const aresplot_plan_step_t* step = plan->steps;
+    const aresplot_plan_step_t* end = step + plan->num_steps;
+
+    for (; step != end; ++step) {
+        step->read(step->src, out_values + step->offset, step->len);
+    }
+    return plan->sample_bytes;
+}
+
+#if ARESPLOT_ENABLE_ENVELOPE
+/**
+ * @brief 一个包络窗口中的值数量
+ * Number of values in one envelope window of a plan.
+ * @param plan 启用了包络的采样计划 Sampling plan with envelopes enabled.
+ * @return 平均值、最小值与最大值各 num_values 个, 另加可选的采样数 num_values each of means, minima and maxima, plus the optional count.
+ */
+static uint8_t envelope_num_values(const aresplot_sample_plan_t* plan) {
+    return (uint8_t)(3 * plan->num_values + ((plan->envelope_flags & ARESPLOT_ENVELOPE_FLAG_COUNT) ? 1 : 0));
+}
+
+/**
+ * @brief 把一个 FP32 采样累加到包络窗口
+ * Folds one FP32 sample into the envelope window.
+ * @param plan 采样所属的计划 Plan the sample was taken with.
+ * @param values 采样值 (FP32) Sample values (FP32).
+ * @param timestamp 采样时间戳 (毫秒) Sample timestamp (ms).
+ * @param config_gen 采样所属的监控配置代数 Monitor config generation the sample belongs to.
+ * @param contiguous 该采样是否紧接上一个采样 Whether the sample directly follows the previous one.
+ * @return 1: 窗口已满, 应由 envelope_take() 取出 1 if the window is full and should be taken with envelope_take().
+ * @note 属于旧监控配置的未完成窗口被丢弃。 An unfinished window of an old monitor config is discarded.
+ */
+static uint8_t envelope_fold(aresplot_ctx_t* ctx, const aresplot_sample_plan_t* plan, const uint8_t* values,
+                             uint32_t timestamp, uint8_t config_gen, uint8_t contiguous) {
+    uint8_t first = (uint8_t)(ctx->envelope_count == 0 || ctx->envelope_config_gen != config_gen);
+
+    if (first) {
+        ctx->envelope_count = 0;
+        ctx->envelope_start_ms = timestamp;
+        ctx->envelope_config_gen = config_gen;
+        ctx->envelope_contiguous = contiguous;
+    }
+    for (uint8_t i = 0; i < plan->num_values; ++i) {
+        float v;
+        memcpy(&v, &values[i * 4], sizeof(float));
+        if (first) {
+            ctx->envelope_min[i] = v;
+            ctx->envelope_max[i] = v;
+            ctx->envelope_sum[i] = v;
+        } else {
+            if (v < ctx->envelope_min[i]) ctx->envelope_min[i] = v;
+            if (v > ctx->envelope_max[i]) ctx->envelope_max[i] = v;
+            ctx->envelope_sum[i] += v;
+        }
+    }
+    ctx->envelope_count++;
+    return (uint8_t)(ctx->envelope_count >= plan->envelope_window);
+}
+
+/**
+ * @brief 取出当前包络窗口 (至少含一个采样) 并开始新窗口
+ * Takes the current envelope window (holding at least one sample) and starts a new one.
+ * @param plan 窗口所属的计划 Plan of the window.
+ * @param out 输出缓冲区, 至少 ARESPLOT_MAX_SAMPLE_BYTES 字节: Mean_0..N-1, Min_0..N-1, Max_0..N-1 [, Count], 均为 FP32
+ * Output buffer, at least ARESPLOT_MAX_SAMPLE_BYTES bytes: Mean_0..N-1, Min_0..N-1, Max_0..N-1 [, Count], all FP32.
+ * @param timestamp 输出: 窗口第一个采样的时间戳 (毫秒) Out: timestamp of the window's first sample (ms).
+ * @return 写入的字节数 Number of bytes written.
+ */
+static uint16_t envelope_take(aresplot_ctx_t* ctx, const aresplot_sample_plan_t* plan, uint8_t* out, uint32_t* timestamp) {
+    uint8_t n = plan->num_values;
+    float count = (float)ctx->envelope_count;
+
+    for (uint8_t i = 0; i < n; ++i) {
+        float mean = ctx->envelope_sum[i] / count;
+        memcpy(&out[i * 4], &mean, sizeof(float));
+        memcpy(&out[(n + i) * 4], &ctx->envelope_min[i], sizeof(float));
+        memcpy(&out[(2 * n + i) * 4], &ctx->envelope_max[i], sizeof(float));
+    }
+    if (plan->envelope_flags & ARESPLOT_ENVELOPE_FLAG_COUNT) {
+        memcpy(&out[3 * n * 4], &count, sizeof(float));
+    }
+    *timestamp = ctx->envelope_start_ms;
+    ctx->envelope_count = 0;
+    return (uint16_t)(envelope_num_values(plan) * 4);
+}
+#endif
+
+#if ARESPLOT_ENABLE_CAPTURE
+/**
+ * @brief 求某个变量在采样中的字节偏移 (合并读取后步骤不再与变量一一对应)
+ * Finds the byte offset of a variable within the sample (steps no longer map one to one to variables once reads are coalesced).
+ * @param plan 采样计划 Sampling plan.
+ * @param index 变量序号 (小于 num_values) Variable index (below num_values).
+ * @param out_mask 输出: BOOL 变量的位掩码, 打包时只有一位, 否则为 0xFF Out: bit mask of a BOOL variable; a single bit when packed, 0xFF otherwise.
+ * @return 字节偏移 Byte offset.
+ */
+static uint16_t plan_value_offset(const aresplot_sample_plan_t* plan, uint8_t index, uint8_t* out_mask) {
+    uint16_t offset = 0;
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    uint8_t packed = (uint8_t)((plan->options & ARESPLOT_START_MONITOR_OPT_PACKED_BOOLS) != 0);
+    uint8_t bools_before = 0;
+    uint8_t num_bools = 0;
+#endif
+
+    *out_mask = 0xFF;
+    for (uint8_t i = 0; i < plan->num_values; ++i) {
+        uint8_t type = plan->value_types[i];
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+        if (packed && type == ARES_TYPE_BOOL) {
+            bools_before = (uint8_t)(bools_before + (i < index));
+            num_bools++;
+            continue;
+        }
+#endif
+        if (i >= index) {
+            continue;
+        }
+#if ARESPLOT_ENABLE_RAW_ENCODING
+        if (plan->options & ARESPLOT_START_MONITOR_OPT_RAW_ENCODING) {
+            offset = (uint16_t)(offset + g_type_sizes[type]);
+            continue;
+        }
+#endif
+        offset = (uint16_t)(offset + 4);
+    }
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    if (packed && plan->value_types[index] == ARES_TYPE_BOOL) {
+        // 位图是采样的最后 ceil(B/8) 个字节 The bitmap is the last ceil(B/8) bytes of the sample
+        *out_mask = (uint8_t)(1U << (bools_before & 7));
+        return (uint16_t)(plan->sample_bytes - (num_bools + 7) / 8 + bools_before / 8);
+    }
+#endif
+    return offset;
+}
+#endif
+
+/**
+ * @brief 开始流式接收 CMD_START_MONITOR 的 Payload (在 LEN 接收完成后调用)
+ * Starts streaming in a CMD_START_MONITOR payload (called once LEN has been received).
+ */
+static void start_monitor_rx_begin(aresplot_ctx_t* ctx) {
+    // 直接写入未被读取的计划, 采样端继续使用已发布的计划
+    // Write straight into the plan nobody is reading; samplers keep using the published one
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+    ctx->rx_start_plan = (uint8_t)(ctx->active_plan ^ 1);
+#else
+    ctx->rx_start_plan = (uint8_t)(ctx->reading_plan ^ 1);
+    // 若新计划已发布但尚未被主循环取用, 目标即为已发布的计划, 主循环须等到该帧结束
+    // If a new plan was published but not yet taken by the main loop, the target is the published plan and the main loop must wait for this frame to end
+    ctx->rx_start_locked_plan = (uint8_t)(ctx->rx_start_plan + 1);
+#endif
+    ctx->rx_start_num_vars = 0;
+    ctx->rx_start_desc = 0;
+    ctx->rx_start_vars_end = 1;
+    ctx->rx_start_var = 0;
+    ctx->rx_start_field = 0;
+    ctx->rx_start_addr = 0;
+    ctx->rx_start_type = 0;
+    ctx->rx_start_blocks = 0;
+    ctx->rx_start_error = ARES_STATUS_OK;
+    ctx->rx_start_options = 0;
+#if ARESPLOT_ENABLE_ENVELOPE
+    ctx->rx_start_envelope_window = 0;
+    ctx->rx_start_envelope_flags = 0;
+#endif
+}
+
+/**
+ * @brief 一个变量描述接收完毕: 把它展开为 count 个变量写入目标计划
+ * A variable descriptor is complete: expands it into count variables in the target plan.
+ * @param plan 目标计划 Target plan.
+ * @param idx 描述最后一个字节在 Payload 中的偏移 Payload offset of the descriptor's last byte.
+ * @param count 元素数 (标量为 1) Element count (1 for a scalar).
+ */
+static void start_monitor_rx_descriptor(aresplot_ctx_t* ctx, aresplot_sample_plan_t* plan, uint16_t idx, uint8_t count) {
+    uint8_t type = ctx->rx_start_type;
+    uint8_t stride = 0; // 元素间距 Element stride
+    uint16_t i = 0;
+
+#if ARESPLOT_ENABLE_BLOCK_DESCRIPTORS
+    if (type & ARESPLOT_VAR_DESC_TYPE_BLOCK) {
+        type = (uint8_t)(type & (uint8_t)~ARESPLOT_VAR_DESC_TYPE_BLOCK);
+        ctx->rx_start_blocks = 1;
+        if (count == 0) {
+            ctx->rx_start_error = ARES_STATUS_ERROR_INVALID_PAYLOAD;
+        } else if (type > ARES_TYPE_BOOL) {
+            ctx->rx_start_error = ARES_STATUS_ERROR_TYPE_UNSUPPORTED; // 未知类型的宽度未知 An unknown type has no known width
+        } else {
+            stride = g_type_sizes[type];
+        }
+    }
+#endif
+    for (; i < count && ctx->rx_start_var < ARESPLOT_MAX_VARS_TO_MONITOR; ++i, ++ctx->rx_start_var) {
+        plan->steps[ctx->rx_start_var].src = ctx->rx_start_addr ? (const volatile void*)ARESPLOT_ADDR_TO_PTR(ctx->rx_start_addr + i * stride)
+                                                           : (const volatile void*)&g_plan_zero_source;
+        plan->value_types[ctx->rx_start_var] = type;
+    }
+    ctx->rx_start_var = (uint16_t)(ctx->rx_start_var + (count - i)); // 超出上限的只计数 Only count those beyond the limit
+    ctx->rx_start_field = 0;
+    ctx->rx_start_addr = 0;
+    if (++ctx->rx_start_desc == ctx->rx_start_num_vars) {
+        ctx->rx_start_vars_end = (uint16_t)(idx + 1);
+    }
+}
+
+/**
+ * @brief 解析 CMD_START_MONITOR 的一个 Payload 字节, 把变量描述直接写入目标计划
+ * Parses one CMD_START_MONITOR payload byte, writing the variable descriptors straight into the target plan.
+ * @param idx 字节在 Payload 中的偏移 Offset of the byte in the payload.
+ * @param byte 字节 Byte.
+ * @note 长度和内容在帧校验通过后由 handle_cmd_start_monitor() 检查, 超出 ARESPLOT_MAX_VARS_TO_MONITOR 的部分被丢弃。
+ * Length and contents are checked by handle_cmd_start_monitor() once the frame checks out; anything beyond ARESPLOT_MAX_VARS_TO_MONITOR is dropped.
+ */
+static void start_monitor_rx_byte(aresplot_ctx_t* ctx, uint16_t idx, uint8_t byte) {
+    aresplot_sample_plan_t* plan = &ctx->sample_plans[ctx->rx_start_plan];
+
+    if (idx == 0) {
+        ctx->rx_start_num_vars = byte; // NumVariables
+        ctx->rx_start_vars_end = byte ? 0xFFFFU : 1; // 块描述更长, 列表结束时才知道 Block descriptors are longer; known once the list ends
+    } else if (idx < ctx->rx_start_vars_end) {
+        // 变量描述: 4 字节地址 (小端) + 1 字节类型 [+ 1 字节元素数]
+        // Variable descriptor: 4-byte address (little-endian) + 1-byte type [+ 1-byte element count]
+        if (ctx->rx_start_field < 4) {
+            ctx->rx_start_addr |= (uint32_t)byte << (8 * ctx->rx_start_field);
+            ctx->rx_start_field++;
+            return;
+        }
+        if (ctx->rx_start_field == 4) {
+            ctx->rx_start_type = byte;
+#if ARESPLOT_ENABLE_BLOCK_DESCRIPTORS
+            if (byte & ARESPLOT_VAR_DESC_TYPE_BLOCK) {
+                ctx->rx_start_field++; // 块描述: 元素数紧随其后 Block descriptor: the element count follows
+                return;
+            }
+#endif
+            byte = 1;
+        }
+        start_monitor_rx_descriptor(ctx, plan, idx, byte);
+    } else if (idx == ctx->rx_start_vars_end) {
+        ctx->rx_start_options = byte; // 可选的 Options 字节位于变量列表之后 The optional Options byte follows the variable list
+    } else {
+        uint16_t k = (uint16_t)(idx - ctx->rx_start_vars_end - 1);
+#if ARESPLOT_ENABLE_ENVELOPE
+        if (ctx->rx_start_options & ARESPLOT_START_MONITOR_OPT_ENVELOPE) {
+            // 包络参数 WindowSamples (2 字节, 小端) + EnvelopeFlags 位于 Options 之后
+            // The envelope parameters WindowSamples (2 bytes, little-endian) + EnvelopeFlags follow Options
+            if (k < 2) {
+                ctx->rx_start_envelope_window |= (uint16_t)(byte << (8 * k));
+            } else if (k == 2) {
+                ctx->rx_start_envelope_flags = byte;
+            }
+            return;
+        }
+#endif
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+        // 分频表 (每个变量 1 字节) 位于 Options 之后 The divider table (1 byte per variable) follows Options
+        if (k < ARESPLOT_MAX_VARS_TO_MONITOR) {
+            plan->dividers[k] = byte;
+        }
+#else
+        (void)k;
+#endif
+    }
+}
+
+/**
+ * @brief 结束 CMD_START_MONITOR 的流式接收 (帧已处理或被丢弃)
+ * Ends streaming in a CMD_START_MONITOR payload (the frame was processed or dropped).
+ * @param dropped 帧是否被丢弃 Whether the frame was dropped.
+ */
+static void start_monitor_rx_end(aresplot_ctx_t* ctx, uint8_t dropped) {
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    if (dropped && ctx->monitoring_active && ctx->rx_start_plan == ctx->active_plan) {
+        // 已发布的计划被部分覆盖, 只能停止监控 The published plan was partly overwritten; monitoring has to stop
+        ctx->monitor_config_gen++;
+        ctx->monitoring_active = 0;
+        ctx->num_monitor_vars = 0;
+    }
+    ctx->rx_start_locked_plan = 0;
+    ARESPLOT_CRITICAL_EXIT(ctx);
+#else
+    (void)ctx;
+    (void)dropped; // 目标计划从未发布 The target plan was never published
+#endif
+}
+
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+/**
+ * @brief 设置中断采样的抽取比 (调用者负责临界区)
+ * Sets the decimation of ISR sampling (caller handles the critical section).
+ * @param decimation 每多少次 aresplot_sample_now() 调用采样一次, 0 视为 1 Take a sample every this many aresplot_sample_now() calls; 0 is treated as 1.
+ */
+static void set_isr_decimation(aresplot_ctx_t* ctx, uint32_t decimation) {
+    const uint32_t ns_per_call = 1000000000U / ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ;
+    if (decimation == 0) {
+        decimation = 1;
+    }
+    ctx->isr_decimation = decimation;
+    ctx->isr_sample_period_ns = (decimation > 0xFFFFFFFFU / ns_per_call) ? 0xFFFFFFFFU : decimation * ns_per_call;
+    ctx->isr_call_count = 0;
+}
+#endif
+
+#if ARESPLOT_ENABLE_RATE_LIMIT
+/**
+ * @brief 估算链路字节预算允许的最高采样率
+ * Estimates the highest sample rate the link byte budget allows for a sampling plan.
+ * @param plan 已发布的采样计划 The published sampling plan.
+ * @return 最高采样率 (Hz, 至少为 1) Highest sample rate (Hz, at least 1).
+ * @note 每个采样按未压缩的最大长度计 (分频时含通道位图), 帧头帧尾按每帧容纳的采样数分摊。
+ * Each sample counts at its uncompressed maximum (with the channel bitmap under dividers); the frame header and
+ * trailer are spread over the samples one frame carries.
+ * 包络模式下按窗口估算, 再乘以每个窗口的采样数。 With envelopes the estimate is per window, then scaled by the samples per window.
+ */
+static uint32_t rate_limit_max_hz(const aresplot_sample_plan_t* plan) {
+    uint32_t sample_cost = plan->sample_bytes;
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    uint32_t num_values = plan->num_wire_values;
+#else
+    uint32_t num_values = plan->num_values;
+#endif
+    uint32_t header = 4; // Timestamp
+    uint32_t per_frame = 1;
+    uint32_t max_hz;
+
+#if ARESPLOT_ENABLE_ENVELOPE
+    if (plan->envelope_window) {
+        // 链路上只有包络窗口, 下面按窗口计 Only envelope windows reach the link, so the estimate below counts windows
+        num_values = envelope_num_values(plan);
+        sample_cost = num_values * 4;
+    }
+#endif
+
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+    header = ARESPLOT_BATCH_HEADER_SIZE;
+#endif
+#if ARESPLOT_ENABLE_SEQUENCE
+    if (plan->options & ARESPLOT_START_MONITOR_OPT_SEQUENCE) {
+        header++; // FrameSeq
+    }
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+    if (plan->options & ARESPLOT_START_MONITOR_OPT_COMPRESSION) {
+        header = ARESPLOT_COMPRESSED_HEADER_SIZE;
+        sample_cost += (num_values + 1) / 2; // 长度半字节 Length nibbles
+    }
+#endif
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+    if (plan->options & ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS) {
+        sample_cost += (num_values + 7) / 8; // 通道位图 Channel bitmap
+    }
+#endif
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+    // 批量帧在采样数达到批量大小或缓冲区装满时发送 A batch goes out at the batch size or when its buffer is full
+    per_frame = (ARESPLOT_BATCH_PAYLOAD_CAPACITY - header) / sample_cost;
+    if (per_frame > ARESPLOT_MONITOR_BATCH_SIZE) {
+        per_frame = ARESPLOT_MONITOR_BATCH_SIZE;
+    } else if (per_frame == 0) {
+        per_frame = 1;
+    }
+#endif
+    max_hz = (uint32_t)((uint64_t)ARESPLOT_LINK_BUDGET_BYTES_PER_SEC * per_frame / (6 + header + per_frame * sample_cost));
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+    {
+        // 低采样率下批量帧因最长累积时间提前发送, 每帧的采样更少 At low rates the latency bound sends batches early, with fewer samples each
+        uint32_t within_latency = 1 + (uint32_t)((uint64_t)max_hz * ARESPLOT_MONITOR_BATCH_MAX_LATENCY_MS / 1000U);
+        if (within_latency < per_frame) {
+            per_frame = within_latency;
+            max_hz = (uint32_t)((uint64_t)ARESPLOT_LINK_BUDGET_BYTES_PER_SEC * per_frame / (6 + header + per_frame * sample_cost));
+        }
+    }
+#endif
+#if ARESPLOT_ENABLE_ENVELOPE
+    if (plan->envelope_window) {
+        // 每个窗口累加 envelope_window 个采样 Each window folds envelope_window samples
+        uint64_t sample_hz = (uint64_t)max_hz * plan->envelope_window;
+        max_hz = (sample_hz > 0xFFFFFFFFU) ? 0xFFFFFFFFU : (uint32_t)sample_hz;
+    }
+#endif
+    return (max_hz > 0) ? max_hz : 1;
+}
+#endif
+
+/**
+ * @brief 按请求的采样率设置采样调度, 启用速率限制时不超过链路字节预算 (调用者负责临界区)
+ * Applies a requested sample rate, kept within the link byte budget when rate limiting is enabled (caller handles the critical section).
+ * @param rate_hz 请求的采样率 (Hz, 0: 默认采样率) Requested sample rate (Hz, 0: the default rate).
+ * @param achieved_rate_hz 输出: 实际采样率 (Hz) Out: achieved sample rate (Hz).
+ * @return ARES_STATUS_OK, 或无法达到请求的采样率时为 ARES_STATUS_ERROR_RATE_UNACHIEVABLE
+ * ARES_STATUS_OK, or ARES_STATUS_ERROR_RATE_UNACHIEVABLE when the requested rate cannot be met.
+ */
+static aresplot_ack_status_t apply_sample_rate(aresplot_ctx_t* ctx, uint32_t rate_hz, float* achieved_rate_hz) {
+    aresplot_ack_status_t status = ARES_STATUS_OK;
+#if ARESPLOT_ENABLE_RATE_LIMIT
+    uint32_t max_hz = 0xFFFFFFFFU; // 未监控时不限制 No limit while not monitoring
+
+    ctx->requested_rate_hz = rate_hz;
+    if (ctx->monitoring_active) {
+        max_hz = rate_limit_max_hz(&ctx->sample_plans[ctx->active_plan]);
+    }
+#endif
+
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+    uint32_t decimation;
+    if (rate_hz == 0) {
+        decimation = (uint32_t)((uint64_t)ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ * ARESPLOT_DEFAULT_SAMPLE_PERIOD_MS / 1000);
+    } else {
+        if (rate_hz > ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ) {
+            rate_hz = ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ; // 不能快于中断频率 Cannot sample faster than the ISR rate
+            status = ARES_STATUS_ERROR_RATE_UNACHIEVABLE;
+        }
+        decimation = (ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ + rate_hz / 2) / rate_hz; // 四舍五入 Round to nearest
+    }
+#if ARESPLOT_ENABLE_RATE_LIMIT
+    if (max_hz < ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ) {
+        uint32_t min_decimation = (ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ + max_hz - 1) / max_hz; // 向上取整 Round up
+        if (decimation < min_decimation) {
+            decimation = min_decimation; // 超出链路预算 Over the link budget
+            status = ARES_STATUS_ERROR_RATE_UNACHIEVABLE;
+        }
+    }
+#endif
+    set_isr_decimation(ctx, decimation);
+    *achieved_rate_hz = (float)ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ / (float)ctx->isr_decimation;
+#else
+    uint32_t num, den; // 周期 num / den 个调度时基单位 Period of num / den scheduler ticks
+    if (rate_hz == 0) {
+        num = ARESPLOT_SCHED_TICK_HZ / 1000U * ARESPLOT_DEFAULT_SAMPLE_PERIOD_MS;
+        den = 1;
+    } else {
+        if (rate_hz > ARESPLOT_SCHED_TICK_HZ) {
+            rate_hz = ARESPLOT_SCHED_TICK_HZ; // 每个时基单位最多采样一次 At most one sample per scheduler tick
+            status = ARES_STATUS_ERROR_RATE_UNACHIEVABLE;
+        }
+        num = ARESPLOT_SCHED_TICK_HZ;
+        den = rate_hz;
+    }
+#if ARESPLOT_ENABLE_RATE_LIMIT
+    if (max_hz < ARESPLOT_SCHED_TICK_HZ && (uint64_t)num * max_hz < (uint64_t)den * ARESPLOT_SCHED_TICK_HZ) {
+        num = ARESPLOT_SCHED_TICK_HZ; // 超出链路预算 Over the link budget
+        den = max_hz;
+        status = ARES_STATUS_ERROR_RATE_UNACHIEVABLE;
+    }
+#endif
+    set_sample_schedule(ctx, num, den);
+    *achieved_rate_hz = (float)ARESPLOT_SCHED_TICK_HZ /
+                        ((float)ctx->sched_period_int + (float)ctx->sched_period_rem / (float)ctx->sched_period_den);
+#endif
+    return status;
+}
+
+/**
+ * @brief 处理接收到的 CMD_START_MONITOR 命令 (变量列表已流式写入 rx_start_plan)
+ * Processes a received CMD_START_MONITOR command (the variable list has been streamed into rx_start_plan).
+ */
+static void handle_cmd_start_monitor(aresplot_ctx_t* ctx) {
+    uint8_t num_descs = ctx->rx_start_num_vars;
+    uint16_t num_vars_requested = ctx->rx_start_var; // 块描述展开后的变量数 Variables after expanding block descriptors
+    uint8_t options = ctx->rx_start_options;
+    uint16_t expected_payload_len = ctx->rx_start_vars_end;
+    uint8_t target_plan = ctx->rx_start_plan;
+    aresplot_ack_status_t status = ARES_STATUS_OK;
+#if ARESPLOT_ENABLE_RATE_LIMIT
+    float achieved_rate_hz = 0.0f;
+#endif
+
+    if (ctx->rx_payload_len > ctx->rx_start_vars_end) {
+        expected_payload_len++; // Options
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+        if (options & ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS) {
+            expected_payload_len = (uint16_t)(expected_payload_len + num_vars_requested);
+        }
+#endif
+#if ARESPLOT_ENABLE_ENVELOPE
+        if (options & ARESPLOT_START_MONITOR_OPT_ENVELOPE) {
+            expected_payload_len = (uint16_t)(expected_payload_len + 3); // WindowSamples + EnvelopeFlags
+        }
+#endif
+    }
+
+    if (ctx->rx_payload_len == 0 || num_descs == 0) {
+        num_vars_requested = 0;
+        status = ARES_STATUS_OK;
+    } else if (num_vars_requested > ARESPLOT_MAX_VARS_TO_MONITOR) {
+        status = ARES_STATUS_ERROR_MCU_BUSY_OR_LIMIT; 
+    } else if (ctx->rx_payload_len != expected_payload_len ||
+               (options & (uint8_t)~ARESPLOT_SUPPORTED_START_MONITOR_OPTIONS) != 0 ||
+               (ctx->rx_start_blocks && !(options & ARESPLOT_START_MONITOR_OPT_BLOCK_DESCRIPTORS))) {
+        status = ARES_STATUS_ERROR_INVALID_PAYLOAD; // 不支持的选项, 或未声明就使用块描述, 也视为无效 Unsupported options, or blocks without the option, are invalid too
+#if ARESPLOT_ENABLE_ENVELOPE
+    } else if ((options & ARESPLOT_START_MONITOR_OPT_ENVELOPE) &&
+               ((options & (ARESPLOT_START_MONITOR_OPT_RAW_ENCODING | ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS)) != 0 ||
+                ctx->rx_start_envelope_window == 0 ||
+                (ctx->rx_start_envelope_flags & (uint8_t)~ARESPLOT_ENVELOPE_FLAG_COUNT) != 0)) {
+        status = ARES_STATUS_ERROR_INVALID_PAYLOAD; // 包络只含 FP32 值, 且不能与分频组合 Envelopes hold FP32 values only and do not combine with dividers
+#endif
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    } else if ((options & ARESPLOT_START_MONITOR_OPT_PACKED_BOOLS) &&
+               (options & (ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS | ARESPLOT_START_MONITOR_OPT_ENVELOPE)) != 0) {
+        status = ARES_STATUS_ERROR_INVALID_PAYLOAD; // 分频与包络均按变量排列值 Dividers and envelopes both lay out one value per variable
+#endif
+    } else if (ctx->rx_start_error != ARES_STATUS_OK) {
+        status = (aresplot_ack_status_t)ctx->rx_start_error;
+    } else {
+        status = compile_sample_plan(&ctx->sample_plans[target_plan], (uint8_t)num_vars_requested, options);
+#if ARESPLOT_ENABLE_ENVELOPE
+        ctx->sample_plans[target_plan].envelope_window =
+            (options & ARESPLOT_START_MONITOR_OPT_ENVELOPE) ? ctx->rx_start_envelope_window : 0;
+        ctx->sample_plans[target_plan].envelope_flags = ctx->rx_start_envelope_flags;
+#endif
+    }
+
+    // 发布: 切换计划索引并递增配置代数, 旧配置下的采样不再发送
+    // Publish: swap the plan index and bump the config generation so samples taken under the old config are no longer sent
+    ARESPLOT_CRITICAL_ENTER(ctx); 
+    ctx->monitor_config_gen++;
+    if (status == ARES_STATUS_OK && num_vars_requested > 0) {
+        ctx->active_plan = target_plan;
+        ctx->num_monitor_vars = (uint8_t)num_vars_requested;
+        ctx->monitoring_active = 1;
+#if ARESPLOT_ENABLE_RATE_LIMIT
+        // 新布局的每采样字节数不同, 按请求的采样率重新限制 (同时重启调度) The new layout costs a different number of bytes per sample: limit the requested rate afresh (restarting the schedule)
+        (void)apply_sample_rate(ctx, ctx->requested_rate_hz, &achieved_rate_hz);
+#elif !ARESPLOT_ENABLE_ISR_SAMPLING
+        restart_sample_schedule(ctx);
+#endif
+    } else {
+        ctx->monitoring_active = 0;
+        ctx->num_monitor_vars = 0;
+    }
+    ARESPLOT_CRITICAL_EXIT(ctx);
+#if ARESPLOT_ENABLE_RATE_LIMIT
+    if (ctx->monitoring_active) {
+        queue_sample_rate_ack_response(ctx, ARESPLOT_CMD_START_MONITOR, status, achieved_rate_hz); // 报告限制后的采样率 Report the limited rate
+        return;
+    }
+#endif
+    queue_ack_response(ctx, ARESPLOT_CMD_START_MONITOR, status);
+}
+
+/**
+ * @brief 解析一个写变量项: 4 字节地址 (小端) + 1 字节类型 + 4 字节 FP32 值
+ * Parses one variable write entry: 4-byte address (little-endian) + 1-byte type + 4-byte FP32 value.
+ * @param p 写入项 (9 字节) The entry (9 bytes).
+ * @param addr 输出: 变量地址 Out: variable address.
+ * @param value 输出: 新值 Out: new value.
+ * @return 原始类型字节 Original type byte.
+ */
+static uint8_t parse_set_entry(const uint8_t* p, void** addr, float* value) {
+    uint32_t temp_addr = (uint32_t)p[0] |
+                        ((uint32_t)p[1] << 8) |
+                        ((uint32_t)p[2] << 16) |
+                        ((uint32_t)p[3] << 24);
+    *addr = ARESPLOT_ADDR_TO_PTR(temp_addr);
+    memcpy(value, &p[5], sizeof(float));
+    return p[4];
+}
+
+/**
+ * @brief 按原始类型写入变量 (调用者负责临界区, 并已确认类型受支持)
+ * Writes a variable at its original type (caller handles the critical section and has checked the type is supported).
+ * @param addr 变量地址 Variable address.
+ * @param original_type 原始类型 (不大于 ARES_TYPE_BOOL) Original type (at most ARES_TYPE_BOOL).
+ * @param float_val 新值 New value.
+ */
+static void write_variable(void* addr, uint8_t original_type, float float_val) {
+    switch (original_type) {
+        case ARES_TYPE_INT8:    *(volatile int8_t*)addr = (int8_t)float_val; break;
+        case ARES_TYPE_UINT8:   *(volatile uint8_t*)addr = (uint8_t)float_val; break;
+        case ARES_TYPE_INT16:   *(volatile int16_t*)addr = (int16_t)float_val; break;
+        case ARES_TYPE_UINT16:  *(volatile uint16_t*)addr = (uint16_t)float_val; break;
+        case ARES_TYPE_INT32:   *(volatile int32_t*)addr = (int32_t)float_val; break;
+        case ARES_TYPE_UINT32:  *(volatile uint32_t*)addr = (uint32_t)float_val; break;
+        case ARES_TYPE_FLOAT32: *(volatile float*)addr = float_val; break;
+        case ARES_TYPE_FLOAT64: *(volatile double*)addr = (double)float_val; break;
+        default:                *(volatile uint8_t*)addr = (float_val != 0.0f) ? 1 : 0; break; // ARES_TYPE_BOOL
+    }
+}
+
+/**
+ * @brief 处理接收到的 CMD_SET_VARIABLE 命令
+ * Processes a received CMD_SET_VARIABLE command.
+ */
+static void handle_cmd_set_variable(aresplot_ctx_t* ctx) {
+    if (ctx->rx_payload_len != 9) {
+        queue_ack_response(ctx, ARESPLOT_CMD_SET_VARIABLE, ARES_STATUS_ERROR_INVALID_PAYLOAD);
+        return;
+    }
+
+    void* addr;
+    float float_val;
+    uint8_t original_type = parse_set_entry(ctx->rx_payload_buffer, &addr, &float_val);
+
+    if (original_type > ARES_TYPE_BOOL) {
+        queue_ack_response(ctx, ARESPLOT_CMD_SET_VARIABLE, ARES_STATUS_ERROR_TYPE_UNSUPPORTED);
+        return;
+    }
+    ARESPLOT_CRITICAL_ENTER(ctx); 
+    write_variable(addr, original_type, float_val);
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    queue_ack_response(ctx, ARESPLOT_CMD_SET_VARIABLE, ARES_STATUS_OK);
+}
+
+#if ARESPLOT_ENABLE_SET_VARIABLES
+/**
+ * @brief 处理接收到的 CMD_SET_VARIABLES 命令: 全部项有效时在一个临界区内写入, 否则一项也不写
+ * Processes a received CMD_SET_VARIABLES command: if every entry is valid they are all written inside one critical
+ * section, otherwise none is.
+ * @note ACK 附带状态位图, 第 i 位置 1 表示第 i 项有效; Status 为 OK 时全部已写入。
+ * The ACK carries a status bitmap whose bit i is set when entry i is valid; with Status OK every entry has been written.
+ */
+static void handle_cmd_set_variables(aresplot_ctx_t* ctx) {
+    uint8_t bitmap[(ARESPLOT_SET_VARIABLES_MAX_ENTRIES + 7) / 8];
+    uint8_t count = ctx->rx_payload_len ? ctx->rx_payload_buffer[0] : 0;
+    aresplot_ack_status_t status = ARES_STATUS_OK;
+
+    if (count == 0 || ctx->rx_payload_len != 1 + 9 * (uint16_t)count) {
+        queue_ack_response(ctx, ARESPLOT_CMD_SET_VARIABLES, ARES_STATUS_ERROR_INVALID_PAYLOAD);
+        return;
+    }
+    // 接收缓冲区按 ARESPLOT_SET_VARIABLES_MAX_ENTRIES 分配, 更多项的帧在 LEN 处已被丢弃
+    // The RX buffer is sized for ARESPLOT_SET_VARIABLES_MAX_ENTRIES; frames with more entries were dropped at LEN
+
+    // 先检查全部项, 再统一写入 Check every entry first, then write them all
+    memset(bitmap, 0, sizeof(bitmap));
+    for (uint8_t i = 0; i < count; ++i) {
+        if (ctx->rx_payload_buffer[1 + 9 * i + 4] <= ARES_TYPE_BOOL) {
+            bitmap[i >> 3] |= (uint8_t)(1U << (i & 7));
+        } else {
+            status = ARES_STATUS_ERROR_TYPE_UNSUPPORTED;
+        }
+    }
+    if (status == ARES_STATUS_OK) {
+        ARESPLOT_CRITICAL_ENTER(ctx);
+        for (uint8_t i = 0; i < count; ++i) {
+            void* addr;
+            float float_val;
+            uint8_t original_type = parse_set_entry(&ctx->rx_payload_buffer[1 + 9 * i], &addr, &float_val);
+            write_variable(addr, original_type, float_val);
+        }
+        ARESPLOT_CRITICAL_EXIT(ctx);
+    }
+    queue_ack_response_extra(ctx, ARESPLOT_CMD_SET_VARIABLES, status, bitmap, (uint8_t)((count + 7) / 8));
+}
+#endif
+
+/**
+ * @brief 处理接收到的 CMD_SET_SAMPLE_RATE 命令
+ * Processes a received CMD_SET_SAMPLE_RATE command.
+ */
+static void handle_cmd_set_sample_rate(aresplot_ctx_t* ctx) {
+    if (ctx->rx_payload_len != 4) {
+        queue_ack_response(ctx, ARESPLOT_CMD_SET_SAMPLE_RATE, ARES_STATUS_ERROR_INVALID_PAYLOAD);
+        return;
+    }
+
+    uint32_t rate_hz;
+    uint8_t* p_payload = ctx->rx_payload_buffer; 
+
+    rate_hz = (uint32_t)p_payload[0] |
+              ((uint32_t)p_payload[1] << 8) |
+              ((uint32_t)p_payload[2] << 16) |
+              ((uint32_t)p_payload[3] << 24);
+
+    aresplot_ack_status_t status;
+    float achieved_rate_hz;
+
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    status = apply_sample_rate(ctx, rate_hz, &achieved_rate_hz);
+    ctx->monitor_config_gen++; // 批量内采样周期必须一致 All samples in a batch must share one period
+    ARESPLOT_CRITICAL_EXIT(ctx);
+
+    queue_sample_rate_ack_response(ctx, ARESPLOT_CMD_SET_SAMPLE_RATE, status, achieved_rate_hz);
+}
+
+#if ARESPLOT_ENABLE_CAPTURE
+/**
+ * @brief 处理接收到的 CMD_CAPTURE_ARM 命令
+ * Processes a received CMD_CAPTURE_ARM command.
+ * @note Payload: VarIndex(1) + Mode(1) + Threshold(FP32) + PreSamples(2) + PostSamples(2)。重新布防会丢弃尚未发完的抓取。
+ * Re-arming discards a capture that has not been fully sent.
+ */
+static void handle_cmd_capture_arm(aresplot_ctx_t* ctx) {
+    const uint8_t* p_payload = ctx->rx_payload_buffer;
+    aresplot_ack_status_t status = ARES_STATUS_OK;
+    uint8_t var_index;
+    uint8_t mode;
+    float threshold;
+    uint32_t pre_samples;
+    uint32_t post_samples;
+
+    if (ctx->rx_payload_len != 10) {
+        queue_ack_response(ctx, ARESPLOT_CMD_CAPTURE_ARM, ARES_STATUS_ERROR_INVALID_PAYLOAD);
+        return;
+    }
+    var_index = p_payload[0];
+    mode = p_payload[1];
+    memcpy(&threshold, &p_payload[2], sizeof(float));
+    pre_samples = (uint32_t)p_payload[6] | ((uint32_t)p_payload[7] << 8);
+    post_samples = (uint32_t)p_payload[8] | ((uint32_t)p_payload[9] << 8);
+
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    if (!ctx->monitoring_active || ctx->num_monitor_vars == 0) {
+        status = ARES_STATUS_ERROR_MCU_BUSY_OR_LIMIT; // 抓取使用当前监控配置 The capture uses the current monitor config
+    } else if (var_index >= ctx->num_monitor_vars || mode > ARESPLOT_CAPTURE_TRIGGER_FORCE) {
+        status = ARES_STATUS_ERROR_INVALID_PAYLOAD;
+    } else {
+        const aresplot_sample_plan_t* plan = &ctx->sample_plans[ctx->active_plan];
+        uint32_t capacity = ARESPLOT_CAPTURE_BUFFER_SIZE / plan->sample_bytes;
+
+        if (capacity > 0xFFFFU) {
+            capacity = 0xFFFFU;
+        }
+        if (pre_samples + 1 + post_samples > capacity) {
+            status = ARES_STATUS_ERROR_MCU_BUSY_OR_LIMIT; // 抓取缓冲区不够大 The capture buffer is too small
+        } else {
+            ctx->capture_sample_bytes = plan->sample_bytes;
+            ctx->capture_capacity = (uint16_t)capacity;
+            ctx->capture_pre = (uint16_t)pre_samples;
+            ctx->capture_total = (uint16_t)(pre_samples + 1 + post_samples);
+            ctx->capture_post_left = (uint16_t)post_samples;
+            ctx->capture_write_slot = 0;
+            ctx->capture_filled = 0;
+            ctx->capture_send_index = 0;
+            ctx->capture_mode = mode;
+            ctx->capture_threshold = threshold;
+            ctx->capture_has_last = 0;
+            ctx->capture_flags = 0;
+            ctx->capture_trigger_offset = plan_value_offset(plan, var_index, &ctx->capture_trigger_mask);
+            ctx->capture_trigger_type = (plan->options & ARESPLOT_START_MONITOR_OPT_RAW_ENCODING) ?
+                                     plan->value_types[var_index] : (uint8_t)ARES_TYPE_FLOAT32;
+            if (ctx->capture_trigger_mask != 0xFF) {
+                ctx->capture_trigger_type = ARES_TYPE_BOOL; // 打包的 BOOL 是位图中的一位 A packed BOOL is one bit of the bitmap
+            }
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+            ctx->capture_period_ns = 1000000000U / ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ; // 每次调用都抓取 Every call is captured
+#else
+            ctx->capture_period_ns = ctx->sched_period_ns;
+#endif
+            ctx->capture_config_gen = ctx->monitor_config_gen;
+            ctx->capture_id++;
+            ctx->capture_state = ARES_CAPTURE_ARMED;
+        }
+    }
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    queue_ack_response(ctx, ARESPLOT_CMD_CAPTURE_ARM, status);
+}
+
+/**
+ * @brief 处理接收到的 CMD_CAPTURE_CANCEL 命令, 取消布防或停止发送当前抓取
+ * Processes a received CMD_CAPTURE_CANCEL command, disarming or abandoning the current capture.
+ */
+static void handle_cmd_capture_cancel(aresplot_ctx_t* ctx) {
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    ctx->capture_state = ARES_CAPTURE_IDLE;
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    queue_ack_response(ctx, ARESPLOT_CMD_CAPTURE_CANCEL, ARES_STATUS_OK);
+}
+#endif
+
+#if ARESPLOT_ENABLE_STATS
+/**
+ * @brief 处理接收到的 CMD_GET_STATS 命令, 标记统计应答等待发送 (应答为 CMD_STATS, 成功时不发送 ACK)
+ * Processes a received CMD_GET_STATS command, flagging the statistics reply (answered with CMD_STATS; no ACK on success).
+ */
+static void handle_cmd_get_stats(aresplot_ctx_t* ctx) {
+    uint8_t flags = (ctx->rx_payload_len == 1) ? ctx->rx_payload_buffer[0] : 0;
+
+    if (ctx->rx_payload_len > 1 || (flags & (uint8_t)~ARESPLOT_GET_STATS_FLAG_RESET) != 0) {
+        queue_ack_response(ctx, ARESPLOT_CMD_GET_STATS, ARES_STATUS_ERROR_INVALID_PAYLOAD);
+        return;
+    }
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    ctx->stats_reset_requested = (uint8_t)((flags & ARESPLOT_GET_STATS_FLAG_RESET) != 0);
+    ctx->stats_pending = 1;
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    ARESPLOT_NOTIFY(ctx);
+}
+#endif
+
+#if ARESPLOT_ENABLE_TIME_SYNC
+/**
+ * @brief 处理接收到的 CMD_TIME_SYNC 命令, 记录收到的时刻并标记应答等待发送 (应答为 CMD_TIME_SYNC_REPLY, 成功时不发送 ACK)
+ * Processes a received CMD_TIME_SYNC command, recording the arrival tick and flagging the reply
+ * (answered with CMD_TIME_SYNC_REPLY; no ACK on success).
+ * @note 未发出的上一个应答被新请求取代。 An unsent previous reply is superseded by the new request.
+ */
+static void handle_cmd_time_sync(aresplot_ctx_t* ctx) {
+    uint32_t rx_tick = time_sync_get_tick(ctx);
+
+    if (ctx->rx_payload_len != ARESPLOT_TIME_SYNC_TOKEN_SIZE) {
+        queue_ack_response(ctx, ARESPLOT_CMD_TIME_SYNC, ARES_STATUS_ERROR_INVALID_PAYLOAD);
+        return;
+    }
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    memcpy(ctx->time_sync_token, ctx->rx_payload_buffer, ARESPLOT_TIME_SYNC_TOKEN_SIZE);
+    ctx->time_sync_rx_tick = rx_tick;
+    ctx->time_sync_pending = 1;
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    ARESPLOT_NOTIFY(ctx);
+}
+#endif
+
+
+/**
+ * @brief 命令成功时是否以 ACK 应答 Whether a command is answered with an ACK when it succeeds
+ * CMD_GET_STATS 与 CMD_TIME_SYNC 以各自的应答帧回复, 不占用 ACK 队列, 队列已满时照常执行;
+ * 其参数错误的 ACK 与 BUSY 一样放入溢出槽。
+ * CMD_GET_STATS and CMD_TIME_SYNC answer with their own reply frames and take no ACK queue slot, so they still run
+ * while the queue is full; the ACK for an invalid payload goes to the overflow slot just like BUSY.
+ */
+static uint8_t cmd_replies_with_ack(uint8_t cmd) {
+#if ARESPLOT_ENABLE_STATS
+    if (cmd == ARESPLOT_CMD_GET_STATS) {
+        return 0;
+    }
+#endif
+#if ARESPLOT_ENABLE_TIME_SYNC
+    if (cmd == ARESPLOT_CMD_TIME_SYNC) {
+        return 0;
+    }
+#endif
+    (void)cmd;
+    return 1;
+}
+
+/**
+ * @brief 处理一个完整的、校验通过的帧
+ * Processes a complete, checksum-verified frame.
+ */
+static void process_received_frame(aresplot_ctx_t* ctx) {
+    switch (ctx->rx_cmd) {
+        case ARESPLOT_CMD_START_MONITOR:
+            handle_cmd_start_monitor(ctx);
+            break;
+        case ARESPLOT_CMD_SET_VARIABLE:
+            handle_cmd_set_variable(ctx);
+            break;
+        case ARESPLOT_CMD_SET_SAMPLE_RATE:
+            handle_cmd_set_sample_rate(ctx);
+            break;
+#if ARESPLOT_ENABLE_CAPTURE
+        case ARESPLOT_CMD_CAPTURE_ARM:
+            handle_cmd_capture_arm(ctx);
+            break;
+        case ARESPLOT_CMD_CAPTURE_CANCEL:
+            handle_cmd_capture_cancel(ctx);
+            break;
+#endif
+#if ARESPLOT_ENABLE_STATS
+        case ARESPLOT_CMD_GET_STATS:
+            handle_cmd_get_stats(ctx);
+            break;
+#endif
+#if ARESPLOT_ENABLE_SET_VARIABLES
+        case ARESPLOT_CMD_SET_VARIABLES:
+            handle_cmd_set_variables(ctx);
+            break;
+#endif
+#if ARESPLOT_ENABLE_TIME_SYNC
+        case ARESPLOT_CMD_TIME_SYNC:
+            handle_cmd_time_sync(ctx);
+            break;
+#endif
+        default:
+            queue_ack_response(ctx, ctx->rx_cmd, ARES_STATUS_ERROR_UNKNOWN_CMD);
+            break;
+    }
+}
+
+// --- 公共 API 函数实现 Public API Function Implementations ---
+
+void aresplot_ctx_init(aresplot_ctx_t* ctx, const aresplot_callbacks_t* callbacks) {
+    memset(ctx, 0, sizeof(*ctx)); // 实例可能未清零 (栈上或不初始化的 RAM 段) The instance may not be zeroed (stack or a no-init RAM section)
+    // 全零即空闲状态 (ARES_RX_STATE_WAIT_SOP, ARES_CAPTURE_IDLE, 空队列, 未监控), 下面只设置非零的默认值
+    // All zero is the idle state (ARES_RX_STATE_WAIT_SOP, ARES_CAPTURE_IDLE, empty queues, not monitoring); only
+    // non-zero defaults are set below
+    ctx->callbacks = *callbacks;
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+    set_sample_schedule(ctx, ARESPLOT_SCHED_TICK_HZ / 1000U * ARESPLOT_DEFAULT_SAMPLE_PERIOD_MS, 1);
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+    ctx->codec_need_key = 1;
+#endif
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+    set_isr_decimation(ctx, (uint32_t)((uint64_t)ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ * ARESPLOT_DEFAULT_SAMPLE_PERIOD_MS / 1000));
+#endif
+#if ARESPLOT_ENABLE_STATS
+    ctx->stats_reset_ms = ARESPLOT_GET_TICK_MS(ctx); // 统计窗口从此刻开始 The stats window starts now
+#endif
+#if ARESPLOT_ENABLE_TIME_SYNC
+    ctx->time_last_tick = time_sync_get_tick(ctx);
+#endif
+}
+
+/**
+ * @brief 帧头 (及标签) 接收完毕, 准备接收 Payload
+ * The frame header (and tag) has arrived; gets ready for the payload.
+ */
+static void rx_begin_payload(aresplot_ctx_t* ctx) {
+    if (ctx->rx_cmd == ARESPLOT_CMD_START_MONITOR) {
+        start_monitor_rx_begin(ctx); // 变量列表边接收边解析 The variable list is parsed as it arrives
+    }
+    if (ctx->rx_payload_len == 0) {
+        ctx->rx_state = ARES_RX_STATE_WAIT_CHECKSUM;
+    } else {
+        ctx->rx_payload_idx = 0;
+        ctx->rx_state = ARES_RX_STATE_WAIT_PAYLOAD;
+    }
+}
+
+/**
+ * @brief 接收状态机处理一个字节
+ * Runs one byte through the receive state machine.
+ * @param byte 接收到的字节 The received byte.
+ */
+static void rx_feed_byte(aresplot_ctx_t* ctx, uint8_t byte) {
+    uint8_t dropped = 0;
+
+    switch (ctx->rx_state) {
+        case ARES_RX_STATE_WAIT_SOP:
+            if (byte == ARESPLOT_SOP) {
+                ctx->rx_state = ARES_RX_STATE_WAIT_CMD;
+                ctx->rx_checksum_calculated = 0; 
+            }
+            break;
+
+        case ARES_RX_STATE_WAIT_CMD:
+            ctx->rx_cmd = byte;
+            ctx->rx_checksum_calculated ^= byte;
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+            ctx->rx_tagged = (uint8_t)((byte & ARESPLOT_CMD_FLAG_TAGGED) != 0);
+            ctx->rx_cmd = (uint8_t)(byte & ~ARESPLOT_CMD_FLAG_TAGGED);
+#endif
+            ctx->rx_state = ARES_RX_STATE_WAIT_LEN1;
+            break;
+
+        case ARES_RX_STATE_WAIT_LEN1:
+            ctx->rx_payload_len = byte; // LSB
+            ctx->rx_checksum_calculated ^= byte;
+            ctx->rx_state = ARES_RX_STATE_WAIT_LEN2;
+            break;
+
+        case ARES_RX_STATE_WAIT_LEN2:
+            ctx->rx_payload_len |= ((uint16_t)byte << 8); // MSB
+            ctx->rx_checksum_calculated ^= byte;
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+            if (ctx->rx_tagged) {
+                // 标签不计入命令的 Payload, 缺少标签的帧直接丢弃 The tag is not part of the command payload; a frame without one is dropped
+                if (ctx->rx_payload_len == 0 ||
+                    (uint16_t)(ctx->rx_payload_len - 1) > ((ctx->rx_cmd == ARESPLOT_CMD_START_MONITOR) ? ARESPLOT_START_MONITOR_MAX_PAYLOAD
+                                                                                               : sizeof(ctx->rx_payload_buffer))) {
+                    ctx->rx_state = ARES_RX_STATE_WAIT_SOP;
+                    break;
+                }
+                ctx->rx_state = ARES_RX_STATE_WAIT_TAG;
+                break;
+            }
+#endif
+            if (ctx->rx_payload_len > ((ctx->rx_cmd == ARESPLOT_CMD_START_MONITOR) ? ARESPLOT_START_MONITOR_MAX_PAYLOAD
+                                                                             : sizeof(ctx->rx_payload_buffer))) { 
+                ctx->rx_state = ARES_RX_STATE_WAIT_SOP; 
+                break;
+            }
+            rx_begin_payload(ctx);
+            break;
+
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+        case ARES_RX_STATE_WAIT_TAG:
+            ctx->rx_tag = byte;
+            ctx->rx_checksum_calculated ^= byte;
+            ctx->rx_payload_len--;
+            rx_begin_payload(ctx);
+            break;
+#endif
+
+        case ARES_RX_STATE_WAIT_PAYLOAD:
+            if (ctx->rx_cmd == ARESPLOT_CMD_START_MONITOR) {
+                start_monitor_rx_byte(ctx, ctx->rx_payload_idx++, byte);
+            } else {
+                ctx->rx_payload_buffer[ctx->rx_payload_idx++] = byte; 
+            }
+            ctx->rx_checksum_calculated ^= byte;
+            if (ctx->rx_payload_idx >= ctx->rx_payload_len) {
+                ctx->rx_state = ARES_RX_STATE_WAIT_CHECKSUM;
+            }
+            break;
+
+        case ARES_RX_STATE_WAIT_CHECKSUM:
+            if (byte == ctx->rx_checksum_calculated) { 
+                ctx->rx_state = ARES_RX_STATE_WAIT_EOP;
+            } else { 
+#if ARESPLOT_ENABLE_STATS
+                ctx->stats.rx_checksum_errors++;
+#endif
+                queue_ack_response(ctx, ctx->rx_cmd, ARES_STATUS_ERROR_CHECKSUM); 
+                if (ctx->rx_cmd == ARESPLOT_CMD_START_MONITOR) {
+                    start_monitor_rx_end(ctx, 1);
+                }
+                ctx->rx_state = ARES_RX_STATE_WAIT_SOP; 
+            }
+            break;
+
+        case ARES_RX_STATE_WAIT_EOP:
+            if (byte != ARESPLOT_EOP) {
+                dropped = 1;
+            } else if (ctx->ack_queue_count >= ARESPLOT_ACK_QUEUE_SIZE && cmd_replies_with_ack(ctx->rx_cmd)) {
+                // ACK 队列已满: 不执行命令, 回复 BUSY 由上位机稍后重发, 队列中已执行命令的 ACK 保持不变
+                // ACK queue full: the command is not executed and is answered with BUSY for the host to resend later;
+                // the ACKs of executed commands in the queue stay intact
+                queue_ack_response(ctx, ctx->rx_cmd, ARES_STATUS_ERROR_BUSY);
+                dropped = 1;
+            } else {
+                process_received_frame(ctx);
+            }
+            if (ctx->rx_cmd == ARESPLOT_CMD_START_MONITOR) {
+                start_monitor_rx_end(ctx, dropped);
+            }
+            ctx->rx_state = ARES_RX_STATE_WAIT_SOP;
+            break;
+
+        default: 
+            ctx->rx_state = ARES_RX_STATE_WAIT_SOP;
+            break;
+    }
+}
+
+void aresplot_ctx_rx_feed_byte(aresplot_ctx_t* ctx, uint8_t byte) {
+#if ARESPLOT_ENABLE_STATS_CYCLES
+    uint32_t start = ARESPLOT_GET_CYCLES(ctx);
+    rx_feed_byte(ctx, byte);
+    stats_record_cycles(&ctx->stats.rx_cycles, ARESPLOT_GET_CYCLES(ctx) - start);
+#else
+    rx_feed_byte(ctx, byte);
+#endif
+}
+
+/**
+ * @brief 计算一段数据的异或校验和, 对齐后按 32 位字累积
+ * Computes the XOR checksum of a block, accumulating 32-bit words once aligned.
+ * @param data 数据 Data.
+ * @param len 字节数 Number of bytes.
+ * @return 所有字节的异或 XOR of all bytes.
+ */
+static uint8_t rx_xor_block(const uint8_t* data, uint16_t len) {
+    uint32_t acc = 0;
+    // 异或与字节位置无关, 未对齐的头尾字节直接并入低字节 XOR ignores byte lanes, so unaligned head and tail bytes simply go into the low byte
+    while (len > 0 && ((uintptr_t)data & 3U) != 0) {
+        acc ^= *data++;
+        len--;
+    }
+    for (; len >= 4; len = (uint16_t)(len - 4), data += 4) {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word)); // 已对齐, 编译为单次加载 Aligned, compiles to a single load
+        acc ^= word;
+    }
+    while (len > 0) {
+        acc ^= *data++;
+        len--;
+    }
+    acc ^= acc >> 16;
+    acc ^= acc >> 8;
+    return (uint8_t)acc;
+}
+
+/**
+ * @brief 按块处理一个接收到的数据包 (见 aresplot_rx_feed_packet())
+ * Runs a received packet through the receiver in blocks (see aresplot_rx_feed_packet()).
+ * @param data 数据包 Packet data.
+ * @param length 数据包长度 Packet length.
+ */
+static void rx_feed_packet(aresplot_ctx_t* ctx, const uint8_t* data, uint16_t length) {
+    const uint8_t* end = data + length;
+
+    while (data != end) {
+        aresplot_rx_state_t state = ctx->rx_state;
+
+        if (state == ARES_RX_STATE_WAIT_SOP) {
+            // 块搜索跳过帧间的无关字节 A block search skips junk between frames
+            const uint8_t* sop = (const uint8_t*)memchr(data, ARESPLOT_SOP, (size_t)(end - data));
+            if (sop == NULL) {
+                return;
+            }
+            data = sop;
+            rx_feed_byte(ctx, *data++);
+        } else if (state == ARES_RX_STATE_WAIT_PAYLOAD) {
+            // 本包中属于 Payload 的部分一次处理 The part of this packet that belongs to the payload is handled at once
+            uint16_t n = (uint16_t)(ctx->rx_payload_len - ctx->rx_payload_idx);
+            if (n > (uint16_t)(end - data)) {
+                n = (uint16_t)(end - data);
+            }
+            ctx->rx_checksum_calculated ^= rx_xor_block(data, n);
+            if (ctx->rx_cmd == ARESPLOT_CMD_START_MONITOR) {
+                for (uint16_t i = 0; i < n; ++i) {
+                    start_monitor_rx_byte(ctx, ctx->rx_payload_idx++, data[i]);
+                }
+            } else {
+                memcpy(&ctx->rx_payload_buffer[ctx->rx_payload_idx], data, n);
+                ctx->rx_payload_idx = (uint16_t)(ctx->rx_payload_idx + n);
+            }
+            data += n;
+            if (ctx->rx_payload_idx >= ctx->rx_payload_len) {
+                ctx->rx_state = ARES_RX_STATE_WAIT_CHECKSUM;
+            }
+        } else {
+            rx_feed_byte(ctx, *data++); // 帧头和帧尾 Frame header and trailer
+        }
+    }
+}
+
+void aresplot_ctx_rx_feed_packet(aresplot_ctx_t* ctx, const uint8_t* data, uint16_t length) {
+#if ARESPLOT_ENABLE_STATS_CYCLES
+    uint32_t start = ARESPLOT_GET_CYCLES(ctx);
+    rx_feed_packet(ctx, data, length);
+    stats_record_cycles(&ctx->stats.rx_cycles, ARESPLOT_GET_CYCLES(ctx) - start);
+#else
+    rx_feed_packet(ctx, data, length);
+#endif
+}
+
+
+#if ARESPLOT_ENABLE_SENDER_LAYOUT
+/**
+ * @brief 监控配置改变后, 从已发布的采样计划复制发送端布局 (调用者负责临界区)
+ * Copies the sender layout from the published plan after a monitor config change (caller handles the critical section).
+ * @param plan 已发布的采样计划 The published sampling plan.
+ * @param config_gen 当前监控配置代数 Current monitor config generation.
+ */
+static void sync_sender_layout(aresplot_ctx_t* ctx, const aresplot_sample_plan_t* plan, uint8_t config_gen) {
+    if (config_gen == ctx->layout_config_gen) {
+        return;
+    }
+    ctx->layout_config_gen = config_gen;
+    ctx->layout_options = plan->options;
+#if ARESPLOT_ENABLE_PACKED_BOOLS
+    ctx->layout_num_values = plan->num_wire_values; // 打包的 BOOL 位图按字节计 The packed BOOL bitmap counts per byte
+#else
+    ctx->layout_num_values = plan->num_values;
+#endif
+    memcpy(ctx->layout_value_formats, plan->value_formats, ctx->layout_num_values);
+#if ARESPLOT_ENABLE_ENVELOPE
+    if (plan->envelope_window) {
+        ctx->layout_num_values = envelope_num_values(plan);
+        memset(ctx->layout_value_formats, 4, ctx->layout_num_values); // 包络值均为 FP32 (异或) Envelope values are all FP32 (XOR)
+    }
+#endif
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+    memcpy(ctx->layout_dividers, plan->dividers, plan->num_values);
+    memset(ctx->channel_countdown, 0, sizeof(ctx->channel_countdown)); // 第一个采样包含所有变量 The first sample carries every variable
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+    ctx->codec_need_key = 1; // 新布局总是从关键帧开始 A new layout always starts with a keyframe
+#endif
+}
+#endif
+
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+#if ARESPLOT_MONITOR_BATCH_SIZE == 1
+/**
+ * @brief 当前采样中是否至少有一个变量到期
+ * Checks whether at least one variable is due in the current sample.
+ * @return 1: 有变量到期, 0: 没有 1 if a variable is due, 0 otherwise.
+ */
+static uint8_t channel_any_due(aresplot_ctx_t* ctx) {
+    for (uint8_t i = 0; i < ctx->layout_num_values; ++i) {
+        if (ctx->channel_countdown[i] == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+/**
+ * @brief 写入当前采样的通道位图 (bit i 对应变量 i, 置位表示该变量的值在本采样中)
+ * Writes the channel bitmap of the current sample (bit i is variable i; set means its value is in this sample).
+ * @param out 输出缓冲区 Output buffer.
+ * @return 位图字节数 Number of bitmap bytes.
+ */
+static uint16_t write_channel_mask(aresplot_ctx_t* ctx, uint8_t* out) {
+    uint16_t mask_bytes = (uint16_t)((ctx->layout_num_values + 7) / 8);
+
+    memset(out, 0, mask_bytes);
+    for (uint8_t i = 0; i < ctx->layout_num_values; ++i) {
+        if (ctx->channel_countdown[i] == 0) {
+            out[i >> 3] |= (uint8_t)(1U << (i & 7));
+        }
+    }
+    return mask_bytes;
+}
+
+/**
+ * @brief 采样发出 (或加入批量) 后推进各变量的分频计数
+ * Advances the per-variable divider counters once a sample has been sent (or added to the batch).
+ */
+static void advance_channel_countdown(aresplot_ctx_t* ctx) {
+    for (uint8_t i = 0; i < ctx->layout_num_values; ++i) {
+        ctx->channel_countdown[i] = ctx->channel_countdown[i] ? (uint8_t)(ctx->channel_countdown[i] - 1) : (uint8_t)(ctx->layout_dividers[i] - 1);
+    }
+}
+#endif
+
+#if ARESPLOT_ENABLE_COMPRESSION
+/**
+ * @brief 决定下一帧是否为关键帧 (在每个压缩帧开始时调用一次)
+ * Decides whether the next frame is a keyframe (call once at the start of each compressed frame).
+ * @return 1: 关键帧, 0: 普通帧 1 for a keyframe, 0 otherwise.
+ */
+static uint8_t codec_begin_frame(aresplot_ctx_t* ctx) {
+    if (ctx->codec_need_key || ctx->codec_samples_since_key >= ARESPLOT_COMPRESSION_KEYFRAME_INTERVAL) {
+        ctx->codec_need_key = 0;
+        ctx->codec_samples_since_key = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 以上一个编码的采样为参考压缩一个采样
+ * Compresses one sample against the last coded sample.
+ * @param values 采样值 (FP32 或原始宽度) Sample values (FP32 or original width).
+ * @param mask 通道位图, 只编码置位的值; NULL 表示全部 Channel bitmap, only set values are coded; NULL means all.
+ * @param key 是否以零为参考 (关键帧的第一个采样) Whether to code against zero (first sample of a keyframe).
+ * @param out 输出缓冲区, 至少 ARESPLOT_MAX_CODED_SAMPLE_BYTES 字节 Output buffer, at least ARESPLOT_MAX_CODED_SAMPLE_BYTES bytes.
+ * @return 写入的字节数 Number of bytes written.
+ * @note 输出为 ceil(M/2) 字节的长度半字节 (M 为编码的值数量, 第 j 个值位于第 j/2 字节, 偶数 j 为低半字节), 随后依次为各值的残差低位字节。
+ * 残差为异或 (浮点) 或 zigzag 差分 (整数), 只保留到最高的非零字节。未编码的值保持原参考。假设MCU为小端序。
+ * The output is ceil(M/2) bytes of length nibbles (M coded values, value j in byte j/2, low nibble for even j), followed by the low
+ * bytes of each value's residual. The residual is an XOR (floats) or a zigzag delta (integers), trimmed to its highest non-zero byte.
+ * Values that are not coded keep their reference. Assumes a little-endian MCU.
+ */
+static uint16_t codec_encode_sample(aresplot_ctx_t* ctx, const uint8_t* values, const uint8_t* mask, uint8_t key, uint8_t* out) {
+    uint8_t num_values = ctx->layout_num_values;
+    uint8_t num_coded = num_values;
+    uint8_t coded = 0;
+    uint16_t out_idx;
+    uint16_t offset = 0;
+
+    if (mask) {
+        num_coded = 0;
+        for (uint8_t i = 0; i < num_values; ++i) {
+            num_coded += (mask[i >> 3] >> (i & 7)) & 1;
+        }
+    }
+    out_idx = (uint16_t)((num_coded + 1) / 2);
+    if (key) {
+        memset(ctx->codec_prev, 0, sizeof(ctx->codec_prev));
+    }
+    memset(out, 0, out_idx);
+
+    for (uint8_t i = 0; i < num_values; ++i) {
+        uint8_t format = ctx->layout_value_formats[i];
+        uint8_t width = format & ARESPLOT_VALUE_FORMAT_WIDTH_MASK;
+        const uint8_t* cur = &values[offset];
+        uint8_t* prev = &ctx->codec_prev[offset];
+        uint8_t residual[ARESPLOT_MAX_VALUE_SIZE];
+        uint8_t len = width;
+
+        if (mask && !((mask[i >> 3] >> (i & 7)) & 1)) {
+            offset += width;
+            continue;
+        }
+
+        if (format & ARESPLOT_VALUE_FORMAT_DELTA) {
+            uint32_t c = 0, p = 0, zz;
+            int32_t delta;
+            uint8_t shift = (uint8_t)(32 - width * 8);
+            memcpy(&c, cur, width);
+            memcpy(&p, prev, width);
+            delta = (int32_t)((c - p) << shift) >> shift; // 按值宽度符号扩展 Sign-extend from the value width
+            zz = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+            memcpy(residual, &zz, sizeof(zz));
+        } else {
+            for (uint8_t j = 0; j < width; ++j) {
+                residual[j] = cur[j] ^ prev[j];
+            }
+        }
+        while (len > 0 && residual[len - 1] == 0) {
+            len--;
+        }
+        out[coded >> 1] |= (uint8_t)(len << ((coded & 1) * 4));
+        coded++;
+        memcpy(&out[out_idx], residual, len);
+        out_idx += len;
+        memcpy(prev, cur, width);
+        offset += width;
+    }
+    if (ctx->codec_samples_since_key < 0xFFFF) {
+        ctx->codec_samples_since_key++;
+    }
+    return out_idx;
+}
+#endif
+
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+/**
+ * @brief 编码后采样的最大字节数 Upper bound of the encoded sample size.
+ * @param values_len 采样值字节数 Number of value bytes.
+ * @return 最大字节数 Max number of bytes.
+ */
+static uint16_t max_encoded_sample_len(aresplot_ctx_t* ctx, uint16_t values_len) {
+#if ARESPLOT_ENABLE_COMPRESSION
+    if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_COMPRESSION) {
+        values_len += (uint16_t)((ctx->layout_num_values + 1) / 2);
+    }
+#endif
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+    if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS) {
+        values_len += (uint16_t)((ctx->layout_num_values + 7) / 8);
+    }
+#endif
+    (void)ctx;
+    return values_len;
+}
+#endif
+
+/**
+ * @brief 按当前布局编码一个采样: 通道位图 (分频时), 随后为压缩或原样的值
+ * Encodes one sample in the current layout: the channel bitmap (with dividers), then the compressed or plain values.
+ * @param values 采样值 Sample values.
+ * @param values_len 采样值字节数 Number of value bytes.
+ * @param key 压缩时是否以零为参考 Whether to code against zero when compressing.
+ * @param out 输出缓冲区, 至少 max_encoded_sample_len() 字节 Output buffer, at least max_encoded_sample_len() bytes.
+ * @return 写入的字节数 Number of bytes written.
+ */
+static uint16_t encode_monitor_sample(aresplot_ctx_t* ctx, const uint8_t* values, uint16_t values_len, uint8_t key, uint8_t* out) {
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+    const uint8_t* mask = NULL;
+    uint16_t out_idx = 0;
+
+    if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS) {
+        mask = out;
+        out_idx = write_channel_mask(ctx, out);
+    }
+#if ARESPLOT_ENABLE_COMPRESSION
+    if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_COMPRESSION) {
+        return (uint16_t)(out_idx + codec_encode_sample(ctx, values, mask, key, &out[out_idx]));
+    }
+#endif
+    if (mask) {
+        uint16_t offset = 0;
+        for (uint8_t i = 0; i < ctx->layout_num_values; ++i) {
+            uint8_t width = ctx->layout_value_formats[i] & ARESPLOT_VALUE_FORMAT_WIDTH_MASK;
+            if ((mask[i >> 3] >> (i & 7)) & 1) {
+                memcpy(&out[out_idx], &values[offset], width);
+                out_idx += width;
+            }
+            offset += width;
+        }
+        return out_idx;
+    }
+#elif ARESPLOT_ENABLE_COMPRESSION
+    if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_COMPRESSION) {
+        return codec_encode_sample(ctx, values, NULL, key, out);
+    }
+#endif
+    (void)ctx;
+    (void)key;
+    memcpy(out, values, values_len);
+    return values_len;
+}
+
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+/**
+ * @brief 读取所有监控变量的当前值, 按当前编码方式写入输出缓冲区
+ * Reads the current value of every monitored variable and writes it in the current encoding to the output buffer.
+ * @param out_values 输出缓冲区, 至少 ARESPLOT_MAX_SAMPLE_BYTES 字节 Output buffer, at least ARESPLOT_MAX_SAMPLE_BYTES bytes.
+ * @param out_config_gen 输出采样时的监控配置代数 Outputs the monitor config generation the sample belongs to.
+ * @return 写入的字节数, 监控未激活时为0 Number of bytes written, 0 if monitoring is not active.
+ */
+static uint16_t sample_monitor_values(aresplot_ctx_t* ctx, uint8_t* out_values, uint8_t* out_config_gen) {
+    uint8_t plan_index;
+
+    // 临界区内只取计划索引, 不拷贝变量表; 编译新计划时不会覆盖该索引的计划
+    // Only the plan index is taken under the lock, no table copy; compiling a new plan never overwrites this one
+    ARESPLOT_CRITICAL_ENTER(ctx); 
+    if (!ctx->monitoring_active || ctx->num_monitor_vars == 0) {
+        ARESPLOT_CRITICAL_EXIT(ctx);
+        return 0;
+    }
+    plan_index = ctx->active_plan;
+    if (ctx->rx_start_locked_plan == (uint8_t)(plan_index + 1)) {
+        ARESPLOT_CRITICAL_EXIT(ctx);
+        return 0; // 该计划正被 CMD_START_MONITOR 覆盖 This plan is being overwritten by a CMD_START_MONITOR
+    }
+    ctx->reading_plan = plan_index;
+    *out_config_gen = ctx->monitor_config_gen;
+#if ARESPLOT_ENABLE_SENDER_LAYOUT
+    sync_sender_layout(ctx, &ctx->sample_plans[plan_index], ctx->monitor_config_gen);
+#endif
+    ARESPLOT_CRITICAL_EXIT(ctx); 
+
+    return run_sample_plan(&ctx->sample_plans[plan_index], out_values);
+}
+#endif
+
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+// 批量 Payload: 低 RAM 配置下直接位于发送缓冲区中帧头之后 Batch payload; in the low-RAM profile it sits in the TX buffer right after the frame header
+#if ARESPLOT_ENABLE_LOW_RAM
+#define ARESPLOT_BATCH_PAYLOAD(ctx) (&(ctx)->tx_assembly_buffer[4])
+#else
+#define ARESPLOT_BATCH_PAYLOAD(ctx) ((ctx)->batch_payload_buffer)
+#endif
+
+/**
+ * @brief 发送当前累积的批量帧 (如果有)
+ * Sends the currently accumulated batch frame (if any).
+ * @return 1: 批量已发送或为空, 0: 无空闲发送缓冲区, 批量被保留 1 if the batch was sent or is empty, 0 if no TX buffer is free and the batch is kept.
+ */
+static uint8_t flush_monitor_batch(aresplot_ctx_t* ctx) {
+    uint8_t* payload = ARESPLOT_BATCH_PAYLOAD(ctx);
+    if (ctx->batch_sample_count == 0) {
+        return 1;
+    }
+    if (ctx->batch_config_gen != ctx->monitor_config_gen) {
+        // 旧变量集的数据不可发送, 发送端布局也可能已经改变 Data of the old variable set must not be sent, and the sender layout may have changed too
+        ctx->batch_sample_count = 0;
+        ctx->batch_payload_len = 0;
+        return 1;
+    }
+    payload[8] = ctx->batch_sample_count;
+#if ARESPLOT_ENABLE_COMPRESSION
+    if (ctx->batch_cmd == ARESPLOT_CMD_MONITOR_DATA_COMPRESSED) {
+        payload[10] = ctx->codec_frame_seq;
+    }
+#endif
+#if ARESPLOT_ENABLE_SEQUENCE
+    if (ctx->batch_cmd == ARESPLOT_CMD_MONITOR_DATA_BATCH && (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_SEQUENCE)) {
+        payload[ARESPLOT_BATCH_HEADER_SIZE] = ctx->stream_frame_seq;
+    }
+#endif
+#if ARESPLOT_ENABLE_LOW_RAM
+    // Payload 已在发送缓冲区中, 补上帧头即可发送 The payload is already in the TX buffer; complete the header and send
+    (void)tx_frame_start_in_buffer(ctx, ctx->tx_assembly_buffer, ctx->batch_cmd);
+    ctx->batch_sample_count = 0; // 先清零, 组帧中不会再次发送本批量 Cleared first so assembling the frame cannot send this batch again
+    tx_frame_end_in_place(ctx, ctx->batch_payload_len);
+#else
+    if (!assemble_and_send_frame_internal(ctx, ctx->batch_cmd, payload, ctx->batch_payload_len)) {
+        return 0;
+    }
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+    if (ctx->batch_cmd == ARESPLOT_CMD_MONITOR_DATA_COMPRESSED) {
+        ctx->codec_frame_seq++;
+    }
+#endif
+#if ARESPLOT_ENABLE_SEQUENCE
+    if (ctx->batch_cmd == ARESPLOT_CMD_MONITOR_DATA_BATCH) {
+        ctx->stream_frame_seq++;
+    }
+#endif
+    ctx->batch_sample_count = 0;
+    ctx->batch_payload_len = 0;
+    return 1;
+}
+
+/**
+ * @brief 将一个采样追加到批量帧, 满足条件时发送
+ * Appends one sample to the batch, sending the batch when it is complete.
+ * @param timestamp 采样时间戳 (毫秒) Sample timestamp (ms).
+ * @param period_ns 采样周期 (纳秒) Sampling period (ns).
+ * @param config_gen 采样所属的监控配置代数 Monitor config generation the sample belongs to.
+ * @param contiguous 该采样是否紧接批量中上一个采样 (间隔恰为一个周期) Whether the sample directly follows the previous one in the batch (exactly one period later).
+ * @param values 采样值 (FP32) Sample values (FP32).
+ * @param values_len 采样值字节数 Number of value bytes.
+ * @return 1: 采样已加入批量, 0: 需先发送已有批量但无空闲发送缓冲区, 采样未被接受
+ * 1 if the sample was added, 0 if the pending batch had to be sent first but no TX buffer is free (the sample was not taken).
+ * @note 批量内第 i 个采样的时间戳由 Timestamp + i * SamplePeriod 推导。若采样不连续
+ * (例如主循环卡顿或环形缓冲区溢出) 或批量缓冲区已满, 则先发送已有批量再开始新批量, 因此推导出的时间戳始终准确。
+ * 属于旧监控配置的未发送批量会被丢弃。
+ * The timestamp of sample i in a batch is derived as Timestamp + i * SamplePeriod. If a sample is not contiguous
+ * (e.g. the main loop stalled or the ring overflowed) or the batch buffer is full, the pending batch is sent first and a new one is started,
+ * so derived timestamps are always exact. An unsent batch belonging to an old monitor config is discarded.
+ */
+static uint8_t append_sample_to_monitor_batch(aresplot_ctx_t* ctx, uint32_t timestamp, uint32_t period_ns, uint8_t config_gen,
+                                              uint8_t contiguous, const uint8_t* values, uint16_t values_len) {
+    uint8_t* payload = ARESPLOT_BATCH_PAYLOAD(ctx);
+    uint16_t coded_bound = max_encoded_sample_len(ctx, values_len); // 编码后采样的最大字节数 Max bytes of the coded sample
+    uint8_t key = 0;
+
+    if (ctx->batch_sample_count > 0) {
+        if (config_gen != ctx->batch_config_gen) {
+            ctx->batch_sample_count = 0; // 旧变量集的数据不可发送 Data of the old variable set must not be sent
+            ctx->batch_payload_len = 0;
+        } else if (!contiguous || ctx->batch_sample_count >= ARESPLOT_MONITOR_BATCH_SIZE ||
+                   ctx->batch_payload_len + coded_bound > ARESPLOT_BATCH_PAYLOAD_CAPACITY) {
+            if (!flush_monitor_batch(ctx)) {
+                return 0; // 已满的批量 (上次发送时无空闲缓冲区) 也在此重试 A full batch left over from a busy pool is retried here too
+            }
+        }
+    }
+
+    if (ctx->batch_sample_count == 0) {
+        ctx->batch_base_time_ms = timestamp;
+        ctx->batch_config_gen = config_gen;
+        payload[0] = (uint8_t)(timestamp & 0xFF);
+        payload[1] = (uint8_t)((timestamp >> 8) & 0xFF);
+        payload[2] = (uint8_t)((timestamp >> 16) & 0xFF);
+        payload[3] = (uint8_t)((timestamp >> 24) & 0xFF);
+        payload[4] = (uint8_t)(period_ns & 0xFF);
+        payload[5] = (uint8_t)((period_ns >> 8) & 0xFF);
+        payload[6] = (uint8_t)((period_ns >> 16) & 0xFF);
+        payload[7] = (uint8_t)((period_ns >> 24) & 0xFF);
+        ctx->batch_cmd = ARESPLOT_CMD_MONITOR_DATA_BATCH;
+        ctx->batch_payload_len = ARESPLOT_BATCH_HEADER_SIZE;
+#if ARESPLOT_ENABLE_SEQUENCE
+        if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_SEQUENCE) {
+            ctx->batch_payload_len++; // FrameSeq 在发送时填写 FrameSeq is filled in when sent
+        }
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+        if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_COMPRESSION) {
+            key = codec_begin_frame(ctx);
+            payload[9] = key ? ARESPLOT_COMPRESSED_FLAG_KEYFRAME : 0;
+            ctx->batch_cmd = ARESPLOT_CMD_MONITOR_DATA_COMPRESSED;
+            ctx->batch_payload_len = ARESPLOT_COMPRESSED_HEADER_SIZE; // FrameSeq 在发送时填写 FrameSeq is filled in when sent
+        }
+#endif
+    }
+
+    // 分频时没有变量到期的采样只含通道位图, 保持批内时间戳连续
+    // With dividers a sample where no variable is due carries only the bitmap, keeping batch timestamps contiguous
+    ctx->batch_payload_len += encode_monitor_sample(ctx, values, values_len, key, &payload[ctx->batch_payload_len]);
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+    if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS) {
+        advance_channel_countdown(ctx);
+    }
+#endif
+    ctx->batch_sample_count++;
+
+    if (ctx->batch_sample_count >= ARESPLOT_MONITOR_BATCH_SIZE ||
+        (uint32_t)(timestamp - ctx->batch_base_time_ms) >= ARESPLOT_MONITOR_BATCH_MAX_LATENCY_MS) {
+        (void)flush_monitor_batch(ctx); // 失败时批量保留到下一个采样 On failure the batch is kept until the next sample
+    }
+    return 1;
+}
+#else
+/**
+ * @brief 以单个 CMD_MONITOR_DATA 帧发送一个采样
+ * Sends one sample as a single CMD_MONITOR_DATA frame.
+ * @param timestamp 采样时间戳 (毫秒) Sample timestamp (ms).
+ * @param values 采样值 (FP32) Sample values (FP32).
+ * @param values_len 采样值字节数 Number of value bytes.
+ * @return 1: 已发送或已排队, 0: 无空闲发送缓冲区 1 if sent or queued, 0 if no TX buffer is free.
+ */
+static uint8_t send_monitor_data_frame(aresplot_ctx_t* ctx, uint32_t timestamp, const uint8_t* values, uint16_t values_len) {
+#if !ARESPLOT_MONITOR_FRAME_IN_PLACE
+    uint8_t monitor_data_buffer[ARESPLOT_MAX_DATA_HEADER_SIZE + ARESPLOT_MAX_CODED_SAMPLE_BYTES];
+#endif
+    uint8_t* monitor_data_payload;
+    uint8_t cmd = ARESPLOT_CMD_MONITOR_DATA;
+    uint16_t header_len = 4;
+    uint16_t payload_len;
+    uint8_t key = 0;
+
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+    if ((ctx->layout_options & ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS) && !channel_any_due(ctx)) {
+        advance_channel_countdown(ctx); // 没有变量到期, 不发送空帧 No variable is due: no empty frame is sent
+        return 1;
+    }
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+    if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_COMPRESSION) {
+        cmd = ARESPLOT_CMD_MONITOR_DATA_COMPRESSED;
+    }
+#endif
+#if ARESPLOT_MONITOR_FRAME_IN_PLACE
+    // 先取得缓冲区再编码: 无空闲缓冲区时压缩参考保持不变 Take the buffer before encoding, so a full pool leaves the compression reference untouched
+    monitor_data_payload = tx_frame_begin_in_place(ctx, cmd);
+    if (monitor_data_payload == NULL) {
+        return 0;
+    }
+#else
+    monitor_data_payload = monitor_data_buffer;
+#endif
+
+    monitor_data_payload[0] = (uint8_t)(timestamp & 0xFF);
+    monitor_data_payload[1] = (uint8_t)((timestamp >> 8) & 0xFF);
+    monitor_data_payload[2] = (uint8_t)((timestamp >> 16) & 0xFF);
+    monitor_data_payload[3] = (uint8_t)((timestamp >> 24) & 0xFF);
+#if ARESPLOT_ENABLE_SEQUENCE
+    if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_SEQUENCE) {
+        monitor_data_payload[4] = ctx->stream_frame_seq; // 压缩帧改用其 FrameSeq Compressed frames use their FrameSeq instead
+        header_len = 5;
+    }
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+    if (cmd == ARESPLOT_CMD_MONITOR_DATA_COMPRESSED) {
+        // 单个采样的压缩帧: SampleCount 为 1, SamplePeriodNs 未使用 (为 0)
+        // Single-sample compressed frame: SampleCount is 1 and SamplePeriodNs is unused (0)
+        key = codec_begin_frame(ctx);
+        memset(&monitor_data_payload[4], 0, 4);
+        monitor_data_payload[8] = 1;
+        monitor_data_payload[9] = key ? ARESPLOT_COMPRESSED_FLAG_KEYFRAME : 0;
+        monitor_data_payload[10] = ctx->codec_frame_seq;
+        header_len = ARESPLOT_COMPRESSED_HEADER_SIZE;
+    }
+#endif
+    payload_len = (uint16_t)(header_len + encode_monitor_sample(ctx, values, values_len, key, &monitor_data_payload[header_len]));
+
+#if ARESPLOT_MONITOR_FRAME_IN_PLACE
+    tx_frame_end_in_place(ctx, payload_len);
+#else
+    if (!assemble_and_send_frame_internal(ctx, cmd, monitor_data_payload, payload_len)) {
+#if ARESPLOT_ENABLE_COMPRESSION
+        if (cmd == ARESPLOT_CMD_MONITOR_DATA_COMPRESSED) {
+            ctx->codec_need_key = 1; // 参考已包含未发送的采样 The reference now includes an unsent sample
+        }
+#endif
+        return 0;
+    }
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+    if (cmd == ARESPLOT_CMD_MONITOR_DATA_COMPRESSED) {
+        ctx->codec_frame_seq++;
+    }
+#endif
+#if ARESPLOT_ENABLE_SEQUENCE
+    if (cmd == ARESPLOT_CMD_MONITOR_DATA) {
+        ctx->stream_frame_seq++;
+    }
+#endif
+#if ARESPLOT_ENABLE_CHANNEL_DIVIDERS
+    if (ctx->layout_options & ARESPLOT_START_MONITOR_OPT_CHANNEL_DIVIDERS) {
+        advance_channel_countdown(ctx);
+    }
+#endif
+    return 1;
+}
 #endif
 
-    // 1. 检查是否有挂起的ACK，并准备发送 (在临界区外组装，减少临界区时间)
-    // Check for pending ACK and prepare for sending (assemble outside critical section to reduce time in cs)
-    aresplot_user_critical_enter();
-    if (g_ack_pending) {
-        ack_cmd_to_process = g_ack_cmd_to_ack;
-        status_to_process = g_ack_status_to_send;
-        process_ack = 1;
-        g_ack_pending = 0; // 清除挂起标志 Clear pending flag
+#if ARESPLOT_ENABLE_CAPTURE
+/**
+ * @brief 按触发变量的编码类型读取其值
+ * Reads the trigger variable from a sample according to its wire type.
+ */
+static float capture_read_trigger_value(aresplot_ctx_t* ctx, const uint8_t* sample) {
+    const uint8_t* p = sample + ctx->capture_trigger_offset;
+
+    switch (ctx->capture_trigger_type) {
+        case ARES_TYPE_INT8:   { int8_t v;   memcpy(&v, p, sizeof(v)); return (float)v; }
+        case ARES_TYPE_UINT8:  { uint8_t v;  memcpy(&v, p, sizeof(v)); return (float)v; }
+        case ARES_TYPE_INT16:  { int16_t v;  memcpy(&v, p, sizeof(v)); return (float)v; }
+        case ARES_TYPE_UINT16: { uint16_t v; memcpy(&v, p, sizeof(v)); return (float)v; }
+        case ARES_TYPE_INT32:  { int32_t v;  memcpy(&v, p, sizeof(v)); return (float)v; }
+        case ARES_TYPE_UINT32: { uint32_t v; memcpy(&v, p, sizeof(v)); return (float)v; }
+        case ARES_TYPE_FLOAT64: { double v;  memcpy(&v, p, sizeof(v)); return (float)v; }
+        case ARES_TYPE_BOOL:   return (p[0] & ctx->capture_trigger_mask) ? 1.0f : 0.0f;
+        default:               { float v;    memcpy(&v, p, sizeof(v)); return v; }
     }
-    aresplot_user_critical_exit();
+}
+
+/**
+ * @brief 判断触发条件 Evaluates the trigger condition.
+ */
+static uint8_t capture_trigger_hit(aresplot_ctx_t* ctx, float value) {
+    switch (ctx->capture_mode) {
+        case ARESPLOT_CAPTURE_TRIGGER_RISING:
+            return (uint8_t)(ctx->capture_has_last && ctx->capture_last_value < ctx->capture_threshold && value >= ctx->capture_threshold);
+        case ARESPLOT_CAPTURE_TRIGGER_FALLING:
+            return (uint8_t)(ctx->capture_has_last && ctx->capture_last_value > ctx->capture_threshold && value <= ctx->capture_threshold);
+        case ARESPLOT_CAPTURE_TRIGGER_ABOVE:
+            return (uint8_t)(value > ctx->capture_threshold);
+        case ARESPLOT_CAPTURE_TRIGGER_BELOW:
+            return (uint8_t)(value < ctx->capture_threshold);
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief 返回抓取缓冲区中下一个写入的槽位, 由调用者填入采样后调用 capture_commit_sample()
+ * Returns the next capture slot; the caller fills in the sample and then calls capture_commit_sample().
+ * @note 仅在 ARMED/TRIGGERED 状态下由采样端调用 Called by the sampler only while ARMED/TRIGGERED.
+ */
+static uint8_t* capture_next_slot(aresplot_ctx_t* ctx) {
+    return &ctx->capture_buffer[(uint32_t)ctx->capture_write_slot * ctx->capture_sample_bytes];
+}
+
+/**
+ * @brief 提交刚写入的抓取采样, 判断触发并在触发后采样采集完后冻结缓冲区
+ * Commits the sample just written, checks the trigger and freezes the buffer once the post-trigger samples are in.
+ * @param timestamp_ms 采样时间戳 (毫秒) Sample timestamp (ms).
+ * @param contiguous 采样是否紧接上一次采样 Whether the sample directly follows the previous one.
+ */
+static void capture_commit_sample(aresplot_ctx_t* ctx, uint32_t timestamp_ms, uint8_t contiguous) {
+    float value = capture_read_trigger_value(ctx, capture_next_slot(ctx));
+    uint16_t slot = ctx->capture_write_slot;
+
+    if (!contiguous && ctx->capture_filled > 0) {
+        ctx->capture_flags |= ARESPLOT_CAPTURE_FLAG_TIMING_GAPS;
+    }
+    if (++ctx->capture_write_slot >= ctx->capture_capacity) {
+        ctx->capture_write_slot = 0;
+    }
+    if (ctx->capture_filled < ctx->capture_capacity) {
+        ctx->capture_filled++;
+    }
+
+    if (ctx->capture_state == ARES_CAPTURE_ARMED) {
+        // 触发前深度填满后才判断触发 The trigger is only evaluated once the pre-trigger depth is filled
+        if (ctx->capture_filled > ctx->capture_pre && capture_trigger_hit(ctx, value)) {
+            ctx->capture_trigger_slot = slot;
+            ctx->capture_trigger_time_ms = timestamp_ms;
+            ctx->capture_state = ARES_CAPTURE_TRIGGERED;
+        }
+    } else if (ctx->capture_post_left > 0) {
+        ctx->capture_post_left--;
+    }
+    if (ctx->capture_state == ARES_CAPTURE_TRIGGERED && ctx->capture_post_left == 0) {
+        ARESPLOT_MEMORY_BARRIER(); // 缓冲区写完后再交给发送端 Hand the buffer to the sender only after it is fully written
+        ctx->capture_state = ARES_CAPTURE_DONE;
+    }
+    ctx->capture_last_value = value;
+    ctx->capture_has_last = 1;
+}
+
+/**
+ * @brief 发送冻结的抓取中的下一块, 发完最后一块后回到空闲状态
+ * Sends the next block of the frozen capture, returning to idle after the last one.
+ */
+static void send_capture_block(aresplot_ctx_t* ctx) {
+    uint8_t header[ARESPLOT_CAPTURE_HEADER_SIZE];
+    uint16_t per_block = (uint16_t)((ARESPLOT_SHARED_BUFFER_SIZE - 6 - ARESPLOT_CAPTURE_HEADER_SIZE) / ctx->capture_sample_bytes);
+    uint16_t count = (uint16_t)(ctx->capture_total - ctx->capture_send_index);
+    uint16_t slot;
+    uint16_t first_span;
+    uint8_t flags = ctx->capture_flags;
+
+    // 单个采样超过发送缓冲区时每块一个采样 (帧分块发送) One sample per block when a sample exceeds the TX buffer (the frame is chunked)
+    if (per_block == 0) {
+        per_block = 1;
+    } else if (per_block > 255) {
+        per_block = 255;
+    }
+    if (count > per_block) {
+        count = per_block;
+    }
+    if (ctx->capture_send_index + count == ctx->capture_total) {
+        flags |= ARESPLOT_CAPTURE_FLAG_LAST;
+    }
+
+    memcpy(&header[0], &ctx->capture_trigger_time_ms, sizeof(uint32_t));
+    memcpy(&header[4], &ctx->capture_period_ns, sizeof(uint32_t));
+    header[8] = ctx->capture_id;
+    header[9] = flags;
+    header[10] = (uint8_t)(ctx->capture_pre & 0xFF);
+    header[11] = (uint8_t)(ctx->capture_pre >> 8);
+    header[12] = (uint8_t)(ctx->capture_send_index & 0xFF);
+    header[13] = (uint8_t)(ctx->capture_send_index >> 8);
+    header[14] = (uint8_t)count;
+
+    if (!tx_frame_begin(ctx, ARESPLOT_CMD_CAPTURE_DATA, (uint16_t)(ARESPLOT_CAPTURE_HEADER_SIZE + count * ctx->capture_sample_bytes))) {
+        return;
+    }
+    tx_frame_write(ctx, header, sizeof(header));
+    // 采样直接从环形缓冲区写出, 回绕时分两段 Samples are written straight from the ring, in two spans when it wraps
+    // 第一个要发送的采样位于触发采样之前 PreSamples 个槽位 The first sample to send is PreSamples slots before the trigger sample
+    slot = (uint16_t)(((uint32_t)ctx->capture_trigger_slot + ctx->capture_capacity - ctx->capture_pre + ctx->capture_send_index) % ctx->capture_capacity);
+    first_span = (uint16_t)(ctx->capture_capacity - slot);
+    if (first_span > count) {
+        first_span = count;
+    }
+    tx_frame_write(ctx, &ctx->capture_buffer[(uint32_t)slot * ctx->capture_sample_bytes], (uint16_t)(first_span * ctx->capture_sample_bytes));
+    if (first_span < count) {
+        tx_frame_write(ctx, &ctx->capture_buffer[0], (uint16_t)((count - first_span) * ctx->capture_sample_bytes));
+    }
+    tx_frame_end(ctx);
+
+    ctx->capture_send_index = (uint16_t)(ctx->capture_send_index + count);
+    if (flags & ARESPLOT_CAPTURE_FLAG_LAST) {
+        ctx->capture_state = ARES_CAPTURE_IDLE;
+    }
+}
+
+/**
+ * @brief 服务触发抓取: 配置改变时取消, 冻结后逐块发送
+ * Services the triggered capture: cancels it on a config change, streams it out once frozen.
+ * @return 本次调用是否应跳过连续数据流 1 if the continuous stream should be skipped on this call.
+ */
+static uint8_t service_capture(aresplot_ctx_t* ctx) {
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    if (ctx->capture_state != ARES_CAPTURE_IDLE && ctx->capture_config_gen != ctx->monitor_config_gen) {
+        ctx->capture_state = ARES_CAPTURE_IDLE; // 布防后监控配置或采样率已改变 The monitor config or rate changed after arming
+    }
+    ARESPLOT_CRITICAL_EXIT(ctx);
+
+    if (ctx->capture_state != ARES_CAPTURE_DONE) {
+        return 0;
+    }
+    ARESPLOT_MEMORY_BARRIER(); // 看到 DONE 之后再读取缓冲区 Read the buffer only after seeing DONE
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+    // 先发出布防前未发完的批量, 保证时间戳有序 Flush the batch left over from before arming first so timestamps stay ordered
+    if (!flush_monitor_batch(ctx)) {
+        return 1;
+    }
+#endif
+    send_capture_block(ctx);
+    return 1;
+}
+#endif
+
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+void aresplot_ctx_sample_now(aresplot_ctx_t* ctx) {
+    uint8_t head;
+    aresplot_sample_slot_t* slot;
+#if ARESPLOT_ENABLE_ENVELOPE
+    const aresplot_sample_plan_t* plan;
+#endif
+
+    // 此处不进入临界区: 新采样计划在未发布的缓冲区中编译, 并在会屏蔽本中断的临界区内发布, 因此读取到的计划总是完整且一致的
+    // No critical section here: a new sampling plan is compiled into the unpublished buffer and published inside a
+    // critical section that masks this ISR, so the plan read below is always complete and consistent.
+    if (!ctx->monitoring_active || ctx->num_monitor_vars == 0) {
+        return;
+    }
+#if ARESPLOT_ENABLE_CAPTURE
+    // 抓取期间每次调用都写入抓取缓冲区 (不抽取), 连续数据流暂停 While capturing, every call goes into the capture buffer (no decimation) and the stream pauses
+    if (ctx->capture_state != ARES_CAPTURE_IDLE && ctx->capture_config_gen == ctx->monitor_config_gen) {
+        if (ctx->capture_state != ARES_CAPTURE_DONE) {
+            (void)run_sample_plan(&ctx->sample_plans[ctx->active_plan], capture_next_slot(ctx));
+            capture_commit_sample(ctx, ARESPLOT_GET_TICK_MS(ctx), 1);
+            if (ctx->capture_state == ARES_CAPTURE_DONE) {
+                ARESPLOT_NOTIFY(ctx); // 缓冲区已冻结, 等待发送 Buffer frozen, waiting to be sent
+            }
+        }
+        return;
+    }
+#endif
+    if (++ctx->isr_call_count < ctx->isr_decimation) {
+        return;
+    }
+    ctx->isr_call_count = 0;
+#if ARESPLOT_ENABLE_ENVELOPE
+    plan = &ctx->sample_plans[ctx->active_plan];
+    if (plan->envelope_window) {
+        // 每个采样累加到窗口, 只有完整的窗口进入环形缓冲区 Every sample is folded into the window; only full windows enter the ring
+        uint8_t values[ARESPLOT_MAX_VARS_TO_MONITOR * 4];
+        (void)run_sample_plan(plan, values);
+        if (!envelope_fold(ctx, plan, values, ARESPLOT_GET_TICK_MS(ctx), ctx->monitor_config_gen, 1)) {
+            return;
+        }
+    }
+#endif
+    ctx->isr_sample_seq++;
+
+    head = ctx->sample_ring_head;
+    if ((uint8_t)(head - ctx->sample_ring_tail) >= ARESPLOT_SAMPLE_RING_SIZE) {
+#if ARESPLOT_ENABLE_STATS
+        ctx->stats.samples_dropped++;
+#endif
+#if ARESPLOT_ENABLE_ENVELOPE
+        ctx->envelope_count = 0; // 窗口随之丢弃 The window is dropped with it
+#endif
+        return; // 环形缓冲区满, 丢弃该采样 (序号仍递增, 消费端据此断开批量) Ring full: drop the sample (the seq still advances so the consumer breaks the batch)
+    }
+
+    slot = &ctx->sample_ring[head & (ARESPLOT_SAMPLE_RING_SIZE - 1)];
+    slot->seq = ctx->isr_sample_seq;
+    slot->config_gen = ctx->monitor_config_gen;
+#if ARESPLOT_ENABLE_ENVELOPE
+    if (plan->envelope_window) {
+        slot->values_len = envelope_take(ctx, plan, slot->values, &slot->timestamp_ms);
+    } else
+#endif
+    {
+        slot->timestamp_ms = ARESPLOT_GET_TICK_MS(ctx);
+        slot->values_len = run_sample_plan(&ctx->sample_plans[ctx->active_plan], slot->values);
+    }
+
+    ARESPLOT_MEMORY_BARRIER(); // 先写完槽位再发布 Publish the slot only after it is fully written
+    ctx->sample_ring_head = (uint8_t)(head + 1);
+    if (head == ctx->sample_ring_tail) {
+        ARESPLOT_NOTIFY(ctx); // 环形缓冲区由空变为非空 The ring went from empty to non-empty
+    }
+}
+
+/**
+ * @brief 将环形缓冲区中所有可用的采样组帧发送
+ * Drains every available sample from the ring buffer into TX frames.
+ */
+static void drain_sample_ring(aresplot_ctx_t* ctx) {
+    uint8_t tail = ctx->sample_ring_tail;
+    uint8_t head;
+    uint8_t config_gen;
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+    uint32_t period_ns;
+#endif
+
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    head = ctx->sample_ring_head;
+    config_gen = ctx->monitor_config_gen;
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+    period_ns = ctx->isr_sample_period_ns;
+#if ARESPLOT_ENABLE_ENVELOPE
+    if (ctx->sample_plans[ctx->active_plan].envelope_window) {
+        // 槽位中是包络窗口, 间隔为整个窗口 The slots hold envelope windows, spaced a whole window apart
+        uint64_t window_ns = (uint64_t)period_ns * ctx->sample_plans[ctx->active_plan].envelope_window;
+        period_ns = (window_ns > 0xFFFFFFFFU) ? 0xFFFFFFFFU : (uint32_t)window_ns;
+    }
+#endif
+#endif
+#if ARESPLOT_ENABLE_SENDER_LAYOUT
+    sync_sender_layout(ctx, &ctx->sample_plans[ctx->active_plan], config_gen);
+#endif
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    ARESPLOT_MEMORY_BARRIER(); // 读取 head 之后再读取槽位 Read slots only after reading head
+
+    while (tail != head) {
+        const aresplot_sample_slot_t* slot = &ctx->sample_ring[tail & (ARESPLOT_SAMPLE_RING_SIZE - 1)];
+
+        // 丢弃属于旧监控配置的采样 Drop samples that belong to an old monitor config
+        if (slot->config_gen == config_gen) {
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+            uint8_t taken = append_sample_to_monitor_batch(ctx, slot->timestamp_ms, period_ns, config_gen,
+                                                           (uint8_t)(slot->seq == ctx->ring_last_seq + 1), slot->values, slot->values_len);
+#else
+            uint8_t taken = send_monitor_data_frame(ctx, slot->timestamp_ms, slot->values, slot->values_len);
+#endif
+            if (!taken) {
+                break; // 无空闲发送缓冲区: 采样留在环形缓冲区中 No free TX buffer: the sample stays in the ring
+            }
+            ctx->ring_last_seq = slot->seq;
+        }
+
+        ARESPLOT_MEMORY_BARRIER(); // 读完槽位再释放 Release the slot only after it has been read
+        tail = (uint8_t)(tail + 1);
+        ctx->sample_ring_tail = tail;
+    }
+}
+#endif
+
+
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+/**
+ * @brief 发送主循环的一个采样; 无空闲发送缓冲区时丢弃
+ * Sends one main-loop sample; drops it when no TX buffer is free.
+ * @param period_ns 与上一采样的间隔 (纳秒) Spacing from the previous sample (ns).
+ * @param contiguous 该采样是否紧接上一个采样 Whether the sample directly follows the previous one.
+ */
+static void send_polled_sample(aresplot_ctx_t* ctx, uint32_t timestamp_ms, uint32_t period_ns, uint8_t config_gen,
+                               uint8_t contiguous, const uint8_t* values, uint16_t values_len) {
+#if ARESPLOT_MONITOR_BATCH_SIZE > 1
+    if (!append_sample_to_monitor_batch(ctx, timestamp_ms, period_ns, config_gen, contiguous, values, values_len)) {
+        // 无空闲发送缓冲区, 采样被丢弃: 下一个采样不再与批量连续
+        // No free TX buffer, the sample is dropped: the next sample no longer continues the batch
+        ARESPLOT_CRITICAL_ENTER(ctx);
+        ctx->sched_contiguous = 0;
+        ARESPLOT_CRITICAL_EXIT(ctx);
+#if ARESPLOT_ENABLE_STATS
+        ctx->stats.samples_dropped++;
+#endif
+    }
+#else
+    (void)config_gen;
+    (void)contiguous;
+    (void)period_ns;
+    if (!send_monitor_data_frame(ctx, timestamp_ms, values, values_len)) {
+        // 无空闲发送缓冲区, 采样被丢弃 No free TX buffer: the sample is dropped
+#if ARESPLOT_ENABLE_STATS
+        ctx->stats.samples_dropped++;
+#endif
+    }
+#endif
+}
+
+#if ARESPLOT_ENABLE_ENVELOPE
+/**
+ * @brief 把主循环的一个采样累加到包络窗口, 窗口满时发送
+ * Folds one main-loop sample into the envelope window and sends the window once it is full.
+ * @param period_ns 采样周期 (纳秒) Sample period (ns).
+ * @note 不连续的采样先发出未完成的窗口 (Count 小于窗口长度), 窗口因此从不跨越间断。
+ * A non-contiguous sample first flushes the unfinished window (its Count is below the window length), so a window never spans a gap.
+ */
+static void envelope_polled_sample(aresplot_ctx_t* ctx, const aresplot_sample_plan_t* plan, uint32_t timestamp_ms,
+                                   uint32_t period_ns, uint8_t config_gen, uint8_t contiguous, const uint8_t* values) {
+    uint8_t out[ARESPLOT_MAX_SAMPLE_BYTES];
+    uint64_t window_ns = (uint64_t)period_ns * plan->envelope_window;
+    uint32_t window_period_ns = (window_ns > 0xFFFFFFFFU) ? 0xFFFFFFFFU : (uint32_t)window_ns;
+    uint32_t window_start;
+    uint16_t out_len;
+
+    if (!contiguous && ctx->envelope_count > 0 && ctx->envelope_config_gen == config_gen) {
+        out_len = envelope_take(ctx, plan, out, &window_start);
+        send_polled_sample(ctx, window_start, window_period_ns, config_gen, ctx->envelope_contiguous, out, out_len);
+    }
+    if (envelope_fold(ctx, plan, values, timestamp_ms, config_gen, contiguous)) {
+        uint8_t window_contiguous = ctx->envelope_contiguous;
+        out_len = envelope_take(ctx, plan, out, &window_start);
+        send_polled_sample(ctx, window_start, window_period_ns, config_gen, window_contiguous, out, out_len);
+    }
+}
+#endif
+#endif
+
+/**
+ * @brief aresplot_service_tick() 的处理过程
+ * Body of aresplot_service_tick().
+ */
+static void service_tick(aresplot_ctx_t* ctx) {
+    uint8_t ack_payload[3 + ARESPLOT_ACK_EXTRA_MAX];
+
+#if ARESPLOT_ENABLE_ASYNC_TX
+    // 0. 重试之前因用户忙而保留的帧 Retry frames held back because the user reported busy
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    tx_pump_queue(ctx);
+    ARESPLOT_CRITICAL_EXIT(ctx);
+#endif
+
+    // 1. 按顺序发送队列中的ACK (在临界区外组装，减少临界区时间)
+    // Send the queued ACKs in order (assemble outside critical section to reduce time in cs)
+    // 无空闲发送缓冲区时其余ACK留在队列中 The remaining ACKs stay queued while no TX buffer is free
+    for (;;) {
+        uint16_t ack_payload_len;
+
+        ARESPLOT_CRITICAL_ENTER(ctx);
+        if (ctx->ack_queue_count == 0 || !tx_buffer_available(ctx)) {
+            ARESPLOT_CRITICAL_EXIT(ctx);
+            break;
+        }
+        {
+            const aresplot_ack_entry_t* entry = &ctx->ack_queue[ctx->ack_queue_head];
+            ack_payload[0] = entry->cmd;
+            ack_payload[1] = entry->status;
+            ack_payload_len = 2;
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+            if (entry->cmd & ARESPLOT_CMD_FLAG_TAGGED) {
+                ack_payload[ack_payload_len++] = entry->tag;
+            }
+#endif
+            memcpy(&ack_payload[ack_payload_len], entry->extra, entry->extra_len); // 实际采样率或状态位图 Achieved rate or status bitmap
+            ack_payload_len = (uint16_t)(ack_payload_len + entry->extra_len);
+        }
+        ctx->ack_queue_head = (uint8_t)((ctx->ack_queue_head + 1) % ARESPLOT_ACK_QUEUE_SIZE);
+        ctx->ack_queue_count--;
+        if (ctx->ack_overflow_pending) {
+            // 溢出槽的回复排到队尾, 保持回复顺序 The overflow reply joins the tail, keeping replies in order
+            aresplot_ack_entry_t* tail = &ctx->ack_queue[(ctx->ack_queue_head + ctx->ack_queue_count) % ARESPLOT_ACK_QUEUE_SIZE];
+            tail->cmd = ctx->ack_overflow_cmd;
+            tail->status = ctx->ack_overflow_status;
+            tail->tag = ctx->ack_overflow_tag;
+            tail->extra_len = 0;
+            ctx->ack_queue_count++;
+            ctx->ack_overflow_pending = 0;
+        }
+        ARESPLOT_CRITICAL_EXIT(ctx);
 
-    if (process_ack) {
-        uint8_t ack_payload[2];
-        ack_payload[0] = ack_cmd_to_process;
-        ack_payload[1] = (uint8_t)status_to_process;
-        assemble_and_send_frame_internal(ARESPLOT_CMD_ACK, ack_payload, 2);
+        assemble_and_send_frame_internal(ctx, ARESPLOT_CMD_ACK, ack_payload, ack_payload_len);
     }
 
 
 #if ARESPLOT_ENABLE_ERROR_REPORT
     // 2. 检查是否有挂起的错误报告 (如果启用)
     // Check for pending error report (if enabled)
-    aresplot_user_critical_enter();
-    if (g_error_report_pending) {
-        error_code_to_process = g_error_report_code_to_send;
-        memcpy(error_msg_to_process, g_error_report_msg_to_send, g_error_report_msg_len_to_send);
-        error_msg_len_to_process = g_error_report_msg_len_to_send;
-        process_error_report = 1;
-        g_error_report_pending = 0; // 清除挂起标志
+    // 挂起期间消息不会被改写 (aresplot_report_error() 拒绝新的报告), 因此直接写入发送缓冲区, 不经过栈上的副本
+    // The message is not rewritten while pending (aresplot_report_error() refuses new reports), so it is written
+    // straight into the TX buffer without a copy on the stack
+    if (ctx->error_report_pending) {
+        uint8_t error_msg_len = ctx->error_report_msg_len_to_send;
+        if (tx_frame_begin(ctx, ARESPLOT_CMD_ERROR_REPORT, (uint16_t)(1 + error_msg_len))) {
+            tx_frame_write(ctx, &ctx->error_report_code_to_send, 1);
+            tx_frame_write(ctx, (const uint8_t*)ctx->error_report_msg_to_send, error_msg_len);
+            ARESPLOT_CRITICAL_ENTER(ctx);
+            ctx->error_report_pending = 0; // 清除挂起标志
+            ARESPLOT_CRITICAL_EXIT(ctx);
+            tx_frame_end(ctx);
+        }
     }
-    aresplot_user_critical_exit();
+#endif
 
-    if (process_error_report) {
-        uint8_t error_payload[1 + ARESPLOT_SHARED_BUFFER_SIZE - 7]; // Max possible payload
-        uint16_t error_payload_len = 1 + error_msg_len_to_process;
-        error_payload[0] = error_code_to_process;
-        if (error_msg_len_to_process > 0) {
-            memcpy(&error_payload[1], error_msg_to_process, error_msg_len_to_process);
-        }
-        assemble_and_send_frame_internal(ARESPLOT_CMD_ERROR_REPORT, error_payload, error_payload_len);
+#if ARESPLOT_ENABLE_STATS
+    // 检查是否有挂起的统计应答 Check for a pending statistics reply
+    if (ctx->stats_pending) {
+        send_stats_frame(ctx);
+    }
+#endif
+#if ARESPLOT_ENABLE_TIME_SYNC
+    // 检查是否有挂起的时间同步应答, 排在监控数据之前以缩短 TxTick 到实际发出的延迟
+    // Check for a pending time sync reply; it goes ahead of monitor data to keep TxTick close to the actual send
+    if (ctx->time_sync_pending) {
+        send_time_sync_reply(ctx);
     }
 #endif
 
     // 3. 检查是否需要发送监控数据
-    if (g_monitoring_active && g_num_monitor_vars > 0) { // 再次检查，因为状态可能已改变
-        current_time_ms = aresplot_user_get_tick_ms();
-        uint32_t time_diff;
+    // Check whether monitor data needs to be sent
+    // ACK 发出前不发送监控数据: 上位机据 CMD_START_MONITOR 的 ACK 切换数据布局, 因此 ACK 必须先于新布局的数据
+    // No monitor data while an ACK is pending: the host switches data layout on the CMD_START_MONITOR ACK, so it must precede data in the new layout
+    if (ctx->ack_queue_count > 0) {
+        return;
+    }
+#if ARESPLOT_ENABLE_CAPTURE
+    if (service_capture(ctx)) {
+        return;
+    }
+#endif
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+    // 采样由 aresplot_sample_now() 在中断中完成, 这里只负责发送 Sampling happens in aresplot_sample_now(); only transmit here
+    drain_sample_ring(ctx);
+#else
+    if (ctx->monitoring_active && ctx->num_monitor_vars > 0) { // 再次检查，因为状态可能已改变
+        uint32_t now_tick = sched_get_tick(ctx);
         
-        aresplot_user_critical_enter();
-        uint32_t last_sample = g_last_sample_time_ms;
-        uint32_t sample_period = g_sample_period_ms;
-        aresplot_user_critical_exit();
+        ARESPLOT_CRITICAL_ENTER(ctx);
+        uint32_t next_tick = ctx->sched_next_tick;
+        uint8_t sched_gen = ctx->monitor_config_gen;
+        ARESPLOT_CRITICAL_EXIT(ctx);
 
-        if (current_time_ms >= last_sample) {
-            time_diff = current_time_ms - last_sample;
-        } else { 
-            time_diff = (0xFFFFFFFFU - last_sample) + current_time_ms + 1;
-        }
-
-        if (time_diff >= sample_period) {
-            uint8_t monitor_data_payload[4 + ARESPLOT_MAX_VARS_TO_MONITOR * 4];
-            uint16_t monitor_data_payload_len = 0;
+        if ((int32_t)(now_tick - next_tick) >= 0) {
+            uint8_t monitor_values[ARESPLOT_MAX_SAMPLE_BYTES];
+            uint8_t config_gen = 0;
+            uint32_t timestamp_ms = ARESPLOT_GET_TICK_MS(ctx);
+            uint16_t monitor_values_len = sample_monitor_values(ctx, monitor_values, &config_gen);
+            uint8_t contiguous;
+            uint32_t period_ns;
             
-            send_monitor_data_payload_assembly(monitor_data_payload, &monitor_data_payload_len);
-            
-            if (monitor_data_payload_len > 0) {
-                 assemble_and_send_frame_internal(ARESPLOT_CMD_MONITOR_DATA, monitor_data_payload, monitor_data_payload_len);
+            ARESPLOT_CRITICAL_ENTER(ctx);
+            // 本次采样晚于截止时刻一个周期以上 (主循环停顿或发送缓冲池已满) 时与上一采样不连续
+            // The sample is not contiguous if it is more than one period past its deadline (main loop stalled or TX pool full)
+            contiguous = (uint8_t)(ctx->sched_contiguous && (uint32_t)(now_tick - next_tick) < ctx->sched_period_int);
+#if ARESPLOT_ENABLE_STATS
+            if ((uint32_t)(now_tick - next_tick) >= ctx->sched_period_int) {
+                ctx->stats.deadline_overruns++; // 至少错过了一个截止时刻 At least one deadline was missed
+            }
+#endif
+            period_ns = ctx->sched_period_ns;
+            if (ctx->monitor_config_gen == sched_gen) { // 调度期间配置未被改变 Config not changed meanwhile
+                advance_sample_schedule(ctx, now_tick);
+            }
+            if (ctx->monitor_config_gen != config_gen) { // 采样属于旧配置 The sample belongs to an old config
+                monitor_values_len = 0;
+            }
+            ARESPLOT_CRITICAL_EXIT(ctx);
+
+#if ARESPLOT_ENABLE_CAPTURE
+            ARESPLOT_CRITICAL_ENTER(ctx);
+            if (monitor_values_len > 0 && ctx->capture_state != ARES_CAPTURE_IDLE && ctx->capture_config_gen == config_gen) {
+                // 抓取期间采样写入抓取缓冲区而不发送 While capturing, the sample goes into the capture buffer instead of the stream
+                memcpy(capture_next_slot(ctx), monitor_values, monitor_values_len);
+                capture_commit_sample(ctx, timestamp_ms, contiguous);
+                monitor_values_len = 0;
+            }
+            ARESPLOT_CRITICAL_EXIT(ctx);
+#endif
+            if (monitor_values_len > 0) {
+#if ARESPLOT_ENABLE_ENVELOPE
+                // reading_plan 在采样后不会被编译覆盖 reading_plan is never compiled over after the sample was taken
+                const aresplot_sample_plan_t* plan = &ctx->sample_plans[ctx->reading_plan];
+                if (plan->envelope_window) {
+                    envelope_polled_sample(ctx, plan, timestamp_ms, period_ns, config_gen, contiguous, monitor_values);
+                } else
+#endif
+                {
+                    send_polled_sample(ctx, timestamp_ms, period_ns, config_gen, contiguous, monitor_values, monitor_values_len);
+                }
             }
-            
-            aresplot_user_critical_enter();
-            g_last_sample_time_ms = current_time_ms; 
-            aresplot_user_critical_exit();
         }
     }
+#endif
 }
 
+/**
+ * @brief 计算距下一次需要调用 aresplot_service_tick() 的时间 (见其返回值)
+ * Computes the time until aresplot_service_tick() is next needed (see its return value).
+ */
+static uint32_t service_next_delay(aresplot_ctx_t* ctx) {
+    uint32_t delay = ARESPLOT_WAIT_FOREVER;
+    uint8_t pending;
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+    uint32_t now_tick = sched_get_tick(ctx);
+#endif
 
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    // 留待下次调用的工作 Work left for a later call
+    pending = (uint8_t)(ctx->ack_queue_count > 0);
 #if ARESPLOT_ENABLE_ERROR_REPORT
-int aresplot_report_error(uint8_t error_code, const char* message, uint8_t msg_len) {
-    aresplot_user_critical_enter();
-    if (g_error_report_pending) { 
-        aresplot_user_critical_exit();
+    pending |= ctx->error_report_pending;
+#endif
+#if ARESPLOT_ENABLE_STATS
+    pending |= ctx->stats_pending;
+#endif
+#if ARESPLOT_ENABLE_TIME_SYNC
+    pending |= ctx->time_sync_pending;
+#endif
+#if ARESPLOT_ENABLE_CAPTURE
+    pending |= (uint8_t)(ctx->capture_state == ARES_CAPTURE_DONE);
+#endif
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+    pending |= (uint8_t)(ctx->sample_ring_head != ctx->sample_ring_tail);
+#endif
+#if ARESPLOT_ENABLE_ASYNC_TX
+    if (ctx->tx_send_count != ctx->tx_write_count && ctx->tx_done_count == ctx->tx_send_count) {
+        // 用户报告忙且没有在途的帧, 不会有 aresplot_tx_complete(): 约 1 ms 后重试
+        // The user reported busy with no frame in flight, so no aresplot_tx_complete() will come: retry in about 1 ms
+        delay = (ARESPLOT_SCHED_TICK_HZ + 999U) / 1000U;
+    }
+#if ARESPLOT_ENABLE_NOTIFY
+    if (pending && !tx_buffer_available(ctx)) {
+        pending = 0;
+        ctx->tx_waiting = 1; // 由 aresplot_tx_complete() 通知 aresplot_tx_complete() notifies
+    }
+#endif
+#endif
+#if ARESPLOT_ENABLE_TX_COALESCE
+    if (ctx->tx_chunk_open) {
+        // 合并中的块在等待时限到达时发送 A chunk being coalesced is sent when its wait limit is reached
+        uint32_t waited_ms = (uint32_t)(ARESPLOT_GET_TICK_MS(ctx) - ctx->tx_chunk_opened_ms);
+        uint32_t remaining = (waited_ms < ARESPLOT_TX_COALESCE_MAX_LATENCY_MS)
+                                 ? (ARESPLOT_TX_COALESCE_MAX_LATENCY_MS - waited_ms) * (ARESPLOT_SCHED_TICK_HZ / 1000U)
+                                 : 0;
+        if (remaining < delay) {
+            delay = remaining;
+        }
+    }
+#endif
+    if (pending) {
+        delay = 0;
+    }
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+    else if (ctx->monitoring_active && ctx->num_monitor_vars > 0) {
+        int32_t until_next = (int32_t)(ctx->sched_next_tick - now_tick);
+        uint32_t remaining = (until_next > 0) ? (uint32_t)until_next : 0;
+        if (remaining < delay) {
+            delay = remaining;
+        }
+    }
+#endif
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    return delay;
+}
+
+uint32_t aresplot_ctx_service_tick(aresplot_ctx_t* ctx) {
+    uint32_t delay;
+#if ARESPLOT_ENABLE_STATS_CYCLES
+    uint32_t start = ARESPLOT_GET_CYCLES(ctx);
+    service_tick(ctx);
+#if ARESPLOT_ENABLE_TX_COALESCE
+    tx_coalesce_poll(ctx);
+#endif
+    delay = service_next_delay(ctx);
+    stats_record_cycles(&ctx->stats.tick_cycles, ARESPLOT_GET_CYCLES(ctx) - start);
+#else
+    service_tick(ctx);
+#if ARESPLOT_ENABLE_TX_COALESCE
+    tx_coalesce_poll(ctx);
+#endif
+    delay = service_next_delay(ctx);
+#endif
+    return delay;
+}
+
+#if ARESPLOT_ENABLE_ASYNC_TX
+void aresplot_ctx_tx_complete(aresplot_ctx_t* ctx) {
+    if (ctx->tx_done_count == ctx->tx_send_count) {
+        return; // 没有在途的帧 No frame in flight
+    }
+    ctx->tx_done_count = (uint8_t)(ctx->tx_done_count + 1);
+    tx_pump_queue(ctx); // 立即发送下一个排队的帧 Start the next queued frame right away
+#if ARESPLOT_ENABLE_NOTIFY
+    if (ctx->tx_waiting) {
+        ctx->tx_waiting = 0;
+        ARESPLOT_NOTIFY(ctx); // 缓冲区已释放, 唤醒等待的工作 A buffer is free again: wake the waiting work
+    }
+#endif
+}
+#endif
+
+#if ARESPLOT_ENABLE_TX_COALESCE
+void aresplot_ctx_tx_flush(aresplot_ctx_t* ctx) {
+    if (ctx->tx_chunk_open) {
+        tx_flush_chunk(ctx);
+    }
+}
+#endif
+
+#if ARESPLOT_ENABLE_ERROR_REPORT
+int aresplot_ctx_report_error(aresplot_ctx_t* ctx, uint8_t error_code, const char* message, uint8_t msg_len) {
+    ARESPLOT_CRITICAL_ENTER(ctx);
+    if (ctx->error_report_pending) { 
+        ARESPLOT_CRITICAL_EXIT(ctx);
         return 0; 
     }
 
-    // 确保消息不会导致payload溢出 g_error_report_msg_to_send 缓冲区
-    // Ensure message doesn't overflow g_error_report_msg_to_send buffer
-    if (msg_len >= sizeof(g_error_report_msg_to_send)) {
-        msg_len = sizeof(g_error_report_msg_to_send) -1; // Leave space for null terminator if it were a C string
+    // 确保消息不会导致payload溢出 error_report_msg_to_send 缓冲区
+    // Ensure message doesn't overflow error_report_msg_to_send buffer
+    if (msg_len >= sizeof(ctx->error_report_msg_to_send)) {
+        msg_len = sizeof(ctx->error_report_msg_to_send) -1; // Leave space for null terminator if it were a C string
     }
     
-    g_error_report_code_to_send = error_code;
+    ctx->error_report_code_to_send = error_code;
     if (message && msg_len > 0) {
-        memcpy(g_error_report_msg_to_send, message, msg_len);
-        g_error_report_msg_len_to_send = msg_len;
+        memcpy(ctx->error_report_msg_to_send, message, msg_len);
+        ctx->error_report_msg_len_to_send = msg_len;
     } else {
-        g_error_report_msg_len_to_send = 0;
+        ctx->error_report_msg_len_to_send = 0;
     }
     
-    g_error_report_pending = 1;
-    aresplot_user_critical_exit();
+    ctx->error_report_pending = 1;
+    ARESPLOT_CRITICAL_EXIT(ctx);
+    ARESPLOT_NOTIFY(ctx);
     return 1; 
 }
 #endif
 
+#if ARESPLOT_ENABLE_DEFAULT_INSTANCE
+// --- 默认实例 Default Instance ---
+// 回调转发到 aresplot_user_* 函数 The callbacks forward to the aresplot_user_* functions
+
+static aresplot_ctx_t g_default_ctx;
+
+#if ARESPLOT_ENABLE_ASYNC_TX
+static int default_send_packet(void* user, const uint8_t* data, uint16_t length) {
+    (void)user;
+    return aresplot_user_send_packet(data, length);
+}
+#else
+static void default_send_packet(void* user, const uint8_t* data, uint16_t length) {
+    (void)user;
+    aresplot_user_send_packet(data, length);
+}
+#endif
+
+static uint32_t default_get_tick_ms(void* user) {
+    (void)user;
+    return aresplot_user_get_tick_ms();
+}
+
+#if ARESPLOT_ENABLE_TICK_US
+static uint32_t default_get_tick_us(void* user) {
+    (void)user;
+    return aresplot_user_get_tick_us();
+}
+#endif
+
+#if ARESPLOT_ENABLE_STATS_CYCLES
+static uint32_t default_get_cycles(void* user) {
+    (void)user;
+    return aresplot_user_get_cycles();
+}
+#endif
+
+static void default_critical_enter(void* user) {
+    (void)user;
+    aresplot_user_critical_enter();
+}
+
+static void default_critical_exit(void* user) {
+    (void)user;
+    aresplot_user_critical_exit();
+}
+
+#if ARESPLOT_ENABLE_NOTIFY
+static void default_notify(void* user) {
+    (void)user;
+    aresplot_user_notify();
+}
+#endif
+
+static const aresplot_callbacks_t g_default_callbacks = {
+    .send_packet = default_send_packet,
+    .get_tick_ms = default_get_tick_ms,
+#if ARESPLOT_ENABLE_TICK_US
+    .get_tick_us = default_get_tick_us,
+#endif
+#if ARESPLOT_ENABLE_STATS_CYCLES
+    .get_cycles = default_get_cycles,
+#endif
+    .critical_enter = default_critical_enter,
+    .critical_exit = default_critical_exit,
+#if ARESPLOT_ENABLE_NOTIFY
+    .notify = default_notify,
+#endif
+    .user = NULL
+};
+
+void aresplot_init(void) {
+    aresplot_ctx_init(&g_default_ctx, &g_default_callbacks);
+}
+
+void aresplot_rx_feed_byte(uint8_t byte) {
+    aresplot_ctx_rx_feed_byte(&g_default_ctx, byte);
+}
+
+void aresplot_rx_feed_packet(const uint8_t* data, uint16_t length) {
+    aresplot_ctx_rx_feed_packet(&g_default_ctx, data, length);
+}
+
+uint32_t aresplot_service_tick(void) {
+    return aresplot_ctx_service_tick(&g_default_ctx);
+}
+
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+void aresplot_sample_now(void) {
+    aresplot_ctx_sample_now(&g_default_ctx);
+}
+#endif
+
+#if ARESPLOT_ENABLE_ASYNC_TX
+void aresplot_tx_complete(void) {
+    aresplot_ctx_tx_complete(&g_default_ctx);
+}
+#endif
+
+#if ARESPLOT_ENABLE_TX_COALESCE
+void aresplot_tx_flush(void) {
+    aresplot_ctx_tx_flush(&g_default_ctx);
+}
+#endif
+
+#if ARESPLOT_ENABLE_ERROR_REPORT
+int aresplot_report_error(uint8_t error_code, const char* message, uint8_t msg_len) {
+    return aresplot_ctx_report_error(&g_default_ctx, error_code, message, msg_len);
+}
+#endif
+#endif // ARESPLOT_ENABLE_DEFAULT_INSTANCE
@@ -0,0 +1,8 @@
+// aresplot_mcu.h - 主机构建用的占位头文件 Placeholder header for the host build
+// 主机测试程序直接 #include "aresplot_client.c", 其声明部分已定义 ARESPLOT_MCU_H, 这里只需满足源码部分的 #include。
+// The host programs #include "aresplot_client.c" directly; its declaration section already defines ARESPLOT_MCU_H,
+// so this file only has to satisfy the #include of the source section.
+
+#ifndef ARESPLOT_MCU_H
+#error "Include aresplot_client.c instead of aresplot_mcu.h in the host build"
+#endif
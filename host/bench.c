@@ -0,0 +1,344 @@
+// bench.c - Aresplot MCU 端的主机微基准测试 Host microbenchmarks of the Aresplot MCU side
+// 直接包含 aresplot_client.c (单一编译单元), 因此也能测量内部的帧组装函数。
+// Includes aresplot_client.c directly (single translation unit), so the internal frame assembly is measurable too.
+// 每次 aresplot_ctx_service_tick() 调用对应一个采样周期。 Every aresplot_ctx_service_tick() call covers one sample period.
+// 用法 Usage: bench [持续毫秒/每项 milliseconds per benchmark, default 200]
+
+#include "aresplot_client.c"
+#include "mock_hal.h"
+
+#define BENCH_RATE_HZ (1000)          // 采样基准的采样率 Sample rate of the sampling benchmarks
+#define BENCH_WAKEUP_RATE_HZ (100)    // 事件驱动调度基准的采样率 Sample rate of the event-driven scheduling benchmark
+#define BENCH_RX_STREAM_SIZE (1u << 16)
+#define BENCH_VAR_OFFSET (0x1000u)    // 被监控变量在沙盒中的起始偏移 Sandbox offset of the monitored variables
+#define BENCH_SCATTER_STRIDE (64u)    // 分散布局中相邻变量的间距 Spacing of adjacent variables in the scattered layout
+
+static uint32_t g_bench_ms = 200;
+static uint8_t  g_bench_frame[ARESPLOT_START_MONITOR_MAX_PAYLOAD + 8];
+static uint8_t  g_bench_stream[BENCH_RX_STREAM_SIZE];
+
+// 计时区间 Timed section
+typedef struct {
+    uint64_t start_ns;
+    uint64_t iterations;
+} bench_timer_t;
+
+static void bench_timer_start(bench_timer_t* t) {
+    t->iterations = 0;
+    t->start_ns = mock_now_ns();
+}
+
+// 达到设定时长后返回 0 Returns 0 once the configured duration has elapsed
+static int bench_timer_running(bench_timer_t* t, uint32_t batch) {
+    t->iterations += batch;
+    return (mock_now_ns() - t->start_ns) < (uint64_t)g_bench_ms * 1000000ull;
+}
+
+static double bench_timer_ns_per_iter(const bench_timer_t* t) {
+    return (double)(mock_now_ns() - t->start_ns) / (double)t->iterations;
+}
+
+static void bench_feed_frame(uint8_t cmd, const uint8_t* payload, uint16_t len) {
+    size_t n = mock_put_frame(g_bench_frame, cmd, payload, len);
+    aresplot_ctx_rx_feed_packet(&g_mock_ctx, g_bench_frame, (uint16_t)n);
+}
+
+/**
+ * @brief 在捕获的输出中查找对某命令的 ACK Looks for the ACK of a command in the captured output
+ * @return ACK 状态, 未找到时为 -1 ACK status, -1 when not found.
+ */
+static int bench_find_ack(uint8_t cmd) {
+    size_t pos = 0;
+    int status = -1;
+    while (pos + 6 <= g_mock_capture_len) {
+        uint16_t len = (uint16_t)(g_mock_capture[pos + 2] | (g_mock_capture[pos + 3] << 8));
+        if (g_mock_capture[pos + 1] == ARESPLOT_CMD_ACK && len >= 2 && (g_mock_capture[pos + 4] & 0x3F) == cmd) {
+            status = g_mock_capture[pos + 5];
+        }
+        pos += (size_t)len + 6;
+    }
+    return status;
+}
+
+static void bench_set_sample_rate(uint32_t rate_hz) {
+    uint8_t p[4] = { (uint8_t)rate_hz, (uint8_t)(rate_hz >> 8), (uint8_t)(rate_hz >> 16), (uint8_t)(rate_hz >> 24) };
+    bench_feed_frame(ARESPLOT_CMD_SET_SAMPLE_RATE, p, sizeof(p));
+}
+
+/**
+ * @brief 组装 CMD_START_MONITOR 的 Payload Builds a CMD_START_MONITOR payload
+ * @param types 各变量类型 (按 n 循环使用) Variable types (used cyclically over n).
+ * @param stride 变量间距, 0 表示按类型宽度紧密排列 Variable spacing; 0 packs them by type width.
+ * @return Payload 长度 Payload length.
+ */
+static uint16_t bench_build_start(uint8_t* p, uint8_t n, const uint8_t* types, uint8_t num_types, uint32_t stride,
+                                  uint8_t options) {
+    uint32_t offset = BENCH_VAR_OFFSET;
+    uint16_t len = 0;
+    p[len++] = n;
+    for (uint8_t i = 0; i < n; ++i) {
+        uint8_t type = types[i % num_types];
+        uint32_t size = g_type_sizes[type];
+        uint32_t addr;
+        offset = (offset + size - 1) & ~(size - 1); // 按自然边界对齐 Natural alignment
+        addr = mock_addr(offset);
+        offset += stride ? stride : size;
+        p[len++] = (uint8_t)addr;
+        p[len++] = (uint8_t)(addr >> 8);
+        p[len++] = (uint8_t)(addr >> 16);
+        p[len++] = (uint8_t)(addr >> 24);
+        p[len++] = type;
+    }
+    p[len++] = options;
+    return len;
+}
+
+/**
+ * @brief 开始监控并确认 MCU 接受 Starts monitoring and checks that the MCU accepted it
+ * @return 1: 已接受 Accepted; 0: 被拒绝 (当前配置不支持) Rejected (unsupported by this configuration).
+ */
+static int bench_start(uint8_t n, const uint8_t* types, uint8_t num_types, uint32_t stride, uint8_t options) {
+    static uint8_t p[ARESPLOT_START_MONITOR_MAX_PAYLOAD];
+    uint16_t len = bench_build_start(p, n, types, num_types, stride, options);
+    mock_init();
+    mock_reset_output(1);
+    bench_set_sample_rate(BENCH_RATE_HZ);
+    bench_feed_frame(ARESPLOT_CMD_START_MONITOR, p, len);
+    for (int i = 0; i < 4; ++i) {
+        aresplot_ctx_service_tick(&g_mock_ctx); // 发出 ACK Sends the ACKs
+    }
+#if ARESPLOT_ENABLE_TX_COALESCE
+    aresplot_ctx_tx_flush(&g_mock_ctx);
+#endif
+    return bench_find_ack(ARESPLOT_CMD_START_MONITOR) == ARES_STATUS_OK;
+}
+
+// 推进一个采样周期 Advances one sample period
+static void bench_step_sample(void) {
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+    for (uint32_t i = 0; i < ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ / BENCH_RATE_HZ; ++i) {
+        mock_advance_us(1000000u / ARESPLOT_ISR_SAMPLE_CALL_RATE_HZ);
+        aresplot_ctx_sample_now(&g_mock_ctx);
+    }
+#else
+    mock_advance_us(1000000u / BENCH_RATE_HZ);
+#endif
+}
+
+/**
+ * @brief aresplot_ctx_service_tick() 的耗时, 每次调用对应一个采样周期
+ * Cost of aresplot_ctx_service_tick() with one sample period per call.
+ */
+static void bench_service_tick(const char* name, uint8_t n, const uint8_t* types, uint8_t num_types, uint32_t stride,
+                               uint8_t options) {
+    bench_timer_t t;
+    volatile uint32_t* first = (volatile uint32_t*)(mock_sandbox() + BENCH_VAR_OFFSET);
+    char label[64];
+    snprintf(label, sizeof(label), "service_tick %-14s x%-3u", name, (unsigned)n);
+    if (!bench_start(n, types, num_types, stride, options)) {
+        printf("%-40s : rejected by this configuration\n", label);
+        return;
+    }
+    mock_reset_output(0);
+    bench_timer_start(&t);
+    do {
+        for (int i = 0; i < 1000; ++i) {
+            *first += 0x01010101u; // 让数据变化, 压缩编码才有实际工作 Keep the data moving so the codec has real work
+            bench_step_sample();
+            aresplot_ctx_service_tick(&g_mock_ctx);
+        }
+    } while (bench_timer_running(&t, 1000));
+    printf("%-40s : %9.1f ns/tick  %7.1f B/tick  %5.2f packets/tick\n", label, bench_timer_ns_per_iter(&t),
+           (double)g_mock_tx_bytes / (double)t.iterations, (double)g_mock_tx_packets / (double)t.iterations);
+}
+
+// 截止时刻未到时的空转开销 Idle cost when no deadline has elapsed
+static void bench_service_tick_idle(void) {
+    static const uint8_t f32[] = { ARES_TYPE_FLOAT32 };
+    bench_timer_t t;
+    if (!bench_start(ARESPLOT_MAX_VARS_TO_MONITOR, f32, 1, 0, 0)) {
+        return;
+    }
+    bench_timer_start(&t);
+    do {
+        for (int i = 0; i < 1000; ++i) {
+            aresplot_ctx_service_tick(&g_mock_ctx);
+        }
+    } while (bench_timer_running(&t, 1000));
+    printf("%-40s : %9.1f ns/call\n", "service_tick idle", bench_timer_ns_per_iter(&t));
+}
+
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+// 按返回的等待时间调度 (事件驱动) 时每秒的调用次数 Calls per second when scheduled by the returned wait (event driven)
+static void bench_service_tick_wakeups(void) {
+    static const uint8_t f32[] = { ARES_TYPE_FLOAT32 };
+    uint64_t end_us;
+    uint32_t calls = 0;
+    if (!bench_start(1, f32, 1, 0, 0)) {
+        return;
+    }
+    bench_set_sample_rate(BENCH_WAKEUP_RATE_HZ);
+    mock_reset_output(0);
+    end_us = g_mock_time_us + 1000000u;
+    while (g_mock_time_us < end_us && calls < 1000000u) {
+        uint32_t delay = aresplot_ctx_service_tick(&g_mock_ctx);
+        calls++;
+        if (delay == ARESPLOT_WAIT_FOREVER) {
+            break;
+        }
+        mock_advance_us((uint32_t)((uint64_t)delay * 1000000u / ARESPLOT_SCHED_TICK_HZ));
+    }
+    printf("%-40s : %9u calls/s  %7u frames/s at %u Hz\n", "service_tick event driven", (unsigned)calls,
+           (unsigned)g_mock_tx_packets, (unsigned)BENCH_WAKEUP_RATE_HZ);
+}
+#endif
+
+static void bench_sampling(void) {
+    static const uint8_t f32[] = { ARES_TYPE_FLOAT32 };
+    static const uint8_t ints[] = { ARES_TYPE_INT8, ARES_TYPE_UINT16, ARES_TYPE_INT32 };
+    static const uint8_t mixed[] = { ARES_TYPE_FLOAT32, ARES_TYPE_INT16, ARES_TYPE_UINT8, ARES_TYPE_FLOAT64,
+                                     ARES_TYPE_UINT32, ARES_TYPE_BOOL, ARES_TYPE_INT8, ARES_TYPE_INT32 };
+    static const uint8_t f64[] = { ARES_TYPE_FLOAT64 };
+    uint8_t counts[] = { 1, 4, ARESPLOT_MAX_VARS_TO_MONITOR };
+    for (unsigned c = 0; c < sizeof(counts); ++c) {
+        uint8_t n = counts[c];
+        if (n > ARESPLOT_MAX_VARS_TO_MONITOR || (c > 0 && n <= counts[c - 1])) {
+            continue;
+        }
+        bench_service_tick("f32", n, f32, 1, 0, 0);
+        bench_service_tick("f32 scattered", n, f32, 1, BENCH_SCATTER_STRIDE, 0);
+        bench_service_tick("int", n, ints, sizeof(ints), 0, 0);
+        bench_service_tick("mixed", n, mixed, sizeof(mixed), 0, 0);
+#if ARESPLOT_ENABLE_RAW_ENCODING
+        bench_service_tick("mixed raw", n, mixed, sizeof(mixed), 0, ARESPLOT_START_MONITOR_OPT_RAW_ENCODING);
+        bench_service_tick("f64 raw", n, f64, 1, 0, ARESPLOT_START_MONITOR_OPT_RAW_ENCODING);
+#else
+        (void)f64;
+#endif
+#if ARESPLOT_ENABLE_COMPRESSION
+        bench_service_tick("f32 compressed", n, f32, 1, 0, ARESPLOT_START_MONITOR_OPT_COMPRESSION);
+#endif
+    }
+    bench_service_tick_idle();
+#if !ARESPLOT_ENABLE_ISR_SAMPLING
+    bench_service_tick_wakeups();
+#endif
+}
+
+/**
+ * @brief 生成混合命令流 Builds a stream of mixed commands
+ * @return 流长度 Stream length.
+ */
+static size_t bench_build_rx_stream(void) {
+    static const uint8_t f32[] = { ARES_TYPE_FLOAT32 };
+    static uint8_t start[ARESPLOT_START_MONITOR_MAX_PAYLOAD];
+    uint16_t start_len = bench_build_start(start, ARESPLOT_MAX_VARS_TO_MONITOR, f32, 1, 0, 0);
+    uint32_t addr = mock_addr(BENCH_VAR_OFFSET);
+    uint8_t set[9] = { (uint8_t)addr, (uint8_t)(addr >> 8), (uint8_t)(addr >> 16), (uint8_t)(addr >> 24),
+                       ARES_TYPE_FLOAT32, 0x00, 0x00, 0x80, 0x3F };
+    uint8_t rate[4] = { (uint8_t)BENCH_RATE_HZ, (uint8_t)(BENCH_RATE_HZ >> 8), 0, 0 };
+    size_t len = 0;
+    while (len + 3 * sizeof(g_bench_frame) <= sizeof(g_bench_stream)) {
+        len += mock_put_frame(&g_bench_stream[len], ARESPLOT_CMD_SET_VARIABLE, set, sizeof(set));
+        len += mock_put_frame(&g_bench_stream[len], ARESPLOT_CMD_SET_SAMPLE_RATE, rate, sizeof(rate));
+        len += mock_put_frame(&g_bench_stream[len], ARESPLOT_CMD_START_MONITOR, start, start_len);
+        g_bench_stream[len++] = 0x00; // 帧间噪声 Noise between frames
+#if ARESPLOT_ENABLE_COMMAND_TAGS
+        {
+            uint8_t tagged[1 + sizeof(set)];
+            tagged[0] = (uint8_t)len;
+            memcpy(&tagged[1], set, sizeof(set));
+            len += mock_put_frame(&g_bench_stream[len], (uint8_t)(ARESPLOT_CMD_SET_VARIABLE | ARESPLOT_CMD_FLAG_TAGGED),
+                                  tagged, sizeof(tagged));
+        }
+#endif
+    }
+    return len;
+}
+
+// 随机噪声, 约 1/256 的字节是 SOP Random noise; about 1 byte in 256 is an SOP
+static size_t bench_build_noise_stream(void) {
+    uint32_t x = 0x12345678u;
+    for (size_t i = 0; i < sizeof(g_bench_stream); ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        g_bench_stream[i] = (uint8_t)x;
+    }
+    return sizeof(g_bench_stream);
+}
+
+static void bench_rx_stream(const char* name, size_t len, uint16_t chunk) {
+    bench_timer_t t;
+    mock_init();
+    mock_reset_output(0);
+    bench_timer_start(&t);
+    do {
+        for (size_t pos = 0; pos < len; pos += chunk) {
+            uint16_t n = (uint16_t)((len - pos < chunk) ? len - pos : chunk);
+            if (chunk == 1) {
+                aresplot_ctx_rx_feed_byte(&g_mock_ctx, g_bench_stream[pos]);
+            } else {
+                aresplot_ctx_rx_feed_packet(&g_mock_ctx, &g_bench_stream[pos], n);
+            }
+            // 丢弃排队的 ACK, 使命令被执行而不是回复 BUSY (512 B 的块内仍有超出队列深度的命令)
+            // Discard the queued ACKs so commands are executed rather than answered with BUSY (a 512 B chunk still holds
+            // more commands than the queue depth)
+            g_mock_ctx.ack_queue_count = 0;
+            g_mock_ctx.ack_overflow_pending = 0;
+        }
+        aresplot_ctx_service_tick(&g_mock_ctx); // 清空 ACK 队列 Drains the ACK queue
+    } while (bench_timer_running(&t, (uint32_t)len));
+    printf("%-40s : %9.1f MB/s  %7.2f ns/byte\n", name, 1000.0 / bench_timer_ns_per_iter(&t),
+           bench_timer_ns_per_iter(&t));
+}
+
+static void bench_rx(void) {
+    size_t len = bench_build_rx_stream();
+    bench_rx_stream("rx commands  feed_packet 64 B", len, 64);
+    bench_rx_stream("rx commands  feed_packet 512 B", len, 512);
+    bench_rx_stream("rx commands  feed_byte", len, 1);
+    len = bench_build_noise_stream();
+    bench_rx_stream("rx noise     feed_packet 64 B", len, 64);
+    bench_rx_stream("rx noise     feed_byte", len, 1);
+}
+
+/**
+ * @brief 帧组装 (含校验和与分块) 的耗时 Cost of frame assembly (checksum and chunking included)
+ */
+static void bench_frame_assembly(void) {
+    static uint8_t payload[1024];
+    static const uint16_t sizes[] = { 2, 40, ARESPLOT_SHARED_BUFFER_SIZE - 6, 1024 };
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+        payload[i] = (uint8_t)(i * 7);
+    }
+    for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        bench_timer_t t;
+        char label[64];
+        mock_init();
+        mock_reset_output(0);
+        bench_timer_start(&t);
+        do {
+            for (int i = 0; i < 1000; ++i) {
+                assemble_and_send_frame_internal(&g_mock_ctx, ARESPLOT_CMD_ACK, payload, sizes[s]);
+            }
+        } while (bench_timer_running(&t, 1000));
+        snprintf(label, sizeof(label), "frame assembly %u B payload", (unsigned)sizes[s]);
+        printf("%-40s : %9.1f ns/frame  %7.2f ns/byte\n", label, bench_timer_ns_per_iter(&t),
+               bench_timer_ns_per_iter(&t) / (double)(sizes[s] + 6));
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        g_bench_ms = (uint32_t)strtoul(argv[1], NULL, 10);
+    }
+    mock_sandbox();
+    printf("aresplot host benchmark: MAX_VARS=%d SHARED_BUFFER=%d BATCH=%d ISR=%d ASYNC_TX=%d COMPRESSION=%d\n",
+           ARESPLOT_MAX_VARS_TO_MONITOR, ARESPLOT_SHARED_BUFFER_SIZE, ARESPLOT_MONITOR_BATCH_SIZE,
+           ARESPLOT_ENABLE_ISR_SAMPLING, ARESPLOT_ENABLE_ASYNC_TX, ARESPLOT_ENABLE_COMPRESSION);
+    bench_rx();
+    bench_sampling();
+    bench_frame_assembly();
+    return 0;
+}
@@ -0,0 +1,100 @@
+# footprint.awk - 由符号表与 GCC 调用图计算 RAM 与栈占用 RAM and stack footprint from the symbol table and the GCC call graph
+#
+#   nm -S footprint.o | awk -f footprint.awk [-v max_ram=N] [-v max_stack=N] - aresplot_client.c footprint.ci
+#
+# 静态 RAM 为 .data 与 .bss 中全部符号之和。栈深度为各入口函数 (非 static 函数) 调用链上栈帧之和的最大值;
+# 采样计划的间接调用 (源码中的 ->read() 调用点) 按最大的读取函数计算, 其余间接调用是用户回调, 其栈不计入。超过 max_ram / max_stack 时以状态 1 退出。
+# Static RAM is the sum of every symbol in .data and .bss. The peak stack of each entry point (non-static function) is
+# the largest sum of frames along its call chains; an indirect call of the sampling plan (a ->read() call site in the source)
+# counts as its largest reader; the other indirect calls are user callbacks, whose stack is not included. Exits with status 1 when max_ram / max_stack is exceeded.
+
+function hex(s,    i, n, c) {
+    n = 0
+    s = tolower(s)
+    for (i = 1; i <= length(s); i++) {
+        c = index("0123456789abcdef", substr(s, i, 1)) - 1
+        n = n * 16 + c
+    }
+    return n
+}
+
+function strip(name) {
+    sub(/^[^:]*:/, "", name) # static 函数带有 "文件:" 前缀 Static functions carry a "file:" prefix
+    return name
+}
+
+function depth(f,    i, d, best) {
+    if (f in memo) return memo[f]
+    if (f in visiting) { recursive = 1; return 0 }
+    visiting[f] = 1
+    best = 0
+    for (i = 1; i <= ncallees[f]; i++) {
+        d = depth(callees[f, i])
+        if (d > best) best = d
+    }
+    delete visiting[f]
+    memo[f] = frame[f] + best
+    return memo[f]
+}
+
+# nm -S: 地址 大小 类型 名称 address size type name
+FILENAME == "-" || FILENAME == "/dev/stdin" {
+    if (NF == 4 && $3 ~ /^[bBdD]$/) ram += hex($2)
+    if (NF == 4 && $4 == "aresplot_footprint_ctx_size") ctx_size = hex($2)
+    next
+}
+
+# 源码: 记下采样计划读取函数的调用行 Source: note the lines that call a sampling plan reader
+FILENAME ~ /\.c$/ {
+    if ($0 ~ /->read\(/) reader_line[FNR] = 1
+    next
+}
+
+/^node:/ {
+    match($0, /title: "[^"]*"/)
+    name = substr($0, RSTART + 8, RLENGTH - 9)
+    frame[name] = 0
+    if (match($0, /\\n[0-9]+ bytes/)) frame[name] = substr($0, RSTART + 2, RLENGTH - 8) + 0
+    if (name !~ /:/ && $0 ~ /bytes/) entries[++nentries] = name
+    if (strip(name) ~ /^plan_read_/) readers[++nreaders] = name
+    next
+}
+
+/^edge:/ {
+    match($0, /sourcename: "[^"]*"/)
+    src = substr($0, RSTART + 13, RLENGTH - 14)
+    match($0, /targetname: "[^"]*"/)
+    dst = substr($0, RSTART + 13, RLENGTH - 14)
+    if (dst == "__indirect_call") {
+        match($0, /label: "[^"]*:[0-9]+:/)
+        line = substr($0, RSTART, RLENGTH - 1)
+        sub(/.*:/, "", line)
+        if (!(line in reader_line)) next # 用户回调 User callback
+        dst = "__plan_reader"
+    }
+    callees[src, ++ncallees[src]] = dst
+    next
+}
+
+END {
+    for (i = 1; i <= nreaders; i++) callees["__plan_reader", ++ncallees["__plan_reader"]] = readers[i]
+    printf "static RAM     %6d bytes (.data + .bss)\n", ram
+    printf "aresplot_ctx_t %6d bytes\n", ctx_size
+    peak = 0
+    for (i = 1; i <= nentries; i++) {
+        d = depth(entries[i])
+        if (d > peak) peak = d
+        printf "stack %-28s %6d bytes\n", entries[i], d
+    }
+    if (recursive) print "warning: recursive call chain, its stack is counted once"
+    status = 0
+    if (max_ram != "" && ram > max_ram + 0) {
+        printf "static RAM %d exceeds the budget of %d bytes\n", ram, max_ram
+        status = 1
+    }
+    if (max_stack != "" && peak > max_stack + 0) {
+        printf "peak stack %d exceeds the budget of %d bytes\n", peak, max_stack
+        status = 1
+    }
+    exit status
+}
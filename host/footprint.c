@@ -0,0 +1,10 @@
+// footprint.c - Aresplot MCU 端的 RAM 与栈占用测量 RAM and stack footprint measurement of the Aresplot MCU side
+// 以目标类似的选项 (默认 -m32 -Os) 编译为目标文件但不链接, footprint.awk 从符号表和 GCC 调用图 (-fcallgraph-info=su)
+// 计算静态 RAM 与各入口函数的最大栈深度。
+// Compiled with target-like options (-m32 -Os by default) into an object that is never linked; footprint.awk computes
+// the static RAM from the symbol table and the peak stack of each entry point from the GCC call graph (-fcallgraph-info=su).
+
+#include "aresplot_client.c"
+
+// 只用于在符号表中读出实例大小, 位于只读段, 不计入 RAM Only read back from the symbol table; read-only, not counted as RAM
+const uint8_t aresplot_footprint_ctx_size[sizeof(aresplot_ctx_t)] = { 0 };
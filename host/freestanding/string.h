@@ -0,0 +1,15 @@
+// string.h - 足迹测量用的最小声明 Minimal declarations for the footprint build
+// 足迹测量以 -ffreestanding 交叉编译 (如 -m32), 主机上不一定有对应的 C 库头文件; 目标文件不链接, 只需声明。
+// The footprint build cross-compiles with -ffreestanding (e.g. -m32), where the host may not have matching C library
+// headers; the object is never linked, so declarations are enough.
+
+#ifndef ARESPLOT_FREESTANDING_STRING_H
+#define ARESPLOT_FREESTANDING_STRING_H
+
+#include <stddef.h>
+
+void* memcpy(void* dst, const void* src, size_t n);
+void* memset(void* dst, int c, size_t n);
+void* memchr(const void* s, int c, size_t n);
+
+#endif
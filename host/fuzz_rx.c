@@ -0,0 +1,407 @@
+// fuzz_rx.c - 接收状态机的模糊测试 Fuzz target for the RX state machine
+// 输入字节按由输入决定的分块方式交替喂给 aresplot_ctx_rx_feed_packet() 与 aresplot_ctx_rx_feed_byte(),
+// 期间推进时钟并调用 aresplot_ctx_service_tick(), 每步检查内部不变量, 最后检查输出流只由有效帧组成。
+// Input bytes are fed through aresplot_ctx_rx_feed_packet() and aresplot_ctx_rx_feed_byte() in input-derived chunks while
+// the clock advances and aresplot_ctx_service_tick() runs; internal invariants are checked after every step and the
+// output stream must consist of valid frames only.
+//
+// 定义 ARESPLOT_FUZZ_LIBFUZZER 时只提供 LLVMFuzzerTestOneInput(), 否则自带驱动:
+// With ARESPLOT_FUZZ_LIBFUZZER only LLVMFuzzerTestOneInput() is provided; otherwise a built-in driver:
+//   fuzz_rx [-n 迭代次数 iterations] [-s 种子 seed]   随机变异内置种子 Mutates the built-in seeds
+//   fuzz_rx 文件 files...                             重放输入 (例如崩溃样本) Replays inputs (e.g. crash samples)
+
+#include <stdint.h>
+
+// 协议中的任意地址都落到沙盒内, 使写变量与采样不会访问沙盒以外的内存
+// Any protocol address lands inside the sandbox, so variable writes and sampling stay within it
+static void* fuzz_addr_to_ptr(uint32_t addr);
+#define ARESPLOT_ADDR_TO_PTR(addr) fuzz_addr_to_ptr(addr)
+
+#include "aresplot_client.c"
+#include "mock_hal.h"
+
+// 沙盒末尾留出的余量: 最大的块描述 (255 个 FLOAT64) Margin at the end of the sandbox: the largest block descriptor (255 FLOAT64)
+#define FUZZ_ADDR_MARGIN (255u * 8u + 8u)
+#define FUZZ_MAX_INPUT (4096u)
+
+static void* fuzz_addr_to_ptr(uint32_t addr) {
+    return mock_sandbox() + (addr % (MOCK_SANDBOX_SIZE - FUZZ_ADDR_MARGIN));
+}
+
+static const uint8_t* g_fuzz_input; // 当前输入, 出错时保存 Current input, saved on failure
+static size_t g_fuzz_input_len;
+static uint64_t g_fuzz_output_frames; // 累计输出帧数, 反映输入到达的深度 Output frames so far; shows how deep the inputs reach
+
+static void fuzz_fail(const char* what) {
+    FILE* f = fopen("fuzz_rx-crash.bin", "wb");
+    fprintf(stderr, "fuzz_rx: invariant violated: %s (input saved to fuzz_rx-crash.bin)\n", what);
+    if (f != NULL) {
+        fwrite(g_fuzz_input, 1, g_fuzz_input_len, f);
+        fclose(f);
+    }
+    abort();
+}
+
+static void fuzz_check_invariants(void) {
+    const aresplot_ctx_t* ctx = &g_mock_ctx;
+    if (g_mock_critical_depth != 0) {
+        fuzz_fail("critical section left open");
+    }
+    if (ctx->rx_state > ARES_RX_STATE_WAIT_EOP) {
+        fuzz_fail("rx state out of range");
+    }
+    if (ctx->rx_state == ARES_RX_STATE_WAIT_PAYLOAD && ctx->rx_payload_idx >= ctx->rx_payload_len) {
+        fuzz_fail("rx payload index past the payload length");
+    }
+    if (ctx->ack_queue_count > ARESPLOT_ACK_QUEUE_SIZE || ctx->ack_queue_head >= ARESPLOT_ACK_QUEUE_SIZE) {
+        fuzz_fail("ack queue out of range");
+    }
+    if (ctx->ack_overflow_pending && ctx->ack_queue_count != ARESPLOT_ACK_QUEUE_SIZE) {
+        fuzz_fail("ack overflow reply pending while the queue has room");
+    }
+    if (ctx->num_monitor_vars > ARESPLOT_MAX_VARS_TO_MONITOR) {
+        fuzz_fail("too many monitored variables");
+    }
+#if ARESPLOT_ENABLE_TX_COALESCE
+    if (ctx->tx_chunk_open ? (ctx->tx_chunk_len == 0 || ctx->tx_chunk_len >= ARESPLOT_TX_CHUNK_SIZE) : (ctx->tx_chunk_len != 0)) {
+        fuzz_fail("coalesced chunk state out of range");
+    }
+#endif
+}
+
+/**
+ * @brief 调用 aresplot_ctx_service_tick() 并检查其返回的等待时间
+ * Calls aresplot_ctx_service_tick() and checks the wait it returns.
+ * 返回非零等待时间即表示当前无事可做: 时钟不变时再次调用不得产生输出。
+ * A non-zero wait claims there is nothing to do right now: calling again on the same clock must not produce output.
+ */
+static void fuzz_service_tick(void) {
+    uint32_t delay = aresplot_ctx_service_tick(&g_mock_ctx);
+    fuzz_check_invariants();
+    if (delay > 0) {
+        uint64_t packets = g_mock_tx_packets;
+        (void)aresplot_ctx_service_tick(&g_mock_ctx);
+        if (g_mock_tx_packets != packets) {
+            fuzz_fail("service_tick returned a wait but still had work");
+        }
+        fuzz_check_invariants();
+    }
+}
+
+/**
+ * @brief 运行一个输入 Runs one input
+ * 第一个字节是分块序列的种子, 其余字节是接收的数据。
+ * The first byte seeds the chunking sequence; the remaining bytes are the received data.
+ */
+static void fuzz_run_input(const uint8_t* data, size_t size) {
+    uint32_t x;
+    size_t pos = 1;
+    if (size < 1) {
+        return;
+    }
+    g_fuzz_input = data;
+    g_fuzz_input_len = size;
+    x = 0x9E3779B9u ^ data[0];
+    mock_init();
+    mock_reset_output(1);
+    while (pos < size) {
+        size_t n;
+#if ARESPLOT_ENABLE_NOTIFY
+        uint64_t notified = g_mock_notify_count;
+        uint8_t acks = g_mock_ctx.ack_queue_count;
+#endif
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        n = 1 + (x & 63);
+        if (n > size - pos) {
+            n = size - pos;
+        }
+        if (x & 0x100) {
+            for (size_t i = 0; i < n; ++i) {
+                aresplot_ctx_rx_feed_byte(&g_mock_ctx, data[pos + i]);
+            }
+        } else {
+            aresplot_ctx_rx_feed_packet(&g_mock_ctx, &data[pos], (uint16_t)n);
+        }
+        pos += n;
+        fuzz_check_invariants();
+#if ARESPLOT_ENABLE_NOTIFY
+        if (g_mock_ctx.ack_queue_count > acks && g_mock_notify_count == notified) {
+            fuzz_fail("ACK queued without a notification");
+        }
+#endif
+        mock_advance_us((x >> 12) & 0x3FFF); // 0..16 ms
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+        aresplot_ctx_sample_now(&g_mock_ctx);
+#endif
+        fuzz_service_tick();
+    }
+    for (int i = 0; i < 16; ++i) {
+        mock_advance_us(10000);
+#if ARESPLOT_ENABLE_ISR_SAMPLING
+        aresplot_ctx_sample_now(&g_mock_ctx);
+#endif
+        fuzz_service_tick();
+    }
+#if ARESPLOT_ENABLE_TX_COALESCE
+    aresplot_ctx_tx_flush(&g_mock_ctx); // 最后一个未满的包 The last partial packet
+#endif
+    if (!g_mock_capture_overflow) {
+        long frames = mock_check_output_frames();
+        if (frames < 0) {
+            fuzz_fail("malformed output frame");
+        }
+        g_fuzz_output_frames += (uint64_t)frames;
+    }
+}
+
+#ifdef ARESPLOT_FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    fuzz_run_input(data, size);
+    return 0;
+}
+
+#else
+
+static uint32_t g_fuzz_rng;
+
+static uint32_t fuzz_rand(void) {
+    g_fuzz_rng ^= g_fuzz_rng << 13;
+    g_fuzz_rng ^= g_fuzz_rng >> 17;
+    g_fuzz_rng ^= g_fuzz_rng << 5;
+    return g_fuzz_rng;
+}
+
+// 内置种子: 每条命令的有效帧 Built-in seeds: valid frames of every command
+#define FUZZ_NUM_SEEDS (13)
+static uint8_t g_fuzz_seeds[FUZZ_NUM_SEEDS][256];
+static size_t  g_fuzz_seed_len[FUZZ_NUM_SEEDS];
+
+static void fuzz_put_addr(uint8_t* p, uint32_t addr) {
+    p[0] = (uint8_t)addr;
+    p[1] = (uint8_t)(addr >> 8);
+    p[2] = (uint8_t)(addr >> 16);
+    p[3] = (uint8_t)(addr >> 24);
+}
+
+static void fuzz_build_seeds(void) {
+    uint8_t p[128];
+    size_t s = 0;
+    uint32_t addr = mock_addr(0x100);
+    // START_MONITOR: 3 个变量 + 全部选项 3 variables + all options
+    p[0] = 3;
+    for (int i = 0; i < 3; ++i) {
+        fuzz_put_addr(&p[1 + i * 5], addr + (uint32_t)i * 4);
+        p[5 + i * 5] = (uint8_t)(i == 2 ? ARES_TYPE_FLOAT64 : ARES_TYPE_FLOAT32);
+    }
+    p[16] = 0x1F;
+    p[17] = 1;
+    p[18] = 2;
+    p[19] = 3;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], ARESPLOT_CMD_START_MONITOR, p, 20);
+    s++;
+    // START_MONITOR: 块描述 Block descriptor
+    p[0] = 1;
+    fuzz_put_addr(&p[1], addr);
+    p[5] = (uint8_t)(ARES_TYPE_INT16 | ARESPLOT_VAR_DESC_TYPE_BLOCK);
+    p[6] = 8;
+    p[7] = 0x10;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], ARESPLOT_CMD_START_MONITOR, p, 8);
+    s++;
+    // START_MONITOR: 2 个变量, 压缩 + 序号 + 包络 (窗口 4, 带计数) 2 variables, compression + sequence + envelope (window 4, with count)
+    p[0] = 2;
+    for (int i = 0; i < 2; ++i) {
+        fuzz_put_addr(&p[1 + i * 5], addr + (uint32_t)i * 4);
+        p[5 + i * 5] = ARES_TYPE_FLOAT32;
+    }
+    p[11] = 0x2A;
+    p[12] = 4;
+    p[13] = 0;
+    p[14] = 0x01;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], ARESPLOT_CMD_START_MONITOR, p, 15);
+    s++;
+    // START_MONITOR: FP32 + 3 个相邻的 BOOL, 压缩 + 打包 BOOL FP32 + 3 adjacent BOOLs, compression + packed BOOLs
+    p[0] = 4;
+    fuzz_put_addr(&p[1], addr);
+    p[5] = ARES_TYPE_FLOAT32;
+    for (int i = 0; i < 3; ++i) {
+        fuzz_put_addr(&p[6 + i * 5], addr + 8 + (uint32_t)i);
+        p[10 + i * 5] = ARES_TYPE_BOOL;
+    }
+    p[21] = 0x42;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], ARESPLOT_CMD_START_MONITOR, p, 22);
+    s++;
+    // START_MONITOR: 停止 Stop
+    p[0] = 0;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], ARESPLOT_CMD_START_MONITOR, p, 1);
+    s++;
+    // SET_VARIABLE
+    fuzz_put_addr(&p[0], addr);
+    p[4] = ARES_TYPE_FLOAT32;
+    p[5] = 0x00;
+    p[6] = 0x00;
+    p[7] = 0x80;
+    p[8] = 0x3F;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], ARESPLOT_CMD_SET_VARIABLE, p, 9);
+    s++;
+    // SET_SAMPLE_RATE 500 Hz
+    p[0] = 0xF4;
+    p[1] = 0x01;
+    p[2] = 0;
+    p[3] = 0;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], ARESPLOT_CMD_SET_SAMPLE_RATE, p, 4);
+    s++;
+    // CAPTURE_ARM: 变量 0, 上升沿, 阈值 0, 触发前/后 16 Variable 0, rising, threshold 0, 16 pre/post
+    memset(p, 0, 10);
+    p[6] = 16;
+    p[8] = 16;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], 0x04, p, 10);
+    s++;
+    // CAPTURE_CANCEL
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], 0x05, p, 0);
+    s++;
+    // GET_STATS + 清零 Reset
+    p[0] = 0x01;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], 0x06, p, 1);
+    s++;
+    // SET_VARIABLES: 2 项 2 entries
+    p[0] = 2;
+    for (int i = 0; i < 2; ++i) {
+        fuzz_put_addr(&p[1 + i * 9], addr + (uint32_t)i * 4);
+        p[5 + i * 9] = (uint8_t)(i ? ARES_TYPE_INT32 : ARES_TYPE_FLOAT32);
+        memset(&p[6 + i * 9], 0x11, 4);
+    }
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], 0x07, p, 19);
+    s++;
+    // 带标签的 SET_SAMPLE_RATE Tagged SET_SAMPLE_RATE
+    p[0] = 0x5C;
+    p[1] = 0x64;
+    p[2] = 0;
+    p[3] = 0;
+    p[4] = 0;
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], (uint8_t)(0x03 | 0x40), p, 5);
+    s++;
+    // TIME_SYNC: 8 字节令牌 8-byte token
+    for (int i = 0; i < 8; ++i) {
+        p[i] = (uint8_t)(0xA0 + i);
+    }
+    g_fuzz_seed_len[s] = mock_put_frame(g_fuzz_seeds[s], 0x08, p, 8);
+    s++;
+}
+
+/**
+ * @brief 重新计算输入中看起来完整的帧的校验和, 让变异后的命令仍能通过校验而到达深层逻辑
+ * Recomputes the checksum of frame-shaped spans so mutated commands still pass and reach the deeper logic.
+ */
+static void fuzz_fix_checksums(uint8_t* data, size_t size) {
+    for (size_t pos = 1; pos + 6 <= size; ++pos) {
+        uint16_t len;
+        uint8_t checksum = 0;
+        if (data[pos] != ARESPLOT_SOP) {
+            continue;
+        }
+        len = (uint16_t)(data[pos + 2] | (data[pos + 3] << 8));
+        if (pos + 6 + len > size) {
+            continue;
+        }
+        for (size_t i = pos + 1; i < pos + 4 + len; ++i) {
+            checksum ^= data[i];
+        }
+        data[pos + 4 + len] = checksum;
+        data[pos + 5 + len] = ARESPLOT_EOP;
+        pos += (size_t)len + 5;
+    }
+}
+
+// 由种子拼接并变异出一个输入 Builds one input by splicing and mutating seeds
+static size_t fuzz_make_input(uint8_t* out) {
+    size_t len = 1;
+    int frames = 1 + (int)(fuzz_rand() % 6);
+    int mutations;
+    out[0] = (uint8_t)fuzz_rand();
+    for (int f = 0; f < frames; ++f) {
+        uint32_t s = fuzz_rand() % FUZZ_NUM_SEEDS;
+        if (len + g_fuzz_seed_len[s] > FUZZ_MAX_INPUT) {
+            break;
+        }
+        memcpy(&out[len], g_fuzz_seeds[s], g_fuzz_seed_len[s]);
+        len += g_fuzz_seed_len[s];
+    }
+    mutations = (int)(fuzz_rand() % 8);
+    for (int m = 0; m < mutations && len > 1; ++m) {
+        size_t at = 1 + fuzz_rand() % (len - 1);
+        switch (fuzz_rand() % 6) {
+        case 0: out[at] ^= (uint8_t)(1u << (fuzz_rand() & 7)); break;
+        case 1: out[at] = (uint8_t)fuzz_rand(); break;
+        case 2: out[at] = (fuzz_rand() & 1) ? ARESPLOT_SOP : ARESPLOT_EOP; break;
+        case 3: // 插入一个字节 Insert a byte
+            if (len < FUZZ_MAX_INPUT) {
+                memmove(&out[at + 1], &out[at], len - at);
+                out[at] = (uint8_t)fuzz_rand();
+                len++;
+            }
+            break;
+        case 4: // 删除一个字节 Delete a byte
+            memmove(&out[at], &out[at + 1], len - at - 1);
+            len--;
+            break;
+        default: // 改写长度字段附近的字节为极值 Set a byte to an extreme value
+            out[at] = (fuzz_rand() & 1) ? 0xFF : 0x00;
+            break;
+        }
+    }
+    if (fuzz_rand() % 4 != 0) {
+        fuzz_fix_checksums(out, len);
+    }
+    return len;
+}
+
+static int fuzz_replay_file(const char* path) {
+    static uint8_t buf[1u << 20];
+    size_t n;
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "fuzz_rx: cannot open %s\n", path);
+        return 1;
+    }
+    n = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    fuzz_run_input(buf, n);
+    printf("fuzz_rx: %s ok (%zu bytes)\n", path, n);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    static uint8_t input[FUZZ_MAX_INPUT];
+    unsigned long iterations = 100000;
+    uint32_t seed = 1;
+    int files = 0;
+    int rc = 0;
+    mock_sandbox();
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else {
+            rc |= fuzz_replay_file(argv[i]);
+            files++;
+        }
+    }
+    if (files > 0) {
+        return rc;
+    }
+    g_fuzz_rng = seed ? seed : 1;
+    fuzz_build_seeds();
+    for (unsigned long it = 0; it < iterations; ++it) {
+        size_t len = fuzz_make_input(input);
+        fuzz_run_input(input, len);
+    }
+    printf("fuzz_rx: %lu inputs ok (seed %u, %llu output frames)\n", iterations, (unsigned)seed,
+           (unsigned long long)g_fuzz_output_frames);
+    return 0;
+}
+
+#endif // ARESPLOT_FUZZ_LIBFUZZER
@@ -0,0 +1,284 @@
+// mock_hal.h - 主机构建的硬件回调模拟 Host-build mocks of the hardware callbacks
+// 在 #include "aresplot_client.c" 之后包含, 每个程序只包含一次。
+// Include after #include "aresplot_client.c", once per program.
+// 辅助函数均为 static inline, 各程序只用到其中一部分也不会告警。
+// The helpers are all static inline, so a program using only some of them builds without warnings.
+
+#ifndef ARESPLOT_MOCK_HAL_H
+#define ARESPLOT_MOCK_HAL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// 变量所在的沙盒内存, 映射在 32 位地址空间内以便用协议地址访问
+// Sandbox memory for the variables, mapped inside the 32-bit address space so protocol addresses can reach it
+#define MOCK_SANDBOX_BASE (0x20000000UL)
+#define MOCK_SANDBOX_SIZE (0x20000UL) // 128 KB
+
+// 输出捕获缓冲区大小 Size of the output capture buffer
+#define MOCK_CAPTURE_SIZE (1u << 20)
+
+static uint8_t* g_mock_sandbox;
+static uint64_t g_mock_time_us;       // 模拟时钟 (微秒) Mock clock (us)
+static uint64_t g_mock_tx_bytes;      // 发送的总字节数 Total bytes sent
+static uint64_t g_mock_tx_packets;    // 发送的数据包数 Packets sent
+static uint8_t  g_mock_capture_enabled; // 是否保存发送的数据 Whether sent data is kept
+static uint8_t  g_mock_capture[MOCK_CAPTURE_SIZE];
+static size_t   g_mock_capture_len;
+static uint8_t  g_mock_capture_overflow; // 捕获缓冲区已满 The capture buffer ran full
+static uint32_t g_mock_critical_depth;   // 临界区嵌套深度 Critical section nesting depth
+#if ARESPLOT_ENABLE_NOTIFY
+static uint64_t g_mock_notify_count;     // 工作通知次数 Work notifications received
+#endif
+
+/**
+ * @brief 映射沙盒内存 (首次调用时) 并返回其基址
+ * Maps the sandbox memory (on first call) and returns its base.
+ */
+static inline uint8_t* mock_sandbox(void) {
+    if (g_mock_sandbox == NULL) {
+        void* p = mmap((void*)MOCK_SANDBOX_BASE, MOCK_SANDBOX_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED || (uintptr_t)p != MOCK_SANDBOX_BASE) {
+            fprintf(stderr, "mock: cannot map the sandbox at 0x%08lx\n", MOCK_SANDBOX_BASE);
+            exit(2);
+        }
+        g_mock_sandbox = (uint8_t*)p;
+    }
+    return g_mock_sandbox;
+}
+
+/**
+ * @brief 沙盒内偏移对应的协议地址 Protocol address of a sandbox offset
+ */
+static inline uint32_t mock_addr(uint32_t offset) {
+    return (uint32_t)(uintptr_t)(mock_sandbox() + offset);
+}
+
+/**
+ * @brief 宿主机单调时钟 (纳秒), 用于计时 Host monotonic clock (ns), used for timing
+ */
+static inline uint64_t mock_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief 推进模拟时钟 Advances the mock clock
+ */
+static inline void mock_advance_us(uint32_t us) {
+    g_mock_time_us += us;
+}
+
+/**
+ * @brief 清空发送计数与捕获 Clears the TX counters and the capture
+ */
+static inline void mock_reset_output(uint8_t capture) {
+    g_mock_tx_bytes = 0;
+    g_mock_tx_packets = 0;
+    g_mock_capture_len = 0;
+    g_mock_capture_overflow = 0;
+    g_mock_capture_enabled = capture;
+}
+
+static inline void mock_record_packet(const uint8_t* data, uint16_t length) {
+    g_mock_tx_bytes += length;
+    g_mock_tx_packets++;
+    if (g_mock_capture_enabled) {
+        if (g_mock_capture_len + length <= sizeof(g_mock_capture)) {
+            memcpy(&g_mock_capture[g_mock_capture_len], data, length);
+            g_mock_capture_len += length;
+        } else {
+            g_mock_capture_overflow = 1;
+        }
+    }
+}
+
+// 测试程序使用的实例, 通过显式的 aresplot_ctx_* 接口驱动, 与 ARESPLOT_ENABLE_DEFAULT_INSTANCE 无关
+// The instance the programs use, driven through the explicit aresplot_ctx_* API regardless of ARESPLOT_ENABLE_DEFAULT_INSTANCE
+static aresplot_ctx_t g_mock_ctx;
+
+// 发送函数同步完成, 异步模式下在发送函数内调用 aresplot_ctx_tx_complete() (阻塞发送)
+// Sends complete synchronously; in async mode aresplot_ctx_tx_complete() is called from inside the send (blocking send)
+#if ARESPLOT_ENABLE_ASYNC_TX
+static int mock_send_packet(void* user, const uint8_t* data, uint16_t length) {
+    mock_record_packet(data, length);
+    aresplot_ctx_tx_complete((aresplot_ctx_t*)user);
+    return 1;
+}
+#else
+static void mock_send_packet(void* user, const uint8_t* data, uint16_t length) {
+    (void)user;
+    mock_record_packet(data, length);
+}
+#endif
+
+static uint32_t mock_get_tick_ms(void* user) {
+    (void)user;
+    return (uint32_t)(g_mock_time_us / 1000u);
+}
+
+#if ARESPLOT_ENABLE_TICK_US
+static uint32_t mock_get_tick_us(void* user) {
+    (void)user;
+    return (uint32_t)g_mock_time_us;
+}
+#endif
+
+#if ARESPLOT_ENABLE_STATS_CYCLES
+static uint32_t mock_get_cycles(void* user) {
+    (void)user;
+    return (uint32_t)mock_now_ns();
+}
+#endif
+
+// 临界区不允许嵌套: 在 MCU 上内层的退出会提前开中断
+// Critical sections must not nest: on an MCU the inner exit would re-enable interrupts early
+static void mock_critical_enter(void* user) {
+    (void)user;
+    if (g_mock_critical_depth++ != 0) {
+        fprintf(stderr, "mock: nested critical section\n");
+        abort();
+    }
+}
+
+static void mock_critical_exit(void* user) {
+    (void)user;
+    if (g_mock_critical_depth == 0) {
+        fprintf(stderr, "mock: critical section exit without enter\n");
+        abort();
+    }
+    g_mock_critical_depth--;
+}
+
+#if ARESPLOT_ENABLE_NOTIFY
+static void mock_notify(void* user) {
+    (void)user;
+    g_mock_notify_count++;
+}
+#endif
+
+static const aresplot_callbacks_t g_mock_callbacks = {
+    .send_packet = mock_send_packet,
+    .get_tick_ms = mock_get_tick_ms,
+#if ARESPLOT_ENABLE_TICK_US
+    .get_tick_us = mock_get_tick_us,
+#endif
+#if ARESPLOT_ENABLE_STATS_CYCLES
+    .get_cycles = mock_get_cycles,
+#endif
+    .critical_enter = mock_critical_enter,
+    .critical_exit = mock_critical_exit,
+#if ARESPLOT_ENABLE_NOTIFY
+    .notify = mock_notify,
+#endif
+    .user = &g_mock_ctx
+};
+
+#if ARESPLOT_ENABLE_DEFAULT_INSTANCE
+// 默认实例的回调, 使库能按默认配置链接; 测试程序只使用 g_mock_ctx, 不调用 aresplot_init()
+// The default instance's callbacks, so the library links in the default config; the programs only use g_mock_ctx
+// and never call aresplot_init()
+#if ARESPLOT_ENABLE_ASYNC_TX
+int aresplot_user_send_packet(const uint8_t* data, uint16_t length) {
+    mock_record_packet(data, length);
+    aresplot_tx_complete();
+    return 1;
+}
+#else
+void aresplot_user_send_packet(const uint8_t* data, uint16_t length) {
+    mock_send_packet(NULL, data, length);
+}
+#endif
+
+uint32_t aresplot_user_get_tick_ms(void) {
+    return mock_get_tick_ms(NULL);
+}
+
+#if ARESPLOT_ENABLE_TICK_US
+uint32_t aresplot_user_get_tick_us(void) {
+    return mock_get_tick_us(NULL);
+}
+#endif
+
+#if ARESPLOT_ENABLE_STATS_CYCLES
+uint32_t aresplot_user_get_cycles(void) {
+    return mock_get_cycles(NULL);
+}
+#endif
+
+void aresplot_user_critical_enter(void) {
+    mock_critical_enter(NULL);
+}
+
+void aresplot_user_critical_exit(void) {
+    mock_critical_exit(NULL);
+}
+
+#if ARESPLOT_ENABLE_NOTIFY
+void aresplot_user_notify(void) {
+    mock_notify(NULL);
+}
+#endif
+#endif // ARESPLOT_ENABLE_DEFAULT_INSTANCE
+
+/**
+ * @brief (重新) 初始化测试实例 (Re)initializes the test instance
+ */
+static inline void mock_init(void) {
+    aresplot_ctx_init(&g_mock_ctx, &g_mock_callbacks);
+}
+
+/**
+ * @brief 组装一个协议帧 (PC -> MCU 方向) Assembles a protocol frame (PC -> MCU direction)
+ * @return 帧长度 Frame length.
+ */
+static inline size_t mock_put_frame(uint8_t* out, uint8_t cmd, const uint8_t* payload, uint16_t len) {
+    uint8_t checksum = (uint8_t)(cmd ^ (uint8_t)(len & 0xFF) ^ (uint8_t)(len >> 8));
+    out[0] = ARESPLOT_SOP;
+    out[1] = cmd;
+    out[2] = (uint8_t)(len & 0xFF);
+    out[3] = (uint8_t)(len >> 8);
+    for (uint16_t i = 0; i < len; ++i) {
+        out[4 + i] = payload[i];
+        checksum ^= payload[i];
+    }
+    out[4 + len] = checksum;
+    out[5 + len] = ARESPLOT_EOP;
+    return (size_t)len + 6;
+}
+
+/**
+ * @brief 检查捕获的输出流是否全部由完整有效的帧组成
+ * Checks that the captured output stream consists solely of complete, valid frames.
+ * @return 有效帧数, 出错时为 -1 Number of valid frames, -1 on error.
+ */
+static inline long mock_check_output_frames(void) {
+    size_t pos = 0;
+    long frames = 0;
+    while (pos < g_mock_capture_len) {
+        if (g_mock_capture_len - pos < 6 || g_mock_capture[pos] != ARESPLOT_SOP) {
+            return -1;
+        }
+        uint16_t len = (uint16_t)(g_mock_capture[pos + 2] | (g_mock_capture[pos + 3] << 8));
+        if (g_mock_capture_len - pos < (size_t)len + 6) {
+            return -1;
+        }
+        uint8_t checksum = 0;
+        for (size_t i = 1; i < (size_t)len + 4; ++i) {
+            checksum ^= g_mock_capture[pos + i];
+        }
+        if (checksum != g_mock_capture[pos + 4 + len] || g_mock_capture[pos + 5 + len] != ARESPLOT_EOP) {
+            return -1;
+        }
+        pos += (size_t)len + 6;
+        frames++;
+    }
+    return frames;
+}
+
+#endif // ARESPLOT_MOCK_HAL_H
@@ -37,6 +37,10 @@ export const DEFAULT_SIM_AMPLITUDE = 1;
 
 // --- Serial Defaults ---
 export const DEFAULT_BAUD_RATE = 115200;
+export const ARESPLOT_TIME_SYNC_INTERVAL_MS = 1000; // CMD_TIME_SYNC period while an Aresplot session runs
+export const ARESPLOT_MAX_TAGS_IN_FLIGHT = 4; // Tagged commands awaiting an ACK at once; ARESPLOT_ACK_QUEUE_SIZE of the default MCU build
+export const ARESPLOT_TAG_TIMEOUT_MS = 1000; // A tagged command without an ACK for this long is given up on
+export const ARESPLOT_BUSY_RETRIES = 3; // Resends of a command the MCU answered with STATUS_ERROR_BUSY
 // Add other serial defaults if needed
 
 // --- Terminal View ---
@@ -7,18 +7,24 @@ import {
   DEFAULT_SIM_FREQUENCY,
   DEFAULT_SIM_AMPLITUDE,
   DEFAULT_BAUD_RATE,
+  ARESPLOT_TIME_SYNC_INTERVAL_MS,
+  ARESPLOT_MAX_TAGS_IN_FLIGHT,
+  ARESPLOT_TAG_TIMEOUT_MS,
+  ARESPLOT_BUSY_RETRIES,
 } from "./config.js";
 import { eventBus } from "./event_bus.js";
 import * as uiManager from "./modules/ui.js";
 import * as serialService from "./modules/serial.js";
 import * as workerService from "./modules/worker_service.js";
 import * as dataProcessor from "./modules/data_processing.js";
+import * as recording from "./modules/recording.js";
 import * as plotModule from "./modules/plot_module.js";
 import * as terminalModule from "./modules/terminal_module.js";
 import * as quatModule from "./modules/quat_module.js";
 import { debounce } from "./utils.js";
 import * as elfAnalyzerService from "./modules/elf_analyzer_service.js";
 import * as aresplotProtocol from "./modules/aresplot_protocol.js";
+import { countRows } from "./modules/data_batch.js";
 
 // Core Application State
 const appState = {
@@ -40,8 +46,32 @@ const appState = {
     parity: "none",
     flowControl: "none",
     bufferSize: 32768,
+    aresplotSampleRateHz: null, // null: never sent, MCU keeps its own rate; 0: MCU default
+    aresplotEnvelopeWindow: 0, // Samples the MCU folds into one min/max/mean window; 0 or 1: every sample is sent
   },
   rAFID: null,
+  aresplotRawEncoding: true, // Request native-width values; cleared when the MCU rejects the option
+  aresplotLastStartUsedRaw: false,
+  aresplotCompression: true, // Request the compressed monitor stream; cleared when the MCU rejects the option
+  aresplotLastStartUsedCompression: false,
+  aresplotDividers: true, // Send per-variable dividers when any slot uses one; cleared when the MCU rejects the option
+  aresplotLastStartUsedDividers: false,
+  aresplotSequence: true, // Request FrameSeq in data frames for loss accounting; cleared when the MCU rejects the option
+  aresplotLastStartUsedSequence: false,
+  aresplotBlocks: true, // Send contiguous same-type slots as block descriptors; cleared when the MCU rejects the option
+  aresplotLastStartUsedBlocks: false,
+  aresplotEnvelope: true, // Request envelope aggregation when a window is set; cleared when the MCU rejects the option
+  aresplotLastStartUsedEnvelope: false,
+  aresplotPackedBools: true, // Send BOOL slots as bits of one bitmap; cleared when the MCU rejects the option
+  aresplotLastStartUsedPackedBools: false,
+  aresplotLastStartPlain: false, // The last CMD_START_MONITOR was the probe sent without any Options
+  aresplotOptionsRejected: false, // The MCU accepted the layout without Options, so an INVALID_PAYLOAD names an Options bit
+  aresplotLastStartNumVars: 0, // Variables in the last CMD_START_MONITOR; a capture trigger must index one of them
+  aresplotTags: true, // Tag commands so pipelined ACKs can be matched to them; cleared when the MCU rejects tagged commands
+  aresplotTaggedCommands: new Map(), // Tagged commands awaiting their ACK: tag -> { frame, sentAt, layout?, startOptions?, busyRetries? }
+  aresplotNextTag: 0,
+  aresplotTagWaiters: [], // Resolvers of commands waiting for fewer than ARESPLOT_MAX_TAGS_IN_FLIGHT tags in flight
+  aresplotTimeSyncTimer: null, // Sends CMD_TIME_SYNC periodically; cleared when the MCU does not support it
 };
 
 const displayModules = [plotModule, terminalModule, quatModule];
@@ -191,6 +221,8 @@ function setupAppEventListeners() {
   eventBus.on("ui:simConfigChanged", handleSimConfigChangeIntent);
   eventBus.on("ui:clearDataClicked", handleClearDataIntent);
   eventBus.on("ui:downloadCsvClicked", handleDownloadCsvIntent);
+  eventBus.on("ui:recordToggleClicked", handleRecordToggleIntent);
+  eventBus.on("ui:convertRecordingClicked", handleConvertRecordingIntent);
   eventBus.on("ui:baudRateSet", handleBaudRateSetIntent);
   eventBus.on("serial:connected", handleSerialConnected);
   eventBus.on("serial:disconnected", handleSerialDisconnected);
@@ -206,6 +238,11 @@ function setupAppEventListeners() {
   eventBus.on("ui:symbolInputValidated", handleSymbolInputValidation); // <<< NEW listener for validation
   eventBus.on("ui:symbolSelectedForAdd", handleSymbolSelectedForAdd); // Listener for add button/enter
   eventBus.on("main:statusUpdate", handleMainStatusUpdate);
+  eventBus.on("ui:aresplotSampleRateSet", handleAresplotSampleRateSet);
+  eventBus.on("ui:aresplotEnvelopeSet", handleAresplotEnvelopeSet);
+  eventBus.on("ui:aresplotCaptureArm", handleAresplotCaptureArm);
+  eventBus.on("ui:aresplotCaptureCancel", handleAresplotCaptureCancel);
+  eventBus.on("ui:aresplotGetStats", handleAresplotGetStats);
   eventBus.on("ui:symbolSlotsUpdated", (event) => {
     const currentSlots = event.detail.slots;
     console.log(
@@ -303,6 +340,8 @@ function handleProtocolChangeIntent(event) {
       // Clear previous symbols if switching TO aresplot
       elfAnalyzerService.clearParsedSymbols();
     }
+    // The ELF used last comes back from the symbol cache, Wasm or not
+    restoreCachedElfSymbols();
   } else {
     // Logic for other protocols (send parser update, etc.)
     if (serialService.isConnected() && !appState.isCollecting) {
@@ -403,6 +442,76 @@ function handleDownloadCsvIntent() {
   dataProcessor.downloadCSV(seriesInfo);
 }
 
+/**
+ * Channel names and types for a recording header: the ELF symbols in the Aresplot slots, in slot order.
+ * Other protocols carry no names, so their channels get the default names.
+ * @returns {{channels: Array<{name: string, type: string|null, address?: number}>}}
+ */
+function describeRecordingChannels() {
+  if (appState.config.serialProtocol !== "aresplot") return { channels: [] };
+  return {
+    channels: uiManager.getSelectedSymbolsInSlots().map((s) => ({
+      name: s.name,
+      type: s._displayType ?? null,
+      address: s.address,
+    })),
+  };
+}
+
+async function handleRecordToggleIntent() {
+  try {
+    if (recording.isRecording()) {
+      const stats = await recording.stopRecording();
+      uiManager.updateRecordingUI({
+        active: false,
+        message: `录制完成: ${stats.rows.toLocaleString()} 行, ${(
+          stats.bytes / 1048576
+        ).toFixed(1)} MB${
+          stats.droppedRows > 0
+            ? `, 磁盘跟不上时丢弃 ${stats.droppedRows.toLocaleString()} 行`
+            : ""
+        }`,
+      });
+      return;
+    }
+    // The file picker needs the click's user activation, so nothing is awaited before it
+    if (await recording.startRecording(describeRecordingChannels())) {
+      uiManager.updateRecordingUI({ active: true });
+    }
+  } catch (error) {
+    console.error("Core: Recording error:", error);
+    uiManager.updateRecordingUI({
+      active: recording.isRecording(),
+      failed: true,
+      message: `录制出错: ${error.message}`,
+    });
+  }
+}
+
+async function handleConvertRecordingIntent() {
+  try {
+    const rows = await recording.convertRecordingToCsv((done, total) =>
+      uiManager.updateRecordingUI({
+        active: recording.isRecording(),
+        message: `转换 CSV: ${done} / ${total} 块`,
+      })
+    );
+    if (rows !== null) {
+      uiManager.updateRecordingUI({
+        active: recording.isRecording(),
+        message: `CSV 已写入: ${rows.toLocaleString()} 行`,
+      });
+    }
+  } catch (error) {
+    console.error("Core: Recording conversion error:", error);
+    uiManager.updateRecordingUI({
+      active: recording.isRecording(),
+      failed: true,
+      message: `转换出错: ${error.message}`,
+    });
+  }
+}
+
 function handleBaudRateSetIntent(event) {
   const { value } = event.detail;
   const num = parseInt(value);
@@ -438,13 +547,13 @@ function handleSerialStatus(event) {
   uiManager.updateStatus(`状态：${status}`);
 }
 function handleWorkerData(event) {
-  const batch = event.detail;
-  if (Array.isArray(batch) && batch.length > 0) {
-    // Batch items are expected to be { timestamp, values, rawLineBytes?, isUnidentifiedAresplotData? }
-    // For Aresplot, timestamp is PC-calibrated, values are FP32.
+  const block = event.detail;
+  if (block && block.count > 0) {
+    // A columnar block { count, timestamps, channels, widths, raw } (see data_batch.js).
+    // For Aresplot, timestamps are PC-calibrated.
     // For other protocols, timestamp is PC time at reception in worker.
-    // rawLineBytes is used by terminalModule.
-    Array.prototype.push.apply(appState.mainThreadDataQueue, batch);
+    // raw holds the bytes shown by terminalModule.
+    appState.mainThreadDataQueue.push(block);
   }
 }
 
@@ -472,7 +581,43 @@ function handleWorkerStatus(event) {
 function handleWorkerInfo(event) {
   // For Aresplot specific info (e.g., timestamp sync)
   const payload = event.detail;
-  if (payload && payload.source === "aresplot_timestamp") {
+  if (payload && payload.source === "aresplot_sample_rate") {
+    console.info("Main (Aresplot Info):", payload.message);
+    if (document.getElementById("elfStatusMessage")) {
+      uiManager.updateElementText(
+        "elfStatusMessage",
+        `MCU sample rate: ${payload.achievedRateHz.toFixed(3)} Hz.`,
+        payload.statusCode !== aresplotProtocol.AckStatus.OK
+      );
+    }
+  } else if (payload && payload.source === "aresplot_ack") {
+    const command =
+      payload.tag !== undefined
+        ? appState.aresplotTaggedCommands.get(payload.tag)
+        : undefined;
+    releaseAresplotTag(payload.tag);
+    const plain = command
+      ? command.startOptions && command.startOptions.plain
+      : payload.commandId === aresplotProtocol.CMD_ID.START_MONITOR &&
+        appState.aresplotLastStartPlain;
+    if (plain && appState.isCollecting) {
+      // The layout works without Options, so the earlier INVALID_PAYLOAD was about an Options bit
+      console.warn("Main: MCU accepted CMD_START_MONITOR without Options, dropping the options it rejects one by one.");
+      appState.aresplotOptionsRejected = true;
+      sendAresplotStartMonitorCommand();
+    }
+  } else if (payload && payload.source === "aresplot_capture") {
+    console.info("Main (Aresplot Info):", payload.message);
+    uiManager.updateElementText("elfStatusMessage", payload.message);
+  } else if (payload && payload.source === "aresplot_mcu_stats") {
+    console.info("Main (Aresplot Info): MCU statistics", payload.stats);
+    uiManager.updateElementText(
+      "aresplotStatsDisplay",
+      formatAresplotStats(payload.stats)
+    );
+  } else if (payload && payload.source === "aresplot_link_stats") {
+    plotModule.updateLinkStats(payload);
+  } else if (payload && payload.source === "aresplot_timestamp") {
     console.info("Main (Aresplot Info):", payload.message);
     // Update a subtle status area or just log for now
     if (
@@ -497,12 +642,131 @@ function handleWorkerWarn(event) {
   } else if (typeof payload === "object" && payload !== null) {
     message = payload.message || JSON.stringify(payload);
     if (payload.source === "aresplot_ack_error") {
+      if (payload.tagRejected) {
+        resendAresplotCommandUntagged(payload.commandId);
+        return;
+      }
+      // The command's own record, when it was tagged; untagged ACKs fall back to the last CMD_START_MONITOR
+      const command =
+        payload.tag !== undefined
+          ? appState.aresplotTaggedCommands.get(payload.tag)
+          : undefined;
+      releaseAresplotTag(payload.tag);
+      if (
+        command &&
+        payload.statusCode === aresplotProtocol.AckStatus.ERROR_BUSY &&
+        (command.busyRetries || 0) < ARESPLOT_BUSY_RETRIES
+      ) {
+        // The MCU's ACK queue was full and it did not execute the command: send it again under a new tag
+        writeAresplotCommand(command.frame, {
+          ...command,
+          busyRetries: (command.busyRetries || 0) + 1,
+        }).catch((e) =>
+          console.error("Main: Error resending Aresplot command:", e)
+        );
+        return;
+      }
+      const used = (command && command.startOptions) || {
+        raw: appState.aresplotLastStartUsedRaw,
+        compression: appState.aresplotLastStartUsedCompression,
+        dividers: appState.aresplotLastStartUsedDividers,
+        sequence: appState.aresplotLastStartUsedSequence,
+        blocks: appState.aresplotLastStartUsedBlocks,
+        envelope: appState.aresplotLastStartUsedEnvelope,
+        packedBools: appState.aresplotLastStartUsedPackedBools,
+        plain: appState.aresplotLastStartPlain,
+      };
       message = `MCU NACK for CMD 0x${(payload.commandId || 0).toString(
         16
       )} - Status 0x${(payload.statusCode || 0).toString(16)}.`;
       targetStatusElementId = "elfStatusMessage";
+      if (
+        payload.commandId === aresplotProtocol.CMD_ID.CAPTURE_ARM &&
+        payload.statusCode ===
+          aresplotProtocol.AckStatus.ERROR_MCU_BUSY_OR_LIMIT
+      ) {
+        message =
+          "MCU rejected the capture: monitoring is not running or the capture does not fit its buffer.";
+      } else if (
+        payload.commandId === aresplotProtocol.CMD_ID.CAPTURE_ARM &&
+        payload.statusCode === aresplotProtocol.AckStatus.ERROR_UNKNOWN_CMD
+      ) {
+        message = "MCU firmware does not support triggered capture.";
+      } else if (
+        payload.commandId === aresplotProtocol.CMD_ID.GET_STATS &&
+        payload.statusCode === aresplotProtocol.AckStatus.ERROR_UNKNOWN_CMD
+      ) {
+        message = "MCU firmware does not support runtime statistics.";
+      } else if (
+        payload.commandId === aresplotProtocol.CMD_ID.TIME_SYNC &&
+        payload.statusCode === aresplotProtocol.AckStatus.ERROR_UNKNOWN_CMD
+      ) {
+        // The worker keeps mapping timestamps from data arrival times
+        stopAresplotTimeSync();
+        console.info("Main: MCU firmware does not support CMD_TIME_SYNC; timestamps follow data arrival times.");
+        return;
+      } else if (
+        payload.commandId === aresplotProtocol.CMD_ID.SET_VARIABLES &&
+        Array.isArray(payload.entryOk)
+      ) {
+        // The MCU writes all entries or none; the bitmap names the ones it rejected
+        const rejected = payload.entryOk
+          .map((ok, i) => (ok ? null : i))
+          .filter((i) => i !== null);
+        message = `MCU rejected the parameter set (Status 0x${payload.statusCode.toString(
+          16
+        )}), nothing was written. Invalid entries: ${rejected.join(", ")}.`;
+      }
+      if (
+        payload.commandId === aresplotProtocol.CMD_ID.START_MONITOR &&
+        payload.statusCode === aresplotProtocol.AckStatus.ERROR_INVALID_PAYLOAD &&
+        (used.raw ||
+          used.compression ||
+          used.dividers ||
+          used.sequence ||
+          used.blocks ||
+          used.envelope ||
+          used.packedBools)
+      ) {
+        if (!appState.aresplotOptionsRejected) {
+          // INVALID_PAYLOAD may just as well be about the layout: first check whether the MCU accepts it
+          // without Options. If it does not, that NACK reports the real error and no option is dropped
+          console.warn("Main: MCU rejected CMD_START_MONITOR, retrying without Options to find the cause.");
+          sendAresplotStartMonitorCommand({ plain: true });
+          return;
+        }
+        // Older firmware (or a build without an option) rejects unknown Options bits: drop packed
+        // BOOLs and the envelope first, then block descriptors, sequence numbers, compression, the
+        // dividers and raw encoding, then send plain FP32 values
+        if (used.packedBools) {
+          console.warn("Main: MCU rejected packed BOOLs, retrying CMD_START_MONITOR with one value per BOOL.");
+          appState.aresplotPackedBools = false;
+        } else if (used.envelope) {
+          console.warn("Main: MCU rejected envelope aggregation, retrying CMD_START_MONITOR with every sample.");
+          appState.aresplotEnvelope = false;
+        } else if (used.blocks) {
+          console.warn("Main: MCU rejected block descriptors, retrying CMD_START_MONITOR with one descriptor per variable.");
+          appState.aresplotBlocks = false;
+        } else if (used.sequence) {
+          console.warn("Main: MCU rejected sequence numbers, retrying CMD_START_MONITOR without them.");
+          appState.aresplotSequence = false;
+        } else if (used.compression) {
+          console.warn("Main: MCU rejected compression, retrying CMD_START_MONITOR without it.");
+          appState.aresplotCompression = false;
+        } else if (used.dividers) {
+          console.warn("Main: MCU rejected per-variable dividers, retrying CMD_START_MONITOR at the full rate.");
+          appState.aresplotDividers = false;
+        } else {
+          console.warn("Main: MCU rejected raw encoding, retrying CMD_START_MONITOR with FP32 values.");
+          appState.aresplotRawEncoding = false;
+        }
+        sendAresplotStartMonitorCommand();
+        return;
+      }
+    } else if (payload.source === "aresplot_capture") {
+      targetStatusElementId = "elfStatusMessage";
     } else if (payload.source === "aresplot_timestamp") {
-      message = `Timestamp Drift: ${payload.message}`;
+      message = `Timestamp: ${payload.message}`;
       targetStatusElementId = "elfStatusMessage";
     } else if (payload.source === "aresplot_parser_internal") {
       message = `Aresplot Parser: ${payload.message}`;
@@ -550,19 +814,21 @@ function handleWorkerError(event) {
  * 2. _protocolType: The numeric AresOriginalType_t value for protocol communication.
  * Modifies the symbol object in place and returns it.
  * @param {object} symbol - The symbol object (must have name, type_name, size from ELF).
+ * @param {boolean} [warn=true] - Log symbols whose type cannot be mapped (off when preparing a whole table).
  * @returns {object} The augmented symbol object.
  */
-function augmentSymbolWithTypeData(symbol) {
+function augmentSymbolWithTypeData(symbol, warn = true) {
   if (
     !symbol ||
     typeof symbol.name === "undefined" ||
     typeof symbol.type_name === "undefined" ||
     typeof symbol.size === "undefined"
   ) {
-    console.warn(
-      "augmentSymbolWithTypeData: Invalid symbol object received.",
-      symbol
-    );
+    if (warn)
+      console.warn(
+        "augmentSymbolWithTypeData: Invalid symbol object received.",
+        symbol
+      );
     if (symbol) {
       symbol._displayType = "UNK"; // Short for UNKNOWN
       symbol._protocolType = null;
@@ -689,7 +955,7 @@ function augmentSymbolWithTypeData(symbol) {
           protocolTypeValue = aresplotProtocol.AresOriginalType.UINT32;
         else protocolTypeValue = null; // Cannot reliably map other sizes
 
-        if (protocolTypeValue === null && sizeBytes > 0) {
+        if (warn && protocolTypeValue === null && sizeBytes > 0) {
           console.warn(
             `Symbol '${symbol.name}' (type: ${typeNameLower}, size: ${sizeBytes}) has unmapped complex/large type. Cannot determine _protocolType.`
           );
@@ -703,10 +969,300 @@ function augmentSymbolWithTypeData(symbol) {
   return symbol;
 }
 
+/**
+ * Copy of an ELF table symbol for a slot. Table symbols carry their types from the analysis
+ * (and the symbol cache), so CMD_START_MONITOR takes address and type as they were cached.
+ * @param {object} symbol - Symbol from elfAnalyzerService.
+ * @returns {object}
+ */
+function slotSymbolFrom(symbol) {
+  return symbol._displayType !== undefined
+    ? { ...symbol }
+    : augmentSymbolWithTypeData({ ...symbol });
+}
+
+/**
+ * Forgets a tagged command once its ACK arrived and wakes the commands waiting for a free tag.
+ * @param {number|undefined} tag - Tag of the acknowledged command; undefined for an untagged ACK.
+ */
+function releaseAresplotTag(tag) {
+  appState.aresplotTaggedCommands.delete(tag);
+  const waiters = appState.aresplotTagWaiters;
+  appState.aresplotTagWaiters = [];
+  waiters.forEach((resolve) => resolve());
+}
+
+/**
+ * Waits until fewer than ARESPLOT_MAX_TAGS_IN_FLIGHT tagged commands await an ACK, so the MCU's ACK queue never
+ * overflows. Commands without an ACK for ARESPLOT_TAG_TIMEOUT_MS (e.g. a frame lost on the link) are given up on.
+ */
+async function waitForAresplotTagSlot() {
+  while (
+    appState.aresplotTags &&
+    appState.aresplotTaggedCommands.size >= ARESPLOT_MAX_TAGS_IN_FLIGHT
+  ) {
+    const now = performance.now();
+    for (const [tag, command] of appState.aresplotTaggedCommands) {
+      if (now - command.sentAt < ARESPLOT_TAG_TIMEOUT_MS) continue;
+      console.warn(
+        `Main: No ACK for Aresplot CMD 0x${command.frame[1].toString(16)} (tag ${tag}), giving up on it.`
+      );
+      appState.aresplotTaggedCommands.delete(tag);
+    }
+    if (appState.aresplotTaggedCommands.size < ARESPLOT_MAX_TAGS_IN_FLIGHT)
+      break;
+    await new Promise((resolve) => {
+      appState.aresplotTagWaiters.push(resolve);
+      setTimeout(resolve, ARESPLOT_TAG_TIMEOUT_MS);
+    });
+  }
+}
+
+/**
+ * Sends an Aresplot command frame, tagged when the MCU supports tags so that its ACK can be matched to it
+ * while other commands are still in flight. At most ARESPLOT_MAX_TAGS_IN_FLIGHT tagged commands are in flight.
+ * @param {Uint8Array} frame - The untagged command frame.
+ * @param {object} [context] - Kept with the command until its ACK arrives (e.g. the options of a CMD_START_MONITOR).
+ *   A layout in it is queued to the worker under the command's tag.
+ */
+async function writeAresplotCommand(frame, context = {}) {
+  await waitForAresplotTagSlot();
+  if (!appState.aresplotTags) {
+    if (context.layout) workerService.queueAresplotMonitorLayout(context.layout);
+    await serialService.write(frame);
+    return;
+  }
+  const tag = appState.aresplotNextTag;
+  appState.aresplotNextTag = (tag + 1) & 0xff;
+  appState.aresplotTaggedCommands.delete(tag); // A command never acknowledged within 256 tags is forgotten
+  appState.aresplotTaggedCommands.set(tag, {
+    frame,
+    ...context,
+    sentAt: performance.now(),
+  });
+  if (context.layout)
+    workerService.queueAresplotMonitorLayout(context.layout, tag);
+  await serialService.write(aresplotProtocol.tagFrame(frame, tag));
+}
+
+/**
+ * Firmware without tag support refuses tagged commands without executing them: stop tagging and resend
+ * the oldest refused command with this ID untagged. Each refused command gets its own ACK, so every one is resent.
+ * @param {number} commandId - ID of the refused command.
+ */
+function resendAresplotCommandUntagged(commandId) {
+  if (appState.aresplotTags) {
+    console.warn("Main: MCU does not support command tags, resending commands untagged.");
+    appState.aresplotTags = false;
+  }
+  for (const [tag, command] of appState.aresplotTaggedCommands) {
+    if (command.frame[1] !== commandId) continue;
+    releaseAresplotTag(tag);
+    if (command.layout) workerService.queueAresplotMonitorLayout(command.layout);
+    serialService
+      .write(command.frame)
+      .catch((e) => console.error("Main: Error resending Aresplot command:", e));
+    return;
+  }
+}
+
+function handleAresplotSampleRateSet(event) {
+  appState.config.aresplotSampleRateHz = event.detail.rateHz;
+  if (appState.isCollecting) sendAresplotSetSampleRateCommand();
+}
+
+function handleAresplotEnvelopeSet(event) {
+  appState.config.aresplotEnvelopeWindow = event.detail.window;
+  if (appState.isCollecting) sendAresplotStartMonitorCommand();
+}
+
+/**
+ * Sends CMD_SET_SAMPLE_RATE with the configured rate. The MCU replies with the achieved rate.
+ */
+async function sendAresplotSetSampleRateCommand() {
+  if (
+    appState.config.serialProtocol !== "aresplot" ||
+    !serialService.isConnected() ||
+    appState.config.aresplotSampleRateHz === null
+  ) {
+    return;
+  }
+  try {
+    const frame = aresplotProtocol.buildSetSampleRateFrame(
+      appState.config.aresplotSampleRateHz
+    );
+    console.log(
+      `Main: Sending CMD_SET_SAMPLE_RATE (${appState.config.aresplotSampleRateHz} Hz) for Aresplot.`
+    );
+    await writeAresplotCommand(frame);
+  } catch (error) {
+    console.error("Main: Error sending Aresplot CMD_SET_SAMPLE_RATE:", error);
+    uiManager.updateElementText(
+      "elfStatusMessage",
+      `Error sending sample rate cmd: ${error.message}`,
+      true
+    );
+  }
+}
+
+/**
+ * Sends CMD_CAPTURE_ARM. The MCU captures at its full rate and sends the result as CAPTURE_DATA blocks,
+ * which the worker merges into the plot; the continuous stream pauses until the capture has been sent.
+ */
+async function handleAresplotCaptureArm(event) {
+  const params = event.detail;
+  if (
+    appState.config.serialProtocol !== "aresplot" ||
+    !serialService.isConnected() ||
+    !appState.isCollecting
+  ) {
+    uiManager.updateElementText(
+      "elfStatusMessage",
+      "Capture: start collecting first.",
+      true
+    );
+    return;
+  }
+  if (params.varIndex >= appState.aresplotLastStartNumVars) {
+    uiManager.updateElementText(
+      "elfStatusMessage",
+      `Capture: slot ${params.varIndex + 1} is not monitored.`,
+      true
+    );
+    return;
+  }
+  try {
+    const frame = aresplotProtocol.buildCaptureArmFrame(params);
+    console.log("Main: Sending CMD_CAPTURE_ARM for Aresplot:", params);
+    await writeAresplotCommand(frame);
+    uiManager.updateElementText(
+      "elfStatusMessage",
+      "Capture armed, waiting for trigger..."
+    );
+  } catch (error) {
+    console.error("Main: Error sending Aresplot CMD_CAPTURE_ARM:", error);
+    uiManager.updateElementText(
+      "elfStatusMessage",
+      `Error arming capture: ${error.message}`,
+      true
+    );
+  }
+}
+
+async function handleAresplotCaptureCancel() {
+  if (
+    appState.config.serialProtocol !== "aresplot" ||
+    !serialService.isConnected()
+  ) {
+    return;
+  }
+  try {
+    await writeAresplotCommand(aresplotProtocol.buildCaptureCancelFrame());
+    uiManager.updateElementText("elfStatusMessage", "Capture cancelled.");
+  } catch (error) {
+    console.error("Main: Error sending Aresplot CMD_CAPTURE_CANCEL:", error);
+  }
+}
+
+/**
+ * Sends CMD_TIME_SYNC now and then every ARESPLOT_TIME_SYNC_INTERVAL_MS. The token is the sending time on the
+ * clock shared with the worker, which fits each reply into its MCU -> PC clock mapping.
+ */
+function startAresplotTimeSync() {
+  stopAresplotTimeSync();
+  const sendTimeSync = () => {
+    if (!serialService.isConnected()) return;
+    const frame = aresplotProtocol.buildTimeSyncFrame(
+      performance.timeOrigin + performance.now()
+    );
+    serialService
+      .write(frame)
+      .catch((e) => console.error("Error sending CMD_TIME_SYNC:", e));
+  };
+  sendTimeSync();
+  appState.aresplotTimeSyncTimer = setInterval(
+    sendTimeSync,
+    ARESPLOT_TIME_SYNC_INTERVAL_MS
+  );
+}
+
+function stopAresplotTimeSync() {
+  if (appState.aresplotTimeSyncTimer !== null) {
+    clearInterval(appState.aresplotTimeSyncTimer);
+    appState.aresplotTimeSyncTimer = null;
+  }
+}
+
+/**
+ * Sends CMD_GET_STATS. The MCU answers with a CMD_STATS frame, which the worker forwards as an info message.
+ */
+async function handleAresplotGetStats(event) {
+  const { reset } = event.detail;
+  if (
+    appState.config.serialProtocol !== "aresplot" ||
+    !serialService.isConnected()
+  ) {
+    uiManager.updateElementText(
+      "elfStatusMessage",
+      "Statistics: connect to the MCU first.",
+      true
+    );
+    return;
+  }
+  try {
+    await serialService.write(aresplotProtocol.buildGetStatsFrame({ reset }));
+  } catch (error) {
+    console.error("Main: Error sending Aresplot CMD_GET_STATS:", error);
+    uiManager.updateElementText(
+      "elfStatusMessage",
+      `Error querying statistics: ${error.message}`,
+      true
+    );
+  }
+}
+
+/**
+ * Formats a CMD_STATS reply for the statistics panel. Cycle counts are converted to microseconds and
+ * CPU load when the MCU reports its cycle counter frequency.
+ * @param {object} stats - The `stats` object of a parsed CMD_STATS frame.
+ * @returns {string} One line per statistic.
+ */
+function formatAresplotStats(stats) {
+  const seconds = stats.elapsedMs / 1000;
+  const perSecond = (count) =>
+    seconds > 0 ? ` (${(count / seconds).toFixed(1)}/s)` : "";
+  const lines = [
+    `窗口: ${seconds.toFixed(1)} s`,
+    `发送帧: ${stats.framesSent}${perSecond(stats.framesSent)}`,
+    `丢弃采样 (发送忙): ${stats.samplesDropped}`,
+    `ACK 被覆盖: ${stats.acksOverwritten}`,
+    `接收校验错误: ${stats.rxChecksumErrors}`,
+    `错过采样时刻: ${stats.deadlineOverruns}`,
+  ];
+  if (!stats.hasCycles) {
+    lines.push("周期统计: 未启用 (ARESPLOT_ENABLE_STATS_CYCLES)");
+    return lines.join("\n");
+  }
+  const hz = stats.cycleCounterHz;
+  const describe = (name, c) => {
+    if (c.calls === 0) return `${name}: 无调用`;
+    const range = `${c.min}/${c.avg}/${c.max} cycles`;
+    if (!hz || seconds <= 0) return `${name}: ${range} (${c.calls} 次)`;
+    const us = (cycles) => ((cycles * 1e6) / hz).toFixed(1);
+    const load = ((c.avg * c.calls) / (hz * seconds)) * 100;
+    return `${name}: ${us(c.min)}/${us(c.avg)}/${us(c.max)} µs, CPU ${load.toFixed(2)}%`;
+  };
+  lines.push(describe("service_tick (min/avg/max)", stats.tick));
+  lines.push(describe("rx_feed (min/avg/max)", stats.rx));
+  return lines.join("\n");
+}
+
 /**
  * Sends the CMD_START_MONITOR command based on current symbol slots for Aresplot.
+ * @param {{plain?: boolean}} [probe] - plain sends the layout without any Options, to tell whether an
+ *   INVALID_PAYLOAD was about the layout or about an Options bit.
  */
-async function sendAresplotStartMonitorCommand() {
+async function sendAresplotStartMonitorCommand({ plain = false } = {}) {
   if (
     appState.config.serialProtocol !== "aresplot" ||
     !serialService.isConnected()
@@ -724,18 +1280,96 @@ async function sendAresplotStartMonitorCommand() {
         );
         return null;
       }
-      return { address: s.address, originalType: s._protocolType };
+      return { address: s.address, originalType: s._protocolType, divider: s._divider || 1 };
     })
     .filter((s) => s !== null); // Filter out any unmappable symbols
 
   try {
-    const frame = aresplotProtocol.buildStartMonitorFrame(symbolsForProtocol);
     const numVars = symbolsForProtocol.length;
+    // Envelope windows are all FP32 and carry every variable, so they exclude raw encoding and dividers
+    const envelopeWindow = appState.config.aresplotEnvelopeWindow;
+    const envelope =
+      appState.aresplotEnvelope && !plain && numVars > 0 && envelopeWindow > 1
+        ? { window: envelopeWindow, count: true }
+        : null;
+    const rawEncoding =
+      appState.aresplotRawEncoding && !plain && numVars > 0 && !envelope;
+    const compression = appState.aresplotCompression && !plain && numVars > 0;
+    // Compressed frames always carry FrameSeq, so the option only matters for the other data frames
+    const sequence =
+      appState.aresplotSequence && !plain && numVars > 0 && !compression;
+    // Dividers are only sent when a slot uses one, so all-full-rate sessions carry no channel bitmaps
+    const dividers =
+      appState.aresplotDividers &&
+      !plain &&
+      !envelope &&
+      symbolsForProtocol.some((s) => s.divider > 1)
+        ? symbolsForProtocol.map((s) => s.divider)
+        : null;
+    // Slots that follow each other in memory (array elements, adjacent globals) collapse into block descriptors
+    const blocks =
+      appState.aresplotBlocks &&
+      !plain &&
+      aresplotProtocol
+        .groupBlockDescriptors(symbolsForProtocol)
+        .some((d) => d.count > 1);
+    // BOOL slots shrink to one bit each; the MCU cannot pack them around channel bitmaps or envelope windows
+    const packedBools =
+      appState.aresplotPackedBools &&
+      !plain &&
+      !dividers &&
+      !envelope &&
+      symbolsForProtocol.some(
+        (s) => s.originalType === aresplotProtocol.AresOriginalType.BOOL
+      );
+    const frame = aresplotProtocol.buildStartMonitorFrame(symbolsForProtocol, {
+      rawEncoding,
+      compression,
+      dividers,
+      sequence,
+      blocks,
+      envelope,
+      packedBools,
+    });
+    // The worker switches to this layout when the MCU acknowledges the frame
+    const layout = {
+      rawEncoding,
+      compression,
+      dividers,
+      sequence,
+      envelope,
+      packedBools,
+      types: symbolsForProtocol.map((s) => s.originalType),
+    };
+    plotModule.setEnvelopeLayout(
+      envelope ? { numVars, count: envelope.count } : null
+    );
+    appState.aresplotLastStartUsedRaw = rawEncoding;
+    appState.aresplotLastStartUsedCompression = compression;
+    appState.aresplotLastStartUsedDividers = dividers !== null;
+    appState.aresplotLastStartUsedSequence = sequence;
+    appState.aresplotLastStartUsedBlocks = blocks;
+    appState.aresplotLastStartUsedEnvelope = envelope !== null;
+    appState.aresplotLastStartUsedPackedBools = packedBools;
+    appState.aresplotLastStartPlain = plain;
+    appState.aresplotLastStartNumVars = numVars;
     console.log(
       `Main: Sending CMD_START_MONITOR with ${numVars} variable(s) for Aresplot.`
     );
     console.log("Main: Sending Aresplot CMD_START_MONITOR frame:", frame);
-    await serialService.write(frame); // Assumes serialService.write accepts Uint8Array
+    await writeAresplotCommand(frame, {
+      layout,
+      startOptions: {
+        raw: rawEncoding,
+        compression,
+        dividers: dividers !== null,
+        sequence,
+        blocks,
+        envelope: envelope !== null,
+        packedBools,
+        plain,
+      },
+    });
     if (document.getElementById("elfStatusMessage")) {
       // Update specific status if element exists
       uiManager.updateElementText(
@@ -762,6 +1396,23 @@ async function sendAresplotStartMonitorCommand() {
   }
 }
 
+/**
+ * Restores the symbol table of the ELF used last from the symbol cache, unless an ELF was
+ * picked or the protocol changed in the meantime.
+ */
+async function restoreCachedElfSymbols() {
+  const restored = await elfAnalyzerService.restoreLastElfSymbols();
+  if (!restored || appState.config.serialProtocol !== "aresplot") return;
+  const statusMsgEl = document.getElementById("elfStatusMessage");
+  if (statusMsgEl) {
+    statusMsgEl.textContent = `ELF restored from cache: ${restored.fileName}. ${restored.symbols.length} symbols found.`;
+    statusMsgEl.classList.remove("text-red-500");
+  }
+  const searchAreaEl = document.getElementById("symbolSearchArea");
+  if (searchAreaEl) searchAreaEl.style.display = "block";
+  uiManager.updateSymbolDatalist([]);
+}
+
 async function handleElfFileSelected(event) {
   const file = event.detail.file;
   if (!file) {
@@ -787,17 +1438,20 @@ async function handleElfFileSelected(event) {
   if (searchInputEl) searchInputEl.value = "";
   uiManager.setAddSymbolButtonEnabled(false);
 
-  updateAresplotStatus("Reading file and initializing Wasm...");
+  updateAresplotStatus("Reading ELF file...");
 
   try {
-    await elfAnalyzerService.ensureInitialized();
-    updateAresplotStatus("Wasm ready. Reading ELF file...");
-
     const arrayBuffer = await file.arrayBuffer();
     const uint8Array = new Uint8Array(arrayBuffer);
-    updateAresplotStatus("Analyzing ELF file...");
+    updateAresplotStatus("Looking up symbol cache / analyzing ELF file...");
 
-    const newAnalysisResults = await elfAnalyzerService.analyzeElf(uint8Array);
+    // A known build comes straight from IndexedDB; otherwise the Wasm analysis runs and the
+    // table is cached with its types attached
+    const { symbols: newAnalysisResults, fromCache } =
+      await elfAnalyzerService.loadElfSymbols(uint8Array, file.name, (symbol) =>
+        augmentSymbolWithTypeData(symbol, false)
+      );
+    const source = fromCache ? " (from cache)" : "";
 
     // --- Symbol Re-matching Logic ---
     const previouslySelectedSymbols = uiManager.getSelectedSymbolsInSlots();
@@ -847,7 +1501,7 @@ async function handleElfFileSelected(event) {
         }
 
         if (bestMatch) {
-          reMatchedSymbols.push(augmentSymbolWithTypeData({ ...bestMatch })); // Use new data, format type
+          reMatchedSymbols.push(slotSymbolFrom(bestMatch)); // Use new data and its types
         } else {
           console.warn(
             `Symbol "${oldSymbolName}" from previous slots not found in new ELF.`
@@ -856,12 +1510,12 @@ async function handleElfFileSelected(event) {
       });
       uiManager.updateSlotsWithNewSymbols(reMatchedSymbols);
       updateAresplotStatus(
-        `ELF loaded. ${newAnalysisResults.length} symbols found. Slots re-matched: ${reMatchedSymbols.length}.`
+        `ELF loaded${source}. ${newAnalysisResults.length} symbols found. Slots re-matched: ${reMatchedSymbols.length}.`
       );
     } else {
       uiManager.clearSymbolSlots(); // Clear if no old slots or new ELF has no results
       updateAresplotStatus(
-        `ELF loaded. ${newAnalysisResults.length} symbols found.`
+        `ELF loaded${source}. ${newAnalysisResults.length} symbols found.`
       );
     }
     // --- End Re-matching ---
@@ -982,7 +1636,7 @@ function handleSymbolSelectedForAdd(event) {
   }
 
   if (foundSymbol) {
-    const symbolToAdd = augmentSymbolWithTypeData({ ...foundSymbol }); // Create a copy and add display type
+    const symbolToAdd = slotSymbolFrom(foundSymbol); // A copy, with the types from the table
     const added = uiManager.addSymbolToSlot(symbolToAdd);
     if (added) {
       uiManager.updateSymbolDatalist([]);
@@ -1070,7 +1724,21 @@ function startCore() {
       "Main: Collection started with Aresplot. Sending initial CMD_START_MONITOR."
     );
     // Small delay to allow worker to initialize stream handling after receiving 'startSerialStream'
-    setTimeout(() => {
+    appState.aresplotRawEncoding = true; // Renegotiate; the MCU may have been reflashed
+    appState.aresplotCompression = true;
+    appState.aresplotDividers = true;
+    appState.aresplotBlocks = true;
+    appState.aresplotPackedBools = true;
+    appState.aresplotEnvelope = true;
+    appState.aresplotSequence = true;
+    appState.aresplotOptionsRejected = false;
+    appState.aresplotTags = true;
+    appState.aresplotTaggedCommands.clear();
+    releaseAresplotTag(undefined); // Wakes commands still waiting for a tag
+    // Rate and monitor commands go out back to back; the MCU queues both ACKs
+    setTimeout(async () => {
+      startAresplotTimeSync(); // First, so the clock mapping exists before data arrives
+      await sendAresplotSetSampleRateCommand();
       sendAresplotStartMonitorCommand();
     }, 10); // Adjust delay if needed
   }
@@ -1083,6 +1751,7 @@ function startCore() {
 async function stopCore() {
   if (!appState.isCollecting) return;
   appState.isCollecting = false;
+  stopAresplotTimeSync();
   if (
     appState.config.serialProtocol === "aresplot" &&
     serialService.isConnected()
@@ -1090,11 +1759,13 @@ async function stopCore() {
     console.log("Main: Stopping Aresplot monitoring.");
     const emptySymbols = [];
     const frame = aresplotProtocol.buildStartMonitorFrame(emptySymbols); // NumVars = 0
+    workerService.queueAresplotMonitorLayout({ rawEncoding: false, compression: false, dividers: null, types: [] });
     serialService
       .write(frame)
       .catch((e) => console.error("Error sending stop monitor cmd:", e));
   }
   await workerService.stopWorker();
+  plotModule.updateLinkStats(null);
   dataProcessor.resetEstimatesAndRate();
   appState.mainThreadDataQueue = [];
   uiManager.updateStatus("状态：已停止");
@@ -1105,22 +1776,31 @@ async function stopCore() {
 
 // --- Main Data Processing Loop ---
 function mainLoop() {
-  const batch = appState.mainThreadDataQueue.splice(
+  const blocks = appState.mainThreadDataQueue.splice(
     0,
     appState.mainThreadDataQueue.length
   );
-  if (batch.length > 0) {
+  if (blocks.length > 0) {
     displayModules.forEach((m) => {
       try {
-        m.processDataBatch(batch);
+        m.processDataBatch(blocks);
       } catch (e) {}
     });
-    const lastTs = batch[batch.length - 1]?.timestamp || performance.now();
-    dataProcessor.updateDataRate(batch.length, lastTs);
-    dataProcessor.addToBuffer(batch);
+    const lastBlock = blocks[blocks.length - 1];
+    const lastTs = lastBlock.timestamps[lastBlock.count - 1] || performance.now();
+    dataProcessor.updateDataRate(countRows(blocks), lastTs);
+    dataProcessor.addToBuffer(blocks);
     dataProcessor.trimDataBuffer(appState.config.maxBufferPoints);
   }
-  if (appState.isCollecting || batch.length > 0) {
+  if (recording.isRecording()) {
+    // Called on every frame, so a quiet stream still gets its pending rows written
+    recording.recordBlocks(blocks);
+    uiManager.updateRecordingUI({
+      active: true,
+      ...recording.getRecordingStats(),
+    });
+  }
+  if (appState.isCollecting || blocks.length > 0) {
     dataProcessor.calculateBufferEstimate(
       dataProcessor.getCurrentDataRate(),
       dataProcessor.getBufferLength(),
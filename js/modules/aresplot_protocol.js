@@ -1,5 +1,7 @@
 // js/modules/aresplot_protocol.js
 
+import { ByteRing } from './byte_ring.js';
+
 // --- Protocol Constants ---
 export const SOP = 0xA5; // Start of Packet
 export const EOP = 0x5A; // End of Packet
@@ -8,13 +10,26 @@ export const CMD_ID = {
     START_MONITOR: 0x01,     // PC -> MCU: Request to start/update/stop monitoring variables
     SET_VARIABLE: 0x02,      // PC -> MCU: Request to set a variable's value
     SET_SAMPLE_RATE: 0x03,   // PC -> MCU: Request to set sample rate (optional)
+    CAPTURE_ARM: 0x04,       // PC -> MCU: Arm a triggered capture (optional)
+    CAPTURE_CANCEL: 0x05,    // PC -> MCU: Cancel the triggered capture (optional)
+    GET_STATS: 0x06,         // PC -> MCU: Query the MCU runtime statistics (optional)
+    SET_VARIABLES: 0x07,     // PC -> MCU: Write several variables atomically (optional)
+    TIME_SYNC: 0x08,         // PC -> MCU: Round-trip clock synchronization request (optional)
     MONITOR_DATA: 0x81,      // MCU -> PC: Transmitting monitored variable data
     ACK: 0x82,               // MCU -> PC: Command Acknowledgment/Response
+    MONITOR_DATA_BATCH: 0x83, // MCU -> PC: Several consecutive samples sharing one header and base timestamp
+    MONITOR_DATA_COMPRESSED: 0x84, // MCU -> PC: Samples coded as XOR / zigzag-delta residuals against the previous sample
+    CAPTURE_DATA: 0x85,      // MCU -> PC: One block of a frozen triggered capture (optional)
+    STATS: 0x86,             // MCU -> PC: Runtime statistics, the reply to GET_STATS (optional)
+    TIME_SYNC_REPLY: 0x87,   // MCU -> PC: MCU clock reading, the reply to TIME_SYNC (optional)
     ERROR_REPORT: 0x8F       // MCU -> PC: MCU asynchronous error report (optional)
 };
 
+// Bit 6 of a PC -> MCU command ID: the payload starts with a 1-byte tag that the MCU echoes in the ACK
+export const CMD_FLAG_TAGGED = 0x40;
+
 // AresOriginalType_t Enum (mirrors the spec)
-// Values that PC sends to MCU in CMD_START_MONITOR and CMD_SET_VARIABLE
+// Values that PC sends to MCU in CMD_START_MONITOR, CMD_SET_VARIABLE and CMD_SET_VARIABLES
 export const AresOriginalType = {
     INT8: 0x00,
     UINT8: 0x01,
@@ -27,6 +42,54 @@ export const AresOriginalType = {
     BOOL: 0x08
 };
 
+// Size in bytes of each type when sent in raw (native-width) encoding
+export const AresTypeSize = {
+    [AresOriginalType.INT8]: 1,
+    [AresOriginalType.UINT8]: 1,
+    [AresOriginalType.INT16]: 2,
+    [AresOriginalType.UINT16]: 2,
+    [AresOriginalType.INT32]: 4,
+    [AresOriginalType.UINT32]: 4,
+    [AresOriginalType.FLOAT32]: 4,
+    [AresOriginalType.FLOAT64]: 8,
+    [AresOriginalType.BOOL]: 1
+};
+
+// Option bits of the optional trailing Options byte in CMD_START_MONITOR
+export const StartMonitorOption = {
+    RAW_ENCODING: 0x01, // Values are sent at their original width instead of FP32
+    COMPRESSION: 0x02,  // Samples are sent as CMD_MONITOR_DATA_COMPRESSED
+    CHANNEL_DIVIDERS: 0x04, // A per-variable divider table follows Options; each sample starts with a channel bitmap
+    SEQUENCE: 0x08, // MONITOR_DATA and MONITOR_DATA_BATCH frames carry a rolling FrameSeq byte
+    BLOCK_DESCRIPTORS: 0x10, // The variable list may contain block descriptors (address + type + count)
+    ENVELOPE: 0x20, // Envelope parameters follow Options; each sample is the min/max/mean of a window of samples
+    PACKED_BOOLS: 0x40 // BOOL variables are sent as one bit each in a bitmap at the end of every sample
+};
+
+// Flag bits of the envelope parameters in CMD_START_MONITOR
+export const EnvelopeFlag = {
+    COUNT: 0x01 // Each window ends with the number of samples folded into it
+};
+
+// Bit 7 of a descriptor's type byte marks a block descriptor, followed by a 1-byte element count
+const VAR_DESC_TYPE_BLOCK = 0x80;
+
+// Trigger modes of CMD_CAPTURE_ARM
+export const CaptureTriggerMode = {
+    RISING: 0x00,  // The variable crosses the threshold upwards
+    FALLING: 0x01, // The variable crosses the threshold downwards
+    ABOVE: 0x02,   // The variable is above the threshold
+    BELOW: 0x03,   // The variable is below the threshold
+    FORCE: 0x04    // Immediately, once the pre-trigger depth is filled
+};
+
+// Flags byte of CMD_CAPTURE_DATA
+const CAPTURE_FLAG_LAST = 0x01;        // Last block of the capture
+const CAPTURE_FLAG_TIMING_GAPS = 0x02; // Sample deadlines were missed during the capture
+
+// Flags byte of CMD_MONITOR_DATA_COMPRESSED
+const COMPRESSED_FLAG_KEYFRAME = 0x01; // The first sample is coded against zero
+
 // ACK Statuses (mirrors the spec)
 export const AckStatus = {
     OK: 0x00,
@@ -37,11 +100,21 @@ export const AckStatus = {
     ERROR_TYPE_UNSUPPORTED: 0x05,
     ERROR_RATE_UNACHIEVABLE: 0x06,
     ERROR_MCU_BUSY_OR_LIMIT: 0x07,
+    ERROR_BUSY: 0x08, // ACK queue full: the command was not executed and can be resent
     ERROR_GENERAL_FAIL: 0xFF
 };
 
 const HEADER_SIZE = 1 + 1 + 2; // SOP + CMD + LEN
 const CHECKSUM_EOP_SIZE = 1 + 1; // CHECKSUM + EOP
+const BATCH_HEADER_SIZE = 4 + 4 + 1; // Timestamp + SamplePeriodNs + SampleCount
+const COMPRESSED_HEADER_SIZE = BATCH_HEADER_SIZE + 1 + 1; // ... + Flags + FrameSeq
+const CAPTURE_HEADER_SIZE = 4 + 4 + 1 + 1 + 2 + 2 + 1; // TriggerTimestamp + SamplePeriodNs + CaptureId + Flags + PreSamples + StartIndex + SampleCount
+const STATS_PAYLOAD_SIZE = 1 + 7 * 4 + 2 * 4 * 4; // Flags + seven counters/fields + Calls/Min/Avg/Max for the tick and RX functions
+const GET_STATS_FLAG_RESET = 0x01; // Clear the MCU statistics after replying
+const STATS_FLAG_CYCLES = 0x01;    // The cycle statistics are valid
+const TIME_SYNC_TOKEN_SIZE = 8;    // Opaque to the MCU; the host sends its own clock as a float64
+const TIME_SYNC_REPLY_SIZE = TIME_SYNC_TOKEN_SIZE + 1 + 8 + 4 + 4; // Token + Flags + TxTick + Turnaround + TxTickMs
+const TIME_SYNC_FLAG_TICK_US = 0x01; // The ticks are in microseconds (otherwise milliseconds)
 
 /**
  * Calculates the AresPlot checksum.
@@ -63,13 +136,47 @@ function calculateAresplotChecksum(cmdId, payloadLenUint16, payloadUint8Array) {
     return checksum;
 }
 
+/**
+ * Groups consecutive symbols that share a type and follow each other in memory (array elements, or scalars
+ * adjacent in the ELF) into block descriptors. Symbols at address 0 are never grouped.
+ * @param {Array<{address: number, originalType: number}>} symbols - Symbols in channel order.
+ * @returns {Array<{address: number, originalType: number, count: number}>} Descriptors in channel order; a count of 1 is a plain scalar.
+ */
+export function groupBlockDescriptors(symbols) {
+    const descriptors = [];
+    for (const symbol of symbols) {
+        const last = descriptors[descriptors.length - 1];
+        const size = AresTypeSize[symbol.originalType];
+        if (last && size && symbol.address !== 0 && last.address !== 0 && last.originalType === symbol.originalType &&
+            last.count < 255 && symbol.address === last.address + last.count * size) {
+            last.count++;
+        } else {
+            descriptors.push({ address: symbol.address, originalType: symbol.originalType, count: 1 });
+        }
+    }
+    return descriptors;
+}
+
 /**
  * Builds a CMD_START_MONITOR (0x01) frame.
  * @param {Array<{address: number, originalType: number}>} symbols - Array of symbol objects.
  * Each symbol object must have 'address' (uint32_t) and 'originalType' (AresOriginalType_t value).
+ * @param {object} [options]
+ * @param {boolean} [options.rawEncoding=false] - Request native-width values.
+ * @param {boolean} [options.compression=false] - Request the compressed monitor stream.
+ * @param {number[]|null} [options.dividers=null] - Per-variable dividers (1..255); variable i is sent in one of every dividers[i] samples.
+ * @param {boolean} [options.sequence=false] - Request a FrameSeq byte in every uncompressed data frame, for loss accounting.
+ * @param {boolean} [options.blocks=false] - Send runs found by groupBlockDescriptors() as block descriptors; the BLOCK_DESCRIPTORS
+ * bit is only set when at least one run has more than one element. Channels (and dividers) stay one per symbol either way.
+ * @param {{window: number, count?: boolean}|null} [options.envelope=null] - Request envelope aggregation: the MCU sends the mean,
+ * min and max of every `window` samples (1..65535) as FP32, followed by the window's sample count when `count` is set.
+ * Cannot be combined with rawEncoding or dividers.
+ * @param {boolean} [options.packedBools=false] - Pack BOOL variables into a bitmap at the end of each sample; the PACKED_BOOLS
+ * bit is only set when at least one symbol is a BOOL. Cannot be combined with dividers or an envelope.
+ * (The Options byte is appended only when an option is requested.)
  * @returns {Uint8Array} The complete frame as a Uint8Array, ready to be sent.
  */
-export function buildStartMonitorFrame(symbols) {
+export function buildStartMonitorFrame(symbols, { rawEncoding = false, compression = false, dividers = null, sequence = false, blocks = false, envelope = null, packedBools = false } = {}) {
     if (!Array.isArray(symbols)) {
         throw new Error("buildStartMonitorFrame: symbols argument must be an array.");
     }
@@ -79,23 +186,60 @@ export function buildStartMonitorFrame(symbols) {
         throw new Error("buildStartMonitorFrame: Number of variables cannot exceed 255.");
     }
 
-    // Calculate payload length: 1 byte for NumVariables + N * 5 bytes for (address + type)
-    const payloadLength = 1 + numVariables * 5;
+    for (const symbol of symbols) {
+        if (typeof symbol.address !== 'number' || typeof symbol.originalType !== 'number') {
+            throw new Error("buildStartMonitorFrame: Each symbol must have 'address' (number) and 'originalType' (AresOriginalType_t number).");
+        }
+    }
+    const grouped = blocks ? groupBlockDescriptors(symbols) : null;
+    const useBlocks = grouped !== null && grouped.some(d => d.count > 1);
+    const descriptors = useBlocks ? grouped : symbols.map(s => ({ address: s.address, originalType: s.originalType, count: 1 }));
+
+    // Calculate payload length: 1 byte for NumVariables + 5 bytes per scalar (address + type) or 6 per block (+ count)
+    // [+ 1 byte Options] [+ 1 divider byte per variable] [+ 3 bytes envelope parameters]
+    if (dividers && (dividers.length !== numVariables || dividers.some(d => !Number.isInteger(d) || d < 1 || d > 255))) {
+        throw new Error("buildStartMonitorFrame: dividers must hold one integer in 1..255 per variable.");
+    }
+    if (envelope && (!Number.isInteger(envelope.window) || envelope.window < 1 || envelope.window > 0xFFFF || rawEncoding || dividers)) {
+        throw new Error("buildStartMonitorFrame: envelope needs a window in 1..65535 and cannot be combined with rawEncoding or dividers.");
+    }
+    const usePackedBools = packedBools && symbols.some(s => s.originalType === AresOriginalType.BOOL);
+    if (usePackedBools && (dividers || envelope)) {
+        throw new Error("buildStartMonitorFrame: packedBools cannot be combined with dividers or an envelope.");
+    }
+    const options = (rawEncoding ? StartMonitorOption.RAW_ENCODING : 0) | (compression ? StartMonitorOption.COMPRESSION : 0) |
+        (dividers ? StartMonitorOption.CHANNEL_DIVIDERS : 0) | (sequence ? StartMonitorOption.SEQUENCE : 0) |
+        (useBlocks ? StartMonitorOption.BLOCK_DESCRIPTORS : 0) | (envelope ? StartMonitorOption.ENVELOPE : 0) |
+        (usePackedBools ? StartMonitorOption.PACKED_BOOLS : 0);
+    const descriptorBytes = descriptors.reduce((n, d) => n + (d.count > 1 ? 6 : 5), 0);
+    const payloadLength = 1 + descriptorBytes + (options ? 1 : 0) + (dividers ? numVariables : 0) + (envelope ? 3 : 0);
     const frameSize = HEADER_SIZE + payloadLength + CHECKSUM_EOP_SIZE;
     const frame = new Uint8Array(frameSize);
     const payloadView = new DataView(frame.buffer, frame.byteOffset + HEADER_SIZE, payloadLength); // View for payload
 
     // --- Build Payload ---
-    payloadView.setUint8(0, numVariables); // NumVariables
+    payloadView.setUint8(0, descriptors.length); // NumVariables (descriptor count)
     let currentPayloadOffset = 1;
-    for (const symbol of symbols) {
-        if (typeof symbol.address !== 'number' || typeof symbol.originalType !== 'number') {
-            throw new Error("buildStartMonitorFrame: Each symbol must have 'address' (number) and 'originalType' (AresOriginalType_t number).");
-        }
-        payloadView.setUint32(currentPayloadOffset, symbol.address, true); // address (little-endian)
+    for (const descriptor of descriptors) {
+        payloadView.setUint32(currentPayloadOffset, descriptor.address, true); // address (little-endian)
         currentPayloadOffset += 4;
-        payloadView.setUint8(currentPayloadOffset, symbol.originalType);    // originalType
-        currentPayloadOffset += 1;
+        if (descriptor.count > 1) {
+            payloadView.setUint8(currentPayloadOffset++, descriptor.originalType | VAR_DESC_TYPE_BLOCK); // block element type
+            payloadView.setUint8(currentPayloadOffset++, descriptor.count); // element count
+        } else {
+            payloadView.setUint8(currentPayloadOffset++, descriptor.originalType); // originalType
+        }
+    }
+    if (options) {
+        payloadView.setUint8(currentPayloadOffset++, options); // Options
+    }
+    if (dividers) {
+        for (const divider of dividers) payloadView.setUint8(currentPayloadOffset++, divider); // Divider table
+    }
+    if (envelope) {
+        payloadView.setUint16(currentPayloadOffset, envelope.window, true); // Window (little-endian)
+        currentPayloadOffset += 2;
+        payloadView.setUint8(currentPayloadOffset++, envelope.count ? EnvelopeFlag.COUNT : 0); // EnvelopeFlags
     }
     const payloadActual = new Uint8Array(frame.buffer, frame.byteOffset + HEADER_SIZE, payloadLength);
 
@@ -125,24 +269,528 @@ export function buildStartMonitorFrame(symbols) {
     return frame;
 }
 
+/**
+ * Wraps a payload into a complete frame (SOP, CMD, LEN, payload, CHECKSUM, EOP).
+ * @param {number} cmdId - Command ID.
+ * @param {Uint8Array} payload - Payload bytes.
+ * @returns {Uint8Array} The complete frame.
+ */
+function buildFrame(cmdId, payload) {
+    const frame = new Uint8Array(HEADER_SIZE + payload.length + CHECKSUM_EOP_SIZE);
+    frame[0] = SOP;
+    frame[1] = cmdId;
+    frame[2] = payload.length & 0xFF;
+    frame[3] = (payload.length >> 8) & 0xFF;
+    frame.set(payload, HEADER_SIZE);
+    frame[HEADER_SIZE + payload.length] = calculateAresplotChecksum(cmdId, payload.length, payload);
+    frame[HEADER_SIZE + payload.length + 1] = EOP;
+    return frame;
+}
+
+/**
+ * Turns a built PC -> MCU frame into its tagged form: bit 6 of CMD is set and the tag is inserted before the payload.
+ * The MCU echoes the tag in the ACK (see the parser's `tag`), so commands can be pipelined and still matched to their ACKs.
+ * @param {Uint8Array} frame - A complete untagged frame from one of the build*Frame functions.
+ * @param {number} tag - Tag to echo (uint8).
+ * @returns {Uint8Array} The complete tagged frame.
+ */
+export function tagFrame(frame, tag) {
+    if (!Number.isInteger(tag) || tag < 0 || tag > 0xFF) {
+        throw new Error("tagFrame: tag must be an integer in the range 0..255.");
+    }
+    const payload = new Uint8Array(frame.length - HEADER_SIZE - CHECKSUM_EOP_SIZE + 1);
+    payload[0] = tag;
+    payload.set(frame.subarray(HEADER_SIZE, frame.length - CHECKSUM_EOP_SIZE), 1);
+    return buildFrame(frame[1] | CMD_FLAG_TAGGED, payload);
+}
+
+/**
+ * Builds a CMD_SET_SAMPLE_RATE (0x03) frame.
+ * The MCU answers with an ACK carrying the rate it actually achieved.
+ * @param {number} rateHz - Requested sample rate in Hz (uint32). 0 restores the MCU default.
+ * @returns {Uint8Array} The complete frame as a Uint8Array, ready to be sent.
+ */
+export function buildSetSampleRateFrame(rateHz) {
+    if (!Number.isInteger(rateHz) || rateHz < 0 || rateHz > 0xFFFFFFFF) {
+        throw new Error("buildSetSampleRateFrame: rateHz must be an integer in the range 0..4294967295.");
+    }
+    const payload = new Uint8Array(4);
+    new DataView(payload.buffer).setUint32(0, rateHz, true);
+    return buildFrame(CMD_ID.SET_SAMPLE_RATE, payload);
+}
+
+/**
+ * Builds a CMD_CAPTURE_ARM (0x04) frame.
+ * The MCU captures pre + 1 + post samples around the trigger at its full sampling rate and then sends them as CMD_CAPTURE_DATA blocks.
+ * @param {object} params
+ * @param {number} params.varIndex - Index of the trigger variable in the current CMD_START_MONITOR list.
+ * @param {number} params.mode - A CaptureTriggerMode value.
+ * @param {number} params.threshold - Trigger threshold (sent as FP32).
+ * @param {number} params.preSamples - Samples kept before the trigger (uint16).
+ * @param {number} params.postSamples - Samples taken after the trigger (uint16).
+ * @returns {Uint8Array} The complete frame as a Uint8Array, ready to be sent.
+ */
+export function buildCaptureArmFrame({ varIndex, mode, threshold, preSamples, postSamples }) {
+    if (!Number.isInteger(varIndex) || varIndex < 0 || varIndex > 0xFF) {
+        throw new Error("buildCaptureArmFrame: varIndex must be an integer in the range 0..255.");
+    }
+    if (!Object.values(CaptureTriggerMode).includes(mode)) {
+        throw new Error(`buildCaptureArmFrame: Unknown trigger mode ${mode}.`);
+    }
+    if (!Number.isFinite(threshold)) {
+        throw new Error("buildCaptureArmFrame: threshold must be a finite number.");
+    }
+    for (const [name, count] of [['preSamples', preSamples], ['postSamples', postSamples]]) {
+        if (!Number.isInteger(count) || count < 0 || count > 0xFFFF) {
+            throw new Error(`buildCaptureArmFrame: ${name} must be an integer in the range 0..65535.`);
+        }
+    }
+    const payload = new Uint8Array(10);
+    const view = new DataView(payload.buffer);
+    view.setUint8(0, varIndex);
+    view.setUint8(1, mode);
+    view.setFloat32(2, threshold, true);
+    view.setUint16(6, preSamples, true);
+    view.setUint16(8, postSamples, true);
+    return buildFrame(CMD_ID.CAPTURE_ARM, payload);
+}
+
+/**
+ * Builds a CMD_CAPTURE_CANCEL (0x05) frame, which disarms the capture or stops sending the current one.
+ * @returns {Uint8Array} The complete frame as a Uint8Array, ready to be sent.
+ */
+export function buildCaptureCancelFrame() {
+    return buildFrame(CMD_ID.CAPTURE_CANCEL, new Uint8Array(0));
+}
+
+/**
+ * Builds a CMD_GET_STATS (0x06) frame. The MCU replies with a CMD_STATS frame instead of an ACK.
+ * @param {object} [options]
+ * @param {boolean} [options.reset=false] - Clear the MCU statistics once the reply has been sent.
+ * @returns {Uint8Array} The complete frame as a Uint8Array, ready to be sent.
+ */
+export function buildGetStatsFrame({ reset = false } = {}) {
+    return buildFrame(CMD_ID.GET_STATS, new Uint8Array([reset ? GET_STATS_FLAG_RESET : 0]));
+}
+
+/**
+ * Builds a CMD_TIME_SYNC (0x08) frame. The MCU replies with a CMD_TIME_SYNC_REPLY frame echoing the token instead of an ACK.
+ * @param {number} hostTimeMs - Host clock at sending, carried as the token so the reply needs no bookkeeping.
+ *   Use performance.timeOrigin + performance.now() when the reply is handled on another thread or worker.
+ * @returns {Uint8Array} The complete frame as a Uint8Array, ready to be sent.
+ */
+export function buildTimeSyncFrame(hostTimeMs) {
+    const payload = new Uint8Array(TIME_SYNC_TOKEN_SIZE);
+    new DataView(payload.buffer).setFloat64(0, hostTimeMs, true);
+    return buildFrame(CMD_ID.TIME_SYNC, payload);
+}
+
+// Entries per CMD_SET_VARIABLES frame the host sends; matches the MCU default ARESPLOT_SET_VARIABLES_MAX_ENTRIES,
+// whose RX buffer silently drops longer frames
+export const SET_VARIABLES_MAX_ENTRIES = 16;
+
+/**
+ * Builds a CMD_SET_VARIABLES (0x07) frame. The MCU writes all entries inside one critical section, or none of them
+ * if any entry is invalid, and answers with one ACK carrying a per-entry bitmap (see the parser's `entryOk`).
+ * @param {Array<{address: number, originalType: number, value: number}>} entries - 1..SET_VARIABLES_MAX_ENTRIES writes, applied in order.
+ * @returns {Uint8Array} The complete frame as a Uint8Array, ready to be sent.
+ */
+export function buildSetVariablesFrame(entries) {
+    if (!Array.isArray(entries) || entries.length < 1 || entries.length > SET_VARIABLES_MAX_ENTRIES) {
+        throw new Error(`buildSetVariablesFrame: entries must be an array of 1..${SET_VARIABLES_MAX_ENTRIES} writes.`);
+    }
+    const payload = new Uint8Array(1 + entries.length * 9);
+    const view = new DataView(payload.buffer);
+    view.setUint8(0, entries.length); // Count
+    entries.forEach((entry, i) => {
+        if (typeof entry.address !== 'number' || typeof entry.originalType !== 'number' || !Number.isFinite(entry.value)) {
+            throw new Error("buildSetVariablesFrame: Each entry must have 'address', 'originalType' and a finite 'value'.");
+        }
+        view.setUint32(1 + i * 9, entry.address, true);
+        view.setUint8(5 + i * 9, entry.originalType);
+        view.setFloat32(6 + i * 9, entry.value, true);
+    });
+    return buildFrame(CMD_ID.SET_VARIABLES, payload);
+}
+
 
 // --- AresplotFrameParser Class ---
 export class AresplotFrameParser {
     constructor() {
-        this.internalBuffer = new Uint8Array(0); // Parser manages its own buffer
+        this.ring = new ByteRing(); // Parser manages its own buffer; frames are read in place
+        this.monitorLayout = null; // Active value layout { rawEncoding, compression, dividers, envelope, packedBools, types }; null means FP32 values
+        this.heldValues = null;   // Last value of every channel; channels missing from a sample keep it (NaN until first seen)
+        this.pendingMonitorLayouts = []; // { tag, layout } of sent CMD_START_MONITOR frames awaiting their ACK, oldest first
+        this.codecPrev = null;    // Reconstructed previous sample of the compressed stream (uncompressed bytes)
+        this.codecSynced = false; // Whether codecPrev is valid, i.e. a keyframe arrived and no frame was lost since
+        this.codecNextSeq = 0;    // FrameSeq expected for the next compressed frame
+        this.lastFrameSeq = null; // FrameSeq of the last data frame accepted under the active layout (null: none yet)
+        this.linkStats = { frames: 0, lostFrames: 0, duplicateFrames: 0, checksumErrors: 0 }; // Counted since the last takeLinkStats()
         // console.log("AresplotFrameParser instance created for direct parsing.");
     }
 
+    /**
+     * Registers the value layout requested by a CMD_START_MONITOR frame that is about to be sent.
+     * It becomes active when the MCU acknowledges that command, since the MCU sends the ACK before any data in the new layout.
+     * @param {{rawEncoding: boolean, compression?: boolean, dividers?: number[]|null, sequence?: boolean,
+     *   envelope?: {window: number, count: boolean}|null, packedBools?: boolean, types: number[]}} layout
+     *   Encoding flags, per-variable dividers and envelope parameters (null when not used) and the AresOriginalType of each variable.
+     *   With an envelope each sample holds the FP32 values Mean[N], Min[N], Max[N] (and Count) instead of one value per variable.
+     *   With packedBools (set only when the frame set PACKED_BOOLS) the BOOL variables move to a bitmap at the end of each sample.
+     * @param {number} [tag] - Tag the frame is sent with; undefined for an untagged frame.
+     */
+    queueMonitorLayout(layout, tag) {
+        if (tag !== undefined) {
+            // A reused tag means the earlier command with it was given up on without an ACK
+            this.pendingMonitorLayouts = this.pendingMonitorLayouts.filter((pending) => pending.tag !== tag);
+        }
+        this.pendingMonitorLayouts.push({ tag, layout });
+    }
+
+    /**
+     * Removes the pending layout a CMD_START_MONITOR ACK answers: the one sent with the ACK's tag, or the oldest
+     * untagged one for an untagged ACK. A bare ACK refusing a tagged frame answers the oldest tagged one.
+     * @param {{tag?: number, tagRejected?: boolean}} ack
+     * @returns {object|undefined} The layout, or undefined when no pending layout matches.
+     */
+    takePendingMonitorLayout(ack) {
+        const index = this.pendingMonitorLayouts.findIndex(
+            ack.tagRejected ? (pending) => pending.tag !== undefined : (pending) => pending.tag === ack.tag
+        );
+        if (index < 0) return undefined;
+        return this.pendingMonitorLayouts.splice(index, 1)[0].layout;
+    }
+
+    /**
+     * Makes a layout active and restarts the compressed stream decoder, which waits for the next keyframe.
+     * @param {object|null} layout - Layout to activate, or null for FP32 values.
+     */
+    activateMonitorLayout(layout) {
+        this.monitorLayout = layout;
+        this.heldValues = layout && layout.dividers ? new Array(layout.types.length).fill(NaN) : null;
+        this.codecPrev = null;
+        this.codecSynced = false;
+        this.lastFrameSeq = null;
+    }
+
+    /**
+     * @returns {boolean} Whether uncompressed data frames of the active layout carry a FrameSeq byte.
+     */
+    hasFrameSeq() {
+        return !!(this.monitorLayout && this.monitorLayout.sequence);
+    }
+
+    /**
+     * Accounts for the FrameSeq of a data frame: a step of more than one means frames were lost on the link.
+     * FrameSeq is one byte, so a run of 256 or more lost frames is undercounted by a multiple of 256.
+     * @param {number} seq - FrameSeq of the frame.
+     * @returns {boolean} False when the frame repeats the previous one and must be dropped.
+     */
+    trackFrameSeq(seq) {
+        const stats = this.linkStats;
+        if (this.lastFrameSeq !== null) {
+            const step = (seq - this.lastFrameSeq) & 0xFF;
+            if (step === 0) {
+                stats.duplicateFrames++;
+                return false;
+            }
+            stats.lostFrames += step - 1;
+        }
+        this.lastFrameSeq = seq;
+        stats.frames++;
+        return true;
+    }
+
+    /**
+     * Returns the link statistics counted since the previous call and starts a new interval.
+     * frames, lostFrames and duplicateFrames cover sequenced data frames only (compressed frames, or any data frame
+     * when the layout requested FrameSeq); checksumErrors counts every frame rejected by its checksum or EOP.
+     * @returns {{frames: number, lostFrames: number, duplicateFrames: number, checksumErrors: number}}
+     */
+    takeLinkStats() {
+        const stats = this.linkStats;
+        this.linkStats = { frames: 0, lostFrames: 0, duplicateFrames: 0, checksumErrors: 0 };
+        return stats;
+    }
+
+    /**
+     * @returns {boolean} Whether samples of the active layout start with a channel bitmap.
+     */
+    hasChannelMask() {
+        return !!(this.monitorLayout && this.monitorLayout.dividers);
+    }
+
+    /**
+     * Merges the channels present in a sample into the held values, so that every sample maps onto all series.
+     * @param {number[]} values - Decoded values, indexed by channel.
+     * @param {function(number): boolean} isPresent - Whether channel i is present in the sample.
+     * @returns {number[]} A full sample (channels that are not present keep their last value).
+     */
+    mergeHeldValues(values, isPresent) {
+        const held = this.heldValues;
+        for (let i = 0; i < held.length; i++) {
+            if (isPresent(i)) held[i] = values[i];
+        }
+        return held.slice();
+    }
+
+    /**
+     * Decodes one uncompressed sample that starts with a channel bitmap and holds only the channels set in it.
+     * @param {Uint8Array} payload - The frame payload.
+     * @param {number} offset - Byte offset of the sample.
+     * @returns {{values: number[], bytes: number}|null} The full sample and its encoded size, or null if it overruns the payload.
+     */
+    decodeMaskedSample(payload, offset) {
+        const layout = this.monitorLayout;
+        const types = layout.types;
+        const maskBytes = (types.length + 7) >> 3;
+        let pos = offset + maskBytes;
+        if (pos > payload.length) return null;
+        const isPresent = i => ((payload[offset + (i >> 3)] >> (i & 7)) & 1) === 1;
+        const view = new DataView(payload.buffer, payload.byteOffset, payload.byteLength);
+        const values = new Array(types.length);
+        for (let i = 0; i < types.length; i++) {
+            if (!isPresent(i)) continue;
+            const width = layout.rawEncoding ? (AresTypeSize[types[i]] || 0) : 4;
+            if (pos + width > payload.length) return null;
+            values[i] = layout.rawEncoding ? this.decodeRawValue(types[i], view, pos) : view.getFloat32(pos, true);
+            pos += width;
+        }
+        return { values: this.mergeHeldValues(values, isPresent), bytes: pos - offset };
+    }
+
+    /**
+     * Decodes a sequence of channel-bitmap samples filling a payload region.
+     * @param {Uint8Array} payload - The frame payload.
+     * @param {number} offset - Byte offset of the first sample.
+     * @param {number} sampleCount - Number of samples.
+     * @returns {number[][]|null} Decoded samples, or null if they do not exactly fill the payload.
+     */
+    decodeMaskedSamples(payload, offset, sampleCount) {
+        const samples = new Array(sampleCount);
+        for (let s = 0; s < sampleCount; s++) {
+            const decoded = this.decodeMaskedSample(payload, offset);
+            if (!decoded) return null;
+            samples[s] = decoded.values;
+            offset += decoded.bytes;
+        }
+        return offset === payload.length ? samples : null;
+    }
+
+    /**
+     * Decodes the samples of a CMD_MONITOR_DATA_COMPRESSED payload against the previous reconstructed sample.
+     * Each sample is ceil(M/2) bytes of length nibbles for its M coded values (value j in byte j >> 1, low nibble for even j),
+     * followed by the low bytes of each value's residual. Floats (and every FP32-encoded value) are XORed with the previous
+     * value; raw-encoded integers and bools are zigzag deltas. With dividers a channel bitmap precedes each sample and
+     * only the channels set in it are coded.
+     * @param {Uint8Array} payload - The frame payload.
+     * @returns {{samples: number[][]}|{warning: string}} Decoded samples, or a warning when the frame cannot be decoded.
+     */
+    decodeCompressedSamples(payload) {
+        const layout = this.monitorLayout;
+        if (!layout || !layout.compression) {
+            return { warning: "MONITOR_DATA_COMPRESSED without a compressed monitor layout." };
+        }
+        const sampleCount = payload[8];
+        const isKeyframe = (payload[9] & COMPRESSED_FLAG_KEYFRAME) !== 0;
+        const frameSeq = payload[10];
+        if (!isKeyframe && (!this.codecSynced || frameSeq !== this.codecNextSeq)) {
+            this.codecSynced = false;
+            return { warning: "Compressed monitor frame skipped until the next keyframe (frame lost)." };
+        }
+
+        const types = layout.types;
+        let widths;
+        let isDelta;
+        if (layout.envelope) {
+            // Envelope windows carry 3N (+ Count) FP32 values; rawEncoding and packedBools are never combined with an envelope
+            widths = new Array(3 * types.length + (layout.envelope.count ? 1 : 0)).fill(4);
+            isDelta = widths.map(() => false);
+        } else {
+            // Packed BOOL bitmap bytes are coded last, XORed like floats
+            widths = this.codedValueWidths();
+            const codedTypes = layout.packedBools ? types.filter(type => type !== AresOriginalType.BOOL) : types;
+            isDelta = widths.map((width, i) => layout.rawEncoding && i < codedTypes.length &&
+                codedTypes[i] !== AresOriginalType.FLOAT32 && codedTypes[i] !== AresOriginalType.FLOAT64);
+        }
+        const numValues = widths.length;
+        const sampleBytes = widths.reduce((sum, width) => sum + width, 0);
+        if (!this.codecPrev || this.codecPrev.length !== sampleBytes) {
+            this.codecPrev = new Uint8Array(sampleBytes);
+        }
+        const prev = this.codecPrev;
+        const prevView = new DataView(prev.buffer);
+        const maskBytes = this.hasChannelMask() ? (numValues + 7) >> 3 : 0;
+        const samples = new Array(sampleCount);
+        let pos = COMPRESSED_HEADER_SIZE;
+
+        if (isKeyframe) prev.fill(0);
+        for (let s = 0; s < sampleCount; s++) {
+            if (pos + maskBytes > payload.length) {
+                this.codecSynced = false;
+                return { warning: "Invalid MONITOR_DATA_COMPRESSED sample layout." };
+            }
+            const maskPos = pos;
+            const isPresent = maskBytes ? (i => ((payload[maskPos + (i >> 3)] >> (i & 7)) & 1) === 1) : (() => true);
+            let numCoded = 0;
+            for (let i = 0; i < numValues; i++) if (isPresent(i)) numCoded++;
+            pos += maskBytes;
+            const nibbleBytes = (numCoded + 1) >> 1;
+            if (pos + nibbleBytes > payload.length) {
+                this.codecSynced = false;
+                return { warning: "Invalid MONITOR_DATA_COMPRESSED sample layout." };
+            }
+            let residualPos = pos + nibbleBytes;
+            let valueOffset = 0;
+            let coded = 0;
+            for (let i = 0; i < numValues; i++) {
+                const width = widths[i];
+                if (!isPresent(i)) {
+                    valueOffset += width;
+                    continue;
+                }
+                const len = (payload[pos + (coded >> 1)] >> ((coded & 1) * 4)) & 0x0F;
+                coded++;
+                if (len > width || residualPos + len > payload.length) {
+                    this.codecSynced = false;
+                    return { warning: "Invalid MONITOR_DATA_COMPRESSED sample layout." };
+                }
+                if (isDelta[i]) {
+                    let zz = 0;
+                    for (let b = 0; b < len; b++) zz |= payload[residualPos + b] << (b * 8);
+                    const delta = (zz >>> 1) ^ -(zz & 1);
+                    let cur = 0;
+                    for (let b = 0; b < width; b++) cur |= prev[valueOffset + b] << (b * 8);
+                    cur = (cur + delta) >>> 0;
+                    for (let b = 0; b < width; b++) prev[valueOffset + b] = (cur >>> (b * 8)) & 0xFF;
+                } else {
+                    for (let b = 0; b < len; b++) prev[valueOffset + b] ^= payload[residualPos + b];
+                }
+                residualPos += len;
+                valueOffset += width;
+            }
+            pos = residualPos;
+            let values;
+            if (layout.rawEncoding || layout.packedBools) {
+                values = this.decodeLayoutSample(prevView, 0);
+            } else {
+                values = new Array(numValues);
+                for (let i = 0; i < numValues; i++) values[i] = prevView.getFloat32(i * 4, true);
+            }
+            // A keyframe resets the reference of absent channels too, so they are taken from the held values
+            samples[s] = maskBytes ? this.mergeHeldValues(values, isPresent) : values;
+        }
+        if (pos !== payload.length) {
+            this.codecSynced = false;
+            return { warning: "Invalid MONITOR_DATA_COMPRESSED sample layout." };
+        }
+        this.codecSynced = true;
+        this.codecNextSeq = (frameSeq + 1) & 0xFF;
+        return { samples };
+    }
+
+    /**
+     * Decodes one sample whose size the active layout fixes (raw-encoded values and/or packed BOOLs).
+     * With packed BOOLs the sample holds the other values in variable order, then ceil(B/8) bitmap bytes
+     * whose bit j is the j-th BOOL; the values are returned in variable order either way.
+     * @param {DataView} view - View over the payload.
+     * @param {number} offset - Byte offset of the sample.
+     * @returns {number[]} Decoded values.
+     */
+    decodeLayoutSample(view, offset) {
+        const { types, rawEncoding, packedBools } = this.monitorLayout;
+        const values = new Array(types.length);
+        for (let i = 0; i < types.length; i++) {
+            if (packedBools && types[i] === AresOriginalType.BOOL) continue;
+            if (rawEncoding) {
+                values[i] = this.decodeRawValue(types[i], view, offset);
+                offset += AresTypeSize[types[i]] || 0;
+            } else {
+                values[i] = view.getFloat32(offset, true);
+                offset += 4;
+            }
+        }
+        if (packedBools) {
+            let bit = 0;
+            for (let i = 0; i < types.length; i++) {
+                if (types[i] !== AresOriginalType.BOOL) continue;
+                values[i] = (view.getUint8(offset + (bit >> 3)) >> (bit & 7)) & 1;
+                bit++;
+            }
+        }
+        return values;
+    }
+
+    /**
+     * Decodes one raw-encoded value.
+     * @param {number} type - AresOriginalType of the value.
+     * @param {DataView} view - View over the payload.
+     * @param {number} offset - Byte offset of the value.
+     * @returns {number} Decoded value (NaN for an unknown type).
+     */
+    decodeRawValue(type, view, offset) {
+        switch (type) {
+            case AresOriginalType.INT8:    return view.getInt8(offset);
+            case AresOriginalType.UINT8:   return view.getUint8(offset);
+            case AresOriginalType.INT16:   return view.getInt16(offset, true);
+            case AresOriginalType.UINT16:  return view.getUint16(offset, true);
+            case AresOriginalType.INT32:   return view.getInt32(offset, true);
+            case AresOriginalType.UINT32:  return view.getUint32(offset, true);
+            case AresOriginalType.FLOAT32: return view.getFloat32(offset, true);
+            case AresOriginalType.FLOAT64: return view.getFloat64(offset, true);
+            case AresOriginalType.BOOL:    return view.getUint8(offset) ? 1 : 0;
+            default: return NaN;
+        }
+    }
+
+    /**
+     * @returns {number} Bytes per sample under the active raw or packed-BOOL layout, or 0 when every value is FP32.
+     */
+    layoutSampleBytes() {
+        const layout = this.monitorLayout;
+        if (!layout || (!layout.rawEncoding && !layout.packedBools)) return 0;
+        return this.codedValueWidths().reduce((sum, width) => sum + width, 0);
+    }
+
+    /**
+     * @returns {number[]} Byte width of each value as the MCU sends it under the active layout: the raw width
+     * or 4 per variable, with packed BOOLs replaced by one trailing byte per 8 of them.
+     */
+    codedValueWidths() {
+        const { types, rawEncoding, packedBools } = this.monitorLayout;
+        const widths = [];
+        let numBools = 0;
+        for (const type of types) {
+            if (packedBools && type === AresOriginalType.BOOL) numBools++;
+            else widths.push(rawEncoding ? (AresTypeSize[type] || 0) : 4);
+        }
+        for (let b = 0; b < numBools; b += 8) widths.push(1);
+        return widths;
+    }
+
+    /**
+     * Decodes FP32 samples of a fixed width into one Float32Array, returning a subarray per sample.
+     * @param {DataView} view - View over the payload.
+     * @param {number} offset - Byte offset of the first sample.
+     * @param {number} sampleCount - Number of samples.
+     * @param {number} valuesPerSample - Values per sample.
+     * @returns {Float32Array[]} Decoded samples.
+     */
+    decodeFloat32Samples(view, offset, sampleCount, valuesPerSample) {
+        const values = new Float32Array(sampleCount * valuesPerSample);
+        for (let i = 0; i < values.length; i++) values[i] = view.getFloat32(offset + i * 4, true);
+        const samples = new Array(sampleCount);
+        for (let s = 0; s < sampleCount; s++) samples[s] = values.subarray(s * valuesPerSample, (s + 1) * valuesPerSample);
+        return samples;
+    }
+
     /**
      * Appends new data to the internal buffer.
      * @param {Uint8Array} newData - The new chunk of data received.
      */
     pushData(newData) {
         if (!(newData instanceof Uint8Array) || newData.length === 0) return;
-        const combined = new Uint8Array(this.internalBuffer.length + newData.length);
-        combined.set(this.internalBuffer);
-        combined.set(newData, this.internalBuffer.length);
-        this.internalBuffer = combined;
+        this.ring.push(newData);
     }
 
     /**
@@ -151,24 +799,42 @@ export class AresplotFrameParser {
      * @returns {object|null} An object describing the parsed segment, or null if no complete segment can be processed yet.
      * Possible return object structures:
      * - Valid MONITOR_DATA: { type: 'data', mcuTimestampMs, values, rawFrame, consumedBytes }
-     * - Valid ACK:        { type: 'ack', ackCmdId, status, rawFrame, consumedBytes }
+     *   (with per-variable dividers, values always holds every channel; channels absent from the frame repeat their last value)
+     * - Valid MONITOR_DATA_BATCH: { type: 'data_batch', mcuTimestampMs, samplePeriodMs, samples: number[][], rawFrame, consumedBytes }
+     *   (sample i was taken at mcuTimestampMs + i * samplePeriodMs; MONITOR_DATA_COMPRESSED is returned the same way)
+     * - Valid CAPTURE_DATA: { type: 'capture_block', captureId, mcuTriggerTimestampMs, samplePeriodMs, preSamples, startIndex,
+     *   isLast, hasTimingGaps, samples: number[][], rawFrame, consumedBytes }
+     *   (sample i was taken at mcuTriggerTimestampMs + (startIndex + i - preSamples) * samplePeriodMs)
+     * - Valid ACK:        { type: 'ack', ackCmdId, status, tag?, tagRejected?, achievedRateHz?, entryOk?, rawFrame, consumedBytes }
+     *   (tag is echoed for a tagged command; tagRejected means firmware without tag support refused a tagged command
+     *   unexecuted, so it must be resent untagged. achievedRateHz is present when the MCU reports it for CMD_SET_SAMPLE_RATE,
+     *   or for CMD_START_MONITOR when the MCU limits the rate to its link budget;
+     *   entryOk is the CMD_SET_VARIABLES bitmap, one boolean per bit padded to a multiple of 8, true for an entry the MCU found valid)
      * - Valid ERROR_REPORT: { type: 'error_report', errorCode, messageBytes, rawFrame, consumedBytes }
-     * - Unidentified Data: { type: 'unidentified', rawData, consumedBytes } (e.g. bytes before SOP, or a corrupted frame)
+     * - Valid STATS:      { type: 'stats', stats: { elapsedMs, framesSent, samplesDropped, acksOverwritten, rxChecksumErrors,
+     *   deadlineOverruns, cycleCounterHz, hasCycles, tick: {calls, min, avg, max}, rx: {calls, min, avg, max} }, rawFrame, consumedBytes }
+     * - Valid TIME_SYNC_REPLY: { type: 'time_sync', hostSendTimeMs, tickHz, txTick, turnaroundTicks, txTickMs, rawFrame, consumedBytes }
+     *   (hostSendTimeMs is the token of buildTimeSyncFrame(); txTick is the 64-bit MCU tick at sending, turnaroundTicks how long the
+     *   request waited on the MCU, txTickMs the 32-bit millisecond tick of the data timestamps read at the same instant)
+     * - Unidentified Data: { type: 'unidentified', rawData, consumedBytes } (e.g. bytes before SOP, a corrupted frame, or a duplicate data frame)
      * - Needs More Data:   null (if buffer doesn't contain a full potential segment yet)
+     * rawFrame and rawData are views into the parser's buffer, valid until the next parseNext() or pushData(); slice() them to
+     * keep the bytes. Values and samples are always owned by the caller (FP32 samples of one frame share one Float32Array).
      */
     parseNext() {
-        if (this.internalBuffer.length === 0) {
+        const ring = this.ring;
+        if (ring.length === 0) {
             return null; // Nothing to parse
         }
 
-        let sopIndex = this.internalBuffer.indexOf(SOP);
+        let sopIndex = ring.indexOf(SOP);
 
         if (sopIndex === -1) { // No SOP found
             // If buffer is "large enough" and no SOP, assume it's all unidentified data
             // and consume it to prevent infinite buffering of garbage.
-            if (this.internalBuffer.length >= 256) { // Configurable threshold
-                const unidentifiedData = this.internalBuffer.slice(0); // Copy
-                this.internalBuffer = new Uint8Array(0);
+            if (ring.length >= 256) { // Configurable threshold
+                const unidentifiedData = ring.peek(ring.length);
+                ring.consume(unidentifiedData.length);
                 // console.warn("AresplotParser: Flushed large buffer segment due to no SOP.", unidentifiedData.length);
                 return { type: 'unidentified', rawData: unidentifiedData, consumedBytes: unidentifiedData.length };
             }
@@ -178,37 +844,38 @@ export class AresplotFrameParser {
         // SOP found
         if (sopIndex > 0) {
             // Data before SOP is unidentified
-            const unidentifiedData = this.internalBuffer.slice(0, sopIndex);
-            this.internalBuffer = this.internalBuffer.slice(sopIndex);
+            const unidentifiedData = ring.peek(sopIndex);
+            ring.consume(sopIndex);
             // console.debug("AresplotParser: Consumed unidentified data before SOP.", unidentifiedData.length);
             return { type: 'unidentified', rawData: unidentifiedData, consumedBytes: unidentifiedData.length };
         }
 
         // Buffer now starts with SOP. Check for header.
-        if (this.internalBuffer.length < HEADER_SIZE) {
+        if (ring.length < HEADER_SIZE) {
             return null; // Not enough for header yet
         }
 
-        const cmdId = this.internalBuffer[1];
-        const payloadLen = this.internalBuffer[2] | (this.internalBuffer[3] << 8); // Little-endian
+        const cmdId = ring.at(1);
+        const payloadLen = ring.at(2) | (ring.at(3) << 8); // Little-endian
 
         // Sanity check for payloadLen
-        if (payloadLen > 2048) { // Max reasonable payload
+        if (payloadLen > 4096) { // Max reasonable payload (255 raw-encoded values in a compressed frame stay below it)
             // console.warn(`AresplotParser: Invalid payload length: ${payloadLen}. Discarding SOP and header.`);
-            const badHeaderSegment = this.internalBuffer.slice(0, HEADER_SIZE);
-            this.internalBuffer = this.internalBuffer.slice(HEADER_SIZE); // Consume the bad header
+            const badHeaderSegment = ring.peek(HEADER_SIZE);
+            ring.consume(HEADER_SIZE); // Consume the bad header
             return { type: 'unidentified', rawData: badHeaderSegment, consumedBytes: HEADER_SIZE };
         }
 
         const expectedFrameSize = HEADER_SIZE + payloadLen + CHECKSUM_EOP_SIZE;
 
-        if (this.internalBuffer.length < expectedFrameSize) {
+        if (ring.length < expectedFrameSize) {
             return null; // Not enough data for the complete frame
         }
 
-        // We have a potential full frame
-        const frameBytes = this.internalBuffer.slice(0, expectedFrameSize);
-        const payload = frameBytes.slice(HEADER_SIZE, HEADER_SIZE + payloadLen);
+        // We have a potential full frame, consumed from the buffer whether it is valid or not
+        const frameBytes = ring.peek(expectedFrameSize);
+        ring.consume(expectedFrameSize);
+        const payload = frameBytes.subarray(HEADER_SIZE, HEADER_SIZE + payloadLen);
         const receivedChecksum = frameBytes[HEADER_SIZE + payloadLen];
         const eop = frameBytes[expectedFrameSize - 1];
 
@@ -219,36 +886,184 @@ export class AresplotFrameParser {
             if (calculatedChecksum !== receivedChecksum) warning += `Checksum error (Cmd:0x${cmdId.toString(16)} Exp:${calculatedChecksum} Got:${receivedChecksum}). `;
             if (eop !== EOP) warning += `EOP error (Cmd:0x${cmdId.toString(16)} Exp:${EOP} Got:${eop}).`;
             // console.warn("AresplotParser: Invalid frame. " + warning);
+            this.linkStats.checksumErrors++;
 
             // Treat the entire expected frame as unidentified/corrupted
-            this.internalBuffer = this.internalBuffer.slice(expectedFrameSize);
             return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: warning.trim() };
         }
 
-        // Frame is valid, consume it from buffer
-        this.internalBuffer = this.internalBuffer.slice(expectedFrameSize);
-
+        // Frame is valid
         // Process payload based on CMD ID
         const payloadView = new DataView(payload.buffer, payload.byteOffset, payload.byteLength);
         switch (cmdId) {
-            case CMD_ID.MONITOR_DATA:
-                if (payload.length < 4 || (payload.length - 4) % 4 !== 0) {
+            case CMD_ID.MONITOR_DATA: {
+                const valuesOffset = this.hasFrameSeq() ? 5 : 4; // Timestamp [+ FrameSeq]
+                if (valuesOffset === 5 && payload.length >= 5 && !this.trackFrameSeq(payload[4])) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize }; // Duplicate frame
+                }
+                if (this.hasChannelMask()) {
+                    const samples = payload.length >= valuesOffset ? this.decodeMaskedSamples(payload, valuesOffset, 1) : null;
+                    if (!samples) {
+                        return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid MONITOR_DATA payload size." };
+                    }
+                    return { type: 'data', mcuTimestampMs: payloadView.getUint32(0, true), values: samples[0], rawFrame: frameBytes, consumedBytes: expectedFrameSize };
+                }
+                const rawBytes = this.layoutSampleBytes();
+                const valuesBytes = payload.length - valuesOffset;
+                if (valuesBytes < 0 || (rawBytes ? valuesBytes !== rawBytes : valuesBytes % 4 !== 0)) {
                     return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid MONITOR_DATA payload size." };
                 }
                 const mcuTimestampMs = payloadView.getUint32(0, true);
-                const numValues = (payload.length - 4) / 4;
-                const values = [];
-                for (let i = 0; i < numValues; i++) {
-                    values.push(payloadView.getFloat32(4 + i * 4, true));
+                if (rawBytes) {
+                    return { type: 'data', mcuTimestampMs, values: this.decodeLayoutSample(payloadView, valuesOffset), rawFrame: frameBytes, consumedBytes: expectedFrameSize };
                 }
+                const values = this.decodeFloat32Samples(payloadView, valuesOffset, 1, valuesBytes / 4)[0];
                 return { type: 'data', mcuTimestampMs, values, rawFrame: frameBytes, consumedBytes: expectedFrameSize };
+            }
+            case CMD_ID.MONITOR_DATA_BATCH: {
+                const headerSize = BATCH_HEADER_SIZE + (this.hasFrameSeq() ? 1 : 0); // ... [+ FrameSeq]
+                if (payload.length < headerSize) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid MONITOR_DATA_BATCH payload size." };
+                }
+                if (headerSize > BATCH_HEADER_SIZE && !this.trackFrameSeq(payload[BATCH_HEADER_SIZE])) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize }; // Duplicate frame
+                }
+                const batchTimestampMs = payloadView.getUint32(0, true);
+                const samplePeriodMs = payloadView.getUint32(4, true) / 1e6;
+                const sampleCount = payloadView.getUint8(8);
+                if (this.hasChannelMask()) {
+                    const samples = sampleCount ? this.decodeMaskedSamples(payload, headerSize, sampleCount) : null;
+                    if (!samples) {
+                        return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid MONITOR_DATA_BATCH sample layout." };
+                    }
+                    return { type: 'data_batch', mcuTimestampMs: batchTimestampMs, samplePeriodMs, samples, rawFrame: frameBytes, consumedBytes: expectedFrameSize };
+                }
+                const valuesBytes = payload.length - headerSize;
+                const rawBytes = this.layoutSampleBytes();
+                if (sampleCount === 0 || (rawBytes ? valuesBytes !== sampleCount * rawBytes : valuesBytes % (sampleCount * 4) !== 0)) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid MONITOR_DATA_BATCH sample layout." };
+                }
+                if (rawBytes) {
+                    const samples = new Array(sampleCount);
+                    let valueOffset = headerSize;
+                    for (let s = 0; s < sampleCount; s++) {
+                        samples[s] = this.decodeLayoutSample(payloadView, valueOffset);
+                        valueOffset += rawBytes;
+                    }
+                    return { type: 'data_batch', mcuTimestampMs: batchTimestampMs, samplePeriodMs, samples, rawFrame: frameBytes, consumedBytes: expectedFrameSize };
+                }
+                const samples = this.decodeFloat32Samples(payloadView, headerSize, sampleCount, valuesBytes / (sampleCount * 4));
+                return { type: 'data_batch', mcuTimestampMs: batchTimestampMs, samplePeriodMs, samples, rawFrame: frameBytes, consumedBytes: expectedFrameSize };
+            }
+            case CMD_ID.MONITOR_DATA_COMPRESSED: {
+                if (payload.length < COMPRESSED_HEADER_SIZE || payload[8] === 0) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid MONITOR_DATA_COMPRESSED payload size." };
+                }
+                // Dropped before the decoder, which would otherwise lose sync until the next keyframe
+                if (!this.trackFrameSeq(payload[10])) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize }; // Duplicate frame
+                }
+                const decoded = this.decodeCompressedSamples(payload);
+                if (decoded.warning) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: decoded.warning };
+                }
+                const mcuTimestampMs = payloadView.getUint32(0, true);
+                const samplePeriodMs = payloadView.getUint32(4, true) / 1e6;
+                return { type: 'data_batch', mcuTimestampMs, samplePeriodMs, samples: decoded.samples, rawFrame: frameBytes, consumedBytes: expectedFrameSize };
+            }
+            case CMD_ID.CAPTURE_DATA: {
+                // Capture samples always hold every channel in the plain (FP32 or raw) layout: no compression, no channel bitmap
+                const sampleCount = payload.length >= CAPTURE_HEADER_SIZE ? payload[14] : 0;
+                const rawBytes = this.layoutSampleBytes();
+                const valuesBytes = payload.length - CAPTURE_HEADER_SIZE;
+                if (sampleCount === 0 || (rawBytes ? valuesBytes !== sampleCount * rawBytes : valuesBytes % (sampleCount * 4) !== 0)) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid CAPTURE_DATA payload size." };
+                }
+                let samples;
+                if (rawBytes) {
+                    samples = new Array(sampleCount);
+                    let valueOffset = CAPTURE_HEADER_SIZE;
+                    for (let s = 0; s < sampleCount; s++) {
+                        samples[s] = this.decodeLayoutSample(payloadView, valueOffset);
+                        valueOffset += rawBytes;
+                    }
+                } else {
+                    samples = this.decodeFloat32Samples(payloadView, CAPTURE_HEADER_SIZE, sampleCount, valuesBytes / (sampleCount * 4));
+                }
+                const flags = payload[9];
+                return {
+                    type: 'capture_block',
+                    captureId: payload[8],
+                    mcuTriggerTimestampMs: payloadView.getUint32(0, true),
+                    samplePeriodMs: payloadView.getUint32(4, true) / 1e6,
+                    preSamples: payloadView.getUint16(10, true),
+                    startIndex: payloadView.getUint16(12, true),
+                    isLast: (flags & CAPTURE_FLAG_LAST) !== 0,
+                    hasTimingGaps: (flags & CAPTURE_FLAG_TIMING_GAPS) !== 0,
+                    samples, rawFrame: frameBytes, consumedBytes: expectedFrameSize
+                };
+            }
             case CMD_ID.ACK:
                 if (payload.length < 2) {
                     return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid ACK payload size." };
                 }
-                const ackCmdId = payloadView.getUint8(0);
+                const ackCmdId = payloadView.getUint8(0) & ~CMD_FLAG_TAGGED;
                 const status = payloadView.getUint8(1);
-                return { type: 'ack', ackCmdId, status, rawFrame: frameBytes, consumedBytes: expectedFrameSize };
+                const ack = { type: 'ack', ackCmdId, status, rawFrame: frameBytes, consumedBytes: expectedFrameSize };
+                let extraOffset = 2; // Extra data follows Status, or the tag of a tagged command
+                if (payloadView.getUint8(0) & CMD_FLAG_TAGGED) {
+                    // Firmware without tag support answers a tagged command with a bare UNKNOWN_CMD
+                    if (payload.length > 2) ack.tag = payload[extraOffset++];
+                    else ack.tagRejected = true;
+                }
+                if (ackCmdId === CMD_ID.START_MONITOR) {
+                    // A corrupted, refused-tag or BUSY frame leaves the MCU config untouched; any other rejection stops monitoring
+                    const layout = this.takePendingMonitorLayout(ack);
+                    if (layout !== undefined && !ack.tagRejected) {
+                        if (status === AckStatus.OK) this.activateMonitorLayout(layout);
+                        else if (status !== AckStatus.ERROR_CHECKSUM && status !== AckStatus.ERROR_BUSY) this.activateMonitorLayout(null);
+                    }
+                }
+                // CMD_START_MONITOR reports the rate too when the MCU limits it to its link budget
+                if ((ackCmdId === CMD_ID.SET_SAMPLE_RATE || ackCmdId === CMD_ID.START_MONITOR) && payload.length >= extraOffset + 4) {
+                    ack.achievedRateHz = payloadView.getFloat32(extraOffset, true);
+                }
+                if (ackCmdId === CMD_ID.SET_VARIABLES && payload.length > extraOffset) {
+                    const entryOk = [];
+                    for (let i = 0; i < (payload.length - extraOffset) * 8; i++) entryOk.push((payload[extraOffset + (i >> 3)] & (1 << (i & 7))) !== 0);
+                    ack.entryOk = entryOk;
+                }
+                return ack;
+            case CMD_ID.STATS: {
+                // Later firmware may append fields; anything past the known layout is ignored
+                if (payload.length < STATS_PAYLOAD_SIZE) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid STATS payload size." };
+                }
+                const u32 = (offset) => payloadView.getUint32(offset, true);
+                const cycles = (offset) => ({ calls: u32(offset), min: u32(offset + 4), avg: u32(offset + 8), max: u32(offset + 12) });
+                const stats = {
+                    elapsedMs: u32(1), framesSent: u32(5), samplesDropped: u32(9), acksOverwritten: u32(13),
+                    rxChecksumErrors: u32(17), deadlineOverruns: u32(21), cycleCounterHz: u32(25),
+                    hasCycles: (payload[0] & STATS_FLAG_CYCLES) !== 0, tick: cycles(29), rx: cycles(45)
+                };
+                return { type: 'stats', stats, rawFrame: frameBytes, consumedBytes: expectedFrameSize };
+            }
+            case CMD_ID.TIME_SYNC_REPLY: {
+                if (payload.length < TIME_SYNC_REPLY_SIZE) {
+                    return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid TIME_SYNC_REPLY payload size." };
+                }
+                const base = TIME_SYNC_TOKEN_SIZE + 1;
+                return {
+                    type: 'time_sync',
+                    hostSendTimeMs: payloadView.getFloat64(0, true),
+                    tickHz: (payload[TIME_SYNC_TOKEN_SIZE] & TIME_SYNC_FLAG_TICK_US) ? 1e6 : 1e3,
+                    // Tick + epoch * 2^32 stays exact in a double for far longer than any session
+                    txTick: payloadView.getUint32(base, true) + payloadView.getUint32(base + 4, true) * 4294967296,
+                    turnaroundTicks: payloadView.getUint32(base + 8, true),
+                    txTickMs: payloadView.getUint32(base + 12, true),
+                    rawFrame: frameBytes, consumedBytes: expectedFrameSize
+                };
+            }
             case CMD_ID.ERROR_REPORT: // Assuming structure: ErrorCode (1 byte) + Optional_Message (M bytes)
                  if (payload.length < 1) {
                     return { type: 'unidentified', rawData: frameBytes, consumedBytes: expectedFrameSize, warning: "Invalid ERROR_REPORT payload size." };
@@ -262,4 +1077,143 @@ export class AresplotFrameParser {
     }
 }
 
-console.log("aresplot_protocol.js loaded");
\ No newline at end of file
+console.log("aresplot_protocol.js loaded");
+
+// --- AresplotClockEstimator Class ---
+const CLOCK_TICK_MS_WRAP = 4294967296; // The 32-bit millisecond tick of the data timestamps wraps after ~49.7 days
+const CLOCK_MAX_SKEW = 0.05;           // Reject fits beyond +-5 % (uncalibrated RC oscillators stay within ~2 %)
+const CLOCK_RESTART_MS = 1000;         // A sample this far off the fit means the MCU clock restarted
+
+/**
+ * Maps MCU data timestamps (the 32-bit millisecond tick) to host time with a continuously updated offset and skew.
+ *
+ * Each sample pairs an MCU time with the host time of the same instant and an error bound. CMD_TIME_SYNC replies give
+ * round-trip samples: the reply left the MCU at txTick, and on the host sometime in [send, recv] minus the time the
+ * request waited on the MCU, so its host time is taken mid-path and the bound is half the path. Older firmware only
+ * offers one-way arrival times of data frames, fed in as the lowest latency seen per interval (addArrival()).
+ * The mapping is a weighted least-squares line over the recent samples whose bound is close to the best one, so
+ * queueing delays on the link are filtered out, and it moves by fractions of a millisecond per sample instead of
+ * jumping. Mapped times of consecutive samples therefore stay evenly spaced over multi-hour sessions.
+ */
+export class AresplotClockEstimator {
+    /**
+     * @param {object} [options]
+     * @param {number} [options.maxSamples=256] - Samples kept for the fit; at one sync per second this spans about four minutes.
+     */
+    constructor({ maxSamples = 256 } = {}) {
+        this.maxSamples = maxSamples;
+        this.reset();
+    }
+
+    /** Forgets all samples, e.g. for a new session or after the MCU restarted. */
+    reset() {
+        this.samples = [];      // { x: MCU ms relative to x0, y: host ms relative to y0, bound }
+        this.x0 = 0;
+        this.y0 = 0;
+        this.lastTickMs = null; // Last unwrapped millisecond tick, the reference for unwrapping
+        this.tickOffsetMs = 0;  // Running mean of sync tick minus millisecond tick (0 when both are the ms tick)
+        this.tickOffsetCount = 0;
+        this.offset = 0;        // y = offset + skew * x
+        this.skew = 1;
+    }
+
+    /** Whether at least one sample has been accepted, so toHostMs() is meaningful. */
+    get ready() {
+        return this.samples.length > 0;
+    }
+
+    /**
+     * Adds a CMD_TIME_SYNC round trip.
+     * @param {object} reply - The parser's 'time_sync' segment.
+     * @param {number} hostSendMs - Host time at which the request was sent.
+     * @param {number} hostRecvMs - Host time at which the reply arrived.
+     * @returns {'accepted'|'rejected'|'restarted'} 'restarted' when the MCU clock no longer fits and the fit was reset.
+     */
+    addSyncReply(reply, hostSendMs, hostRecvMs) {
+        const txTickMs = this._unwrapTickMs(reply.txTickMs);
+        const txMs = reply.txTick * 1000 / reply.tickHz;
+        const pathMs = (hostRecvMs - hostSendMs) - reply.turnaroundTicks * 1000 / reply.tickHz;
+        if (!(pathMs >= 0) || pathMs > CLOCK_RESTART_MS) return 'rejected';
+        // With a us sync tick and the ms data tick from the same clock their difference is constant apart from the
+        // ms truncation; its mean puts each ms timestamp at the middle of its millisecond
+        this.tickOffsetCount = Math.min(this.tickOffsetCount + 1, this.maxSamples);
+        this.tickOffsetMs += (txMs - txTickMs - this.tickOffsetMs) / this.tickOffsetCount;
+        // The bound includes one tick, since txTick and the turnaround are both truncated
+        return this._addSample(txMs - this.tickOffsetMs, hostRecvMs - pathMs / 2, pathMs / 2 + 1000 / reply.tickHz);
+    }
+
+    /**
+     * Adds a one-way sample from data frame arrivals (firmware without CMD_TIME_SYNC).
+     * @param {number} mcuTimestampMs - Data timestamp of the frame with the lowest latency in the interval.
+     * @param {number} hostMs - Host time at which that frame arrived.
+     * @returns {'accepted'|'rejected'|'restarted'}
+     */
+    addArrival(mcuTimestampMs, hostMs) {
+        return this._addSample(this._unwrapTickMs(mcuTimestampMs), hostMs, 0);
+    }
+
+    /**
+     * Maps an MCU data timestamp to host time.
+     * @param {number} mcuTimestampMs - 32-bit millisecond tick, possibly with a fractional part (batch sample times).
+     * @returns {number} Host time in ms, on the clock the samples were given in.
+     */
+    toHostMs(mcuTimestampMs) {
+        const x = this._unwrapNear(mcuTimestampMs) - this.x0;
+        return this.y0 + this.offset + this.skew * x;
+    }
+
+    _unwrapNear(tickMs) {
+        if (this.lastTickMs === null) return tickMs;
+        return tickMs + Math.round((this.lastTickMs - tickMs) / CLOCK_TICK_MS_WRAP) * CLOCK_TICK_MS_WRAP;
+    }
+
+    _unwrapTickMs(tickMs) {
+        const unwrapped = this._unwrapNear(tickMs);
+        if (this.lastTickMs === null || unwrapped > this.lastTickMs) this.lastTickMs = unwrapped;
+        return unwrapped;
+    }
+
+    _addSample(mcuMs, hostMs, bound) {
+        let result = 'accepted';
+        if (this.samples.length === 0) {
+            this.x0 = mcuMs;
+            this.y0 = hostMs;
+        } else if (Math.abs(this.toHostMs(mcuMs) - hostMs) > CLOCK_RESTART_MS + bound) {
+            const tickOffsetMs = this.tickOffsetMs;
+            this.reset();
+            this.lastTickMs = mcuMs;
+            this.tickOffsetMs = tickOffsetMs;
+            this.x0 = mcuMs;
+            this.y0 = hostMs;
+            result = 'restarted';
+        }
+        this.samples.push({ x: mcuMs - this.x0, y: hostMs - this.y0, bound });
+        if (this.samples.length > this.maxSamples) this.samples.shift();
+        this._fit();
+        return result;
+    }
+
+    _fit() {
+        // Samples whose bound is close to the best one; the rest waited in a queue somewhere on the link
+        const best = Math.min(...this.samples.map(s => s.bound));
+        const limit = best * 2 + 0.5;
+        let sw = 0, sx = 0, sy = 0;
+        const used = this.samples.filter(s => s.bound <= limit);
+        for (const s of used) {
+            const w = 1 / ((s.bound + 0.25) * (s.bound + 0.25));
+            sw += w; sx += w * s.x; sy += w * s.y;
+        }
+        const mx = sx / sw, my = sy / sw;
+        let sxx = 0, sxy = 0;
+        for (const s of used) {
+            const w = 1 / ((s.bound + 0.25) * (s.bound + 0.25));
+            sxx += w * (s.x - mx) * (s.x - mx);
+            sxy += w * (s.x - mx) * (s.y - my);
+        }
+        // The skew needs a few seconds of spread; until then the offset alone is fitted
+        let skew = (used.length >= 3 && sxx > 0) ? sxy / sxx : 1;
+        if (!(Math.abs(skew - 1) <= CLOCK_MAX_SKEW) || (this.samples[this.samples.length - 1].x - this.samples[0].x) < 2000) skew = this.skew;
+        this.skew = skew;
+        this.offset = my - skew * mx;
+    }
+}
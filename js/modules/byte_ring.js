@@ -0,0 +1,120 @@
+// js/modules/byte_ring.js
+// Growable ring buffer for received serial bytes.
+//
+// Serial chunks are appended at the write index and consumed frames advance the read index, so neither appending
+// nor consuming copies the bytes still buffered. The capacity is a power of two and doubles when a chunk does not
+// fit; it never shrinks, so at a steady rate the ring is allocated once.
+
+const DEFAULT_CAPACITY = 4096;
+
+export class ByteRing {
+    /**
+     * @param {number} [capacity=4096] - Initial capacity in bytes, rounded up to a power of two.
+     */
+    constructor(capacity = DEFAULT_CAPACITY) {
+        this.buffer = new Uint8Array(1 << Math.ceil(Math.log2(Math.max(16, capacity))));
+        this.mask = this.buffer.length - 1;
+        this.readIndex = 0;  // Position of the oldest byte
+        this.size = 0;       // Bytes buffered
+        this.scratch = null; // Holds peek() results that wrap around the end of the buffer
+    }
+
+    /** Number of bytes buffered. */
+    get length() {
+        return this.size;
+    }
+
+    /**
+     * Appends a chunk, growing the ring when it does not fit.
+     * @param {Uint8Array} bytes
+     */
+    push(bytes) {
+        const len = bytes.length;
+        if (len === 0) return;
+        if (this.size + len > this.buffer.length) this.grow(this.size + len);
+        const capacity = this.buffer.length;
+        const writeIndex = (this.readIndex + this.size) & this.mask;
+        const first = Math.min(len, capacity - writeIndex);
+        this.buffer.set(first === len ? bytes : bytes.subarray(0, first), writeIndex);
+        if (first < len) this.buffer.set(bytes.subarray(first), 0);
+        this.size += len;
+    }
+
+    /**
+     * @param {number} index - Offset from the oldest byte, below length.
+     * @returns {number} The byte at that offset.
+     */
+    at(index) {
+        return this.buffer[(this.readIndex + index) & this.mask];
+    }
+
+    /**
+     * Finds a byte value.
+     * @param {number} value - Byte to look for.
+     * @param {number} [fromIndex=0] - Offset to start at.
+     * @returns {number} Offset of the first match at or after fromIndex, or -1.
+     */
+    indexOf(value, fromIndex = 0) {
+        if (fromIndex >= this.size) return -1;
+        const start = this.readIndex + fromIndex;
+        const end = this.readIndex + this.size;
+        const capacity = this.buffer.length;
+        if (start < capacity) {
+            const found = this.buffer.subarray(start, Math.min(end, capacity)).indexOf(value);
+            if (found !== -1) return fromIndex + found;
+            if (end <= capacity) return -1;
+            const wrapped = this.buffer.subarray(0, end - capacity).indexOf(value);
+            return wrapped === -1 ? -1 : capacity - this.readIndex + wrapped;
+        }
+        const wrapped = this.buffer.subarray(start - capacity, end - capacity).indexOf(value);
+        return wrapped === -1 ? -1 : fromIndex + wrapped;
+    }
+
+    /**
+     * Returns the oldest bytes as one contiguous view without consuming them. The view aliases the ring (or a
+     * scratch buffer when the bytes wrap around its end), so it is only valid until the next push() or peek();
+     * slice() it to keep the bytes.
+     * @param {number} len - Number of bytes, at most length.
+     * @returns {Uint8Array}
+     */
+    peek(len) {
+        const capacity = this.buffer.length;
+        if (this.readIndex + len <= capacity) {
+            return this.buffer.subarray(this.readIndex, this.readIndex + len);
+        }
+        if (!this.scratch || this.scratch.length < len) this.scratch = new Uint8Array(capacity);
+        const first = capacity - this.readIndex;
+        this.scratch.set(this.buffer.subarray(this.readIndex), 0);
+        this.scratch.set(this.buffer.subarray(0, len - first), first);
+        return this.scratch.subarray(0, len);
+    }
+
+    /**
+     * Drops the oldest bytes.
+     * @param {number} len - Number of bytes, at most length.
+     */
+    consume(len) {
+        this.size -= len;
+        // An empty ring restarts at the front, so later frames rarely wrap
+        this.readIndex = this.size === 0 ? 0 : (this.readIndex + len) & this.mask;
+    }
+
+    /** Drops all buffered bytes. */
+    clear() {
+        this.readIndex = 0;
+        this.size = 0;
+    }
+
+    grow(minCapacity) {
+        let capacity = this.buffer.length * 2;
+        while (capacity < minCapacity) capacity *= 2;
+        const next = new Uint8Array(capacity);
+        next.set(this.peek(this.size));
+        this.buffer = next;
+        this.mask = capacity - 1;
+        this.readIndex = 0;
+        this.scratch = null;
+    }
+}
+
+console.log("byte_ring.js loaded");
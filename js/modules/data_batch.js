@@ -0,0 +1,136 @@
+// js/modules/data_batch.js
+// Columnar data blocks passed from the worker to the main thread.
+//
+// A block holds `count` rows in typed-array columns, so the worker can post it with its buffers in the
+// transfer list (no structured clone of per-point objects) and the display and buffer modules read the
+// columns in place:
+//   {
+//     count,                 // Rows in the block
+//     timestamps,            // Float64Array, ms on the performance.now() clock; [0, count) valid
+//     channels,              // Array of Float64Array, one column per channel; NaN where a row had no value
+//     widths,                // Uint16Array, number of values each row carried (0 for raw-only rows)
+//     raw,                   // Sparse raw bytes for the terminal: Array<{ row, bytes: Uint8Array }>
+//   }
+
+const MIN_CAPACITY = 64;
+
+/**
+ * Fills preallocated columns row by row and hands them out as blocks. The capacity of the next block
+ * follows the size of the last one, so at a steady rate the columns are allocated once per block and
+ * never reallocated.
+ */
+export class DataBatchBuilder {
+  constructor() {
+    this.nextCapacity = MIN_CAPACITY;
+    this._allocate(0);
+  }
+
+  /** Number of rows added since the last take(). */
+  get length() {
+    return this.count;
+  }
+
+  /**
+   * Appends one row.
+   * @param {number} timestamp - Row timestamp (ms).
+   * @param {ArrayLike<number>} values - Channel values; may be empty for raw-only rows.
+   * @param {Uint8Array} [rawBytes] - Raw bytes shown by the terminal for this row.
+   */
+  push(timestamp, values, rawBytes) {
+    if (this.count === this.capacity) this._grow();
+    const row = this.count++;
+    const width = values.length;
+    while (this.channels.length < width) {
+      this.channels.push(new Float64Array(this.capacity).fill(NaN));
+    }
+    this.timestamps[row] = timestamp;
+    this.widths[row] = width;
+    for (let ch = 0; ch < this.channels.length; ch++) {
+      this.channels[ch][row] = ch < width ? values[ch] : NaN;
+    }
+    if (rawBytes instanceof Uint8Array && rawBytes.byteLength > 0) {
+      this.raw.push({ row, bytes: rawBytes });
+    }
+  }
+
+  /**
+   * Hands out the rows added so far as a block and starts a new one with the same channels.
+   * @returns {{block: object, transfer: ArrayBuffer[]}} The block and the buffers to transfer with it.
+   */
+  take() {
+    const block = {
+      count: this.count,
+      timestamps: this.timestamps,
+      channels: this.channels,
+      widths: this.widths,
+      raw: this.raw,
+    };
+    const transfer = [this.timestamps.buffer, this.widths.buffer, ...this.channels.map((c) => c.buffer)];
+    this.nextCapacity = Math.max(MIN_CAPACITY, 1 << Math.ceil(Math.log2(this.count + 1)));
+    this._allocate(this.channels.length);
+    return { block, transfer };
+  }
+
+  _allocate(numChannels) {
+    this.capacity = this.nextCapacity;
+    this.count = 0;
+    this.timestamps = new Float64Array(this.capacity);
+    this.widths = new Uint16Array(this.capacity);
+    this.channels = [];
+    for (let ch = 0; ch < numChannels; ch++) this.channels.push(new Float64Array(this.capacity).fill(NaN));
+    this.raw = [];
+  }
+
+  _grow() {
+    const capacity = this.capacity * 2;
+    const grow = (column, Type) => {
+      const next = new Type(capacity);
+      next.set(column);
+      return next;
+    };
+    this.timestamps = grow(this.timestamps, Float64Array);
+    this.widths = grow(this.widths, Uint16Array);
+    this.channels = this.channels.map((column) => {
+      const next = grow(column, Float64Array);
+      next.fill(NaN, this.capacity);
+      return next;
+    });
+    this.capacity = capacity;
+  }
+}
+
+/**
+ * Builds a block from row objects, for the few callers that produce single rows on the main thread.
+ * @param {Array<{timestamp: number, values: ArrayLike<number>, rawLineBytes?: Uint8Array}>} rows
+ * @returns {object} The block.
+ */
+export function blockFromRows(rows) {
+  const builder = new DataBatchBuilder();
+  for (const row of rows) builder.push(row.timestamp, row.values, row.rawLineBytes);
+  return builder.take().block;
+}
+
+/**
+ * Total number of rows in a list of blocks.
+ * @param {Array<object>} blocks
+ * @returns {number}
+ */
+export function countRows(blocks) {
+  let rows = 0;
+  for (const block of blocks) rows += block.count;
+  return rows;
+}
+
+/**
+ * Copies the values one row carried into a plain array.
+ * @param {object} block
+ * @param {number} row
+ * @returns {number[]}
+ */
+export function rowValues(block, row) {
+  const values = new Array(block.widths[row]);
+  for (let ch = 0; ch < values.length; ch++) values[ch] = block.channels[ch][row];
+  return values;
+}
+
+console.log("data_batch.js loaded");
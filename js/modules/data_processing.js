@@ -4,7 +4,11 @@
 import { formatSecondsToHMS } from "../utils.js";
 
 // --- Module State ---
-let dataBuffer = []; // Buffer specifically for CSV export/download
+// Buffer specifically for CSV export/download: the columnar blocks from the worker, kept as they arrived.
+// Rows before dataBufferHead in the first block have been trimmed.
+let dataBlocks = [];
+let dataBufferHead = 0;
+let dataBufferLength = 0;
 let currentDataRateHz = 0;
 let estimatedBufferTimeRemainingSec = null;
 let estimatedBufferTimeSec = null;
@@ -14,37 +18,38 @@ let lastRateCheckTime = 0;
 // --- Buffer Management ---
 
 /**
- * Adds data points from a batch to the internal CSV buffer.
- * @param {Array<object>} batch - Array of data items { timestamp, values, ... }.
+ * Adds data blocks to the internal CSV buffer. The blocks are kept as they are, without copying rows.
+ * @param {Array<object>} blocks - Columnar data blocks (see data_batch.js).
  */
-export function addToBuffer(batch) {
-  for (const item of batch) {
-    // Ensure basic structure is present
-    if (
-      !item ||
-      typeof item.timestamp !== "number" ||
-      !Array.isArray(item.values)
-    )
-      continue;
-    // Store only timestamp and validated values for CSV
-    dataBuffer.push({
-      timestamp: item.timestamp,
-      values: item.values.map((v) =>
-        typeof v === "number" && isFinite(v) ? v : NaN
-      ), // Sanitize values
-    });
+export function addToBuffer(blocks) {
+  for (const block of blocks) {
+    if (!block || block.count === 0) continue;
+    dataBlocks.push(block);
+    dataBufferLength += block.count;
   }
 }
 
 /**
  * Trims the internal CSV data buffer to the specified maximum number of points.
+ * Whole blocks are dropped from the front; a partly trimmed first block is skipped up to dataBufferHead.
  * @param {number} maxPoints - The maximum number of points to keep.
  */
 export function trimDataBuffer(maxPoints) {
-  const pointsToRemove = dataBuffer.length - maxPoints;
-  if (pointsToRemove > 0) {
-    dataBuffer.splice(0, pointsToRemove);
+  let pointsToRemove = dataBufferLength - maxPoints;
+  if (pointsToRemove <= 0) return;
+  dataBufferLength -= pointsToRemove;
+  let dropBlocks = 0;
+  while (pointsToRemove > 0) {
+    const left = dataBlocks[dropBlocks].count - dataBufferHead;
+    if (pointsToRemove < left) {
+      dataBufferHead += pointsToRemove;
+      break;
+    }
+    pointsToRemove -= left;
+    dataBufferHead = 0;
+    dropBlocks++;
   }
+  if (dropBlocks > 0) dataBlocks.splice(0, dropBlocks);
 }
 
 /**
@@ -52,14 +57,16 @@ export function trimDataBuffer(maxPoints) {
  * @returns {number}
  */
 export function getBufferLength() {
-  return dataBuffer.length;
+  return dataBufferLength;
 }
 
 /**
  * Clears the internal CSV data buffer.
  */
 export function clearBuffer() {
-  dataBuffer = [];
+  dataBlocks = [];
+  dataBufferHead = 0;
+  dataBufferLength = 0;
 }
 
 // --- Data Rate Calculation ---
@@ -160,69 +167,90 @@ export function resetEstimatesAndRate() {
 // --- Data Export ---
 
 /**
- * Generates and triggers the download of the internal dataBuffer as a CSV file.
+ * Builds the CSV header row (without line break).
+ * @param {Array<string|undefined>} names - Channel names by index; missing ones get a default name.
+ * @param {number} numChannels - Number of channel columns.
+ * @returns {string}
+ */
+export function csvHeaderLine(names, numChannels) {
+  let header = "Timestamp (s)";
+  for (let i = 0; i < numChannels; i++) {
+    const seriesName = names?.[i] || `通道 ${i + 1}`;
+    // Sanitize name for CSV (remove commas, quotes)
+    const sanitizedName = seriesName.replace(/["',]/g, "");
+    header += `,${sanitizedName}`;
+  }
+  return header;
+}
+
+/**
+ * Formats the rows of a data block from a given row on as CSV lines (joined by line breaks, none at the end).
+ * @param {object} block - Columnar data block (see data_batch.js).
+ * @param {number} fromRow - First row to format.
+ * @param {number} numChannels - Number of channel columns.
+ * @returns {string}
+ */
+export function blockRowsToCsv(block, fromRow, numChannels) {
+  const rows = [];
+  for (let row = fromRow; row < block.count; row++) {
+    // Format timestamp (seconds with high precision)
+    let rowValues = [(block.timestamps[row] / 1000.0).toFixed(6)];
+
+    // Format channel values (numbers with high precision, empty for NaN or values the row did not carry)
+    const width = block.widths[row];
+    for (let ch = 0; ch < numChannels; ch++) {
+      const value = ch < width ? block.channels[ch][row] : NaN;
+      rowValues.push(isFinite(value) ? value.toFixed(6) : "");
+    }
+    rows.push(rowValues.join(","));
+  }
+  return rows.join("\n");
+}
+
+/**
+ * Generates and triggers the download of the internal data buffer as a CSV file.
+ * The file is assembled from one string per block, never as one string of the whole buffer.
  * @param {Array<{name: string}> | null} chartSeriesRef - Optional array of series objects (like [{name: 'Ch 1'}, ...]) for header names.
  */
 export function downloadCSV(chartSeriesRef = null) {
-  if (!dataBuffer || dataBuffer.length === 0) {
+  if (dataBufferLength === 0) {
     alert("没有数据可以下载。");
     return;
   }
   console.log("Generating CSV from dataProcessor buffer...");
 
-  const numPoints = dataBuffer.length;
-  const numChannels = dataBuffer[0]?.values?.length || 0;
+  const numChannels = dataBlocks[0].widths[dataBufferHead];
   if (numChannels === 0) {
     alert("缓冲区中未找到通道数据。");
     return;
   }
 
-  // Build Header Row
-  let header = "Timestamp (s)";
-  for (let i = 0; i < numChannels; i++) {
-    // Use names from chart series if provided, otherwise default
-    const seriesName = chartSeriesRef?.[i]?.name || `通道 ${i + 1}`;
-    // Sanitize name for CSV (remove commas, quotes)
-    const sanitizedName = seriesName.replace(/["',]/g, "");
-    header += `,${sanitizedName}`;
-  }
-  header += "\n";
+  // Build Header Row (names from chart series if provided, otherwise default)
+  const header =
+    csvHeaderLine(
+      chartSeriesRef?.map((s) => s?.name),
+      numChannels
+    ) + "\n";
 
   // Process data rows (using Promise for potentially large data)
   new Promise((resolve, reject) => {
     try {
-      const rows = [header];
-      // Use map for potentially better performance? Or keep simple loop.
-      for (let i = 0; i < numPoints; i++) {
-        const entry = dataBuffer[i];
-        // Skip invalid entries just in case
-        if (
-          !entry ||
-          typeof entry.timestamp !== "number" ||
-          !Array.isArray(entry.values)
-        )
-          continue;
-
-        // Format timestamp (seconds with high precision)
-        let rowValues = [(entry.timestamp / 1000.0).toFixed(6)];
-
-        // Format channel values (numbers with high precision, empty for NaN/null/undefined)
-        for (let ch = 0; ch < numChannels; ch++) {
-          const value = entry.values[ch];
-          rowValues.push(
-            typeof value === "number" && isFinite(value) ? value.toFixed(6) : ""
-          );
+      const parts = [header];
+      let head = dataBufferHead;
+      for (const block of dataBlocks) {
+        if (head < block.count) {
+          parts.push("\n", blockRowsToCsv(block, head, numChannels));
         }
-        rows.push(rowValues.join(","));
+        head = 0;
       }
-      resolve(rows.join("\n"));
+      resolve(parts);
     } catch (error) {
       reject(error);
     }
   })
-    .then((csvContent) => {
+    .then((csvParts) => {
       // Create Blob and trigger download
-      const blob = new Blob([csvContent], { type: "text/csv;charset=utf-8;" });
+      const blob = new Blob(csvParts, { type: "text/csv;charset=utf-8;" });
       const link = document.createElement("a");
       const url = URL.createObjectURL(blob);
       link.setAttribute("href", url);
@@ -7,13 +7,21 @@
 // Using the full URL as specified in the documentation:
 import { default as wasmInit, analyze_elf_recursively } from 'https://captainkaz.github.io/elf_analyzer_wasm/pkg/elf_analyzer_wasm.js';
 // --- End Static Import ---
+import * as symbolCache from './symbol_cache.js';
 
 // Module state
 let isWasmInitialized = false;
 let isWasmInitializing = false;
 let allParsedSymbols = [];
+let symbolIndex = null; // N-gram index of allParsedSymbols, see buildSymbolIndex()
+let symbolTableGeneration = 0; // Bumped whenever the table changes, so a late cache restore cannot replace a newer table
 let wasmInitializationPromise = null; // Stores the promise during initialization
 
+// Search index: every 1- to 3-character substring of the lower-cased names maps to the ascending
+// indices of the symbols containing it. A term of 3+ characters is looked up by its rarest trigram,
+// then each candidate is confirmed with includes(), so results keep the table order of a linear scan.
+const INDEX_GRAM_MAX = 3;
+
 /**
  * Initializes the Wasm module. Should be called once during app startup.
  * Uses the statically imported init function.
@@ -94,25 +102,123 @@ export async function analyzeElf(elfFileBytes) {
     try {
         // Call the statically imported Wasm function
         const results = analyze_elf_recursively(elfFileBytes);
-        allParsedSymbols = results || [];
+        setSymbolTable(results || [], null);
         console.log(`ELF analysis complete. Found ${allParsedSymbols.length} symbols.`);
         return allParsedSymbols;
     } catch (error) {
         console.error("Error during Wasm analyze_elf_recursively call:", error);
-        allParsedSymbols = [];
+        setSymbolTable([], null);
         throw new Error(`ELF Analysis Failed: ${error.message || error}`);
     }
 }
 
+/**
+ * Loads the symbols of an ELF file from the IndexedDB cache, or analyzes it and caches the result.
+ * The cache is keyed by the ELF's GNU build ID (SHA-256 of the file without one), so a rebuilt
+ * firmware is analyzed again while a known one skips the Wasm module entirely.
+ * @param {Uint8Array} elfFileBytes - The ELF file content.
+ * @param {string} fileName - Shown when the table is restored in a later session.
+ * @param {function(object): void} [prepareSymbol] - Run once on each freshly analyzed symbol before it is
+ * cached (e.g. to attach the protocol type), so cached symbols come back ready to use.
+ * @returns {Promise<{symbols: Array<object>, fromCache: boolean}>}
+ */
+export async function loadElfSymbols(elfFileBytes, fileName, prepareSymbol = null) {
+    const key = await symbolCache.computeElfKey(elfFileBytes).catch(() => null);
+    const cached = key ? await symbolCache.loadSymbolTable(key) : null;
+    if (cached) {
+        setSymbolTable(cached.symbols, cached.index);
+        symbolCache.setLastSymbolTable(key);
+        console.log(`ELF symbols loaded from cache (${key}). Found ${allParsedSymbols.length} symbols.`);
+        return { symbols: allParsedSymbols, fromCache: true };
+    }
+    await analyzeElf(elfFileBytes);
+    if (prepareSymbol) allParsedSymbols.forEach(prepareSymbol);
+    if (key && allParsedSymbols.length > 0) {
+        // Not awaited: the table is usable now, the write only matters for the next session
+        symbolCache.saveSymbolTable(key, {
+            fileName,
+            byteLength: elfFileBytes.byteLength,
+            symbols: allParsedSymbols,
+            index: symbolIndex,
+        });
+    }
+    return { symbols: allParsedSymbols, fromCache: false };
+}
+
+/**
+ * Restores the symbol table of the ELF loaded last (in this or an earlier session) from the cache.
+ * Does nothing when another table was loaded or cleared while the cache was being read.
+ * @returns {Promise<{symbols: Array<object>, fileName: string}|null>} The restored table, or null.
+ */
+export async function restoreLastElfSymbols() {
+    const generation = symbolTableGeneration;
+    const cached = await symbolCache.loadLastSymbolTable();
+    if (!cached || generation !== symbolTableGeneration) return null;
+    setSymbolTable(cached.symbols, cached.index);
+    console.log(`ELF symbols of "${cached.fileName}" restored from cache. Found ${allParsedSymbols.length} symbols.`);
+    return { symbols: allParsedSymbols, fileName: cached.fileName };
+}
+
+/**
+ * Replaces the symbol table, building its search index unless one is given.
+ * @param {Array<object>} symbols
+ * @param {object|null} index - Index from the cache, or null to build one.
+ */
+function setSymbolTable(symbols, index) {
+    allParsedSymbols = symbols;
+    symbolIndex = symbols.length > 0 ? index || buildSymbolIndex(symbols) : null;
+    symbolTableGeneration++;
+}
+
+/**
+ * Builds the n-gram search index of a symbol table.
+ * @param {Array<object>} symbols
+ * @returns {{names: Array<string>, grams: Map<string, Uint32Array>}} Lower-cased names by symbol index,
+ * and the ascending symbol indices per 1- to INDEX_GRAM_MAX-character substring.
+ */
+function buildSymbolIndex(symbols) {
+    const names = symbols.map((symbol) => (symbol && symbol.name ? symbol.name.toLowerCase() : ''));
+    const postings = new Map();
+    names.forEach((name, i) => {
+        for (let n = 1; n <= INDEX_GRAM_MAX; n++) {
+            for (let at = 0; at + n <= name.length; at++) {
+                const gram = name.substr(at, n);
+                let list = postings.get(gram);
+                if (!list) postings.set(gram, (list = []));
+                if (list[list.length - 1] !== i) list.push(i); // A name lists each gram once
+            }
+        }
+    });
+    const grams = new Map();
+    postings.forEach((list, gram) => grams.set(gram, Uint32Array.from(list)));
+    return { names, grams };
+}
+
+/**
+ * Candidate symbol indices for a lower-cased term: the shortest posting list among its longest grams.
+ * @param {string} term - Non-empty, lower-cased.
+ * @returns {Uint32Array} Ascending indices; every match is among them.
+ */
+function candidatesFor(term) {
+    const n = Math.min(term.length, INDEX_GRAM_MAX);
+    let best = null;
+    for (let at = 0; at + n <= term.length; at++) {
+        const list = symbolIndex.grams.get(term.substr(at, n));
+        if (!list) return new Uint32Array(0);
+        if (!best || list.length < best.length) best = list;
+    }
+    return best;
+}
+
 // --- Functions below remain the same ---
 
 /**
- * Checks if the Wasm module has been initialized and an ELF file loaded.
+ * Checks if the symbols of an ELF file are loaded (analyzed, or restored from the cache).
  * @returns {boolean} True if symbols are available, false otherwise.
  */
 export function isElfLoadedAndAnalyzed() {
-    // Ensure wasm is initialized *and* symbols have been loaded
-    return isWasmInitialized && allParsedSymbols.length > 0;
+    // Symbols come from the Wasm analysis or from the cache, which needs no Wasm
+    return allParsedSymbols.length > 0;
 }
 
 /**
@@ -135,9 +241,11 @@ export function searchSymbols(searchTerm, limit = 50) {
     const lowerSearchTerm = trimmedSearchTerm.toLowerCase();
     const matched = [];
 
-    // First pass: find all matches up to the limit
-    for (const symbol of allParsedSymbols) {
-        if (symbol && symbol.name && symbol.name.toLowerCase().includes(lowerSearchTerm)) {
+    // First pass: confirm the index candidates in table order, up to the limit
+    const names = symbolIndex.names;
+    for (const i of candidatesFor(lowerSearchTerm)) {
+        const symbol = allParsedSymbols[i];
+        if (lowerSearchTerm.length <= INDEX_GRAM_MAX || names[i].includes(lowerSearchTerm)) {
             // Add a copy to avoid modifying the original allParsedSymbols
             matched.push({ ...symbol, needsDisambiguation: false });
             if (matched.length >= limit) {
@@ -181,7 +289,7 @@ export function getAllParsedSymbols() {
  * Clears the stored symbols. Called when data is cleared or protocol changes.
  */
 export function clearParsedSymbols() {
-    allParsedSymbols = [];
+    setSymbolTable([], null);
     console.log("Cleared stored ELF symbols.");
 }
 
@@ -0,0 +1,250 @@
+// js/modules/lod_pyramid.js
+// Multi-resolution min/max history of one plot series.
+//
+// Rows (x, lo, hi) are kept in typed-array rings; hi is only stored for
+// envelope bands, other series have lo === hi. Level k >= 1 holds one bucket
+// { x, min, max } per FANOUT^k consecutive rows. Buckets are kept up to date as
+// rows arrive (amortized O(1) per row) and cover fixed row ranges, so a level
+// is never rebuilt. Rows are numbered from 0 in arrival order; evicting old
+// rows also drops every bucket that covered one of them, so no level shows data
+// the raw history no longer has.
+
+export const LOD_FANOUT = 4;
+const LOD_LEVELS = 12; // Coarsest bucket: 4^12 = 16.7M rows
+const MIN_CAPACITY = 1024;
+
+/** Min/max accumulator of the bucket being filled at one level. */
+function newAccumulator() {
+  return { x: 0, min: Infinity, max: -Infinity, count: 0 };
+}
+
+export class LodSeries {
+  /**
+   * @param {boolean} [band=false] - Rows carry a separate minimum and maximum
+   * (envelope band).
+   */
+  constructor(band = false) {
+    this.band = band;
+    this.startRow = 0; // Oldest row kept
+    this.endRow = 0; // Rows pushed so far
+    this.lastX = -Infinity;
+    this._allocate(MIN_CAPACITY);
+    this.accumulators = [];
+    for (let k = 0; k <= LOD_LEVELS; k++) {
+      this.accumulators.push(newAccumulator());
+    }
+  }
+
+  /** Number of rows kept. */
+  get length() {
+    return this.endRow - this.startRow;
+  }
+
+  _allocate(capacity) {
+    this.capacity = capacity;
+    this.mask = capacity - 1;
+    this.xs = new Float64Array(capacity);
+    this.los = new Float64Array(capacity);
+    this.his = this.band ? new Float64Array(capacity) : this.los;
+    // levels[k]: ring of buckets by bucket number, large enough for every
+    // bucket inside the kept rows
+    this.levels = [null];
+    for (let k = 1; k <= LOD_LEVELS; k++) {
+      const size = Math.max(1, capacity >> (2 * k));
+      this.levels.push({
+        mask: size - 1,
+        x: new Float64Array(size),
+        min: new Float64Array(size),
+        max: new Float64Array(size),
+      });
+    }
+  }
+
+  /** Doubles the capacity, keeping every row and bucket at its number. */
+  _grow() {
+    const old = {
+      mask: this.mask,
+      xs: this.xs,
+      los: this.los,
+      his: this.his,
+      levels: this.levels,
+    };
+    this._allocate(this.capacity * 2);
+    for (let r = this.startRow; r < this.endRow; r++) {
+      const from = r & old.mask;
+      const to = r & this.mask;
+      this.xs[to] = old.xs[from];
+      this.los[to] = old.los[from];
+      if (this.band) this.his[to] = old.his[from];
+    }
+    for (let k = 1; k <= LOD_LEVELS; k++) {
+      const src = old.levels[k];
+      const dst = this.levels[k];
+      const rows = this.bucketRows(k);
+      const end = Math.floor(this.endRow / rows);
+      for (let b = this.firstRow(k) / rows; b < end; b++) {
+        dst.x[b & dst.mask] = src.x[b & src.mask];
+        dst.min[b & dst.mask] = src.min[b & src.mask];
+        dst.max[b & dst.mask] = src.max[b & src.mask];
+      }
+    }
+  }
+
+  /**
+   * Appends one row and folds it into every level.
+   * @param {number} x - Timestamp, not below the previous one.
+   * @param {number} lo - Value (band: window minimum); NaN for no value.
+   * @param {number} [hi=lo] - Band: window maximum.
+   */
+  push(x, lo, hi = lo) {
+    if (this.length === this.capacity) this._grow();
+    const i = this.endRow & this.mask;
+    this.xs[i] = x;
+    this.los[i] = lo;
+    if (this.band) this.his[i] = hi;
+    this.endRow++;
+    this.lastX = x;
+    // Feed the row into level 1, and each bucket completed at level k into
+    // level k + 1
+    let bx = x;
+    let bmin = lo;
+    let bmax = this.band ? hi : lo;
+    for (let k = 1; k <= LOD_LEVELS; k++) {
+      const acc = this.accumulators[k];
+      if (acc.count === 0) acc.x = bx;
+      if (bmin < acc.min) acc.min = bmin; // NaN compares false and is skipped
+      if (bmax > acc.max) acc.max = bmax;
+      if (++acc.count < LOD_FANOUT) break;
+      const level = this.levels[k];
+      const b = (this.endRow / this.bucketRows(k) - 1) & level.mask;
+      level.x[b] = acc.x;
+      level.min[b] = acc.min;
+      level.max[b] = acc.max;
+      bx = acc.x;
+      bmin = acc.min;
+      bmax = acc.max;
+      this.accumulators[k] = newAccumulator();
+    }
+  }
+
+  /**
+   * Evicts the oldest rows beyond a limit, together with the buckets that
+   * covered them.
+   * @param {number} maxRows - Rows to keep.
+   */
+  trim(maxRows) {
+    if (this.length > maxRows) this.startRow = this.endRow - maxRows;
+  }
+
+  /** Drops every row and bucket. */
+  clear() {
+    this.startRow = this.endRow = 0;
+    this.lastX = -Infinity;
+    this.accumulators = this.accumulators.map(newAccumulator);
+  }
+
+  /**
+   * @param {number} level
+   * @returns {number} Rows per bucket at that level.
+   */
+  bucketRows(level) {
+    return LOD_FANOUT ** level;
+  }
+
+  /**
+   * @param {number} level
+   * @returns {number} Points emit() draws per bucket at that level.
+   */
+  pointsPerBucket(level) {
+    return level === 0 && !this.band ? 1 : 2;
+  }
+
+  /**
+   * @param {number} level
+   * @returns {number} First row of the oldest bucket at that level that lies
+   * wholly in the kept rows.
+   */
+  firstRow(level) {
+    const rows = this.bucketRows(level);
+    return Math.ceil(this.startRow / rows) * rows;
+  }
+
+  /**
+   * Finds the first kept row at or after a time.
+   * @param {number} x
+   * @returns {number} Row number in [startRow, endRow].
+   */
+  lowerBound(x) {
+    let lo = this.startRow;
+    let hi = this.endRow;
+    while (lo < hi) {
+      const mid = (lo + hi) >>> 1;
+      if (this.xs[mid & this.mask] < x) lo = mid + 1;
+      else hi = mid;
+    }
+    return lo;
+  }
+
+  /**
+   * Picks the coarsest level that still draws about one bucket per pixel.
+   * @param {number} rows - Rows in view.
+   * @param {number} pixels - Width of the view in pixels.
+   * @returns {number} Level; 0 draws the raw rows.
+   */
+  chooseLevel(rows, pixels) {
+    let level = 0;
+    while (level < LOD_LEVELS && rows / this.bucketRows(level) > 2 * pixels) {
+      level++;
+    }
+    return level;
+  }
+
+  /**
+   * Appends the points of rows [rowFrom, rowTo) at a level to an array. rowFrom
+   * lies on a bucket boundary; when rowTo is endRow the bucket still being
+   * filled is drawn from its rows so far. Each bucket draws its minimum and
+   * maximum at its first time; a bucket without values draws NaN.
+   * @param {number} level
+   * @param {number} rowFrom
+   * @param {number} rowTo
+   * @param {Array<{x: number, y: number}>} out
+   */
+  emit(level, rowFrom, rowTo, out) {
+    if (level === 0) {
+      for (let r = rowFrom; r < rowTo; r++) {
+        const i = r & this.mask;
+        const x = this.xs[i];
+        out.push({ x, y: this.los[i] });
+        if (this.band) out.push({ x, y: this.his[i] });
+      }
+      return;
+    }
+    const rows = this.bucketRows(level);
+    const buckets = this.levels[level];
+    const full = Math.floor(rowTo / rows);
+    for (let b = rowFrom / rows; b < full; b++) {
+      const i = b & buckets.mask;
+      this._emitBucket(buckets.x[i], buckets.min[i], buckets.max[i], out);
+    }
+    if (rowTo === this.endRow && rowTo % rows !== 0) {
+      // The partial bucket is spread over the accumulators of levels 1..level
+      let x = Infinity;
+      let min = Infinity;
+      let max = -Infinity;
+      for (let k = 1; k <= level; k++) {
+        const acc = this.accumulators[k];
+        if (acc.count === 0) continue;
+        if (acc.x < x) x = acc.x;
+        if (acc.min < min) min = acc.min;
+        if (acc.max > max) max = acc.max;
+      }
+      this._emitBucket(x, min, max, out);
+    }
+  }
+
+  _emitBucket(x, min, max, out) {
+    const empty = min === Infinity;
+    out.push({ x, y: empty ? NaN : min });
+    out.push({ x, y: empty ? NaN : max });
+  }
+}
@@ -7,11 +7,14 @@ import {
   seriesColors,
   ZOOM_FACTOR,
 } from "../config.js";
+import { blockFromRows, countRows } from "./data_batch.js";
+import { LodSeries } from "./lod_pyramid.js";
 
 // --- Module State ---
 let chartInstance = null;
 let followToggleElement = null;
 let dataRateDisplayElement = null;
+let linkStatsDisplayElement = null;
 let customInteractionPluginInstance = null;
 let isInitialized = false;
 let moduleElementId = null; // Store the ID of the container element
@@ -21,6 +24,16 @@ let internalConfig = {
   maxBufferPoints: DEFAULT_MAX_BUFFER_POINTS,
 };
 
+// Envelope layout of the Aresplot stream ({ numVars, count }), or null when
+// every channel is one series. Kept across clear(), which recreates the chart.
+let envelopeLayout = null;
+
+// Per series: the full history as a min/max LOD pyramid, and the part of it that
+// series.data currently holds ({ level, rowFrom, rowTo, live }). series.data only
+// ever holds about one bucket per pixel around the visible range.
+let lodSeries = [];
+let lodViews = [];
+
 // Data Rate Calculation State
 let dataPointCounter = 0;
 let lastRateCheckTime = 0;
@@ -36,12 +49,15 @@ class CustomInteractionPlugin {
   startPanDomains = { x: null, y: null };
   updateFollowStateCallback = null;
   shouldEnableFollowCheck = null;
+  getLatestX = null;
 
   constructor(options = {}) {
     this.updateFollowStateCallback =
       options.onFollowStateChange || function () {};
     this.shouldEnableFollowCheck =
       options.shouldEnableFollowCheck || (() => true);
+    // series.data is only a display window, so the newest time comes from the owner
+    this.getLatestX = options.getLatestX || (() => -Infinity);
   }
 
   apply(chartInstance) {
@@ -239,15 +255,8 @@ class CustomInteractionPlugin {
     )
       return;
     const currentXDomain = this.chart.model.xScale.domain();
-    let maxXData = -Infinity;
-    this.chart.options.series.forEach((s) => {
-      if (s.visible !== false && s.data.length > 0) {
-        const seriesMaxX = s.data[s.data.length - 1].x;
-        if (isFinite(seriesMaxX) && seriesMaxX > maxXData)
-          maxXData = seriesMaxX;
-      }
-    });
-    if (maxXData === -Infinity) return;
+    const maxXData = this.getLatestX();
+    if (!isFinite(maxXData)) return;
     const timeThreshold = 500;
     const viewEndX = currentXDomain[1];
     if (viewEndX >= maxXData - timeThreshold) {
@@ -383,6 +392,7 @@ class DraggableLegend {
 
       // Update styles (visibility, color)
       const isVisible = s.visible !== false;
+      elements.name.textContent = s.name ?? elements.name.textContent;
       elements.item.style.opacity = isVisible ? "1" : "0.5";
       elements.name.style.textDecoration = isVisible ? "none" : "line-through";
       elements.example.style.backgroundColor = (
@@ -517,6 +527,224 @@ class DraggableLegend {
 }
 // --- Internal Plot Module Helpers ---
 
+/**
+ * Style of series i: one line per channel, or with an envelope layout the mean lines, then one
+ * translucent min/max band per variable, then the (hidden) window sample count.
+ * @param {number} i - Series index.
+ * @returns {{name: string, lineWidth: number, color: string, visible?: boolean}}
+ */
+function seriesStyle(i) {
+  const env = envelopeLayout;
+  if (env && i >= env.numVars && i < 2 * env.numVars) {
+    const v = i - env.numVars;
+    return {
+      name: `Ch ${v + 1} 最小/最大`,
+      lineWidth: 1,
+      color: seriesColors[v % seriesColors.length] + "66",
+    };
+  }
+  if (env && i === 2 * env.numVars && env.count) {
+    return {
+      name: "窗口样本数",
+      lineWidth: 1,
+      color: "#6b7280",
+      visible: false,
+    };
+  }
+  return {
+    name: env ? `Ch ${i + 1} 均值` : `Ch ${i + 1}`,
+    lineWidth: 1.5,
+    color: seriesColors[i % seriesColors.length],
+  };
+}
+
+/**
+ * Series needed for a row of the given width.
+ * @param {number} width - Values in the row.
+ * @returns {number}
+ */
+function seriesForWidth(width) {
+  const env = envelopeLayout;
+  if (!env) return width;
+  return Math.min(width, 2 * env.numVars + (env.count ? 1 : 0));
+}
+
+/**
+ * Sets how Aresplot envelope windows (Mean[N], Min[N], Max[N] [, Count]) map onto series.
+ * The chart cannot fill areas, so each band is drawn as a translucent zigzag between the
+ * minimum and maximum of every window.
+ * @param {{numVars: number, count: boolean}|null} layout - Envelope layout, or null for one series per channel.
+ */
+export function setEnvelopeLayout(layout) {
+  const next =
+    layout && layout.numVars > 0
+      ? { numVars: layout.numVars, count: !!layout.count }
+      : null;
+  if (
+    (next === null && envelopeLayout === null) ||
+    (next &&
+      envelopeLayout &&
+      next.numVars === envelopeLayout.numVars &&
+      next.count === envelopeLayout.count)
+  ) {
+    return;
+  }
+  envelopeLayout = next;
+  const series = chartInstance?.options?.series;
+  if (!series) return;
+  series.forEach((s, i) => {
+    if (lodSeries[i] && lodSeries[i].band !== isBandSeries(i)) {
+      // A band keeps two values per row; start the history of this series over
+      lodSeries[i] = new LodSeries(isBandSeries(i));
+      lodViews[i] = null;
+      s.data.splice(0, s.data.length);
+    }
+    const style = seriesStyle(i);
+    s.name = style.name;
+    s.lineWidth = style.lineWidth;
+    s.color = style.color;
+    s.visible = style.visible ?? s.visible;
+  });
+  chartInstance.update();
+}
+
+/**
+ * @param {number} i - Series index.
+ * @returns {boolean} Whether series i is an envelope min/max band.
+ */
+function isBandSeries(i) {
+  const env = envelopeLayout;
+  return !!env && i >= env.numVars && i < 2 * env.numVars;
+}
+
+/**
+ * LOD history of series i, created on first use.
+ * @param {number} i - Series index.
+ * @returns {LodSeries}
+ */
+function lodSeriesFor(i) {
+  if (!lodSeries[i]) {
+    lodSeries[i] = new LodSeries(isBandSeries(i));
+    lodViews[i] = null;
+  }
+  return lodSeries[i];
+}
+
+/**
+ * @returns {number} Newest time over the visible series, or -Infinity without data.
+ */
+function latestVisibleX() {
+  const series = chartInstance?.options?.series;
+  let latest = -Infinity;
+  series?.forEach((s, i) => {
+    const store = lodSeries[i];
+    if (s.visible !== false && store?.length > 0 && store.lastX > latest)
+      latest = store.lastX;
+  });
+  return latest;
+}
+
+/**
+ * Appends points to series.data in chunks, keeping the argument count of push() bounded.
+ * @param {Array} data - series.data.
+ * @param {Array<{x: number, y: number}>} points
+ */
+function pushPoints(data, points) {
+  const CHUNK = 8192;
+  for (let k = 0; k < points.length; k += CHUNK) {
+    data.push(...points.slice(k, k + CHUNK));
+  }
+}
+
+/**
+ * Brings series.data of one series in line with the view: the level that draws about one
+ * bucket per pixel, and enough buckets around the visible range to pan without a rebuild.
+ * A view that reaches the newest row is live and follows new rows; its last bucket, still
+ * being filled, is redrawn as rows arrive.
+ * @returns {boolean} Whether series.data changed.
+ */
+function syncLodView(i, data, x0, x1, pixels) {
+  const store = lodSeries[i];
+  const view = lodViews[i];
+  // Rows in view, with one more on each side so the lines run to the edges
+  const v0 = Math.max(store.startRow, store.lowerBound(x0) - 1);
+  const v1 = Math.min(store.endRow, store.lowerBound(x1) + 1);
+  const level = store.chooseLevel(v1 - v0, pixels);
+  const rows = store.bucketRows(level);
+  const perBucket = store.pointsPerBucket(level);
+  const first = store.firstRow(level);
+  const visibleBuckets = Math.ceil((v1 - v0) / rows) + 1;
+
+  if (view && view.level === level) {
+    let changed = false;
+    if (view.rowFrom < first) {
+      // Rows were evicted: drop the buckets that covered them
+      const drop = ((first - view.rowFrom) / rows) * perBucket;
+      if (drop < data.length) {
+        data.splice(0, drop);
+        view.rowFrom = first;
+        changed = true;
+      } else {
+        view.rowFrom = -1; // Nothing left: rebuild below
+      }
+    }
+    if (view.rowFrom >= 0 && view.live && view.rowTo < store.endRow) {
+      if (view.rowTo % rows !== 0) {
+        for (let k = 0; k < perBucket; k++) data.pop();
+        view.rowTo -= view.rowTo % rows;
+      }
+      const points = [];
+      store.emit(level, view.rowTo, store.endRow, points);
+      pushPoints(data, points);
+      view.rowTo = store.endRow;
+      changed = true;
+    }
+    const covers =
+      view.rowFrom >= 0 &&
+      (view.rowFrom <= v0 || view.rowFrom === first) &&
+      view.rowTo >= v1;
+    const compact =
+      (view.rowTo - view.rowFrom) / rows <= 6 * visibleBuckets + 8;
+    if (covers && compact) return changed;
+  }
+
+  // Rebuild around the visible range, one visible width on each side
+  const span = v1 - v0;
+  let to = Math.ceil((v1 + span) / rows) * rows;
+  if (to >= store.endRow) to = store.endRow;
+  let from = Math.max(first, Math.floor((v0 - span) / rows) * rows);
+  from = Math.min(from, to - (to % rows));
+  const points = [];
+  store.emit(level, from, to, points);
+  data.splice(0, data.length);
+  pushPoints(data, points);
+  lodViews[i] = {
+    level,
+    rowFrom: from,
+    rowTo: to,
+    live: to === store.endRow,
+  };
+  return true;
+}
+
+/**
+ * Brings series.data of every series in line with the current x domain and chart width.
+ * @returns {boolean} Whether any series.data changed.
+ */
+function syncLodViews() {
+  const series = chartInstance?.options?.series;
+  if (!series) return false;
+  const [x0, x1] = chartInstance.model.xScale.domain();
+  const [p0, p1] = chartInstance.model.xScale.range();
+  const pixels = Math.max(1, Math.abs(p1 - p0));
+  let changed = false;
+  for (let i = 0; i < series.length; i++) {
+    if (lodSeries[i] && syncLodView(i, series[i].data, x0, x1, pixels))
+      changed = true;
+  }
+  return changed;
+}
+
 function handleInternalFollowChange(event) {
   const isChecked = event.target.checked;
   if (internalConfig.follow !== isChecked) {
@@ -537,6 +765,29 @@ function updateDataRateDisplay() {
   }
 }
 
+/**
+ * Shows Aresplot link statistics next to the data rate, or hides them.
+ * @param {{lostPerSec: number, duplicatesPerSec: number, checksumErrorsPerSec: number}|null} stats - Per-second counts, or null to hide.
+ */
+export function updateLinkStats(stats) {
+  if (!linkStatsDisplayElement) return;
+  if (!stats) {
+    linkStatsDisplayElement.style.display = "none";
+    return;
+  }
+  const lossy =
+    stats.lostPerSec > 0 ||
+    stats.duplicatesPerSec > 0 ||
+    stats.checksumErrorsPerSec > 0;
+  linkStatsDisplayElement.textContent = `丢失: ${stats.lostPerSec.toFixed(
+    1
+  )}/s 重复: ${stats.duplicatesPerSec.toFixed(
+    1
+  )}/s 校验: ${stats.checksumErrorsPerSec.toFixed(1)}/s`;
+  linkStatsDisplayElement.style.color = lossy ? "#dc2626" : "";
+  linkStatsDisplayElement.style.display = "";
+}
+
 function setInternalFollowState(newFollowState) {
   if (internalConfig.follow !== newFollowState) {
     internalConfig.follow = newFollowState;
@@ -556,6 +807,7 @@ export function create(elementId, initialState = {}) {
   const targetDiv = containerElement.querySelector("#lineChart");
   followToggleElement = containerElement.querySelector("#followToggle");
   dataRateDisplayElement = containerElement.querySelector("#dataRateDisplay");
+  linkStatsDisplayElement = containerElement.querySelector("#linkStatsDisplay");
   if (!targetDiv || !followToggleElement || !dataRateDisplayElement) {
     console.error("Plot Module: Could not find internal elements.");
     return false;
@@ -573,12 +825,7 @@ export function create(elementId, initialState = {}) {
 
   let initialSeries = [];
   for (let i = 0; i < internalConfig.numChannels; i++) {
-    initialSeries.push({
-      name: `Ch ${i + 1}`,
-      data: [],
-      lineWidth: 1.5,
-      color: seriesColors[i % seriesColors.length],
-    });
+    initialSeries.push({ ...seriesStyle(i), data: [] });
   }
 
   try {
@@ -587,6 +834,7 @@ export function create(elementId, initialState = {}) {
     customInteractionPluginInstance = new CustomInteractionPlugin({
       onFollowStateChange: setInternalFollowState,
       shouldEnableFollowCheck: () => true,
+      getLatestX: latestVisibleX,
     });
 
     chartInstance = new TimeChart.core(targetDiv, {
@@ -631,6 +879,12 @@ export function create(elementId, initialState = {}) {
       },
     });
 
+    // Re-pick the LOD of every series once the chart has settled its x domain
+    // (follow, pan, zoom, resize); update() again only when series.data changed
+    chartInstance.model.updated.on(() => {
+      if (syncLodViews()) chartInstance.update();
+    });
+
     followToggleElement.checked = internalConfig.follow;
     followToggleElement.addEventListener("change", handleInternalFollowChange);
     updateDataRateDisplay();
@@ -652,8 +906,12 @@ export function create(elementId, initialState = {}) {
   }
 }
 
-export function processDataBatch(batch) {
-  if (!chartInstance || !isInitialized || batch.length === 0) return;
+/**
+ * Appends columnar data blocks (see data_batch.js) to the chart series.
+ * @param {Array<object>} blocks
+ */
+export function processDataBatch(blocks) {
+  if (!chartInstance || !isInitialized || blocks.length === 0) return;
 
   const series = chartInstance.options?.series;
   if (!series) return;
@@ -664,12 +922,10 @@ export function processDataBatch(batch) {
   let needsSeriesUpdate = false;
 
   // First pass: Check max channels needed and add new series if required
-  for (const item of batch) {
-    if (item && Array.isArray(item.values)) {
-      maxChannelsSeenInBatch = Math.max(
-        maxChannelsSeenInBatch,
-        item.values.length
-      );
+  for (const block of blocks) {
+    for (let row = 0; row < block.count; row++) {
+      const needed = seriesForWidth(block.widths[row]);
+      if (needed > maxChannelsSeenInBatch) maxChannelsSeenInBatch = needed;
     }
   }
 
@@ -680,12 +936,7 @@ export function processDataBatch(batch) {
       console.log(
         `Plot Module: Dynamically adding series for Channel ${i + 1}`
       );
-      series.push({
-        name: `Ch ${i + 1}`,
-        data: [],
-        lineWidth: 1.5,
-        color: seriesColors[i % seriesColors.length],
-      });
+      series.push({ ...seriesStyle(i), data: [] });
       needsSeriesUpdate = true; // Flag that series structure changed
     }
     // Update internal config if necessary (though numChannels might represent expected channels)
@@ -697,70 +948,69 @@ export function processDataBatch(batch) {
     // Example: dispatchEvent(new CustomEvent('plot:channelsChanged', { detail: maxChannelsSeenInBatch }));
   }
 
-  // Second pass: Add data points
-  for (const item of batch) {
-    if (
-      !item ||
-      typeof item.timestamp !== "number" ||
-      !Array.isArray(item.values)
-    )
-      continue;
-    const { timestamp, values } = item;
-    if (timestamp > latestTimestamp) latestTimestamp = timestamp;
-
-    // Now iterate up to the potentially increased series length
+  // Second pass: Add rows to the LOD history of each series
+  // Column by column, so each series reads one typed array in order
+  const env = envelopeLayout;
+  for (const block of blocks) {
+    const { count, timestamps, channels, widths } = block;
+    for (let row = 0; row < count; row++) {
+      if (timestamps[row] > latestTimestamp) latestTimestamp = timestamps[row];
+    }
+    // Iterate up to the potentially increased series length
     for (let i = 0; i < series.length; i++) {
-      // Use current series.length
-      if (series[i]?.data) {
-        const seriesData = series[i].data;
-        const yValue =
-          typeof values[i] === "number" && isFinite(values[i])
-            ? values[i]
-            : NaN;
-        if (
-          seriesData.length === 0 ||
-          timestamp >= seriesData[seriesData.length - 1].x
-        ) {
-          seriesData.push({ x: timestamp, y: yValue });
+      if (!series[i]?.data) continue;
+      const store = lodSeriesFor(i);
+      if (store.band) {
+        // Band: the window's minimum and maximum at the same time
+        const minColumn = i < channels.length ? channels[i] : null;
+        const maxCh = i + env.numVars;
+        const maxColumn = maxCh < channels.length ? channels[maxCh] : null;
+        for (let row = 0; row < count; row++) {
+          const timestamp = timestamps[row];
+          if (timestamp < store.lastX) continue;
+          const lo =
+            minColumn !== null && i < widths[row] ? minColumn[row] : NaN;
+          const hi =
+            maxColumn !== null && maxCh < widths[row] ? maxColumn[row] : NaN;
+          store.push(
+            timestamp,
+            isFinite(lo) ? lo : NaN,
+            isFinite(hi) ? hi : NaN
+          );
+          pointsAdded += 2;
+        }
+        continue;
+      }
+      // The count series reads the column after the maxima
+      const ch = env && i === 2 * env.numVars ? 3 * env.numVars : i;
+      const column = ch < channels.length ? channels[ch] : null;
+      for (let row = 0; row < count; row++) {
+        const timestamp = timestamps[row];
+        const value = column !== null && ch < widths[row] ? column[row] : NaN;
+        if (timestamp >= store.lastX) {
+          store.push(timestamp, isFinite(value) ? value : NaN);
           pointsAdded++;
         }
       }
     }
   }
 
-  dataPointCounter += batch.length;
+  dataPointCounter += countRows(blocks);
 
   if (pointsAdded > 0 || needsSeriesUpdate) {
-    // Define a threshold factor (e.g., 1.05 = trim when 5% over buffer size)
-    // Adjust this factor based on performance needs. Larger factor = less frequent trims.
+    // Trim when 1% over the buffer size, so series.data drops its oldest buckets in batches
     const TRIM_THRESHOLD_FACTOR = 1.01;
     const trimThreshold = Math.floor(
       internalConfig.maxBufferPoints * TRIM_THRESHOLD_FACTOR
     );
-    let needsChartUpdate = false; // Track if chart update is needed
-
     for (let i = 0; i < series.length; i++) {
-      const seriesData = series[i]?.data;
-      if (seriesData) {
-        // Check if length exceeds the *threshold*, not just maxBufferPoints
-        if (seriesData.length > trimThreshold) {
-          // Calculate how many points to remove to get back to maxBufferPoints
-          const pointsToRemove =
-            seriesData.length - internalConfig.maxBufferPoints;
-          if (pointsToRemove > 0) {
-            // console.log(`Trimming series ${i}: length ${seriesData.length} > threshold ${trimThreshold}. Removing ${pointsToRemove}`);
-            seriesData.splice(0, pointsToRemove); // Perform the trim
-            needsChartUpdate = true; // Trimming occurred, need update
-          }
-        } else if (pointsAdded > 0 || needsSeriesUpdate) {
-          // If no trimming occurred but data was added/series changed, still need update
-          needsChartUpdate = true;
-        }
-      }
+      const store = lodSeries[i];
+      if (store && store.length > trimThreshold)
+        store.trim(internalConfig.maxBufferPoints);
     }
 
-    // Update chart view only if data was added/changed or trimming occurred
-    if (needsChartUpdate) {
+    // Only the rows in view reach series.data, at about one point per pixel
+    if (syncLodViews() || needsSeriesUpdate) {
       chartInstance.update();
     }
   }
@@ -873,7 +1123,7 @@ export function clear() {
 
 export function truncate() {
   if (!isInitialized) return;
-  processDataBatch([{timestamp: latestTimestamp, values: []}]);
+  processDataBatch([blockFromRows([{ timestamp: latestTimestamp, values: [] }])]);
 }
 export function destroy() {
   if (!isInitialized) return;
@@ -885,9 +1135,12 @@ export function destroy() {
   }
   followToggleElement = null;
   dataRateDisplayElement = null;
+  linkStatsDisplayElement = null;
   chartInstance?.dispose();
   chartInstance = null;
   customInteractionPluginInstance = null;
+  lodSeries = [];
+  lodViews = [];
   internalConfig = {
     follow: true,
     numChannels: DEFAULT_SIM_CHANNELS,
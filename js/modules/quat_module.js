@@ -1,6 +1,8 @@
 // js/modules/quat_module.js
 // Handles dynamic channel updates on select click and initial channel check.
 
+import { rowValues } from "./data_batch.js";
+
 // --- Module State ---
 export let threeRenderer = null;
 export let threeCamera = null;
@@ -341,16 +343,16 @@ export function create(elementId, initialState = {}) {
   }
 }
 
-export function processDataBatch(batch) {
-  if (!isInitialized || batch.length === 0) {
+export function processDataBatch(blocks) {
+  if (!isInitialized || blocks.length === 0) {
       return;
   }
 
   // Detect maximum channels in the current batch
   let maxChannelsInBatch = 0;
-  for (const item of batch) {
-      if (item && Array.isArray(item.values)) {
-          maxChannelsInBatch = Math.max(maxChannelsInBatch, item.values.length);
+  for (const block of blocks) {
+      for (let row = 0; row < block.count; row++) {
+          maxChannelsInBatch = Math.max(maxChannelsInBatch, block.widths[row]);
       }
   }
 
@@ -383,12 +385,12 @@ export function processDataBatch(batch) {
   }
 
   // Process the last data point for visualization
-  const lastItem = batch[batch.length - 1];
-  if (!lastItem || !Array.isArray(lastItem.values)) {
+  const lastBlock = blocks[blocks.length - 1];
+  if (lastBlock.count === 0) {
       return;
   }
 
-  const { values } = lastItem;
+  const values = rowValues(lastBlock, lastBlock.count - 1);
   const { w, x, y, z } = internalConfig.selectedChannels;
 
   // Validate selected indices against the current data frame's length
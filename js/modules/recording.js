@@ -0,0 +1,540 @@
+// js/modules/recording.js
+// Streams incoming data blocks to a file (File System Access API), so a recording is bounded by the
+// disk rather than by the in-memory CSV buffer, and reads such recordings back chunk by chunk.
+//
+// File layout (.aresrec, little-endian, every section starts at a multiple of 8 bytes):
+//   Header   "ARESREC1", u32 jsonLength, u32 0, UTF-8 JSON { version, created, baseTime, channels: [{ name, type }] },
+//            zero padding to 8
+//   Chunk*   u32 "CHNK", u32 rows, u16 channels, u16 0, u32 payloadBytes, f64 tStart, f64 tEnd,
+//            then the payload: f64 timestamps[rows], u16 widths[rows], u8 encodings[channels] (0 = f32, 1 = f64),
+//            zero padding to 8, then one column per channel (f32 or f64 [rows], NaN where a row had no value),
+//            each padded to 8
+//   Index    u32 "INDX", u32 chunkCount, then per chunk: f64 offset, f64 tStart, f64 tEnd, u32 rows, u32 channels
+//   Trailer  f64 indexOffset, "ARESIDX1"
+// A chunk stores a column as f32 when every value in it survives the round trip (all FP32 Aresplot data),
+// otherwise as f64. A file without its index (tab closed while recording) is read by walking the chunks.
+
+import { blockRowsToCsv, csvHeaderLine } from "./data_processing.js";
+
+const FILE_MAGIC = "ARESREC1";
+const TRAILER_MAGIC = "ARESIDX1";
+const CHUNK_MAGIC = 0x4b4e4843; // "CHNK"
+const INDEX_MAGIC = 0x58444e49; // "INDX"
+const FORMAT_VERSION = 1;
+const CHUNK_HEADER_BYTES = 32;
+const INDEX_ENTRY_BYTES = 32;
+const TRAILER_BYTES = 16;
+// A chunk is written once CHUNK_ROWS rows are pending, or the oldest pending row is CHUNK_MAX_AGE_MS old
+const CHUNK_ROWS = 16384;
+const CHUNK_MAX_AGE_MS = 1000;
+// Bytes waiting for the disk beyond which incoming rows are dropped (the recording gets a gap); rows are
+// recorded again once the backlog is below half of it
+const MAX_QUEUED_WRITE_BYTES = 64 * 1048576;
+const ENCODING_F32 = 0;
+const ENCODING_F64 = 1;
+
+const align8 = (n) => (n + 7) & ~7;
+
+// --- Recording State ---
+let writable = null; // FileSystemWritableFileStream while recording
+// One write is in flight at a time; chunks finished meanwhile wait in writeQueue and go out as one write
+let writeQueue = [];
+let queuedWriteBytes = 0; // Bytes in writeQueue and in the write in flight
+let writeInFlight = null; // Promise of the drain loop, null when idle
+let writeError = null;
+let fileOffset = 0; // Bytes handed to the writer so far
+let backlogged = false; // Rows are being dropped because the disk does not keep up
+let droppedRows = 0;
+let pendingBlocks = []; // { block, from }: rows not yet in a chunk
+let pendingRows = 0;
+let pendingSince = 0;
+// { offset, tStart, tEnd, rows, channels } per written chunk
+let chunkIndex = [];
+let recordedRows = 0;
+
+/**
+ * @returns {boolean} Whether this browser can stream recordings to disk.
+ */
+export function isRecordingSupported() {
+  return (
+    typeof window !== "undefined" &&
+    typeof window.showSaveFilePicker === "function"
+  );
+}
+
+/**
+ * @returns {boolean} Whether a recording is in progress.
+ */
+export function isRecording() {
+  return writable !== null;
+}
+
+/**
+ * @returns {{rows: number, bytes: number, chunks: number, failed: boolean, backlogged: boolean,
+ *   droppedRows: number}} Rows recorded and bytes written so far; failed once a write has failed (the error
+ * is thrown by stopRecording()); backlogged while rows are dropped because the disk does not keep up.
+ */
+export function getRecordingStats() {
+  return {
+    rows: recordedRows,
+    bytes: fileOffset,
+    chunks: chunkIndex.length,
+    failed: writeError !== null,
+    backlogged,
+    droppedRows,
+  };
+}
+
+function enqueueWrite(bytes) {
+  fileOffset += bytes.byteLength;
+  queuedWriteBytes += bytes.byteLength;
+  writeQueue.push(bytes);
+  if (!writeInFlight) writeInFlight = drainWrites(writable);
+}
+
+/**
+ * Writes the queued chunks until the queue is empty, merging the chunks that queued up during a write
+ * into one Blob. Nothing more is written after a failed write.
+ * @param {FileSystemWritableFileStream} target
+ */
+async function drainWrites(target) {
+  while (writeQueue.length > 0) {
+    const parts = writeQueue;
+    writeQueue = [];
+    const bytes = parts.reduce((sum, part) => sum + part.byteLength, 0);
+    try {
+      if (!writeError) {
+        await target.write(parts.length === 1 ? parts[0] : new Blob(parts));
+      }
+    } catch (error) {
+      writeError = error;
+    }
+    queuedWriteBytes -= bytes;
+  }
+  writeInFlight = null;
+}
+
+/**
+ * Decides whether incoming rows are recorded, given the bytes still waiting for the disk.
+ * @returns {boolean} False while the backlog is over MAX_QUEUED_WRITE_BYTES (until it halves).
+ */
+function keepsUpWithDisk() {
+  if (!backlogged && queuedWriteBytes >= MAX_QUEUED_WRITE_BYTES) {
+    backlogged = true;
+    console.warn(
+      `Recording: ${(queuedWriteBytes / 1048576).toFixed(0)} MB waiting for the disk, dropping rows until it catches up.`
+    );
+  } else if (backlogged && queuedWriteBytes < MAX_QUEUED_WRITE_BYTES / 2) {
+    backlogged = false;
+    console.info(`Recording: disk caught up, ${droppedRows} rows dropped so far.`);
+  }
+  return !backlogged;
+}
+
+/**
+ * Asks for a file and starts recording into it. Must be called from a user gesture.
+ * @param {{channels: Array<{name: string, type: string|null}>}} info - Channel names and types
+ * (e.g. from the ELF symbols in the Aresplot slots) for the header; rows may carry more channels.
+ * @returns {Promise<boolean>} False when the user cancelled the file picker.
+ */
+export async function startRecording(info) {
+  if (writable) return true;
+  if (!isRecordingSupported()) {
+    throw new Error(
+      "此浏览器不支持 File System Access API, 无法录制到文件。"
+    );
+  }
+  let handle;
+  try {
+    const timestamp = new Date().toISOString().replace(/[:.]/g, "-");
+    handle = await window.showSaveFilePicker({
+      suggestedName: `web_plotter_recording_${timestamp}.aresrec`,
+      types: [
+        {
+          description: "Aresplot 录制",
+          accept: { "application/octet-stream": [".aresrec"] },
+        },
+      ],
+    });
+  } catch (error) {
+    if (error.name === "AbortError") return false;
+    throw error;
+  }
+  writable = await handle.createWritable();
+  writeQueue = [];
+  queuedWriteBytes = 0;
+  writeInFlight = null;
+  writeError = null;
+  fileOffset = 0;
+  backlogged = false;
+  droppedRows = 0;
+  pendingBlocks = [];
+  pendingRows = 0;
+  chunkIndex = [];
+  recordedRows = 0;
+
+  const json = new TextEncoder().encode(
+    JSON.stringify({
+      version: FORMAT_VERSION,
+      created: new Date().toISOString(),
+      // Row timestamps are on the performance.now() clock
+      baseTime: Date.now() - performance.now(),
+      channels: info?.channels || [],
+    })
+  );
+  const header = new Uint8Array(align8(16 + json.byteLength));
+  header.set(new TextEncoder().encode(FILE_MAGIC), 0);
+  new DataView(header.buffer).setUint32(8, json.byteLength, true);
+  header.set(json, 16);
+  enqueueWrite(header);
+  console.log("Recording started.");
+  return true;
+}
+
+/**
+ * Queues data blocks for the recording; full (or old enough) runs of rows are written as chunks.
+ * Blocks are only referenced until their chunk is written, so memory stays bounded by CHUNK_ROWS plus
+ * MAX_QUEUED_WRITE_BYTES: while the disk lags that far behind, incoming blocks are dropped.
+ * @param {Array<object>} blocks - Columnar data blocks (see data_batch.js).
+ */
+export function recordBlocks(blocks) {
+  if (!writable) return;
+  const record = keepsUpWithDisk();
+  for (const block of blocks) {
+    if (!block || block.count === 0) continue;
+    if (!record) {
+      droppedRows += block.count;
+      continue;
+    }
+    if (pendingRows === 0) pendingSince = performance.now();
+    pendingBlocks.push({ block, from: 0 });
+    pendingRows += block.count;
+    while (pendingRows >= CHUNK_ROWS) writeChunk(CHUNK_ROWS);
+  }
+  if (pendingRows > 0 && performance.now() - pendingSince >= CHUNK_MAX_AGE_MS) {
+    writeChunk(pendingRows);
+  }
+}
+
+/**
+ * Writes the first `rows` pending rows as one chunk.
+ * @param {number} rows
+ */
+function writeChunk(rows) {
+  // Gather the row runs of the chunk and its channel count
+  const runs = [];
+  let channels = 0;
+  let left = rows;
+  while (left > 0) {
+    const pending = pendingBlocks[0];
+    const take = Math.min(left, pending.block.count - pending.from);
+    runs.push({ block: pending.block, from: pending.from, count: take });
+    channels = Math.max(channels, pending.block.channels.length);
+    pending.from += take;
+    left -= take;
+    if (pending.from === pending.block.count) pendingBlocks.shift();
+  }
+  pendingRows -= rows;
+  if (pendingRows > 0) pendingSince = performance.now();
+
+  // f32 unless some value of the column does not survive the round trip
+  const encodings = new Uint8Array(channels);
+  for (let ch = 0; ch < channels; ch++) {
+    check: for (const run of runs) {
+      const column = run.block.channels[ch];
+      if (!column) continue;
+      for (let row = run.from; row < run.from + run.count; row++) {
+        const value = column[row];
+        if (value === value && Math.fround(value) !== value) {
+          encodings[ch] = ENCODING_F64;
+          break check;
+        }
+      }
+    }
+  }
+
+  const widthsOffset = 8 * rows;
+  const columnsOffset = align8(widthsOffset + 2 * rows + channels);
+  let payloadBytes = columnsOffset;
+  for (let ch = 0; ch < channels; ch++) {
+    payloadBytes += align8((encodings[ch] === ENCODING_F64 ? 8 : 4) * rows);
+  }
+  const buffer = new ArrayBuffer(CHUNK_HEADER_BYTES + payloadBytes);
+  const payload = CHUNK_HEADER_BYTES;
+  const timestamps = new Float64Array(buffer, payload, rows);
+  const widths = new Uint16Array(buffer, payload + widthsOffset, rows);
+  new Uint8Array(buffer, payload + widthsOffset + 2 * rows, channels).set(
+    encodings
+  );
+  let at = 0;
+  for (const run of runs) {
+    const end = run.from + run.count;
+    timestamps.set(run.block.timestamps.subarray(run.from, end), at);
+    widths.set(run.block.widths.subarray(run.from, end), at);
+    at += run.count;
+  }
+  let columnOffset = payload + columnsOffset;
+  for (let ch = 0; ch < channels; ch++) {
+    const Type = encodings[ch] === ENCODING_F64 ? Float64Array : Float32Array;
+    const column = new Type(buffer, columnOffset, rows);
+    at = 0;
+    for (const run of runs) {
+      const source = run.block.channels[ch];
+      if (source) {
+        column.set(source.subarray(run.from, run.from + run.count), at);
+      } else {
+        column.fill(NaN, at, at + run.count);
+      }
+      at += run.count;
+    }
+    columnOffset += align8(Type.BYTES_PER_ELEMENT * rows);
+  }
+
+  const tStart = timestamps[0];
+  const tEnd = timestamps[rows - 1];
+  const view = new DataView(buffer);
+  view.setUint32(0, CHUNK_MAGIC, true);
+  view.setUint32(4, rows, true);
+  view.setUint16(8, channels, true);
+  view.setUint32(12, payloadBytes, true);
+  view.setFloat64(16, tStart, true);
+  view.setFloat64(24, tEnd, true);
+
+  chunkIndex.push({ offset: fileOffset, tStart, tEnd, rows, channels });
+  recordedRows += rows;
+  enqueueWrite(new Uint8Array(buffer));
+}
+
+/**
+ * Writes the pending rows and the index, and closes the file.
+ * @returns {Promise<object>} What was recorded, as from getRecordingStats().
+ * @throws When a write failed during the recording; the file is closed as far as it got.
+ */
+export async function stopRecording() {
+  if (!writable) return getRecordingStats();
+  if (pendingRows > 0) writeChunk(pendingRows);
+
+  const indexOffset = fileOffset;
+  const trailer = 8 + INDEX_ENTRY_BYTES * chunkIndex.length;
+  const index = new ArrayBuffer(trailer + TRAILER_BYTES);
+  const view = new DataView(index);
+  view.setUint32(0, INDEX_MAGIC, true);
+  view.setUint32(4, chunkIndex.length, true);
+  chunkIndex.forEach((chunk, i) => {
+    const at = 8 + i * INDEX_ENTRY_BYTES;
+    view.setFloat64(at, chunk.offset, true);
+    view.setFloat64(at + 8, chunk.tStart, true);
+    view.setFloat64(at + 16, chunk.tEnd, true);
+    view.setUint32(at + 24, chunk.rows, true);
+    view.setUint32(at + 28, chunk.channels, true);
+  });
+  view.setFloat64(trailer, indexOffset, true);
+  new Uint8Array(index, trailer + 8, 8).set(
+    new TextEncoder().encode(TRAILER_MAGIC)
+  );
+  enqueueWrite(new Uint8Array(index));
+
+  const target = writable;
+  writable = null;
+  pendingBlocks = [];
+  await writeInFlight;
+  await target.close();
+  const stats = getRecordingStats();
+  console.log(
+    `Recording stopped: ${stats.rows} rows in ${stats.chunks} chunks, ${stats.bytes} bytes, ${stats.droppedRows} rows dropped.`
+  );
+  if (writeError) throw writeError;
+  return stats;
+}
+
+// --- Reading ---
+
+async function readBytes(file, start, end) {
+  return file.slice(start, end).arrayBuffer();
+}
+
+async function readView(file, start, end) {
+  return new DataView(await readBytes(file, start, end));
+}
+
+function decodeText(buffer, start, length) {
+  return new TextDecoder().decode(new Uint8Array(buffer, start, length));
+}
+
+/**
+ * Opens a recording for reading. Only the header and the index are read.
+ * @param {Blob} file - The .aresrec file.
+ * @returns {Promise<{header: object, chunks: Array<{offset: number, tStart: number, tEnd: number, rows: number, channels: number}>,
+ *   complete: boolean, findChunk: function(number): number, readChunk: function(number): Promise<object>}>}
+ * complete is false when the index was missing and the chunks were found by walking the file.
+ */
+export async function openRecording(file) {
+  const head = await readView(file, 0, 16);
+  if (head.byteLength < 16 || decodeText(head.buffer, 0, 8) !== FILE_MAGIC) {
+    throw new Error("不是 Aresplot 录制文件。");
+  }
+  const jsonLength = head.getUint32(8, true);
+  const json = await readBytes(file, 16, 16 + jsonLength);
+  const header = JSON.parse(decodeText(json, 0, json.byteLength));
+  const dataStart = align8(16 + jsonLength);
+
+  let chunks = null;
+  if (file.size >= dataStart + 8 + TRAILER_BYTES) {
+    const indexEnd = file.size - TRAILER_BYTES;
+    const trailer = await readView(file, indexEnd, file.size);
+    const indexOffset = trailer.getFloat64(0, true);
+    if (
+      decodeText(trailer.buffer, 8, 8) === TRAILER_MAGIC &&
+      indexOffset >= dataStart
+    ) {
+      const index = await readView(file, indexOffset, indexEnd);
+      if (index.getUint32(0, true) === INDEX_MAGIC) {
+        chunks = [];
+        for (let i = 0; i < index.getUint32(4, true); i++) {
+          const at = 8 + i * INDEX_ENTRY_BYTES;
+          chunks.push({
+            offset: index.getFloat64(at, true),
+            tStart: index.getFloat64(at + 8, true),
+            tEnd: index.getFloat64(at + 16, true),
+            rows: index.getUint32(at + 24, true),
+            channels: index.getUint32(at + 28, true),
+          });
+        }
+      }
+    }
+  }
+  const complete = chunks !== null;
+  if (!complete) {
+    // No index: walk the chunk headers up to the first incomplete chunk
+    chunks = [];
+    for (let offset = dataStart; offset + CHUNK_HEADER_BYTES <= file.size; ) {
+      const chunk = await readView(file, offset, offset + CHUNK_HEADER_BYTES);
+      if (chunk.getUint32(0, true) !== CHUNK_MAGIC) break;
+      const end = offset + CHUNK_HEADER_BYTES + chunk.getUint32(12, true);
+      if (end > file.size) break;
+      chunks.push({
+        offset,
+        tStart: chunk.getFloat64(16, true),
+        tEnd: chunk.getFloat64(24, true),
+        rows: chunk.getUint32(4, true),
+        channels: chunk.getUint16(8, true),
+      });
+      offset = end;
+    }
+  }
+
+  return {
+    header,
+    chunks,
+    complete,
+    /**
+     * @param {number} time - Timestamp (ms, performance.now() clock of the recording).
+     * @returns {number} Index of the first chunk ending at or after the time (chunks.length if none).
+     */
+    findChunk(time) {
+      let lo = 0;
+      let hi = chunks.length;
+      while (lo < hi) {
+        const mid = (lo + hi) >>> 1;
+        if (chunks[mid].tEnd < time) lo = mid + 1;
+        else hi = mid;
+      }
+      return lo;
+    },
+    /**
+     * @param {number} i - Chunk index.
+     * @returns {Promise<object>} The chunk as a data block (see data_batch.js), ready for processDataBatch().
+     */
+    async readChunk(i) {
+      const { offset, rows } = chunks[i];
+      const head = await readView(file, offset, offset + CHUNK_HEADER_BYTES);
+      const end = offset + CHUNK_HEADER_BYTES + head.getUint32(12, true);
+      return decodeChunk(await readBytes(file, offset, end), rows);
+    },
+  };
+}
+
+/**
+ * Decodes one chunk (header included) into a data block with Float64Array columns.
+ * @param {ArrayBuffer} buffer
+ * @param {number} rows
+ * @returns {object}
+ */
+function decodeChunk(buffer, rows) {
+  const channels = new DataView(buffer).getUint16(8, true);
+  const payload = CHUNK_HEADER_BYTES;
+  const widthsOffset = 8 * rows;
+  const encodingsOffset = payload + widthsOffset + 2 * rows;
+  const encodings = new Uint8Array(buffer, encodingsOffset, channels);
+  let columnOffset = payload + align8(widthsOffset + 2 * rows + channels);
+  const columns = [];
+  for (let ch = 0; ch < channels; ch++) {
+    const Type = encodings[ch] === ENCODING_F64 ? Float64Array : Float32Array;
+    columns.push(Float64Array.from(new Type(buffer, columnOffset, rows)));
+    columnOffset += align8(Type.BYTES_PER_ELEMENT * rows);
+  }
+  return {
+    count: rows,
+    timestamps: new Float64Array(buffer, payload, rows),
+    channels: columns,
+    widths: new Uint16Array(buffer, payload + widthsOffset, rows),
+    raw: [],
+  };
+}
+
+/**
+ * Converts a recording to CSV one chunk at a time, asking for the input and output files.
+ * The CSV matches downloadCSV(). Must be called from a user gesture.
+ * @param {function(number, number): void} [onProgress] - Called with (chunks done, chunks total).
+ * @returns {Promise<number|null>} Rows written, or null when a file picker was cancelled.
+ */
+export async function convertRecordingToCsv(onProgress = () => {}) {
+  if (
+    !isRecordingSupported() ||
+    typeof window.showOpenFilePicker !== "function"
+  ) {
+    throw new Error(
+      "此浏览器不支持 File System Access API, 无法转换录制文件。"
+    );
+  }
+  let input;
+  let output;
+  try {
+    [input] = await window.showOpenFilePicker({
+      types: [
+        {
+          description: "Aresplot 录制",
+          accept: { "application/octet-stream": [".aresrec"] },
+        },
+      ],
+    });
+    const file = await input.getFile();
+    const recording = await openRecording(file);
+    output = await window.showSaveFilePicker({
+      suggestedName: file.name.replace(/\.aresrec$/i, "") + ".csv",
+      types: [{ description: "CSV", accept: { "text/csv": [".csv"] } }],
+    });
+    const csv = await output.createWritable();
+    const numChannels = recording.chunks.reduce(
+      (n, chunk) => Math.max(n, chunk.channels),
+      0
+    );
+    const names = recording.header.channels.map((channel) => channel.name);
+    await csv.write(csvHeaderLine(names, numChannels) + "\n");
+    let rows = 0;
+    for (let i = 0; i < recording.chunks.length; i++) {
+      const block = await recording.readChunk(i);
+      await csv.write("\n" + blockRowsToCsv(block, 0, numChannels));
+      rows += block.count;
+      onProgress(i + 1, recording.chunks.length);
+    }
+    await csv.close();
+    console.log(`Recording converted to CSV: ${rows} rows.`);
+    return rows;
+  } catch (error) {
+    if (error.name === "AbortError") return null;
+    throw error;
+  }
+}
+
+console.log("recording.js loaded.");
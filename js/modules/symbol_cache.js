@@ -0,0 +1,211 @@
+// js/modules/symbol_cache.js
+// Persists analyzed ELF symbol tables in IndexedDB, keyed by the ELF's GNU build ID
+// (or the SHA-256 of the file when it has none), so a known ELF skips the Wasm analysis.
+
+const DB_NAME = 'aresplot-symbol-cache';
+const DB_VERSION = 1;
+const TABLE_STORE = 'elfSymbols'; // One record per ELF: { key, fileName, byteLength, savedAt, version, symbols, index }
+const META_STORE = 'meta'; // { name: 'lastKey', value } - the ELF to restore on the next session
+// Bump when the analyzer output or the cached record layout changes; older records are ignored
+const CACHE_FORMAT_VERSION = 1;
+const MAX_CACHED_ELFS = 4; // Oldest tables are dropped beyond this
+
+const SHT_NOTE = 7;
+const NT_GNU_BUILD_ID = 3;
+
+let dbPromise = null;
+
+/**
+ * Opens (and on first use creates) the cache database.
+ * @returns {Promise<IDBDatabase|null>} The database, or null when IndexedDB is unavailable.
+ */
+function openDb() {
+    if (dbPromise) return dbPromise;
+    dbPromise = new Promise((resolve) => {
+        if (typeof indexedDB === 'undefined') {
+            resolve(null);
+            return;
+        }
+        const request = indexedDB.open(DB_NAME, DB_VERSION);
+        request.onupgradeneeded = () => {
+            const db = request.result;
+            if (!db.objectStoreNames.contains(TABLE_STORE)) {
+                db.createObjectStore(TABLE_STORE, { keyPath: 'key' }).createIndex('savedAt', 'savedAt');
+            }
+            if (!db.objectStoreNames.contains(META_STORE)) db.createObjectStore(META_STORE, { keyPath: 'name' });
+        };
+        request.onsuccess = () => resolve(request.result);
+        request.onerror = () => {
+            console.warn('Symbol cache: IndexedDB unavailable:', request.error);
+            resolve(null);
+        };
+    });
+    return dbPromise;
+}
+
+/**
+ * Wraps an IDBRequest in a promise.
+ * @param {IDBRequest} request
+ * @returns {Promise<any>}
+ */
+function promisify(request) {
+    return new Promise((resolve, reject) => {
+        request.onsuccess = () => resolve(request.result);
+        request.onerror = () => reject(request.error);
+    });
+}
+
+/**
+ * Resolves when a transaction has committed.
+ * @param {IDBTransaction} tx
+ * @returns {Promise<void>}
+ */
+function committed(tx) {
+    return new Promise((resolve, reject) => {
+        tx.oncomplete = () => resolve();
+        tx.onabort = tx.onerror = () => reject(tx.error);
+    });
+}
+
+function toHex(bytes) {
+    let hex = '';
+    for (const b of bytes) hex += b.toString(16).padStart(2, '0');
+    return hex;
+}
+
+/**
+ * Reads the GNU build ID from the SHT_NOTE sections of an ELF32/ELF64 file (either byte order).
+ * @param {Uint8Array} bytes - The ELF file.
+ * @returns {string|null} The build ID in hex, or null when the file has none or is not an ELF.
+ */
+export function readGnuBuildId(bytes) {
+    if (bytes.byteLength < 52 || bytes[0] !== 0x7f || bytes[1] !== 0x45 || bytes[2] !== 0x4c || bytes[3] !== 0x46) {
+        return null;
+    }
+    const is64 = bytes[4] === 2;
+    const le = bytes[5] === 1;
+    const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    const word = (offset) => (is64 ? Number(view.getBigUint64(offset, le)) : view.getUint32(offset, le));
+    try {
+        const shoff = word(is64 ? 0x28 : 0x20);
+        const shentsize = view.getUint16(is64 ? 0x3a : 0x2e, le);
+        const shnum = view.getUint16(is64 ? 0x3c : 0x30, le);
+        for (let s = 0; s < shnum; s++) {
+            const sh = shoff + s * shentsize;
+            if (view.getUint32(sh + 4, le) !== SHT_NOTE) continue;
+            const start = word(sh + (is64 ? 0x18 : 0x10));
+            const end = start + word(sh + (is64 ? 0x20 : 0x14));
+            // Notes: namesz, descsz, type, then name and desc each padded to 4 bytes
+            for (let n = start; n + 12 <= end;) {
+                const namesz = view.getUint32(n, le);
+                const descsz = view.getUint32(n + 4, le);
+                const type = view.getUint32(n + 8, le);
+                const name = n + 12;
+                const desc = name + ((namesz + 3) & ~3);
+                if (
+                    type === NT_GNU_BUILD_ID && namesz === 4 && descsz > 0 && desc + descsz <= end &&
+                    bytes[name] === 0x47 && bytes[name + 1] === 0x4e && bytes[name + 2] === 0x55 // "GNU"
+                ) {
+                    return toHex(bytes.subarray(desc, desc + descsz));
+                }
+                n = desc + ((descsz + 3) & ~3);
+            }
+        }
+    } catch (error) {
+        // Truncated or malformed headers: fall back to hashing the file
+    }
+    return null;
+}
+
+/**
+ * Computes the cache key of an ELF file: its GNU build ID, or else the SHA-256 of its content.
+ * @param {Uint8Array} bytes - The ELF file.
+ * @returns {Promise<string|null>} The key, or null when neither is available (no WebCrypto).
+ */
+export async function computeElfKey(bytes) {
+    const buildId = readGnuBuildId(bytes);
+    if (buildId) return `build-id:${buildId}`;
+    if (typeof crypto === 'undefined' || !crypto.subtle) return null;
+    const digest = await crypto.subtle.digest('SHA-256', bytes);
+    return `sha256:${toHex(new Uint8Array(digest))}`;
+}
+
+/**
+ * Loads a cached symbol table.
+ * @param {string} key - Key from computeElfKey().
+ * @returns {Promise<{key: string, fileName: string, symbols: Array<object>, index: object}|null>} The record, or null on a miss.
+ */
+export async function loadSymbolTable(key) {
+    const db = await openDb();
+    if (!db) return null;
+    try {
+        const record = await promisify(db.transaction(TABLE_STORE).objectStore(TABLE_STORE).get(key));
+        return record && record.version === CACHE_FORMAT_VERSION ? record : null;
+    } catch (error) {
+        console.warn('Symbol cache: read failed:', error);
+        return null;
+    }
+}
+
+/**
+ * Loads the symbol table of the ELF used last.
+ * @returns {Promise<object|null>} The record as from loadSymbolTable(), or null.
+ */
+export async function loadLastSymbolTable() {
+    const db = await openDb();
+    if (!db) return null;
+    try {
+        const last = await promisify(db.transaction(META_STORE).objectStore(META_STORE).get('lastKey'));
+        return last ? loadSymbolTable(last.value) : null;
+    } catch (error) {
+        console.warn('Symbol cache: read failed:', error);
+        return null;
+    }
+}
+
+/**
+ * Stores a symbol table and its search index and makes it the one restored next session.
+ * Failures (quota, private mode) are logged and otherwise ignored.
+ * @param {string} key - Key from computeElfKey().
+ * @param {{fileName: string, byteLength: number, symbols: Array<object>, index: object}} table
+ * @returns {Promise<void>}
+ */
+export async function saveSymbolTable(key, table) {
+    const db = await openDb();
+    if (!db) return;
+    try {
+        const tx = db.transaction([TABLE_STORE, META_STORE], 'readwrite');
+        const tables = tx.objectStore(TABLE_STORE);
+        tables.put({ ...table, key, savedAt: Date.now(), version: CACHE_FORMAT_VERSION });
+        tx.objectStore(META_STORE).put({ name: 'lastKey', value: key });
+        // Keep the newest MAX_CACHED_ELFS tables, walking the savedAt index newest first without loading records
+        const cursorRequest = tables.index('savedAt').openKeyCursor(null, 'prev');
+        let kept = 0;
+        cursorRequest.onsuccess = () => {
+            const cursor = cursorRequest.result;
+            if (!cursor) return;
+            if (++kept > MAX_CACHED_ELFS) tables.delete(cursor.primaryKey);
+            cursor.continue();
+        };
+        await committed(tx);
+    } catch (error) {
+        console.warn('Symbol cache: write failed:', error);
+    }
+}
+
+/**
+ * Marks a cached table as the one restored next session.
+ * @param {string} key
+ * @returns {Promise<void>}
+ */
+export async function setLastSymbolTable(key) {
+    const db = await openDb();
+    if (!db) return;
+    try {
+        const tx = db.transaction(META_STORE, 'readwrite');
+        tx.objectStore(META_STORE).put({ name: 'lastKey', value: key });
+        await committed(tx);
+    } catch (error) {
+        console.warn('Symbol cache: write failed:', error);
+    }
+}
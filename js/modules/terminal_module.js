@@ -3,6 +3,7 @@
 
 // Target update interval for the raw output terminal in milliseconds (e.g., 100ms = ~10 FPS)
 import { TERMINAL_UPDATE_INTERVAL_MS } from "../config.js";
+import { rowValues } from "./data_batch.js";
 
 // Module state
 let terminalInstance = null;
@@ -237,82 +238,78 @@ export function create(elementId, initialState = {}) {
   }
 }
 
-export function processDataBatch(batch) {
-  if (!isInitialized || batch.length === 0) return;
+/**
+ * Shows the latest values and appends one terminal line per row of the columnar blocks (see data_batch.js).
+ * @param {Array<object>} blocks
+ */
+export function processDataBatch(blocks) {
+  if (!isInitialized || blocks.length === 0) return;
   const now = performance.now();
 
   // --- Update parsed data display (always) ---
-  let latestValuesForDisplay = null;
-  for (let i = batch.length - 1; i >= 0; i--) {
-    if (batch[i] && Array.isArray(batch[i].values)) {
-      latestValuesForDisplay = batch[i].values;
-      break;
-    }
-  }
-  if (latestValuesForDisplay !== null) {
-    updateParsedDataDisplayInternal(latestValuesForDisplay);
+  const lastBlock = blocks[blocks.length - 1];
+  if (lastBlock.count > 0) {
+    updateParsedDataDisplayInternal(rowValues(lastBlock, lastBlock.count - 1));
   }
 
   // --- Format and buffer raw output (always) ---
-  for (const item of batch) {
-    if (!item || typeof item.timestamp !== "number") continue;
-    const { timestamp, values, rawLineBytes } = item;
-    const displayTimeStr = (timestamp / 1000.0).toFixed(3);
-    let displayLine = "";
-
-    if (rawLineBytes instanceof Uint8Array && rawLineBytes.byteLength > 0) {
-      // --- Display based on mode ---
-      if (internalConfig.rawDisplayMode === "hex") {
-        // Show HEX button now that we have raw bytes (if not already visible)
-        if (rawHexBtnElement?.classList.contains("hidden")) {
-            rawHexBtnElement.classList.remove("hidden");
-        }
-        displayLine = Array.prototype.map
-          .call(rawLineBytes, (b) =>
-            b.toString(16).toUpperCase().padStart(2, "0")
-          )
-          .join(" ");
-      } else {
-        // STR mode (uses currentEncoding via textDecoder)
-        try {
-          // Ensure textDecoder is initialized and using the current encoding
-          if (!textDecoder) {
-              try {
-                  textDecoder = new TextDecoder(currentEncoding, { fatal: false });
-              } catch (err) {
-                  console.error(`Failed to initialize TextDecoder with ${currentEncoding}, falling back to utf-8`, err);
-                  currentEncoding = 'utf-8';
-                  terminalEncodingSelectElement.value = currentEncoding; // Update dropdown if fallback occurs
-                  textDecoder = new TextDecoder(currentEncoding, { fatal: false });
-              }
+  for (const block of blocks) {
+    let rawIndex = 0;
+    for (let row = 0; row < block.count; row++) {
+      const timestamp = block.timestamps[row];
+      let rawLineBytes = null;
+      if (rawIndex < block.raw.length && block.raw[rawIndex].row === row) {
+        rawLineBytes = block.raw[rawIndex++].bytes;
+      }
+      const displayTimeStr = (timestamp / 1000.0).toFixed(3);
+      let displayLine = "";
+
+      if (rawLineBytes instanceof Uint8Array && rawLineBytes.byteLength > 0) {
+        // --- Display based on mode ---
+        if (internalConfig.rawDisplayMode === "hex") {
+          // Show HEX button now that we have raw bytes (if not already visible)
+          if (rawHexBtnElement?.classList.contains("hidden")) {
+              rawHexBtnElement.classList.remove("hidden");
+          }
+          displayLine = Array.prototype.map
+            .call(rawLineBytes, (b) =>
+              b.toString(16).toUpperCase().padStart(2, "0")
+            )
+            .join(" ");
+        } else {
+          // STR mode (uses currentEncoding via textDecoder)
+          try {
+            // Ensure textDecoder is initialized and using the current encoding
+            if (!textDecoder) {
+                try {
+                    textDecoder = new TextDecoder(currentEncoding, { fatal: false });
+                } catch (err) {
+                    console.error(`Failed to initialize TextDecoder with ${currentEncoding}, falling back to utf-8`, err);
+                    currentEncoding = 'utf-8';
+                    terminalEncodingSelectElement.value = currentEncoding; // Update dropdown if fallback occurs
+                    textDecoder = new TextDecoder(currentEncoding, { fatal: false });
+                }
+            }
+            let decodedString = textDecoder
+              .decode(rawLineBytes, { stream: false }) // Use stream: false for complete lines
+              .replace(/[\x00-\x08\x0B\x0C\x0E-\x1F\x7F]/g, "."); // Replace non-printable chars
+            displayLine = decodedString.trimEnd(); // Remove trailing whitespace/newlines from source data
+          } catch (e) {
+            console.warn(`Decoding error with ${currentEncoding}:`, e);
+            displayLine = "[Decode Error]";
+            // No automatic fallback here, user must select a working encoding
           }
-          let decodedString = textDecoder
-            .decode(rawLineBytes, { stream: false }) // Use stream: false for complete lines
-            .replace(/[\x00-\x08\x0B\x0C\x0E-\x1F\x7F]/g, "."); // Replace non-printable chars
-          displayLine = decodedString.trimEnd(); // Remove trailing whitespace/newlines from source data
-        } catch (e) {
-          console.warn(`Decoding error with ${currentEncoding}:`, e);
-          displayLine = "[Decode Error]";
-          // No automatic fallback here, user must select a working encoding
         }
+      } else if (block.widths[row] > 0) {
+        displayLine = rowValues(block, row)
+          .map((v) => (isNaN(v) ? "NaN" : v.toFixed(3)))
+          .join(", ");
+      } else {
+        displayLine = "[No Data]";
       }
-    } else if (Array.isArray(values) && values.length > 0) {
-      displayLine = values
-        .map((v) =>
-          v === null || v === undefined
-            ? "N/A"
-            : isNaN(v)
-            ? "NaN"
-            : typeof v === "number"
-            ? v.toFixed(3)
-            : String(v)
-        )
-        .join(", ");
-    } else {
-      displayLine = "[No Data]";
+      // Append formatted line with timestamp and module-added newline to buffer
+      rawOutputBuffer += `${displayTimeStr}: ${displayLine}\r\n`;
     }
-    // Append formatted line with timestamp and module-added newline to buffer
-    rawOutputBuffer += `${displayTimeStr}: ${displayLine}\r\n`;
   }
 
   // --- Write buffer to terminal based on time interval ---
@@ -68,6 +68,9 @@ function queryElements() {
     bufferStatus: get("bufferStatus"),
     downloadCsvButton: get("downloadCsvButton"),
     clearDataButton: get("clearDataButton"),
+    recordButton: get("recordButton"),
+    convertRecordingButton: get("convertRecordingButton"),
+    recordingStatus: get("recordingStatus"),
     displayAreaContainer: get("displayAreaContainer"),
     displayArea: get("displayArea"),
     bottomRow: get("bottomRow"),
@@ -80,6 +83,19 @@ function queryElements() {
     elfFileInput: get("elfFileInput"),
     elfName: get("elfName"),
     elfStatusMessage: get("elfStatusMessage"),
+    aresplotSampleRateInput: get("aresplotSampleRateInput"),
+    aresplotSetSampleRateButton: get("aresplotSetSampleRateButton"),
+    aresplotEnvelopeInput: get("aresplotEnvelopeInput"),
+    aresplotSetEnvelopeButton: get("aresplotSetEnvelopeButton"),
+    aresplotCaptureSlotInput: get("aresplotCaptureSlotInput"),
+    aresplotCaptureModeSelect: get("aresplotCaptureModeSelect"),
+    aresplotCaptureThresholdInput: get("aresplotCaptureThresholdInput"),
+    aresplotCapturePreInput: get("aresplotCapturePreInput"),
+    aresplotCapturePostInput: get("aresplotCapturePostInput"),
+    aresplotCaptureArmButton: get("aresplotCaptureArmButton"),
+    aresplotCaptureCancelButton: get("aresplotCaptureCancelButton"),
+    aresplotGetStatsButton: get("aresplotGetStatsButton"),
+    aresplotGetStatsResetButton: get("aresplotGetStatsResetButton"),
     symbolSearchArea: get("symbolSearchArea"),
     symbolSearchInput: get("symbolSearchInput"),
     symbolDatalist: get("symbolDatalist"),
@@ -177,12 +193,56 @@ function setupControlPanelListeners() {
     }
     eventBus.emit("ui:bufferDurationChanged", { duration: v });
   });
+  addListener(domElements.aresplotSetSampleRateButton, "click", () => {
+    const raw = domElements.aresplotSampleRateInput?.value.trim() || "";
+    const rateHz = raw === "" ? 0 : Math.round(Number(raw));
+    if (!Number.isFinite(rateHz) || rateHz < 0) return;
+    eventBus.emit("ui:aresplotSampleRateSet", { rateHz }); // 0 = MCU default
+  });
+  addListener(domElements.aresplotSetEnvelopeButton, "click", () => {
+    const raw = domElements.aresplotEnvelopeInput?.value.trim() || "";
+    const windowSize = raw === "" ? 0 : Math.round(Number(raw));
+    if (!Number.isFinite(windowSize) || windowSize < 0 || windowSize > 65535)
+      return;
+    eventBus.emit("ui:aresplotEnvelopeSet", { window: windowSize }); // 0 or 1 = every sample
+  });
+  addListener(domElements.aresplotCaptureArmButton, "click", () => {
+    const slot = parseInt(domElements.aresplotCaptureSlotInput?.value, 10);
+    const mode = parseInt(domElements.aresplotCaptureModeSelect?.value, 10);
+    const threshold = parseFloat(domElements.aresplotCaptureThresholdInput?.value);
+    const preSamples = parseInt(domElements.aresplotCapturePreInput?.value, 10);
+    const postSamples = parseInt(domElements.aresplotCapturePostInput?.value, 10);
+    if (![slot, mode, threshold, preSamples, postSamples].every(Number.isFinite)) return;
+    if (slot < 1 || preSamples < 0 || postSamples < 0) return;
+    eventBus.emit("ui:aresplotCaptureArm", {
+      varIndex: slot - 1, // Slots are shown 1-based
+      mode,
+      threshold,
+      preSamples,
+      postSamples,
+    });
+  });
+  addListener(domElements.aresplotCaptureCancelButton, "click", () =>
+    eventBus.emit("ui:aresplotCaptureCancel")
+  );
+  addListener(domElements.aresplotGetStatsButton, "click", () =>
+    eventBus.emit("ui:aresplotGetStats", { reset: false })
+  );
+  addListener(domElements.aresplotGetStatsResetButton, "click", () =>
+    eventBus.emit("ui:aresplotGetStats", { reset: true })
+  );
   addListener(domElements.downloadCsvButton, "click", () =>
     eventBus.emit("ui:downloadCsvClicked")
   );
   addListener(domElements.clearDataButton, "click", () =>
     eventBus.emit("ui:clearDataClicked")
   );
+  addListener(domElements.recordButton, "click", () =>
+    eventBus.emit("ui:recordToggleClicked")
+  );
+  addListener(domElements.convertRecordingButton, "click", () =>
+    eventBus.emit("ui:convertRecordingClicked")
+  );
 }
 
 // Reads all relevant config values from UI elements
@@ -406,8 +466,9 @@ function setupAresplotListeners() {
 }
 
 // --- Symbol Slot Management ---
-const MAX_SLOTS = 10;
+const MAX_SLOTS = 64; // Matches large MCU configs; smaller ones reject the excess with ERROR_MCU_BUSY_OR_LIMIT
 let selectedSymbolsInSlots = []; // Array to hold the symbol objects in the slots
+const SLOT_DIVIDER_CHOICES = [1, 2, 5, 10, 20, 50, 100]; // Offered per-variable dividers
 let sortableInstance = null;
 
 /**
@@ -492,6 +553,19 @@ export function renderSymbolSlots() {
 
     const controlsDiv = document.createElement("div");
     controlsDiv.className = "flex items-center";
+    // Per-variable divider: the variable is sent in one of every N samples (Aresplot only)
+    const dividerSelect = document.createElement("select");
+    dividerSelect.title = "Sample divider (send this variable every N samples)";
+    dividerSelect.className = "slot-divider-select text-xs border rounded mr-1";
+    dividerSelect.dataset.slotIndex = index;
+    for (const divider of SLOT_DIVIDER_CHOICES) {
+      const option = document.createElement("option");
+      option.value = divider;
+      option.textContent = `÷${divider}`;
+      dividerSelect.appendChild(option);
+    }
+    dividerSelect.value = symbol._divider || 1;
+    controlsDiv.appendChild(dividerSelect);
     const deleteButton = document.createElement("button");
     deleteButton.title = "Delete Symbol";
     deleteButton.className =
@@ -601,6 +675,15 @@ export function initSymbolSlots() {
       }
     }
   });
+  domElements.symbolSlotsContainer.addEventListener("change", (event) => {
+    const select = event.target.closest("select.slot-divider-select");
+    if (!select) return;
+    const symbol = selectedSymbolsInSlots[parseInt(select.dataset.slotIndex, 10)];
+    if (symbol) {
+      symbol._divider = parseInt(select.value, 10) || 1;
+      emitSlotsUpdatedEvent();
+    }
+  });
 }
 
 /**
@@ -623,7 +706,7 @@ export function addSymbolToSlot(symbolWithDisplayType) {
   }
   if (selectedSymbolsInSlots.length >= MAX_SLOTS) {
     eventBus.emit("main:statusUpdate", {
-      message: "Error: Slots are full (Max 10 symbols).",
+      message: `Error: Slots are full (Max ${MAX_SLOTS} symbols).`,
       isError: true,
     });
     return false;
@@ -824,6 +907,43 @@ function updateBufferUI(stats = {}) {
   domElements.bufferStatus.innerHTML = statusText;
 }
 
+/**
+ * Shows the state of the recording to file.
+ * @param {{active: boolean, rows?: number, bytes?: number, failed?: boolean, backlogged?: boolean,
+ *   droppedRows?: number, message?: string}} state -
+ * A message replaces the row/byte counts (e.g. the result of a finished recording or conversion).
+ */
+function updateRecordingUI(state) {
+  const {
+    active,
+    rows = 0,
+    bytes = 0,
+    failed = false,
+    backlogged = false,
+    droppedRows = 0,
+    message = null,
+  } = state;
+  if (domElements.recordButton) {
+    domElements.recordButton.textContent = active ? "停止录制" : "录制到文件";
+    domElements.recordButton.classList.toggle("bg-red-500", active);
+  }
+  const status = domElements.recordingStatus;
+  if (!status) return;
+  if (!active && !message) {
+    status.style.display = "none";
+    return;
+  }
+  status.textContent =
+    message ||
+    `录制中: ${rows.toLocaleString()} 行, ${(bytes / 1048576).toFixed(1)} MB${
+      failed ? " (写入失败)" : ""
+    }${backlogged ? " (磁盘写入跟不上, 正在丢弃数据)" : ""}${
+      droppedRows > 0 ? `, 已丢弃 ${droppedRows.toLocaleString()} 行` : ""
+    }`;
+  status.style.color = failed ? "#dc2626" : droppedRows > 0 ? "#d97706" : "";
+  status.style.display = "";
+}
+
 /**
  * Updates the text content of a DOM element.
  * @param {string} elementId - The ID of the element.
@@ -1280,6 +1400,7 @@ export {
   updateStatus,
   updateButtonStates,
   updateBufferUI,
+  updateRecordingUI,
   showWorkerStatus,
   showParserStatus,
   updateControlVisibility,
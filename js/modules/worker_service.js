@@ -158,5 +158,19 @@ function updateSimConfig(config) {
   worker.postMessage({ type: 'updateSimConfig', payload: config });
 }
 
+/**
+ * 通知 Worker 即将发送的 CMD_START_MONITOR 所请求的数据布局, 收到对应 ACK 后按该布局解码。
+ * Tells the worker the value layout of a CMD_START_MONITOR frame about to be sent; it is used once the matching ACK arrives.
+ * @param {{rawEncoding: boolean, types: number[]}} layout - 编码方式及每个变量的 AresOriginalType
+ * @param {number} [tag] - 该帧的命令标签, 不带标签时省略 Tag the frame is sent with; omitted when untagged
+ */
+function queueAresplotMonitorLayout(layout, tag) {
+  if (!worker) {
+    console.error("WorkerService: Cannot queue Aresplot layout, worker not initialized.");
+    return;
+  }
+  worker.postMessage({ type: "queueAresplotMonitorLayout", payload: { layout, tag } });
+}
+
 // 导出公共接口
-export { init, startWorker, stopWorker, updateParser, terminate, updateSimConfig};
+export { init, startWorker, stopWorker, updateParser, terminate, updateSimConfig, queueAresplotMonitorLayout };
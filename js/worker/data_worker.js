@@ -10,10 +10,13 @@ const MAX_RAW_BUFFER_LENGTH_FOR_DISPLAY_BREAK = 80; // For non-Aresplot text lin
 console.warn("Worker Top-Level: data_worker.js script started execution.");
 import {
     AresplotFrameParser, // The class itself
+    AresplotClockEstimator,
     CMD_ID as ARESPLOT_CMD_ID,
     AckStatus as ARESPLOT_ACK_STATUS
     // SOP, EOP are used internally by AresplotFrameParser, not directly needed here
 } from '../modules/aresplot_protocol.js'; // Adjust path if necessary
+import { DataBatchBuilder } from '../modules/data_batch.js';
+import { ByteRing } from '../modules/byte_ring.js';
 
 
 // --- Simulation State (Copied from your original plotter.html worker script) ---
@@ -22,30 +25,40 @@ let currentDataSource = 'simulated'; // Default source
 let simConfig = { numChannels: 4, frequency: 1000, amplitude: 1 };
 let simCurrentRunStartTime = 0;
 let simLastBatchSendTime = 0;
+const simBatchBuilder = new DataBatchBuilder();
 
 function generateAndSendSimBatch() {
     const now = performance.now();
     const timeSinceLastBatch = Math.max(1, now - simLastBatchSendTime);
     const pointsInBatch = Math.max(1, Math.round((simConfig.frequency * timeSinceLastBatch) / 1000));
-    const batch = [];
+    const values = new Array(simConfig.numChannels);
     for (let p = 0; p < pointsInBatch; p++) {
         const pointTimestamp = simLastBatchSendTime + (timeSinceLastBatch * (p + 1)) / pointsInBatch;
         const pointElapsedMs = pointTimestamp - simCurrentRunStartTime; // Relative to this worker's sim start
-        const values = [];
         for (let i = 0; i < simConfig.numChannels; i++) {
             const phase = (i * Math.PI) / 4;
             const freqMultiplier = 1 + i * 0.5;
             const timeSec = pointElapsedMs / 1000.0;
             let value = simConfig.amplitude * Math.sin(2 * Math.PI * freqMultiplier * timeSec + phase) + (Math.random() - 0.5) * 0.1 * simConfig.amplitude;
-            values.push(typeof value === 'number' && isFinite(value) ? value : 0);
+            values[i] = typeof value === 'number' && isFinite(value) ? value : 0;
         }
-        batch.push({ timestamp: pointTimestamp, values: values }); // No rawLineBytes for sim
-    }
-    if (batch.length > 0) {
-        self.postMessage({ type: 'dataBatch', payload: batch });
+        simBatchBuilder.push(pointTimestamp, values); // No raw bytes for sim
     }
+    postDataBatch(simBatchBuilder);
     simLastBatchSendTime = now;
 }
+/**
+ * Posts the rows collected in a builder as one columnar block, transferring its column buffers.
+ * @param {DataBatchBuilder} builder
+ */
+function postDataBatch(builder) {
+    if (builder.length === 0) return;
+    const { block, transfer } = builder.take();
+    try {
+        self.postMessage({ type: 'dataBatch', payload: block }, transfer);
+    } catch (postError) { console.error("Worker: Error posting dataBatch:", postError); }
+}
+
 function startSimulation() {
     stopSimulation();
     simCurrentRunStartTime = performance.now();
@@ -66,7 +79,7 @@ function stopSimulation() {
 
 // --- Serial Data Handling State (Worker) ---
 let keepReadingSerial = false;
-let internalWorkerBuffer = new Uint8Array(0); // Buffer for non-Aresplot text/custom parsers
+const textParserRing = new ByteRing(); // Buffer for non-Aresplot text/custom parsers
 let currentReader = null;
 
 let currentParserType = "default"; // Active parser type: 'default', 'justfloat', 'firewater', 'aresplot', 'custom'
@@ -75,21 +88,24 @@ let selectedBuiltInParser = parseDefault; // Holds the function for 'default', '
 
 // --- Aresplot Specific State ---
 let aresplotParserInstanceForWorker = null; // Use distinct name
-let initialTimestampBias = null;
-let lastBiasCheckPcTime = 0;
-const TIMESTAMP_DRIFT_THRESHOLD_MS = 500;
-const TIMESTAMP_DRIFT_CHECK_INTERVAL_MS = 5000;
-
-
-// --- Utility Functions ---
-function concatUint8Arrays(a, b) {
-    if (!a || a.byteLength === 0) return b;
-    if (!b || b.byteLength === 0) return a;
-    const result = new Uint8Array(a.byteLength + b.byteLength);
-    result.set(a, 0);
-    result.set(b, a.byteLength);
-    return result;
-}
+let aresplotLayoutsAwaitingParser = []; // { layout, tag } queued before the parser instance for the stream existed
+// MCU -> PC clock mapping, fed by CMD_TIME_SYNC replies or, for firmware without them, by data frame arrivals
+const aresplotClock = new AresplotClockEstimator();
+let aresplotClockFromTimeSync = false;
+// Lowest-latency data frame of the current arrival interval: { startPcTime, mcuTimestampMs, pcTime }
+let aresplotArrivalBest = null;
+const ARESPLOT_ARRIVAL_INTERVAL_MS = 1000;
+// MCU time at which the sample following the last batch is due, used to undo ms quantization of batch timestamps
+let aresplotNextBatchMcuTimeMs = null;
+let aresplotLastBatchPeriodMs = 0;
+// Triggered capture being received: its CaptureId and the StartIndex expected in its next block
+let aresplotCaptureId = null;
+let aresplotCaptureNextIndex = 0;
+// Link statistics (lost/duplicate frames, checksum rejects) are reported once per interval while the stream runs
+const ARESPLOT_LINK_STATS_INTERVAL_MS = 1000;
+let aresplotLinkStatsTimer = null;
+let aresplotLinkStatsLastPcTime = 0;
+
 
 // --- Built-in Non-Aresplot Parsers (From your original plotter.html worker and previous discussions) ---
 // These parsers return: { values: number[]|null, frameByteLength: number, rawLineBytes?: Uint8Array }
@@ -149,9 +165,8 @@ function parseJustFloat(uint8ArrayData) {
         if (tailStartIndex !== -1) {
             const dataBeforeTailLength = tailStartIndex;
             if (dataBeforeTailLength > 0 && dataBeforeTailLength % floatSize === 0) {
-                const dataPart = uint8ArrayData.slice(0, dataBeforeTailLength);
                 const values = [];
-                const view = new DataView(dataPart.buffer, dataPart.byteOffset);
+                const view = new DataView(uint8ArrayData.buffer, uint8ArrayData.byteOffset, dataBeforeTailLength);
                 for (let offset = 0; offset < dataBeforeTailLength; offset += floatSize) {
                     values.push(view.getFloat32(offset, true)); // true for little-endian
                 }
@@ -191,26 +206,143 @@ function parseFirewater(uint8ArrayData) {
 }
 // --- End Built-in Parsers ---
 
-// --- Aresplot Time Sync Logic (copied from previous, unchanged) ---
-function handleAresplotMonitorData(mcuTimestampMs, fp32ValuesArray, rawFrameBytes) {
+// --- Aresplot Time Sync Logic ---
+/**
+ * Resets the clock mapping for a new Aresplot session.
+ */
+function resetAresplotClock() {
+    aresplotClock.reset();
+    aresplotClockFromTimeSync = false;
+    aresplotArrivalBest = null;
+}
+
+/**
+ * Reports the outcome of a clock sample to the main thread.
+ * @param {string} result - The estimator's result for the sample.
+ * @param {boolean} wasReady - Whether the mapping existed before the sample.
+ */
+function reportAresplotClockSample(result, wasReady) {
+    if (result === 'restarted') {
+        self.postMessage({ type: 'warn', payload: { source: 'aresplot_timestamp', message: 'MCU clock restarted; re-synchronizing.' } });
+    } else if (result === 'accepted' && !wasReady) {
+        const how = aresplotClockFromTimeSync ? 'CMD_TIME_SYNC' : 'data arrival times';
+        self.postMessage({ type: 'info', payload: { source: 'aresplot_timestamp', message: `Clock mapping initialized from ${how}.` }});
+    }
+}
+
+/**
+ * Feeds a CMD_TIME_SYNC reply into the clock mapping. The first reply replaces any arrival-based mapping.
+ * @param {object} syncSegment - The parser's 'time_sync' segment.
+ * @param {number} pcRecvTime - performance.now() when the reply was read.
+ */
+function handleAresplotTimeSync(syncSegment, pcRecvTime) {
+    if (!aresplotClockFromTimeSync) {
+        aresplotClock.reset();
+        aresplotClockFromTimeSync = true;
+    }
+    const wasReady = aresplotClock.ready;
+    // The token carries the main thread's clock; both threads share performance.timeOrigin + performance.now()
+    const pcSendTime = syncSegment.hostSendTimeMs - performance.timeOrigin;
+    reportAresplotClockSample(aresplotClock.addSyncReply(syncSegment, pcSendTime, pcRecvTime), wasReady);
+}
+
+/**
+ * Maps an MCU data timestamp to PC time. Without CMD_TIME_SYNC the newest sample of each frame also feeds the
+ * mapping: the lowest-latency frame of every interval becomes one sample, so the mapping follows the lower edge of
+ * the link latency instead of its jitter.
+ * @param {number} mcuTimestampMs - MCU timestamp to map.
+ * @param {number} [newestMcuTimestampMs=mcuTimestampMs] - MCU timestamp of the most recent sample in the frame.
+ * @returns {number} PC timestamp.
+ */
+function aresplotMcuToPcTime(mcuTimestampMs, newestMcuTimestampMs = mcuTimestampMs) {
+    if (!aresplotClockFromTimeSync) {
+        const pcNow = performance.now();
+        const best = aresplotArrivalBest;
+        if (best === null) {
+            aresplotArrivalBest = { startPcTime: pcNow, mcuTimestampMs: newestMcuTimestampMs, pcTime: pcNow };
+        } else if (pcNow - newestMcuTimestampMs < best.pcTime - best.mcuTimestampMs) {
+            best.mcuTimestampMs = newestMcuTimestampMs;
+            best.pcTime = pcNow;
+        }
+        if (!aresplotClock.ready || pcNow - aresplotArrivalBest.startPcTime >= ARESPLOT_ARRIVAL_INTERVAL_MS) {
+            const wasReady = aresplotClock.ready;
+            reportAresplotClockSample(aresplotClock.addArrival(aresplotArrivalBest.mcuTimestampMs, aresplotArrivalBest.pcTime), wasReady);
+            aresplotArrivalBest = null;
+        }
+    }
+    return aresplotClock.toHostMs(mcuTimestampMs);
+}
+
+function handleAresplotMonitorData(mcuTimestampMs, fp32ValuesArray, rawFrameBytes, batch) {
+    batch.push(aresplotMcuToPcTime(mcuTimestampMs), fp32ValuesArray, rawFrameBytes);
+}
+
+/**
+ * Expands a MONITOR_DATA_BATCH segment into individual data points.
+ * Arrival samples use the newest sample so that the batch latency does not skew them.
+ * The raw frame is attached to the first point only, so the terminal shows it once.
+ * Batch timestamps are whole milliseconds; when a batch continues the previous one at the same
+ * (possibly sub-ms) period, its base is taken from the previous batch instead, so the timeline stays evenly spaced.
+ */
+function handleAresplotMonitorBatch(batchSegment, batch) {
+    const { samplePeriodMs, samples, rawFrame } = batchSegment;
+    let mcuTimestampMs = batchSegment.mcuTimestampMs;
+    if (aresplotNextBatchMcuTimeMs !== null && samplePeriodMs === aresplotLastBatchPeriodMs) {
+        const quantizationMs = aresplotNextBatchMcuTimeMs - mcuTimestampMs;
+        if (quantizationMs >= 0 && quantizationMs < 1) mcuTimestampMs = aresplotNextBatchMcuTimeMs;
+    }
+    aresplotNextBatchMcuTimeMs = mcuTimestampMs + samples.length * samplePeriodMs;
+    aresplotLastBatchPeriodMs = samplePeriodMs;
+
+    aresplotMcuToPcTime(mcuTimestampMs, mcuTimestampMs + (samples.length - 1) * samplePeriodMs);
+    for (let i = 0; i < samples.length; i++) {
+        batch.push(aresplotClock.toHostMs(mcuTimestampMs + i * samplePeriodMs), samples[i], i === 0 ? rawFrame.slice() : undefined);
+    }
+}
+
+/**
+ * Posts the parser's link statistics for the interval since the previous report, as per-second rates.
+ */
+function postAresplotLinkStats() {
+    if (!aresplotParserInstanceForWorker) return;
     const pcNow = performance.now();
-    let calibratedPcTimestamp;
-    if (initialTimestampBias === null) {
-        initialTimestampBias = pcNow - mcuTimestampMs;
-        lastBiasCheckPcTime = pcNow;
-        self.postMessage({ type: 'info', payload: { source: 'aresplot_timestamp', message: `Timestamp bias initialized: ${initialTimestampBias.toFixed(0)}ms.` }});
+    const seconds = (pcNow - aresplotLinkStatsLastPcTime) / 1000;
+    aresplotLinkStatsLastPcTime = pcNow;
+    if (seconds <= 0) return;
+    const stats = aresplotParserInstanceForWorker.takeLinkStats();
+    self.postMessage({ type: 'info', payload: {
+        source: 'aresplot_link_stats',
+        framesPerSec: stats.frames / seconds,
+        lostPerSec: stats.lostFrames / seconds,
+        duplicatesPerSec: stats.duplicateFrames / seconds,
+        checksumErrorsPerSec: stats.checksumErrors / seconds,
+        message: `Link: ${stats.lostFrames} lost, ${stats.duplicateFrames} duplicate, ${stats.checksumErrors} checksum errors in ${seconds.toFixed(1)}s.`
+    }});
+}
+
+/**
+ * Expands a CAPTURE_DATA block into data points on the same timeline as the continuous stream.
+ * Capture blocks are sent long after they were sampled, so they do not feed the clock mapping.
+ * A missing block (StartIndex not following the previous block) is reported and the capture carries on.
+ */
+function handleAresplotCaptureBlock(captureSegment, batch) {
+    const { captureId, mcuTriggerTimestampMs, samplePeriodMs, preSamples, startIndex, samples, rawFrame } = captureSegment;
+    if (!aresplotClock.ready) aresplotMcuToPcTime(mcuTriggerTimestampMs);
+    if (startIndex !== (captureId === aresplotCaptureId ? aresplotCaptureNextIndex : 0)) {
+        self.postMessage({ type: 'warn', payload: { source: 'aresplot_capture', message: `Capture #${captureId}: block(s) lost before sample ${startIndex}.` } });
     }
-    const currentFrameBias = pcNow - mcuTimestampMs;
-    const drift = Math.abs(currentFrameBias - initialTimestampBias);
-    if (drift > TIMESTAMP_DRIFT_THRESHOLD_MS) {
-        self.postMessage({ type: 'warn', payload: { source: 'aresplot_timestamp', message: `Timestamp drift >${TIMESTAMP_DRIFT_THRESHOLD_MS}ms detected (${drift.toFixed(0)}ms). Re-synchronizing. Plot may jump.` } });
-        initialTimestampBias = currentFrameBias;
-        lastBiasCheckPcTime = pcNow;
-    } else if (pcNow - lastBiasCheckPcTime > TIMESTAMP_DRIFT_CHECK_INTERVAL_MS) {
-        lastBiasCheckPcTime = pcNow;
+    aresplotCaptureId = captureId;
+    aresplotCaptureNextIndex = startIndex + samples.length;
+
+    const baseMcuTimestampMs = mcuTriggerTimestampMs + (startIndex - preSamples) * samplePeriodMs;
+    for (let i = 0; i < samples.length; i++) {
+        batch.push(aresplotClock.toHostMs(baseMcuTimestampMs + i * samplePeriodMs), samples[i], i === 0 ? rawFrame.slice() : undefined);
+    }
+    if (captureSegment.isLast) {
+        const gapNote = captureSegment.hasTimingGaps ? ' (sample deadlines were missed; timing is approximate)' : '';
+        self.postMessage({ type: 'info', payload: { source: 'aresplot_capture', captureId, sampleCount: aresplotCaptureNextIndex, message: `Capture #${captureId} received: ${aresplotCaptureNextIndex} samples at ${(1000 / samplePeriodMs).toFixed(1)} Hz${gapNote}.` } });
+        aresplotCaptureId = null;
     }
-    calibratedPcTimestamp = mcuTimestampMs + initialTimestampBias;
-    return { timestamp: calibratedPcTimestamp, values: fp32ValuesArray, rawLineBytes: rawFrameBytes };
 }
 // --- End Aresplot Time Sync ---
 
@@ -222,7 +354,7 @@ function setSerialParser(protocol, parserCode) {
     currentParserType = protocol;
     customSerialParserFunction = null;
     selectedBuiltInParser = null;
-    if (protocol !== 'aresplot') { initialTimestampBias = null; }
+    if (protocol !== 'aresplot') { resetAresplotClock(); }
 
     switch (protocol) {
         case "custom":
@@ -251,18 +383,23 @@ function setSerialParser(protocol, parserCode) {
 async function startReadingSerialFromStream(stream) {
     console.log(`Worker: startReadingSerialFromStream. Active parser type: ${currentParserType}`);
     keepReadingSerial = true;
-    const dataPointsBatch = [];
+    const dataBatch = new DataBatchBuilder();
     let lastSerialSendTime = performance.now();
 
     // Reset/Initialize parser state for the stream
     if (currentParserType === "aresplot") {
         aresplotParserInstanceForWorker = new AresplotFrameParser(); // No callbacks, direct return handling
-        initialTimestampBias = null; // Reset bias for new Aresplot session
-        lastBiasCheckPcTime = 0;
+        aresplotLayoutsAwaitingParser.forEach(({ layout, tag }) => aresplotParserInstanceForWorker.queueMonitorLayout(layout, tag));
+        aresplotLayoutsAwaitingParser = [];
+        resetAresplotClock(); // New Aresplot session, possibly a different or restarted MCU
+        aresplotNextBatchMcuTimeMs = null;
+        aresplotCaptureId = null;
+        aresplotLinkStatsLastPcTime = performance.now();
+        aresplotLinkStatsTimer = setInterval(postAresplotLinkStats, ARESPLOT_LINK_STATS_INTERVAL_MS);
         console.log("Worker: AresplotFrameParser instance created for stream.");
     } else {
         aresplotParserInstanceForWorker = null;
-        internalWorkerBuffer = new Uint8Array(0); // Buffer for other parsers
+        textParserRing.clear(); // Buffer for other parsers
     }
 
     try {
@@ -287,80 +424,95 @@ async function startReadingSerialFromStream(stream) {
                     // Loop to consume all processable segments from Aresplot parser's internal buffer
                     while (keepReadingSerial && (aresplotSegment = aresplotParserInstanceForWorker.parseNext())) {
                         if (aresplotSegment.type === 'data') {
-                            const dataPoint = handleAresplotMonitorData(aresplotSegment.mcuTimestampMs, aresplotSegment.values, aresplotSegment.rawFrame);
-                            if (dataPoint) dataPointsBatch.push(dataPoint);
+                            handleAresplotMonitorData(aresplotSegment.mcuTimestampMs, aresplotSegment.values, aresplotSegment.rawFrame.slice(), dataBatch);
+                        } else if (aresplotSegment.type === 'data_batch') {
+                            handleAresplotMonitorBatch(aresplotSegment, dataBatch);
+                        } else if (aresplotSegment.type === 'capture_block') {
+                            handleAresplotCaptureBlock(aresplotSegment, dataBatch);
                         } else if (aresplotSegment.type === 'ack') {
+                            if (aresplotSegment.achievedRateHz !== undefined) {
+                                self.postMessage({ type: 'info', payload: { source: 'aresplot_sample_rate', achievedRateHz: aresplotSegment.achievedRateHz, statusCode: aresplotSegment.status, message: `MCU sample rate: ${aresplotSegment.achievedRateHz.toFixed(3)} Hz` }});
+                            }
                             if (aresplotSegment.status !== ARESPLOT_ACK_STATUS.OK) {
-                                self.postMessage({ type: 'warn', payload: { source: 'aresplot_ack_error', commandId: aresplotSegment.ackCmdId, statusCode: aresplotSegment.status, message: `MCU NACK for CMD 0x${aresplotSegment.ackCmdId.toString(16)} - Status 0x${aresplotSegment.status.toString(16)}` }});
+                                self.postMessage({ type: 'warn', payload: { source: 'aresplot_ack_error', commandId: aresplotSegment.ackCmdId, statusCode: aresplotSegment.status, tag: aresplotSegment.tag, tagRejected: aresplotSegment.tagRejected, entryOk: aresplotSegment.entryOk, message: `MCU NACK for CMD 0x${aresplotSegment.ackCmdId.toString(16)} - Status 0x${aresplotSegment.status.toString(16)}` }});
+                            } else if (aresplotSegment.tag !== undefined) {
+                                // Lets the main thread retire the tagged command it was waiting on
+                                self.postMessage({ type: 'info', payload: { source: 'aresplot_ack', commandId: aresplotSegment.ackCmdId, tag: aresplotSegment.tag, message: `MCU ACK for CMD 0x${aresplotSegment.ackCmdId.toString(16)} (tag ${aresplotSegment.tag})` }});
                             }
+                        } else if (aresplotSegment.type === 'time_sync') {
+                            handleAresplotTimeSync(aresplotSegment, pcTimeForFrameProcessing);
+                        } else if (aresplotSegment.type === 'stats') {
+                            self.postMessage({ type: 'info', payload: { source: 'aresplot_mcu_stats', stats: aresplotSegment.stats, message: 'MCU statistics received.' }});
                         } else if (aresplotSegment.type === 'error_report') { // Assuming ERROR_REPORT exists in CMD_ID
-                            self.postMessage({ type: 'warn', payload: { source: 'aresplot_mcu_error', errorCode: aresplotSegment.errorCode, messageBytes: aresplotSegment.messageBytes, rawFrame: aresplotSegment.rawFrame }});
+                            self.postMessage({ type: 'warn', payload: { source: 'aresplot_mcu_error', errorCode: aresplotSegment.errorCode, messageBytes: aresplotSegment.messageBytes, rawFrame: aresplotSegment.rawFrame.slice() }});
                         } else if (aresplotSegment.type === 'unidentified') {
-                            dataPointsBatch.push({ timestamp: pcTimeForFrameProcessing, values: [], rawLineBytes: aresplotSegment.rawData, isUnidentifiedAresplotData: true });
+                            dataBatch.push(pcTimeForFrameProcessing, [], aresplotSegment.rawData.slice()); // Raw-only row
                             if (aresplotSegment.warning) {
                                  self.postMessage({ type: 'warn', payload: { source: 'aresplot_parser_internal', message: aresplotSegment.warning }});
                             }
                         }
-                        // consumedBytes is handled internally by parseNext() removing from its buffer
+                        // consumedBytes is handled internally by parseNext() removing from its buffer; the raw views it
+                        // returns alias that buffer, so the rows and messages above take copies of them
                     }
                 } else {
                     // Logic for other parsers (custom, default, justfloat, firewater)
-                    internalWorkerBuffer = concatUint8Arrays(internalWorkerBuffer, value);
+                    // The parsers read one contiguous view of the buffered bytes; consumed frames only advance an offset
+                    textParserRing.push(value);
+                    const buffered = textParserRing.peek(textParserRing.length);
+                    let consumed = 0;
                     let processedInLoop;
                     do {
                         processedInLoop = 0;
+                        const pending = buffered.subarray(consumed);
                         let parseResult = null;
                         try {
                             if (currentParserType === "custom" && customSerialParserFunction) {
-                                parseResult = customSerialParserFunction(internalWorkerBuffer);
+                                // User code gets its own copy: it may assume byteOffset 0 or keep and mutate the array
+                                parseResult = customSerialParserFunction(pending.slice());
                             } else if (selectedBuiltInParser) {
-                                parseResult = selectedBuiltInParser(internalWorkerBuffer);
+                                parseResult = selectedBuiltInParser(pending);
                             } else {
                                 console.error("Worker: No valid parser function selected for type:", currentParserType);
                                 // To prevent infinite loop, consume something or break
-                                if (internalWorkerBuffer.length > 0) {
-                                    dataPointsBatch.push({ timestamp: pcTimeForFrameProcessing, values: [], rawLineBytes: internalWorkerBuffer.slice(0,1), isUnidentifiedData: true });
-                                    internalWorkerBuffer = internalWorkerBuffer.slice(1);
-                                    processedInLoop = 1;
-                                }
+                                dataBatch.push(pcTimeForFrameProcessing, [], pending.slice(0,1)); // Raw-only row
+                                consumed += 1;
+                                processedInLoop = 1;
                                 break; // Break inner loop if no parser
                             }
 
                             if (parseResult && parseResult.values !== null && parseResult.frameByteLength > 0) {
-                                const rawBytes = parseResult.rawLineBytes || internalWorkerBuffer.slice(0, parseResult.frameByteLength);
-                                dataPointsBatch.push({ timestamp: pcTimeForFrameProcessing, values: parseResult.values, rawLineBytes: rawBytes });
-                                internalWorkerBuffer = internalWorkerBuffer.slice(parseResult.frameByteLength);
+                                let rawBytes = parseResult.rawLineBytes || pending.subarray(0, parseResult.frameByteLength);
+                                if (rawBytes.buffer === buffered.buffer) rawBytes = rawBytes.slice(); // Rows outlive the buffer view
+                                dataBatch.push(pcTimeForFrameProcessing, parseResult.values, rawBytes);
+                                consumed += parseResult.frameByteLength;
                                 processedInLoop = parseResult.frameByteLength;
                             }
                         } catch (e) {
                             self.postMessage({ type: "error", payload: `Parser error (${currentParserType}): ${e.message}` });
-                            if (internalWorkerBuffer.length > 0) { // Consume a byte to try to recover
-                                internalWorkerBuffer = internalWorkerBuffer.slice(1);
-                                processedInLoop = 1;
-                            }
+                            consumed += 1; // Consume a byte to try to recover
+                            processedInLoop = 1;
                         }
-                    } while (processedInLoop > 0 && internalWorkerBuffer.length > 0 && keepReadingSerial);
+                    } while (processedInLoop > 0 && consumed < buffered.length && keepReadingSerial);
 
                     // MAX_RAW_BUFFER_LENGTH_FOR_DISPLAY_BREAK logic (as in your original)
+                    const remaining = buffered.subarray(Math.min(consumed, buffered.length));
                     if (currentParserType !== "justfloat" && currentParserType !== "aresplot" && // Typically for text-based
-                        internalWorkerBuffer.length > MAX_RAW_BUFFER_LENGTH_FOR_DISPLAY_BREAK &&
-                        internalWorkerBuffer.indexOf(0x0A) === -1 &&
-                        internalWorkerBuffer.indexOf(0x0D) === -1)
+                        remaining.length > MAX_RAW_BUFFER_LENGTH_FOR_DISPLAY_BREAK &&
+                        remaining.indexOf(0x0A) === -1 &&
+                        remaining.indexOf(0x0D) === -1)
                     {
-                        const rawSegmentBytes = internalWorkerBuffer.slice(0, MAX_RAW_BUFFER_LENGTH_FOR_DISPLAY_BREAK);
-                        dataPointsBatch.push({ timestamp: pcTimeForFrameProcessing, values: [], rawLineBytes: rawSegmentBytes, isUnidentifiedData: true });
-                        internalWorkerBuffer = internalWorkerBuffer.slice(MAX_RAW_BUFFER_LENGTH_FOR_DISPLAY_BREAK);
+                        const rawSegmentBytes = remaining.slice(0, MAX_RAW_BUFFER_LENGTH_FOR_DISPLAY_BREAK);
+                        dataBatch.push(pcTimeForFrameProcessing, [], rawSegmentBytes); // Raw-only row
+                        consumed += MAX_RAW_BUFFER_LENGTH_FOR_DISPLAY_BREAK;
                         self.postMessage({ type: 'warn', payload: { source: 'parser_line_break', message: `Forced line break in '${currentParserType}' due to no newline.` }});
                     }
+                    textParserRing.consume(Math.min(consumed, buffered.length));
                 }
             }
 
             // Batch send data to main thread periodically
-            if (dataPointsBatch.length > 0 && (pcTimeForFrameProcessing - lastSerialSendTime >= SERIAL_BATCH_TIME_MS)) {
-                try {
-                    self.postMessage({ type: "dataBatch", payload: [...dataPointsBatch] });
-                } catch (postError) { console.error("Worker: Error posting dataBatch:", postError); }
-                dataPointsBatch.length = 0;
+            if (dataBatch.length > 0 && (pcTimeForFrameProcessing - lastSerialSendTime >= SERIAL_BATCH_TIME_MS)) {
+                postDataBatch(dataBatch);
                 lastSerialSendTime = pcTimeForFrameProcessing;
             }
         } // end while
@@ -377,14 +529,14 @@ async function startReadingSerialFromStream(stream) {
             } catch (e) { console.warn("Worker: Error during reader final cleanup:", e); }
         }
         currentReader = null;
-        aresplotParserInstanceForWorker = null; // Clean up Aresplot instance
-        initialTimestampBias = null;
-        internalWorkerBuffer = new Uint8Array(0);
-        if (dataPointsBatch.length > 0) { // Send any remaining data
-            try { self.postMessage({ type: "dataBatch", payload: [...dataPointsBatch] }); }
-            catch (e) { console.error("Worker: Error posting final dataBatch from finally:", e); }
-            dataPointsBatch.length = 0;
+        if (aresplotLinkStatsTimer) {
+            clearInterval(aresplotLinkStatsTimer);
+            aresplotLinkStatsTimer = null;
         }
+        aresplotParserInstanceForWorker = null; // Clean up Aresplot instance
+        resetAresplotClock();
+        textParserRing.clear();
+        postDataBatch(dataBatch); // Send any remaining data
         self.postMessage({ type: "status", payload: "Worker: Serial read loop finished/terminated." });
     }
 }
@@ -428,6 +580,11 @@ self.onmessage = async (event) => {
         case 'updateSimConfig':
             if (currentDataSource === "simulated") { simConfig = payload; if (simWorkerBatchInterval) startSimulation(); }
             break;
+        case "queueAresplotMonitorLayout":
+            // Sent by main right before it writes a CMD_START_MONITOR frame
+            if (aresplotParserInstanceForWorker) aresplotParserInstanceForWorker.queueMonitorLayout(payload.layout, payload.tag);
+            else aresplotLayoutsAwaitingParser.push(payload);
+            break;
         case "updateActiveParser":
             console.log("Worker: 'updateActiveParser' for protocol:", payload.protocol);
             if (currentDataSource === "webserial") {
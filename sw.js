@@ -1,7 +1,7 @@
 // sw.js
 
 // 定义缓存名称，通常包含版本号以便更新
-const CACHE_NAME = "web-serial-plotter-cache-v3.1+"; // Increment version number
+const CACHE_NAME = "web-serial-plotter-cache-v3.2"; // Increment version number
 // 定义需要缓存的核心文件（应用外壳）和依赖项
 const urlsToCache = [
   "/", // 根路径通常也需要缓存
@@ -18,10 +18,15 @@ const urlsToCache = [
   "js/modules/terminal_module.js",
   "js/modules/quat_module.js",
   "js/modules/data_processing.js",
+  "js/modules/recording.js",
+  "js/modules/data_batch.js",
+  "js/modules/lod_pyramid.js",
+  "js/modules/byte_ring.js",
   "js/modules/serial.js",
   "js/modules/worker_service.js",
   "js/worker/data_worker.js", // Worker 脚本也需要缓存
   "js/modules/elf_analyzer_service.js",
+  "js/modules/symbol_cache.js",
   "js/modules/aresplot_protocol.js",
   // HTML Partials
   "html_partials/control_panel.html",